@@ -0,0 +1,137 @@
+/// \file
+/// \brief Heap allocations and peak memory of a parse as the input grows,
+/// for each input form, counted by interposing the allocator.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <yaml.h>
+
+#include "easyyaml.h"
+#include "bench_corpus.h"
+#include "easyyaml_alloc.h"
+
+
+extern int bench_c_api_parse (const char * input, bench_config * cfg);
+extern int bench_c_api_parse_json (const char * input, size_t len, bench_config * cfg);
+extern easyyaml_schema * bench_c_api_schema ();
+
+
+/// Count the tokens of a YAML (or JSON) document with libyaml alone.
+
+static size_t bench_tokens (const char * input)
+{
+  yaml_parser_t parser;
+  yaml_token_t token;
+  size_t tokens = 0;
+
+  if (!yaml_parser_initialize(&parser))
+    return 0;
+  yaml_parser_set_input_string(&parser, (const unsigned char *) input, strlen(input));
+
+  do {
+    if (!yaml_parser_scan(&parser, &token))
+      break;
+    int type = token.type;
+    yaml_token_delete(&token);
+    tokens++;
+    if (type == YAML_STREAM_END_TOKEN)
+      break;
+  } while (1);
+
+  yaml_parser_delete(&parser);
+
+  return tokens;
+}
+
+
+/// Print the allocations of a parse of \p tokens tokens, \p users users.
+
+static void bench_alloc_report (const char * name, int users, size_t tokens, const easyyaml_alloc_stats * stats)
+{
+  printf("%-8s %8d %9zu %10zu %8.3f %12zu %9.1f %10zu\n",
+         name, users, tokens, stats->allocs, (double) stats->allocs / tokens,
+         stats->bytes, (double) stats->bytes / tokens, stats->peak);
+}
+
+
+int main (int argc, char ** argv)
+{
+  int max_users = argc > 1 ? atoi(argv[1]) : 10000;
+  char filename[] = "/tmp/bench_alloc_XXXXXX";
+  easyyaml_alloc_stats stats;
+  bench_config cfg;
+
+  if (!easyyaml_alloc_start()) {
+    printf("(allocation accounting not available)\n");
+    return 0;
+  }
+  easyyaml_alloc_stop(&stats);
+
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    perror("bench_alloc: mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  printf("%-8s %8s %9s %10s %8s %12s %9s %10s\n", "input", "users", "tokens", "allocs", "/token", "bytes", "/token", "peak");
+
+  for (int users = 10; users <= max_users; users *= 10) {
+    char * input = bench_corpus_users(users);
+    char * json  = bench_corpus_users_json(users);
+    size_t len   = strlen(json);
+    size_t tokens = bench_tokens(input);
+    FILE * fp    = fopen(filename, "w");
+
+    if (fp == NULL || fputs(input, fp) < 0 || fclose(fp) != 0) {
+      perror("bench_alloc: write corpus");
+      return 1;
+    }
+
+    memset(&cfg, 0, sizeof(cfg));
+    easyyaml_alloc_start();
+    int rc = bench_c_api_parse(input, &cfg);
+    easyyaml_alloc_stop(&stats);
+    if (rc != EASYYAML_SUCCESS || cfg.users != users) {
+      fprintf(stderr, "bench_alloc: string parse failed (%d)\n", rc);
+      return 1;
+    }
+    bench_alloc_report("string", users, tokens, &stats);
+
+    memset(&cfg, 0, sizeof(cfg));
+    easyyaml_alloc_start();
+    rc = easyyaml_parse_file(filename, bench_c_api_schema(), &cfg);
+    easyyaml_alloc_stop(&stats);
+    if (rc != EASYYAML_SUCCESS || cfg.users != users) {
+      fprintf(stderr, "bench_alloc: file parse failed (%d)\n", rc);
+      return 1;
+    }
+    bench_alloc_report("file", users, tokens, &stats);
+
+    memset(&cfg, 0, sizeof(cfg));
+    size_t json_tokens = bench_tokens(json);
+    easyyaml_alloc_start();
+    rc = bench_c_api_parse_json(json, len, &cfg);
+    easyyaml_alloc_stop(&stats);
+    if (rc != EASYYAML_SUCCESS || cfg.users != users) {
+      fprintf(stderr, "bench_alloc: JSON parse failed (%d)\n", rc);
+      return 1;
+    }
+    bench_alloc_report("json", users, json_tokens, &stats);
+
+    free(input);
+    free(json);
+  }
+
+  unlink(filename);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    printf("peak RSS %ld KB\n", usage.ru_maxrss);
+
+  return 0;
+}
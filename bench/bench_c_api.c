@@ -0,0 +1,140 @@
+/// \file
+/// \brief The benchmark schema implemented with the C API, as a baseline.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "easyyaml.h"
+#include "bench_corpus.h"
+
+
+static void ey_handle_port (easyyaml_stack * stack, int val, bench_config * cfg)
+{
+  cfg->port = val;
+}
+
+static void ey_handle_ssl (easyyaml_stack * stack, char * val, bench_config * cfg)
+{
+  cfg->ssl = strcmp(val, "true") == 0;
+}
+
+static void ey_handle_password (easyyaml_stack * stack, char * val, bench_config * cfg)
+{
+  cfg->users++;
+  cfg->password_bytes += strlen(val);
+}
+
+static void ey_handle_uid (easyyaml_stack * stack, int val, bench_config * cfg)
+{
+  cfg->uid_sum += val;
+}
+
+static void ey_handle_access (easyyaml_stack * stack, char * val, bench_config * cfg)
+{
+  cfg->access++;
+}
+
+
+/// The benchmark schema.
+
+easyyaml_schema * bench_c_api_schema ()
+{
+  static EASYYAML_SCHEMA(server_ys)
+    EASYYAML_INT("port",      &ey_handle_port, "TCP port"     ),
+    EASYYAML_STR("ssl",       &ey_handle_ssl,  "SSL enabled"  ),
+    EASYYAML_STR("base-path", NULL,            "URL base path"),
+    EASYYAML_END();
+
+  static EASYYAML_SCHEMA(access_ys)
+    EASYYAML_STR(NULL, &ey_handle_access, "User access privileges"),
+    EASYYAML_END();
+
+  static EASYYAML_SCHEMA(user_ys)
+    EASYYAML_STR("password", &ey_handle_password, "Password"              ),
+    EASYYAML_INT("uid",      &ey_handle_uid,      "User ID"               ),
+    EASYYAML_LST("access",   access_ys,           "User access privileges"),
+    EASYYAML_END();
+
+  static EASYYAML_SCHEMA(users_ys)
+    EASYYAML_MAP(NULL, user_ys, "User"),
+    EASYYAML_END();
+
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("version", NULL,      "Configuration version"),
+    EASYYAML_MAP("restapi", server_ys, "RESTful API server"   ),
+    EASYYAML_MAP("users",   users_ys,  "Users"                ),
+    EASYYAML_END();
+
+  return ys;
+}
+
+
+/// Parse the corpus with the C API schema.
+
+int bench_c_api_parse (const char * input, bench_config * cfg)
+{
+  return easyyaml_parse_string(input, bench_c_api_schema(), cfg);
+}
+
+
+/// Parse the JSON form of the corpus with the same C API schema.
+
+int bench_c_api_parse_json (const char * input, size_t len, bench_config * cfg)
+{
+  return easyyaml_parse_json(input, len, bench_c_api_schema(), cfg);
+}
+
+
+/// Parse the MessagePack form of the corpus with the same C API schema.
+
+int bench_c_api_parse_msgpack (const char * input, size_t len, bench_config * cfg)
+{
+  return easyyaml_parse_msgpack(input, len, bench_c_api_schema(), cfg);
+}
+
+
+/// Getter emitting the corpus, with \p users users generated as they are
+/// asked for (in the static buffers, as each is written before the next).
+
+static int ey_get_corpus (easyyaml_stack * stack, const easyyaml_schema * ys, size_t i, easyyaml_emit_value * val, void * cfg)
+{
+  static char name[32];
+  static char password[32];
+  int users = *(int *) cfg;
+
+  if (ys->key == NULL && strcmp(ys->descr, "User") == 0) {
+    if ((int) i >= users)
+      return 0;
+    snprintf(name, sizeof(name), "user%d", (int) i);
+    val->key = name;
+  } else if (ys->key == NULL) {
+    if (i >= 2)
+      return 0;
+    val->str = i == 0 ? "read" : atoi(stack->prev->key + 4) % 3 == 0 ? "admin" : "write";
+  } else if (strcmp(ys->key, "version") == 0) {
+    val->str = "1.2.7";
+  } else if (strcmp(ys->key, "port") == 0) {
+    val->num = 80;
+  } else if (strcmp(ys->key, "ssl") == 0) {
+    val->str = "false";
+  } else if (strcmp(ys->key, "base-path") == 0) {
+    val->str = "/api";
+  } else if (strcmp(ys->key, "password") == 0) {
+    snprintf(password, sizeof(password), "pw%08d", atoi(stack->key + 4));
+    val->str = password;
+  } else if (strcmp(ys->key, "uid") == 0) {
+    val->num = 1000 + atoi(stack->key + 4);
+  }
+
+  return 1;
+}
+
+
+/// Emit the corpus with \p users users with the same C API schema.
+
+int bench_c_api_emit (int users, char ** out, size_t * out_len)
+{
+  return easyyaml_emit_string(bench_c_api_schema(), &users, ey_get_corpus, out, out_len);
+}
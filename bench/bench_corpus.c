@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_corpus.h"
+
+
+/// Generate a 'hello universe' style document with \p users users, the
+/// caller must free the result.
+
+char * bench_corpus_users (int users)
+{
+  size_t size = 256 + (size_t) users * 128;
+  char * buf  = (char *) malloc(size);
+  char * p    = buf;
+
+  p += sprintf(p, "version: 1.2.7\nrestapi:\n  port: 80\n  ssl: false\n  base-path: /api\nusers:\n");
+  for (int i = 0; i < users; i++)
+    p += sprintf(p, "  user%d:\n    password: pw%08d\n    uid: %d\n    access:\n      - read\n      - %s\n",
+                 i, i, 1000 + i, i % 3 == 0 ? "admin" : "write");
+
+  return buf;
+}
+
+
+/// Generate the same document as \ref bench_corpus_users as JSON, the
+/// caller must free the result.
+
+char * bench_corpus_users_json (int users)
+{
+  size_t size = 256 + (size_t) users * 128;
+  char * buf  = (char *) malloc(size);
+  char * p    = buf;
+
+  p += sprintf(p, "{\"version\": \"1.2.7\", \"restapi\": {\"port\": 80, \"ssl\": false, \"base-path\": \"/api\"},\n \"users\": {");
+  for (int i = 0; i < users; i++)
+    p += sprintf(p, "%s\n  \"user%d\": {\"password\": \"pw%08d\", \"uid\": %d, \"access\": [\"read\", \"%s\"]}",
+                 i > 0 ? "," : "", i, i, 1000 + i, i % 3 == 0 ? "admin" : "write");
+  sprintf(p, "\n }\n}\n");
+
+  return buf;
+}
+
+
+/// Monotonic time in seconds.
+
+double bench_now ()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/// Print the best and mean of \p runs timings, and the best throughput.
+
+void bench_report (const char * name, const char * corpus, double * times, int runs, size_t bytes)
+{
+  double best = times[0];
+  double sum  = 0;
+
+  for (int i = 0; i < runs; i++) {
+    if (times[i] < best)
+      best = times[i];
+    sum += times[i];
+  }
+
+  printf("%-28s %-16s best %9.3f ms  mean %9.3f ms  %8.1f MB/s\n",
+         name, corpus, best * 1e3, sum / runs * 1e3, bytes / best / 1e6);
+}
@@ -0,0 +1,38 @@
+/// \file
+/// \brief Synthetic YAML corpora and timing helpers for the libeasyyaml
+/// benchmarks.
+
+
+#ifndef EASYYAML_BENCH_CORPUS_INCLUDED
+#define EASYYAML_BENCH_CORPUS_INCLUDED
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// The structure every benchmark parses into, so results can be compared.
+
+typedef struct bench_config_st {
+  int  port;
+  int  ssl;
+  long users;
+  long uid_sum;
+  long access;
+  long password_bytes;
+} bench_config;
+
+
+extern char * bench_corpus_users (int users);
+extern char * bench_corpus_users_json (int users);
+extern double bench_now ();
+extern void   bench_report (const char * name, const char * corpus, double * times, int runs, size_t bytes);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // EASYYAML_BENCH_CORPUS_INCLUDED
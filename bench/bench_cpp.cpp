@@ -0,0 +1,134 @@
+/// \file
+/// \brief Benchmark of the C++ wrapper (easyyaml.hpp) against the C API.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include "easyyaml.hpp"
+#include "bench_corpus.h"
+
+
+extern "C" int bench_c_api_parse (const char * input, bench_config * cfg);
+extern "C" int bench_c_api_parse_json (const char * input, size_t len, bench_config * cfg);
+extern "C" int bench_c_api_parse_msgpack (const char * input, size_t len, bench_config * cfg);
+extern "C" int bench_c_api_emit (int users, char ** out, size_t * out_len);
+
+
+#define BENCH_RUNS 7
+
+
+struct bench_server {
+  int  port;
+  bool ssl;
+};
+
+struct bench_cpp_config {
+  bench_server server;
+  bench_config totals;
+};
+
+
+static constexpr auto bench_schema = easyyaml::schema<bench_cpp_config>(
+  easyyaml::str("version", [](bench_cpp_config &, std::string_view) {}, "Configuration version"),
+  easyyaml::map("restapi", &bench_cpp_config::server,
+    easyyaml::field("port", &bench_server::port, "TCP port"),
+    easyyaml::field("ssl", &bench_server::ssl, "SSL enabled"),
+    easyyaml::str("base-path", [](bench_server &, std::string_view) {}, "URL base path")),
+  easyyaml::map("users", &bench_cpp_config::totals,
+    easyyaml::map(nullptr,
+      easyyaml::str("password", [](bench_config & c, std::string_view v) { c.users++; c.password_bytes += v.size(); }),
+      easyyaml::integer("uid", [](bench_config & c, int v) { c.uid_sum += v; }),
+      easyyaml::list("access",
+        easyyaml::str(nullptr, [](bench_config & c, std::string_view) { c.access++; }))))
+);
+
+
+int main (int argc, char ** argv)
+{
+  int    users = argc > 1 ? atoi(argv[1]) : 20000;
+  char * input = bench_corpus_users(users);
+  size_t bytes = strlen(input);
+  char * json  = bench_corpus_users_json(users);
+  size_t json_bytes = strlen(json);
+  char * msgpack;
+  size_t msgpack_bytes;
+  char   corpus[32];
+  double c_times[BENCH_RUNS];
+  double cpp_times[BENCH_RUNS];
+  double json_times[BENCH_RUNS];
+  double msgpack_times[BENCH_RUNS];
+  double emit_times[BENCH_RUNS];
+  bench_config c_cfg;
+  bench_config json_cfg;
+  bench_config msgpack_cfg;
+  bench_cpp_config cpp_cfg;
+
+  snprintf(corpus, sizeof(corpus), "users=%d", users);
+
+  if (easyyaml_yaml_to_msgpack(input, &msgpack, &msgpack_bytes) != EASYYAML_SUCCESS)
+    return 1;
+
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    memset(&c_cfg, 0, sizeof(c_cfg));
+    double t0 = bench_now();
+    if (bench_c_api_parse(input, &c_cfg) != EASYYAML_SUCCESS)
+      return 1;
+    c_times[i] = bench_now() - t0;
+
+    memset(&cpp_cfg, 0, sizeof(cpp_cfg));
+    t0 = bench_now();
+    if (easyyaml::parse_string<bench_schema>(input, cpp_cfg) != EASYYAML_SUCCESS)
+      return 1;
+    cpp_times[i] = bench_now() - t0;
+
+    memset(&json_cfg, 0, sizeof(json_cfg));
+    t0 = bench_now();
+    if (bench_c_api_parse_json(json, json_bytes, &json_cfg) != EASYYAML_SUCCESS)
+      return 1;
+    json_times[i] = bench_now() - t0;
+
+    memset(&msgpack_cfg, 0, sizeof(msgpack_cfg));
+    t0 = bench_now();
+    if (bench_c_api_parse_msgpack(msgpack, msgpack_bytes, &msgpack_cfg) != EASYYAML_SUCCESS)
+      return 1;
+    msgpack_times[i] = bench_now() - t0;
+
+    char * emitted;
+    size_t emitted_bytes;
+    t0 = bench_now();
+    if (bench_c_api_emit(users, &emitted, &emitted_bytes) != EASYYAML_SUCCESS)
+      return 1;
+    emit_times[i] = bench_now() - t0;
+    if (emitted_bytes != bytes || memcmp(emitted, input, bytes) != 0) {
+      fprintf(stderr, "bench_cpp: emitted YAML differs from the corpus\n");
+      return 1;
+    }
+    free(emitted);
+  }
+
+  if (c_cfg.users != cpp_cfg.totals.users || c_cfg.uid_sum != cpp_cfg.totals.uid_sum
+      || c_cfg.access != cpp_cfg.totals.access || c_cfg.port != cpp_cfg.server.port) {
+    fprintf(stderr, "bench_cpp: C and C++ results differ\n");
+    return 1;
+  }
+
+  if (memcmp(&c_cfg, &json_cfg, sizeof(c_cfg)) != 0 || memcmp(&c_cfg, &msgpack_cfg, sizeof(c_cfg)) != 0) {
+    fprintf(stderr, "bench_cpp: YAML, JSON and MessagePack results differ\n");
+    return 1;
+  }
+
+  bench_report("C API", corpus, c_times, BENCH_RUNS, bytes);
+  bench_report("C++ wrapper (easyyaml.hpp)", corpus, cpp_times, BENCH_RUNS, bytes);
+  bench_report("C API (JSON)", corpus, json_times, BENCH_RUNS, json_bytes);
+  bench_report("C API (MessagePack)", corpus, msgpack_times, BENCH_RUNS, msgpack_bytes);
+  bench_report("C API emit", corpus, emit_times, BENCH_RUNS, bytes);
+
+  free(input);
+  free(json);
+  free(msgpack);
+
+  return 0;
+}
@@ -0,0 +1,443 @@
+/// \file
+/// \brief Microbenchmarks isolating each stage of the parse: scanning,
+/// fixed key matching, handler dispatch, stack path rendering and the
+/// error path, with hardware counters where perf_event_open is available.
+/// A stage which can only be timed as part of a parse is timed as the
+/// difference between two parses of the same input, differing only in
+/// that stage's work (a longer schema to search, or handlers to call).
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <yaml.h>
+
+#include "config.h"
+#include "easyyaml.h"
+#include "bench_corpus.h"
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+#define BENCH_RUNS 9
+#define BENCH_KEYS 32
+#define BENCH_COUNTERS 4
+
+
+/// A stage's results: its best time, and if it was run against a base,
+/// the median of its runs' times less the base's interleaved with them
+/// (\c net) and the interquartile range of those (\c noise), and its
+/// counters summed over all the runs (or negative if not available).
+
+typedef struct bench_stage_st {
+  const char * name;
+  double       ops;
+  double       best;
+  int          has_base;
+  double       net;
+  double       noise;
+  double       counters[BENCH_COUNTERS];
+} bench_stage;
+
+
+static int  bench_perf_fd = -1;
+static long bench_handled;
+static char bench_keys[BENCH_KEYS][8];
+static char bench_pads[BENCH_KEYS][8];
+
+
+static void bench_noop_logger (int level, const char * msg)
+{
+}
+
+static void bench_handle_str (easyyaml_stack * stack, char * val, void * cfg)
+{
+  bench_handled++;
+}
+
+
+/// Open the hardware counters as a group, leaving \ref bench_perf_fd at -1
+/// if they are not available (not supported, or not permitted).
+
+static void bench_perf_open ()
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  static const uint64_t configs[BENCH_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+  };
+
+  int fds[BENCH_COUNTERS];
+
+  for (int i = 0; i < BENCH_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = configs[i];
+    attr.disabled       = i == 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP;
+
+    fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+    if (fds[i] < 0) {
+      while (i-- > 0)
+        close(fds[i]);
+      return;
+    }
+  }
+  bench_perf_fd = fds[0];
+#endif
+}
+
+
+/// Start counting (resetting the counters).
+
+static void bench_perf_start ()
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  if (bench_perf_fd >= 0) {
+    ioctl(bench_perf_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(bench_perf_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+}
+
+
+/// Stop counting, adding the counts to \p counters.
+
+static void bench_perf_stop (double * counters)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  uint64_t values[1 + BENCH_COUNTERS];
+
+  if (bench_perf_fd >= 0) {
+    ioctl(bench_perf_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(bench_perf_fd, values, sizeof(values)) == (ssize_t) sizeof(values)) {
+      for (int i = 0; i < BENCH_COUNTERS; i++)
+        counters[i] += (double) values[1 + i];
+      return;
+    }
+  }
+#endif
+  for (int i = 0; i < BENCH_COUNTERS; i++)
+    counters[i] = -1;
+}
+
+
+/// Order times, shortest first.
+
+static int bench_cmp_time (const void * a, const void * b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/// Time one run of \p fn with \p arg, exiting if it fails.
+
+static double bench_time (const char * name, int (*fn)(void *), void * arg)
+{
+  double t0 = bench_now();
+
+  if (fn(arg) != 0) {
+    fprintf(stderr, "bench_stages: stage %s failed\n", name);
+    exit(1);
+  }
+
+  return bench_now() - t0;
+}
+
+
+/// Run \p fn with \p arg \ref BENCH_RUNS times, after a run (untimed) to
+/// warm the caches and heap, recording the best time and the counters as
+/// stage \p name of \p ops operations per run. If \p base_fn is not NULL,
+/// it is run with \p base_arg before each run, for the difference.
+
+static void bench_stage_run (bench_stage * stage, const char * name, double ops, int (*fn)(void *), void * arg,
+                             int (*base_fn)(void *), void * base_arg)
+{
+  double times[BENCH_RUNS];
+  double diffs[BENCH_RUNS];
+
+  memset(stage, 0, sizeof(bench_stage));
+  stage->name     = name;
+  stage->ops      = ops;
+  stage->has_base = base_fn != NULL;
+
+  if (base_fn != NULL)
+    bench_time(name, base_fn, base_arg);
+  bench_time(name, fn, arg);
+
+  for (int i = 0; i < BENCH_RUNS; i++) {
+    double base_t = base_fn != NULL ? bench_time(name, base_fn, base_arg) : 0;
+
+    bench_perf_start();
+    times[i] = bench_time(name, fn, arg);
+    bench_perf_stop(stage->counters);
+    diffs[i] = times[i] - base_t;
+  }
+
+  qsort(times, BENCH_RUNS, sizeof(double), &bench_cmp_time);
+  qsort(diffs, BENCH_RUNS, sizeof(double), &bench_cmp_time);
+  stage->best  = times[0];
+  stage->net   = diffs[BENCH_RUNS / 2];
+  stage->noise = diffs[BENCH_RUNS * 3 / 4] - diffs[BENCH_RUNS / 4];
+}
+
+
+/// Print a stage's time per operation, and if it was run against a base,
+/// the time it takes over the base per each of \p net_ops operations (or
+/// if that is within the noise, "noise"), and its counters per operation.
+
+static void bench_stage_report (const bench_stage * stage, double net_ops)
+{
+  double ns = stage->best / stage->ops * 1e9;
+
+  printf("%-26s %10.0f %9.1f ", stage->name, stage->ops, ns);
+  if (!stage->has_base)
+    printf("%9s", "-");
+  else if (stage->net <= stage->noise)
+    printf("%9s", "noise");
+  else
+    printf("%9.2f", stage->net / net_ops * 1e9);
+
+  for (int i = 0; i < BENCH_COUNTERS; i++) {
+    if (stage->counters[i] < 0)
+      printf(" %9s", "-");
+    else
+      printf(" %9.1f", stage->counters[i] / (stage->ops * BENCH_RUNS));
+  }
+  printf("\n");
+}
+
+
+/// Generate a list of \p rows maps, each with all \ref BENCH_KEYS keys (in
+/// reverse schema order, so matching searches), the caller must free the
+/// result.
+
+static char * bench_corpus_wide (int rows)
+{
+  char * buf = (char *) malloc(16 + (size_t) rows * BENCH_KEYS * 24);
+  char * p   = buf;
+
+  p += sprintf(p, "rows:\n");
+  for (int i = 0; i < rows; i++) {
+    for (int k = BENCH_KEYS - 1; k >= 0; k--)
+      p += sprintf(p, "%s%s: v%d\n", k == BENCH_KEYS - 1 ? "  - " : "    ", bench_keys[k], i);
+  }
+
+  return buf;
+}
+
+
+/// Scan all the tokens of a document with libyaml alone.
+
+static int bench_scan (void * arg)
+{
+  const char * input = (const char *) arg;
+  yaml_parser_t parser;
+  yaml_token_t token;
+
+  if (!yaml_parser_initialize(&parser))
+    return 1;
+  yaml_parser_set_input_string(&parser, (const unsigned char *) input, strlen(input));
+
+  do {
+    if (!yaml_parser_scan(&parser, &token)) {
+      yaml_parser_delete(&parser);
+      return 1;
+    }
+    int type = token.type;
+    yaml_token_delete(&token);
+    if (type == YAML_STREAM_END_TOKEN)
+      break;
+  } while (1);
+
+  yaml_parser_delete(&parser);
+
+  return 0;
+}
+
+
+/// A document and schema to parse it with, \c repeat times, expecting
+/// the result \c expect.
+
+typedef struct bench_parse_st {
+  const char *      input;
+  easyyaml_schema * ys;
+  int               expect;
+  int               repeat;
+} bench_parse;
+
+static int bench_parse_string (void * arg)
+{
+  bench_parse * parse = (bench_parse *) arg;
+
+  for (int i = 0; i < parse->repeat; i++) {
+    if (easyyaml_parse_string(parse->input, parse->ys, NULL) != parse->expect)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/// Parse a document \c repeat times with one reusable parser.
+
+static int bench_parse_reused (void * arg)
+{
+  bench_parse * parse = (bench_parse *) arg;
+  easyyaml_parser * parser = easyyaml_parser_new(parse->ys, NULL);
+  size_t len = strlen(parse->input);
+  int retval = parser == NULL;
+
+  for (int i = 0; i < parse->repeat && retval == 0; i++)
+    retval = easyyaml_parser_parse(parser, parse->input, len, NULL) != parse->expect;
+  if (parser != NULL)
+    easyyaml_parser_free(parser);
+
+  return retval;
+}
+
+
+/// Render the path of a stack \p arg deep, 1000 times.
+
+static int bench_stack_path (void * arg)
+{
+  easyyaml_stack * stack = (easyyaml_stack *) arg;
+  size_t len = 0;
+
+  for (int i = 0; i < 1000; i++)
+    len += strlen(easyyaml_stack_path(stack));
+
+  return len == 0;
+}
+
+
+/// Format and log an error message 1000 times (to a logger which drops it).
+
+static int bench_log (void * arg)
+{
+  for (int i = 0; i < 1000; i++)
+    easyyaml_log(EASYYAML_LOG_LEVEL_ERROR, "key %s unexpected while parsing map at %s (%d)", "bogus", "/rows/k00", i);
+
+  return 0;
+}
+
+
+int main (int argc, char ** argv)
+{
+  int rows = argc > 1 ? atoi(argv[1]) : 5000;
+  bench_stage stage;
+  easyyaml_schema row_ys[BENCH_KEYS + 1];
+  easyyaml_schema row_handler_ys[BENCH_KEYS + 1];
+  easyyaml_schema row_padded_ys[2 * BENCH_KEYS + 1];
+
+  // The padded schema has as many keys again ahead of the document's,
+  // each sharing a prefix with them, so finding any key searches past
+  // BENCH_KEYS more entries.
+  for (int k = 0; k < BENCH_KEYS; k++) {
+    snprintf(bench_keys[k], sizeof(bench_keys[k]), "k%02d", k);
+    snprintf(bench_pads[k], sizeof(bench_pads[k]), "k%02d_", k);
+    easyyaml_schema entry = EASYYAML_STR(bench_keys[k], NULL, "field");
+    easyyaml_schema pad   = EASYYAML_STR(bench_pads[k], NULL, "padding");
+    row_ys[k] = entry;
+    row_handler_ys[k] = entry;
+    row_handler_ys[k].data = (void *) &bench_handle_str;
+    row_padded_ys[k] = pad;
+    row_padded_ys[BENCH_KEYS + k] = entry;
+  }
+  memset(&row_ys[BENCH_KEYS], 0, sizeof(easyyaml_schema));
+  memset(&row_handler_ys[BENCH_KEYS], 0, sizeof(easyyaml_schema));
+  memset(&row_padded_ys[2 * BENCH_KEYS], 0, sizeof(easyyaml_schema));
+
+  easyyaml_schema item_ys[]         = { EASYYAML_MAP(NULL, row_ys, "row"), { 0, 0, 0 } };
+  easyyaml_schema item_handler_ys[] = { EASYYAML_MAP(NULL, row_handler_ys, "row"), { 0, 0, 0 } };
+  easyyaml_schema item_padded_ys[]  = { EASYYAML_MAP(NULL, row_padded_ys, "row"), { 0, 0, 0 } };
+  easyyaml_schema ys[]              = { EASYYAML_LST("rows", item_ys, "rows"), { 0, 0, 0 } };
+  easyyaml_schema handler_ys[]      = { EASYYAML_LST("rows", item_handler_ys, "rows"), { 0, 0, 0 } };
+  easyyaml_schema padded_ys[]       = { EASYYAML_LST("rows", item_padded_ys, "rows"), { 0, 0, 0 } };
+
+  char * input = bench_corpus_wide(rows);
+  double nkeys = (double) rows * BENCH_KEYS;
+
+  easyyaml_set_logger(&bench_noop_logger);
+  bench_perf_open();
+
+  printf("%-26s %10s %9s %9s %9s %9s %9s %9s\n", "stage", "ops", "ns/op", "net ns", "cycles", "instrs", "cache-mis", "branch-mi");
+
+  // Each key is a key, a scalar, a value and a scalar token.
+  bench_stage_run(&stage, "scan (per key)", nkeys, &bench_scan, input, NULL, NULL);
+  bench_stage_report(&stage, 0);
+
+  bench_parse parse = {input, ys, EASYYAML_SUCCESS, 1};
+  bench_stage_run(&stage, "parse (per key)", nkeys, &bench_parse_string, &parse, NULL, NULL);
+  bench_stage_report(&stage, 0);
+
+  // The padded parse differs only in searching BENCH_KEYS more schema
+  // entries per key, so its net is per entry searched.
+  bench_parse parse_padded = {input, padded_ys, EASYYAML_SUCCESS, 1};
+  bench_stage_run(&stage, "key search (per entry)", nkeys, &bench_parse_string, &parse_padded,
+                  &bench_parse_string, &parse);
+  bench_stage_report(&stage, nkeys * BENCH_KEYS);
+
+  // The handler parse differs only in calling a handler per key.
+  bench_parse parse_handlers = {input, handler_ys, EASYYAML_SUCCESS, 1};
+  bench_handled = 0;
+  bench_stage_run(&stage, "dispatch (per call)", nkeys, &bench_parse_string, &parse_handlers,
+                  &bench_parse_string, &parse);
+  bench_stage_report(&stage, nkeys);
+  if (bench_handled != (long) nkeys * (BENCH_RUNS + 1)) {
+    fprintf(stderr, "bench_stages: handlers called %ld times, expected %ld\n", bench_handled, (long) nkeys * (BENCH_RUNS + 1));
+    return 1;
+  }
+
+  static const int depths[] = {1, 4, 16, 64};
+  easyyaml_stack stacks[65];
+  stacks[0].key  = NULL;
+  stacks[0].prev = NULL;
+  for (int d = 1; d <= 64; d++) {
+    stacks[d].key  = bench_keys[d % BENCH_KEYS];
+    stacks[d].prev = &stacks[d - 1];
+  }
+  for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "stack path (depth %d)", depths[i]);
+    bench_stage_run(&stage, name, 1000, &bench_stack_path, &stacks[depths[i]], NULL, NULL);
+    bench_stage_report(&stage, 0);
+  }
+
+  bench_stage_run(&stage, "log formatting", 1000, &bench_log, NULL, NULL, NULL);
+  bench_stage_report(&stage, 0);
+
+  // A parse failing on an unknown key, net of the same parse succeeding.
+  bench_parse parse_ok = {"rows:\n  - k00: v\n", ys, EASYYAML_SUCCESS, 1000};
+  bench_parse parse_err = {"rows:\n  - k00: v\n    bogus: v\n", ys, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, 1000};
+  bench_stage_run(&stage, "small parse", 1000, &bench_parse_string, &parse_ok, NULL, NULL);
+  bench_stage_report(&stage, 0);
+  bench_stage_run(&stage, "error path (per error)", 1000, &bench_parse_string, &parse_err,
+                  &bench_parse_string, &parse_ok);
+  bench_stage_report(&stage, 1000);
+
+  // The same small parse with a parser reused from one to the next, which
+  // saves rather than adds work, so is compared by its own time.
+  bench_stage_run(&stage, "small parse (reused)", 1000, &bench_parse_reused, &parse_ok, NULL, NULL);
+  bench_stage_report(&stage, 0);
+
+  if (bench_perf_fd < 0)
+    printf("(hardware counters not available)\n");
+
+  free(input);
+
+  return 0;
+}
@@ -71,6 +71,7 @@ static void ey_handle_svr_ssl (easyyaml_stack * stack, char * val, hello_config
 static void ey_handle_svr_base_path (easyyaml_stack * stack, char * val, hello_config * cfg);
 static void ey_handle_user_password (easyyaml_stack * stack, char * val, hello_config * cfg);
 static void ey_handle_user_access (easyyaml_stack * stack, char * val, hello_config * cfg);
+static hello_user * ey_user (easyyaml_stack * user_stack, hello_config * cfg);
 
 
 /// YAML schema.
@@ -138,47 +139,53 @@ static void ey_handle_svr_base_path (easyyaml_stack * stack, char * val, hello_c
   strcpy(cfg->svr_base_path, val);
 }
 
-static void ey_handle_user_password (easyyaml_stack * stack, char * val, hello_config * cfg)
+/// The user for the variable key stack entry \p user_stack, which is
+/// indexed by the key's ID (created the first time the key is seen).
+
+static hello_user * ey_user (easyyaml_stack * user_stack, hello_config * cfg)
 {
-  for (int i = 0; i < 10; i++) {
-    if (cfg->users[i].username == NULL) {
-      cfg->users[i].username = (char *) malloc(strlen(stack->prev->key) + 1);
-      strcpy(cfg->users[i].username, stack->prev->key);
-    }
-    if (strcmp(cfg->users[i].username, stack->prev->key) == 0) {
-      cfg->users[i].password = (char *) malloc(strlen(val) + 1);
-      strcpy(cfg->users[i].password, val);
-      return;
-    }
+  if (user_stack->id >= 10) {
+    fprintf(stderr, "ey_hello_universe: reading configuration, run out of space for new user \"%s\"\n", user_stack->key);
+    cfg->valid = 0;
+    return NULL;
   }
-  fprintf(stderr, "ey_hello_universe: reading configuration, run out of space for new user \"%s\"\n", stack->prev->key);
-  cfg->valid = 0;
+
+  hello_user * user = &cfg->users[user_stack->id];
+  if (user->username == NULL) {
+    user->username = (char *) malloc(strlen(user_stack->key) + 1);
+    strcpy(user->username, user_stack->key);
+  }
+
+  return user;
+}
+
+static void ey_handle_user_password (easyyaml_stack * stack, char * val, hello_config * cfg)
+{
+  hello_user * user = ey_user(stack->prev, cfg);
+  if (user == NULL)
+    return;
+
+  user->password = (char *) malloc(strlen(val) + 1);
+  strcpy(user->password, val);
 }
 
 static void ey_handle_user_access (easyyaml_stack * stack, char * val, hello_config * cfg)
 {
-  for (int i = 0; i < 10; i++) {
-    if (cfg->users[i].username == NULL) {
-      cfg->users[i].username = (char *) malloc(strlen(stack->prev->key) + 1);
-      strcpy(cfg->users[i].username, stack->prev->key);
-    }
-    if (strcmp(cfg->users[i].username, stack->prev->key) == 0) {
-      if (strcmp(val, "admin") == 0) {
-        cfg->users[i].admin = 1;
-        cfg->users[i].read = 1;
-        cfg->users[i].write = 1;
-      } else if (strcmp(val, "read") == 0) {
-        cfg->users[i].read = 1;
-      } else if (strcmp(val, "write") == 0) {
-        cfg->users[i].write = 1;
-      } else {
-        fprintf(stderr, "ey_hello_universe: reading configuration, ignoring unrecognised access \"%s\" for user \"%s\"\n", val, stack->prev->key);
-      }
-      return;
-    }
+  hello_user * user = ey_user(stack->prev, cfg);
+  if (user == NULL)
+    return;
+
+  if (strcmp(val, "admin") == 0) {
+    user->admin = 1;
+    user->read = 1;
+    user->write = 1;
+  } else if (strcmp(val, "read") == 0) {
+    user->read = 1;
+  } else if (strcmp(val, "write") == 0) {
+    user->write = 1;
+  } else {
+    fprintf(stderr, "ey_hello_universe: reading configuration, ignoring unrecognised access \"%s\" for user \"%s\"\n", val, stack->prev->key);
   }
-  fprintf(stderr, "ey_hello_universe: reading configuration, run out of space for new user \"%s\"\n", stack->prev->key);
-  cfg->valid = 0;
 }
 
 
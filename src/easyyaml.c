@@ -1,24 +1,1039 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <yaml.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "easyyaml.h"
 
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define EASYYAML_WITH_GZIP 1
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define EASYYAML_WITH_ZSTD 1
+#include <zstd.h>
+#endif
+
+#if defined(HAVE_UCONTEXT_H) && defined(HAVE_MAKECONTEXT) && defined(HAVE_SWAPCONTEXT)
+#define EASYYAML_WITH_PUSH 1
+#include <ucontext.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+#define EASYYAML_WITH_MMAP 1
+#include <sys/mman.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(HAVE_STDATOMIC_H) && defined(HAVE_PTHREAD_H)
+#define EASYYAML_WITH_HOLDER 1
+#include <stdatomic.h>
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#define EASYYAML_WITH_THREADS 1
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#define EASYYAML_WITH_ATOMICS 1
+#include <stdatomic.h>
+#endif
+
+#ifdef HAVE_LIBYAML_REWIND
+#define EASYYAML_WITH_REWIND 1
+#endif
+
+#if defined(HAVE_SYS_RANDOM_H) && defined(HAVE_GETRANDOM)
+#define EASYYAML_WITH_GETRANDOM 1
+#include <sys/random.h>
+#endif
+
+
+/// Reader input state (see \ref easyyaml_parse_reader), read in large
+/// blocks and optionally decompressed as libyaml asks for more.
+
+typedef struct easyyaml_input_st {
+  long   (*read_fn)(void *, char *, size_t);
+  void *   user;
+  char *   buf;
+  size_t   buf_size;
+  size_t   buf_pos;
+  size_t   buf_len;
+  int      eof;
+  int      fd;
+  int      decompress;
+  int      in_frame;
+  int      err_code;
+  char     errmsg[128];
+  size_t   total_bytes;
+  size_t   max_bytes;
+#ifdef EASYYAML_WITH_GZIP
+  z_stream       zs;
+  int            zs_init;
+#endif
+#ifdef EASYYAML_WITH_ZSTD
+  ZSTD_DStream * zds;
+#endif
+} easyyaml_input;
+
+
+/// Coroutine, running a parse on its own stack so that it can be suspended
+/// part way through when its input runs out (see \ref easyyaml_push_new).
+
+typedef struct easyyaml_coro_st {
+  void       (*fn)(void *);
+  void *       arg;
+  int          done;
+#ifdef EASYYAML_WITH_PUSH
+  ucontext_t   caller_uc;
+  ucontext_t   coro_uc;
+  void *       stack;
+  size_t       stack_size;
+#endif
+} easyyaml_coro;
+
+
+/// Interned variable key, the key string being at \c offset in the
+/// symbol table's string buffer.
+
+typedef struct easyyaml_symbol_st {
+  uint64_t hash;
+  size_t   offset;
+  size_t   len;
+} easyyaml_symbol;
+
+
+/// Symbol table of the variable keys seen by a parse, giving each distinct
+/// key a dense ID in order of first appearance. Keys are hashed with a
+/// randomly keyed SipHash, so input crafted to collide cannot degrade the
+/// table, and looked up by open addressing (\c slots hold ID + 1, or zero
+/// if empty).
+
+typedef struct easyyaml_symtab_st {
+  uint64_t          sip_key[2];
+  size_t *          slots;
+  size_t            slots_size;
+  easyyaml_symbol * symbols;
+  size_t            count;
+  size_t            symbols_size;
+  char *            strs;
+  size_t            strs_len;
+  size_t            strs_size;
+} easyyaml_symtab;
+
+
+/// An included file (see \ref easyyaml_includes_new), scanned into the
+/// same encoding of its tokens as an anchored node, with the \c anchors
+/// its aliases refer to (by index) and the \c paths it includes in turn.
+/// It is identified by the device and inode of the file, and current
+/// while its modification time and size are unchanged.
+/// The cache and each parse replaying it hold a reference (\c refs), so
+/// a fragment replaced in the cache lives until the last parse is done.
+
+typedef struct easyyaml_fragment_st {
+  easyyaml_includes * owner;
+  dev_t               dev;
+  ino_t               ino;
+  time_t              mtime;
+  long                mtime_ns;
+  off_t               size;
+  unsigned char *     buf;
+  size_t              len;
+  struct easyyaml_anchor_st * anchors;
+  size_t              anchors_count;
+  char **             paths;
+  size_t              paths_count;
+  size_t              refs;
+} easyyaml_fragment;
+
+
+/// Include cache, shared by the parses given it (see \ref easyyaml_options)
+/// so \c lock guards the fragment \c list and the counts.
+
+struct easyyaml_includes_st {
+  char *               base_dir;
+  easyyaml_fragment ** list;
+  size_t               count;
+  size_t               size;
+  size_t               scans;
+  size_t               hits;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_t      lock;
+#endif
+};
+
+
+/// A preload of included files, a wave at a time: the paths of a wave,
+/// from \c start up to \c end of \c paths (all the paths seen so far),
+/// are loaded in parallel, and the paths they include which have not been
+/// seen added, to make the next wave.
+
+typedef struct easyyaml_preload_st {
+  easyyaml_includes * includes;
+  char **             paths;
+  size_t              count;
+  size_t              size;
+  size_t              next;
+  size_t              end;
+  int                 retval;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_t     lock;
+#endif
+} easyyaml_preload;
+
+
+/// Anchored node, captured (as its tokens are read) into \c buf, as a
+/// compact encoding of the tokens for replay at each alias of it. A
+/// capture is pending until the first token of the node, and is complete
+/// when its \c depth returns to zero. The node of an include is complete
+/// from the start, its \c buf being that of its \c fragment, as are the
+/// fragment's anchors, whose \c buf is \c borrowed from it. The aliases in
+/// \c buf refer to the anchors from \c base.
+
+#define ANCHOR_PENDING 0
+#define ANCHOR_CAPTURING 1
+#define ANCHOR_COMPLETE 2
+#define ANCHOR_ABANDONED 3
+
+typedef struct easyyaml_anchor_st {
+  unsigned char * buf;
+  size_t          len;
+  size_t          size;
+  size_t          depth;
+  int             state;
+  size_t          base;
+  int             borrowed;
+  easyyaml_fragment * fragment;
+} easyyaml_anchor;
+
+
+/// Replay of an anchored node (or an \c include), from \c pos up to
+/// \c end of its buffer.
+
+typedef struct easyyaml_replay_st {
+  size_t      anchor;
+  size_t      pos;
+  size_t      end;
+  yaml_mark_t mark;
+  int         include;
+} easyyaml_replay;
+
+
+/// Anchors of a parse, \c latest giving the latest anchor defined with
+/// each (interned) name. Captures nest, so those in progress (\c active)
+/// form a stack, as do replays of aliases within replays.
+
+typedef struct easyyaml_anchors_st {
+  easyyaml_symtab   names;
+  size_t *          latest;
+  size_t            latest_size;
+  easyyaml_anchor * list;
+  size_t            count;
+  size_t            size;
+  size_t *          active;
+  size_t            active_count;
+  size_t            active_size;
+  easyyaml_replay * replays;
+  size_t            replays_count;
+  size_t            replays_size;
+} easyyaml_anchors;
+
+
+/// JSON input (see \ref easyyaml_parse_json), tokenized into the same
+/// block style tokens as libyaml would produce for the equivalent YAML,
+/// one at a time as the parse asks for them. The \c stack holds the
+/// brackets of the objects and arrays open.
+
+#define JSON_START 0
+#define JSON_VALUE 1
+#define JSON_OBJ_FIRST 2
+#define JSON_KEY 3
+#define JSON_COLON 4
+#define JSON_ARR_FIRST 5
+#define JSON_AFTER 6
+#define JSON_DONE 7
+
+typedef struct easyyaml_json_st {
+  const unsigned char * buf;
+  size_t                len;
+  size_t                pos;
+  size_t                line;
+  size_t                line_start;
+  int                   state;
+  char *                stack;
+  size_t                depth;
+  size_t                stack_size;
+  char                  errmsg[128];
+} easyyaml_json;
+
+
+/// An open MessagePack map or array, with the number of entries or items
+/// (still to come when reading, or so far when writing), and its header
+/// when writing.
+
+typedef struct easyyaml_msgpack_level_st {
+  size_t start;
+  size_t count;
+  int    map;
+} easyyaml_msgpack_level;
+
+
+/// The header of a MessagePack map or array being written, which belongs
+/// at \c start in the output less headers.
+
+typedef struct easyyaml_msgpack_header_st {
+  size_t        start;
+  unsigned char bytes[5];
+  unsigned char len;
+} easyyaml_msgpack_header;
+
+
+/// MessagePack input (see \ref easyyaml_parse_msgpack), tokenized like
+/// JSON into block style tokens. A nil value is an empty node, so makes
+/// no token. The \c stack holds the maps and arrays open.
+
+#define MSGPACK_START 0
+#define MSGPACK_VALUE 1
+#define MSGPACK_KEY 2
+#define MSGPACK_COLON 3
+#define MSGPACK_AFTER 4
+#define MSGPACK_DONE 5
+
+typedef struct easyyaml_msgpack_st {
+  const unsigned char *    buf;
+  size_t                   len;
+  size_t                   pos;
+  int                      state;
+  easyyaml_msgpack_level * stack;
+  size_t                   depth;
+  size_t                   stack_size;
+  char                     errmsg[128];
+} easyyaml_msgpack;
+
+
+/// MessagePack output (see \ref easyyaml_yaml_to_msgpack). The header of
+/// a map or array is only known at its end, once its count is, so the
+/// output is written without them, and they are set aside in \c headers
+/// (in the order the maps and arrays start, which is their order in the
+/// output) and put in place at the end, in one pass.
+
+typedef struct easyyaml_msgpack_out_st {
+  unsigned char *           buf;
+  size_t                    len;
+  size_t                    size;
+  easyyaml_msgpack_level *  levels;
+  size_t                    depth;
+  size_t                    levels_size;
+  easyyaml_msgpack_header * headers;
+  size_t                    headers_count;
+  size_t                    headers_size;
+} easyyaml_msgpack_out;
+
+
+/// Emitter state (see \ref easyyaml_emit_string). The output is built up
+/// in \c buf, which when emitting to a file descriptor is written out
+/// whenever it fills. The \c headers of maps and lists (their key, or the
+/// indicator of a list item) are only written once something is written
+/// in them, since an empty block map or list can not be written, so is
+/// left out.
+
+typedef struct easyyaml_emit_header_st {
+  const char * key;
+  size_t       indent;
+} easyyaml_emit_header;
+
+typedef struct easyyaml_emitter_st {
+  char *                 buf;
+  size_t                 len;
+  size_t                 size;
+  int                    fd;
+  int                    (*getter)(easyyaml_stack *, const easyyaml_schema *, size_t, easyyaml_emit_value *, void *);
+  easyyaml_emit_header * headers;
+  size_t                 headers_count;
+  size_t                 headers_written;
+  size_t                 headers_size;
+  int                    in_item;
+} easyyaml_emitter;
+
+
+/// Document image (see \ref easyyaml_image_build), a whole parsed document
+/// in one block, linked by offsets rather than pointers so that it can be
+/// mapped at any address by any number of processes. After the header
+/// (the magic number, the image length, the root offset and a spare word)
+/// come the nodes, each a type and a length or count, followed by the
+/// scalar (zero byte terminated and padded to four bytes), the key and
+/// value offsets of each map entry (sorted by key), or the offsets of the
+/// list items. Children are written before their parents, so the root
+/// is last, and no offset is zero. The \c map is what to unmap or free
+/// on closing.
+
+#define IMAGE_MAGIC 0x31495945
+#define IMAGE_HEADER_LEN 16
+#define IMAGE_NULL 0
+#define IMAGE_STR 1
+#define IMAGE_MAP 2
+#define IMAGE_LST 3
+
+#define IMAGE_U32(buf, off) (*(const uint32_t *) ((const unsigned char *) (buf) + (off)))
+
+struct easyyaml_image_st {
+  const unsigned char * buf;
+  size_t                len;
+  size_t                root;
+  void *                map;
+};
+
+
+/// An open map or list being written to an image, whose children's
+/// offsets are on the \c offsets stack from \c first.
+
+typedef struct easyyaml_image_level_st {
+  size_t first;
+  int    map;
+} easyyaml_image_level;
+
+typedef struct easyyaml_image_out_st {
+  unsigned char *        buf;
+  size_t                 len;
+  size_t                 size;
+  uint32_t *             offsets;
+  size_t                 offsets_count;
+  size_t                 offsets_size;
+  easyyaml_image_level * levels;
+  size_t                 depth;
+  size_t                 levels_size;
+} easyyaml_image_out;
+
+
+/// A map entry of an image being sorted into place.
+
+typedef struct easyyaml_image_entry_st {
+  const char * key;
+  uint32_t     key_len;
+  uint32_t     key_off;
+  uint32_t     value_off;
+  int          merged;
+} easyyaml_image_entry;
+
+
+/// Limits on compiling an enum table: the displacements tried for each
+/// bucket before the table is made larger, and the largest table (per
+/// value) before giving up.
+
+#define ENUM_MAX_DISP 4096
+#define ENUM_MAX_LOAD 1024
+
+
+/// The compiled perfect hash of an enum table (see \ref
+/// easyyaml_enum_compile): a displacement for each bucket, the slots the
+/// values are placed in (each the index of a value plus one, or zero if
+/// empty), and the length of each name.
+
+struct easyyaml_enum_hash_st {
+  size_t     mask;
+  size_t     buckets;
+  uint32_t * slots;
+  uint32_t * disps;
+  size_t *   lens;
+};
+
+
+/// Limits on includes: the nesting of includes within included files
+/// (beyond which they are taken to be a cycle), and the threads loading
+/// the included files of a preload.
+
+#define INCLUDE_MAX_DEPTH 16
+#define INCLUDE_THREADS 8
+
+
+/// The kinds of route pattern segment: a literal key, "*" matching any
+/// one key, "**" matching any number of keys, and the end of a pattern.
+
+#define ROUTE_SEG_KEY 0
+#define ROUTE_SEG_ANY 1
+#define ROUTE_SEG_DEEP 2
+#define ROUTE_SEG_END 3
+
+
+/// A path pattern added to a router, split into its segments, with the
+/// handler of the values it matches. Its positions (before each segment,
+/// and at the end) are numbered from \c first.
+
+typedef struct easyyaml_route_st {
+  char **  segs;
+  size_t   segs_count;
+  size_t   first;
+  void  (* handler)(easyyaml_stack *, char *, void *);
+} easyyaml_route;
+
+
+/// A router state's transition on a literal key.
+
+typedef struct easyyaml_route_trans_st {
+  const char * key;
+  size_t       len;
+  size_t       next;
+} easyyaml_route_trans;
+
+
+/// A router state, standing for the set of route positions at \c set in
+/// the router's \c sets: its transitions on literal keys (at \c trans in
+/// the router's \c trans, sorted by key), the state for any other key,
+/// and the routes whose handlers are called for a value at it (at
+/// \c matches in the router's \c matches).
+
+typedef struct easyyaml_route_state_st {
+  size_t   set;
+  size_t   set_count;
+  uint64_t set_hash;
+  size_t   trans;
+  size_t   trans_count;
+  size_t   other;
+  size_t   matches;
+  size_t   matches_count;
+} easyyaml_route_state;
+
+
+/// Router (see \ref easyyaml_router_new). Its routes are compiled into a
+/// DFA over keys by the subset construction: state 0 is the empty set,
+/// which never matches, and \c root the state of the root path. States
+/// are found by an open addressed hash table of their indexes (plus one,
+/// zero being an empty slot) keyed by the hash of their sets.
+
+struct easyyaml_router_st {
+  easyyaml_route *       routes;
+  size_t                 routes_count;
+  size_t                 routes_size;
+  int                    compiled;
+  size_t                 root;
+  easyyaml_route_state * states;
+  size_t                 states_count;
+  size_t                 states_size;
+  size_t *               slots;
+  size_t                 slots_size;
+  easyyaml_route_trans * trans;
+  size_t                 trans_count;
+  size_t                 trans_size;
+  size_t *               sets;
+  size_t                 sets_count;
+  size_t                 sets_size;
+  size_t *               matches;
+  size_t                 matches_count;
+  size_t                 matches_size;
+  size_t                 positions;
+  size_t *               pos_route;
+  unsigned char *        pos_kind;
+  unsigned char *        marks;
+  size_t *               scratch;
+  size_t                 scratch_count;
+};
+
+
+/// A map or list being walked by a router, in state \c state at path
+/// \c stack, with (for a map) its current entry's key in \c node (unless
+/// it is a merge key, whose entries are the map's own) and its state.
+
+typedef struct easyyaml_route_level_st {
+  int            map;
+  int            want_key;
+  int            merge;
+  size_t         state;
+  easyyaml_stack * stack;
+  easyyaml_stack node;
+  size_t         node_state;
+  int            has_key_token;
+  yaml_token_t   key_token;
+} easyyaml_route_level;
+
+
+/// The kinds of node of a layered document (see \ref easyyaml_parse_layers),
+/// \c LAYER_NONE being an entry or item with no value.
+
+#define LAYER_NONE 0
+#define LAYER_SCALAR 1
+#define LAYER_MAP 2
+#define LAYER_LIST 3
+
+#define LAYER_NIL ((size_t) -1)
+
+
+/// A node of a layered document: a scalar, or a map or list whose entries
+/// (or items) are linked from \c first through their \c next. A node whose
+/// value is replaced by a later layer is reset in place, its \c gen being
+/// advanced so that the keys of its old entries no longer find them.
+
+typedef struct easyyaml_layer_node_st {
+  int             type;
+  unsigned char * key;
+  size_t          key_len;
+  int             key_style;
+  unsigned char * value;
+  size_t          value_len;
+  int             style;
+  size_t          first;
+  size_t          last;
+  size_t          next;
+  size_t          gen;
+} easyyaml_layer_node;
+
+
+/// A layered document, the layers merged into its \c nodes (the first the
+/// root map) as they are read. The entries of maps are indexed by their
+/// map's node and generation and their key, interned in \c keys, whose IDs
+/// index \c bindings, the entries' nodes.
+
+typedef struct easyyaml_layers_st {
+  easyyaml_layer_node * nodes;
+  size_t                count;
+  size_t                size;
+  easyyaml_symtab       keys;
+  size_t *              bindings;
+  size_t                bindings_size;
+  unsigned char *       keybuf;
+  size_t                keybuf_size;
+} easyyaml_layers;
+
+
+/// A map or list being read into a layered document, \c node, a merge
+/// key's map being read into its enclosing map, \c merges deep. The
+/// entries the layer has set in the map are noted from \c set_start.
+
+typedef struct easyyaml_layer_level_st {
+  size_t node;
+  int    map;
+  int    want_key;
+  size_t merges;
+  size_t set_start;
+} easyyaml_layer_level;
+
+
+/// Profile (see \ref easyyaml_profile_new), the stats of each schema entry
+/// seen (in the order first seen), found by an open addressed hash table
+/// of their indexes (plus one, zero being an empty slot) keyed by the
+/// address of the entry.
+
+struct easyyaml_profile_st {
+  easyyaml_profile_entry * entries;
+  size_t                   count;
+  size_t                   size;
+  size_t *                 slots;
+  size_t                   slots_size;
+};
+
+
+/// Parse context, passed through the parse.
+
+typedef struct easyyaml_ctx_st {
+  yaml_parser_t *          parser;
+  easyyaml_input *         input;
+  const easyyaml_options * opts;
+  yaml_token_t             pending;
+  int                      has_pending;
+  yaml_mark_t              mark;
+  int                      token_budget;
+  size_t                   tokens_left;
+  uint64_t                 deadline_ns;
+  int                      limited;
+  size_t                   tokens;
+  size_t                   keys;
+  uint64_t                 limit_deadline_ns;
+  easyyaml_anchors         anchors;
+  easyyaml_json *          json;
+  easyyaml_msgpack *       msgpack;
+  easyyaml_profile *       profile;
+  size_t                   prof;
+  int                      keep_aliases;
+  size_t                   alias;
+} easyyaml_ctx;
+
+
+#define FRAME_OBJ 1
+#define FRAME_LIST 2
+#define FRAME_REC 3
+
+#define INLINE_FRAMES 16
+
+
+/// Parse frame, one for each map or list being parsed. The \c stack of
+/// a frame is its own \c node for a map entry, and is shared with the
+/// enclosing frame for a list item. A records map (whose \c ys is the
+/// records schema entry itself) also holds the array of records.
+
+typedef struct easyyaml_frame_st {
+  int               type;
+  easyyaml_schema * ys;
+  void *            cfg;
+  easyyaml_stack    node;
+  easyyaml_stack *  stack;
+  int               own_node;
+  yaml_token_t      key_token;
+  int               has_key_token;
+  int               in_entry;
+  size_t            pos;
+  char *            recs;
+  size_t            rec_count;
+  size_t            rec_cap;
+  size_t            merges;
+  size_t            set_keys_start;
+  size_t            prof;
+} easyyaml_frame;
+
+
+/// Key set by a map entry, \c key being the index of its schema entry, or
+/// for a variable key its interned id, and \c merges the number of merge
+/// keys it was merged in by (zero if the map sets it itself).
+
+typedef struct easyyaml_set_key_st {
+  size_t key;
+  size_t merges;
+} easyyaml_set_key;
+
+
+/// A schema, and those it is under, while walking a schema.
+
+typedef struct easyyaml_schema_chain_st {
+  const easyyaml_schema *                 ys;
+  const struct easyyaml_schema_chain_st * prev;
+} easyyaml_schema_chain;
+
+
+/// Parse engine, an iterative state machine over a stack of frames (so
+/// the C stack used does not grow with the nesting depth). The frames
+/// start out in the engine itself, and move to the heap if they outgrow
+/// it, unless the caller supplied them. A cursor's engine has an event
+/// sink \c ev, which is passed each map or list start and end, and each
+/// scalar, in place of calling the handlers, the key and value tokens
+/// (and the node) of the last scalar being kept until the next step.
+
+typedef struct easyyaml_engine_st {
+  easyyaml_ctx      ctx;
+  easyyaml_schema * ys;
+  void *            cfg;
+  int               started;
+  int               done;
+  int               retval;
+  size_t            errors_before;
+  easyyaml_frame *  frames;
+  size_t            frames_size;
+  size_t            depth;
+  int               frames_user;
+  easyyaml_symtab   symtab;
+  int               keep_symtab;
+  int               compiled;
+  easyyaml_set_key * set_keys;
+  size_t            set_keys_count;
+  size_t            set_keys_size;
+  easyyaml_event *  ev;
+  easyyaml_stack    ev_stack;
+  yaml_token_t      ev_key;
+  yaml_token_t      ev_value;
+  int               has_ev_key;
+  int               has_ev_value;
+  easyyaml_frame    inline_frames[INLINE_FRAMES];
+} easyyaml_engine;
+
+
+/// Push parser state (see \ref easyyaml_push_new). The parse switches back
+/// to the caller whenever it runs out of fed input, resuming on the next
+/// \ref easyyaml_push_feed.
+
+struct easyyaml_push_st {
+  easyyaml_coro      coro;
+  yaml_parser_t      parser;
+  easyyaml_input     input;
+  easyyaml_options   opts;
+  easyyaml_schema *  ys;
+  void *             cfg;
+  const char *       chunk;
+  size_t             chunk_len;
+  int                finished;
+  int                retval;
+};
+
+
+/// Stepped parse state (see \ref easyyaml_stepper_new_string).
+
+struct easyyaml_stepper_st {
+  easyyaml_engine    engine;
+  yaml_parser_t      parser;
+  easyyaml_input     input;
+  int                has_input;
+  char *             input_string;
+  easyyaml_options   opts;
+};
+
+
+/// Reusable parser (see \ref easyyaml_parser_new). Between documents the
+/// libyaml parser is rewound rather than recreated and the engine's key
+/// symbol table emptied rather than freed, so both keep their memory.
+
+struct easyyaml_parser_st {
+  easyyaml_engine        engine;
+  yaml_parser_t          parser;
+  easyyaml_symtab        symtab;
+  easyyaml_schema *      ys;
+  easyyaml_options       opts;
+  int                    used;
+  int                    rewind;
+  easyyaml_parser_pool * pool;
+  easyyaml_parser *      prev;
+  easyyaml_parser *      next;
+};
+
+
+/// Per thread pool of reusable parsers (see \ref easyyaml_parser_pool_new),
+/// each thread's parser found by \c key. All the pool's parsers are listed
+/// in \c parsers (under \c lock), for freeing with the pool.
+
+struct easyyaml_parser_pool_st {
+  easyyaml_schema *  ys;
+  easyyaml_options   opts;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_key_t      key;
+  pthread_mutex_t    lock;
+#endif
+  easyyaml_parser *  parsers;
+};
+
+
+/// Pull parse state (see \ref easyyaml_cursor_new_string), an engine
+/// with an event sink.
+
+struct easyyaml_cursor_st {
+  easyyaml_engine    engine;
+  yaml_parser_t      parser;
+  easyyaml_input     input;
+  int                has_input;
+  char *             input_string;
+  easyyaml_options   opts;
+};
+
+
+#ifdef EASYYAML_WITH_HOLDER
+/// A config version replaced in a holder, kept until no reader can still
+/// be using it, that is until every reader in a read section entered it
+/// after the epoch was advanced past \c retired.
+
+typedef struct easyyaml_version_st easyyaml_version;
+
+struct easyyaml_version_st {
+  void *             cfg;
+  uint64_t           retired;
+  easyyaml_version * next;
+};
+
+
+/// Config holder (see \ref easyyaml_holder_new). Readers only ever load
+/// \c current and store to their own \c epoch, the \c lock is only taken
+/// by reloads and reader registration.
+
+struct easyyaml_holder_st {
+  _Atomic(void *)          current;
+  _Atomic uint64_t         epoch;
+  pthread_mutex_t          lock;
+  easyyaml_holder_reader * readers;
+  easyyaml_version *       retired;
+  size_t                   cfg_size;
+  void                     (*cfg_free)(void *);
+};
+
+
+/// A holder reader, whose \c epoch is that at which it entered its read
+/// section, or zero when outside one. Readers are kept until the holder
+/// is freed, and reused once freed (\c in_use cleared).
+
+struct easyyaml_holder_reader_st {
+  easyyaml_holder *        holder;
+  _Atomic uint64_t         epoch;
+  atomic_int               in_use;
+  easyyaml_holder_reader * next;
+};
+#endif
+
 
 /// Local function declarations.
 
-static int    parse (yaml_parser_t * parser, easyyaml_schema * ys, void * cfg);
-static int    scan_tok (yaml_parser_t * parser, yaml_token_t * token);
-static int    rec_parse (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * c);
-static int    rec_parse_obj (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * c);
-static int    rec_parse_obj_varkeys (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg);
-static int    rec_parse_obj_fixedkeys (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg);
-static int    rec_parse_list (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * c);
+static int    parse (yaml_parser_t * parser, easyyaml_input * input, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+#ifdef EASYYAML_WITH_HOLDER
+static int    holder_publish (easyyaml_holder * holder, void * cfg, int retval);
+static size_t holder_reclaim (easyyaml_holder * holder);
+static void   holder_cfg_free (easyyaml_holder * holder, void * cfg);
+#endif
+static int    profile_enter (easyyaml_ctx * ctx, const easyyaml_schema * ys, easyyaml_stack * stack);
+static int    profile_scan (easyyaml_ctx * ctx, yaml_token_t * token);
+static void   profile_call (easyyaml_ctx * ctx, size_t prof, uint64_t start_ns);
+static void   profile_hist (uint64_t * hist, uint64_t ns);
+static uint64_t profile_percentile (const uint64_t * hist, uint64_t count, int pct, uint64_t max_ns);
+static int    profile_cmp_time (const void * a, const void * b);
+static int    profile_cmp_calls (const void * a, const void * b);
+static long   fd_read (void * user, char * buf, size_t len);
+#ifdef EASYYAML_WITH_PUSH
+static int    coro_init (easyyaml_coro * coro, size_t stack_size, void (*fn)(void *), void * arg);
+static void   coro_main (unsigned int coro_hi, unsigned int coro_lo);
+static void   coro_resume (easyyaml_coro * coro);
+static void   coro_yield (easyyaml_coro * coro);
+static void   coro_free (easyyaml_coro * coro);
+static long   push_read (void * user, char * buf, size_t len);
+static void   push_main (void * arg);
+static void   push_free (easyyaml_push * push);
+#endif
+static easyyaml_stepper * stepper_new (const easyyaml_options * opts);
+#ifdef EASYYAML_WITH_REWIND
+static void   parser_rewind (yaml_parser_t * parser);
+#endif
+#ifdef EASYYAML_WITH_THREADS
+static void   parser_pool_release (void * arg);
+#endif
+static easyyaml_cursor * cursor_new (const easyyaml_options * opts);
+static int    input_read (void * data, unsigned char * buffer, size_t size, size_t * size_read);
+static int    input_decode (easyyaml_input * input, unsigned char * buffer, size_t size, size_t * size_read);
+static int    input_fill (easyyaml_input * input);
+static int    input_error (easyyaml_input * input, int err_code, const char * errmsg);
+static void   input_free (easyyaml_input * input);
+static int    scan_tok (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    parser_tok (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    json_tok (easyyaml_json * json, yaml_token_t * token);
+static void   json_skip_ws (easyyaml_json * json);
+static int    json_string (easyyaml_json * json, yaml_token_t * token);
+static int    json_literal (easyyaml_json * json, yaml_token_t * token);
+static int    json_push (easyyaml_json * json, char bracket);
+static int    json_error (easyyaml_json * json, const char * expected);
+static int    msgpack_tok (easyyaml_msgpack * mp, yaml_token_t * token);
+static int    msgpack_scalar (easyyaml_msgpack * mp, yaml_token_t * token);
+static int    msgpack_container (easyyaml_msgpack * mp, size_t * count);
+static int    msgpack_need (easyyaml_msgpack * mp, size_t n);
+static uint64_t msgpack_be (const unsigned char * p, size_t n);
+static int    msgpack_error (easyyaml_msgpack * mp, const char * expected);
+static int    msgpack_convert (easyyaml_ctx * ctx, easyyaml_msgpack_out * out);
+static int    msgpack_put_scalar (easyyaml_msgpack_out * out, yaml_token_t * token);
+static int    msgpack_put_header (easyyaml_msgpack_out * out, int base, size_t n);
+static size_t msgpack_header (unsigned char * p, int base, size_t n);
+static int    msgpack_close (easyyaml_msgpack_out * out);
+static int    msgpack_finish (easyyaml_msgpack_out * out);
+static int    msgpack_reserve (easyyaml_msgpack_out * out, size_t n);
+static int    emit_map (easyyaml_emitter * em, easyyaml_schema * ys, easyyaml_stack * stack, size_t indent, void * cfg);
+static int    emit_node (easyyaml_emitter * em, easyyaml_schema * ys, const char * key, easyyaml_emit_value * val, easyyaml_stack * stack, size_t indent);
+static int    emit_header (easyyaml_emitter * em, const char * key, size_t indent);
+static int    emit_line_start (easyyaml_emitter * em, const char * key, size_t indent);
+static int    emit_scalar (easyyaml_emitter * em, const char * str, size_t len);
+static size_t emit_utf8 (const unsigned char * s, size_t len, char * esc);
+static int    emit_put (easyyaml_emitter * em, const char * data, size_t len);
+static int    emit_flush (easyyaml_emitter * em);
+static int    image_build (easyyaml_ctx * ctx, char ** out, size_t * out_len);
+static int    image_convert (easyyaml_ctx * ctx, easyyaml_image_out * out);
+static int    image_put_node (easyyaml_image_out * out, uint32_t type, const char * data, size_t len);
+static int    image_push_offset (easyyaml_image_out * out, size_t offset);
+static int    image_close (easyyaml_image_out * out);
+static int    image_reserve (easyyaml_image_out * out, size_t n);
+static int    image_write_file (const char * image_filename, const char * buf, size_t len);
+static easyyaml_image * image_open (const unsigned char * buf, size_t len, void * map);
+static int    image_check (const unsigned char * buf, size_t len, char * errmsg, size_t errmsg_len);
+static size_t image_find (const easyyaml_image * image, size_t node, const char * key, size_t len);
+static int    image_key_cmp (const char * a, size_t a_len, const char * b, size_t b_len);
+static int    image_entry_cmp (const void * a, const void * b);
+static void   router_reset (easyyaml_router * router);
+static int    router_grow (void ** arr, size_t * size, size_t need, size_t elem_size);
+static void   route_mark (easyyaml_router * router, size_t pos);
+static void   route_close (easyyaml_router * router);
+static void   route_move (easyyaml_router * router, size_t state, const char * key, size_t len);
+static int    route_state (easyyaml_router * router, size_t * state);
+static int    route_expand (easyyaml_router * router, size_t state);
+static int    route_pos_cmp (const void * a, const void * b);
+static int    route_trans_cmp (const void * a, const void * b);
+static size_t route_next (const easyyaml_router * router, size_t state, const char * key, size_t len);
+static int    route_walk (easyyaml_router * router, easyyaml_ctx * ctx, void * cfg);
+static int    route_push (easyyaml_route_level ** levels, size_t * levels_size, size_t depth, easyyaml_stack * root);
+static int    replay_tok (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token);
+static int    replay_push (easyyaml_ctx * ctx, size_t anchor, yaml_mark_t mark);
+static int    anchor_start (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    anchor_alias (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token);
+static int    anchor_record (easyyaml_ctx * ctx, yaml_token_t * token, size_t alias);
+static int    anchor_new (easyyaml_anchors * anchors, size_t * anchor);
+static int    anchor_encode (easyyaml_anchor * anchor, yaml_token_t * token, size_t alias);
+static int    anchor_append (easyyaml_anchor * anchor, const void * data, size_t len);
+static void   anchors_free (easyyaml_anchors * anchors);
+static int    include_tag (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    include_start (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token);
+static int    include_get (easyyaml_includes * includes, const char * path, easyyaml_fragment ** fragment);
+static int    fragment_load (easyyaml_includes * includes, const char * filename, easyyaml_fragment ** fragment);
+static void   fragment_release (easyyaml_fragment * fragment);
+static void   fragment_free (easyyaml_fragment * fragment);
+static void * preload_worker (void * arg);
+static int    preload_add (easyyaml_preload * preload, const char * path);
+static int    layers_read (easyyaml_layers * layers, const char * filename, const easyyaml_options * opts);
+static int    layers_walk (easyyaml_layers * layers, easyyaml_ctx * ctx);
+static int    layers_node (easyyaml_layers * layers, size_t * node);
+static int    layers_entry (easyyaml_layers * layers, size_t map, yaml_token_t * key, size_t * node);
+static void   layers_reset (easyyaml_layers * layers, size_t node, int type);
+static int    layers_encode (easyyaml_layers * layers, easyyaml_anchor * enc);
+static int    layers_put (easyyaml_anchor * enc, int type, const unsigned char * value, size_t len, int style);
+static void   layers_free (easyyaml_layers * layers);
+static void   unscan_tok (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    skip_node (easyyaml_ctx * ctx, yaml_token_t * token);
+static int    skip_value (easyyaml_ctx * ctx);
+static void   engine_init (easyyaml_engine * engine, yaml_parser_t * parser, easyyaml_input * input, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+static int    engine_run (easyyaml_engine * engine);
+static int    engine_step (easyyaml_engine * engine);
+static int    engine_finish (easyyaml_engine * engine, int retval);
+static void   engine_free (easyyaml_engine * engine);
+static int    engine_start (easyyaml_engine * engine);
+static int    push_frame (easyyaml_engine * engine, int type, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, void * cfg, yaml_token_t * key_token);
+static void   pop_frame (easyyaml_engine * engine);
+static int    grow_frames (easyyaml_engine * engine);
+static int    step_obj (easyyaml_engine * engine);
+static int    step_obj_varkey (easyyaml_engine * engine);
+static int    step_obj_fixedkey (easyyaml_engine * engine);
+static int    step_list (easyyaml_engine * engine);
+static int    step_rec (easyyaml_engine * engine);
+static int    scan_varkey (easyyaml_engine * engine, yaml_token_t * token, easyyaml_stack * stack, int * have_key);
+static void   recs_free (easyyaml_schema * ys, char * recs, size_t count);
+static int    is_merge_key (yaml_token_t * token);
+static int    enter_merge (easyyaml_engine * engine);
+static int    set_key (easyyaml_engine * engine, size_t key, int * merged_over);
+static int    enter_value (easyyaml_engine * engine, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, void * cfg, yaml_token_t * key_token);
+static int    enter_any (easyyaml_engine * engine, easyyaml_stack * stack, int own_node, yaml_token_t * key_token, yaml_token_t * token);
+static void   sink_scalar (easyyaml_engine * engine, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, yaml_token_t * key_token, yaml_token_t * token, int num);
+static void   sink_begin (easyyaml_engine * engine, easyyaml_schema * ys);
+static void   sink_end (easyyaml_engine * engine);
+static void   sink_release (easyyaml_engine * engine);
+static uint64_t enum_hash (const char * str, size_t len);
+static size_t enum_slot (uint64_t hash, uint32_t disp, size_t mask);
+static int    enum_place (easyyaml_enum_hash * hash, const uint64_t * hashes, const size_t * order, const size_t * starts, size_t bucket_count, size_t * slots);
+static int    enum_bucket_cmp (const void * a, const void * b);
+static void   enum_release (easyyaml_enum * table);
+static int    schema_compile (easyyaml_schema * ys);
+static int    schema_compile_walk (easyyaml_schema * ys, const easyyaml_schema_chain * ancestors);
+static int    intern_key (easyyaml_symtab * symtab, const char * key, size_t len, size_t * id);
+static int    symtab_grow_slots (easyyaml_symtab * symtab);
+static void   symtab_seed (easyyaml_symtab * symtab);
+static void   symtab_clear (easyyaml_symtab * symtab);
+static void   symtab_free (easyyaml_symtab * symtab);
+static uint64_t siphash (const uint64_t key[2], const unsigned char * data, size_t len);
+static int    budget_spent (easyyaml_ctx * ctx);
+static int    check_limits (easyyaml_ctx * ctx, yaml_token_t * token);
+static uint64_t now_ns (void);
 static char * tok_to_str (int tok);
-static char * stack_render_rec (easyyaml_stack * stack, char * buf, char * buf_of);
+static size_t stack_path_len (easyyaml_stack * stack);
+static void   stack_render (easyyaml_stack * stack, char * buf, size_t buf_size);
+static uint64_t stack_hash (uint64_t hash, const char * key, size_t len);
 static int    error_handler (int err_code, const void * data, const char * reason, const char * errmsg_fmt, ...);
+static int    schema_error (easyyaml_ctx * ctx, int err_code, easyyaml_schema * ys, easyyaml_stack * stack, const char * key, int tok);
+static int    errors_add (easyyaml_errors * errors, int err_code, yaml_mark_t * mark, easyyaml_schema * ys, easyyaml_stack * stack, const char * key, int tok);
+static char * format_error (int err_code, const easyyaml_schema * ys, const char * path, const char * key, int tok, char * buf, size_t len);
 
 /// Logger, log level and error handler intialisation.
 
@@ -26,6 +1041,20 @@ static int logger_loglevel = EASYYAML_LOG_LEVEL_ERROR;
 static void (*alt_logger)(int level, const char * fmt) = NULL;
 static int (*alt_errhandler)(int err_code, const void * data, const char * reason, const char * errmsg_fmt) = NULL;
 
+#ifdef EASYYAML_WITH_THREADS
+static pthread_mutex_t schema_compile_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/// The generation of compiled enum tables, a new one starting each time
+/// one is freed (schemas record the generation they were compiled in, and
+/// start at zero, so are compiled by their first parse).
+
+#ifdef EASYYAML_WITH_ATOMICS
+static atomic_uint schema_generation = 1;
+#else
+static unsigned int schema_generation = 1;
+#endif
+
 
 /// Set the log level (used only by the default logger).
 
@@ -51,28 +1080,102 @@ void easyyaml_set_errhandler (int (*handler)(int, const void *, const char *, co
 }
 
 
+/// Initialise parse options to the defaults.
+
+void easyyaml_options_init (easyyaml_options * opts)
+{
+  memset(opts, 0, sizeof(easyyaml_options));
+}
+
+
+/// Return the size of the parse frame needed for each level of nesting,
+/// for sizing a caller supplied frame buffer.
+
+size_t easyyaml_frame_size (void)
+{
+  return sizeof(easyyaml_frame);
+}
+
+
 /// Open and parse the YAML file.
 
 int easyyaml_parse_file (const char * filename, easyyaml_schema * ys, void * cfg)
 {
-  FILE * fh = fopen(filename, "r");
-  if (fh == NULL)
+  return easyyaml_parse_file_opts(filename, ys, cfg, NULL);
+}
+
+
+/// Open and parse the YAML file, with options.
+
+int easyyaml_parse_file_opts (const char * filename, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
     return error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
 
+  int parse_retval = easyyaml_parse_fd_opts(fd, ys, cfg, opts);
+
+  close(fd);
+
+  return parse_retval;
+}
+
+
+/// Parse YAML read from a file descriptor (until end of file).
+
+int easyyaml_parse_fd (int fd, easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_parse_fd_opts(fd, ys, cfg, NULL);
+}
+
+
+/// Parse YAML read from a file descriptor (until end of file), with options.
+
+int easyyaml_parse_fd_opts (int fd, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  return easyyaml_parse_reader_opts(&fd_read, &fd, ys, cfg, opts);
+}
+
+
+/// Parse YAML read by \p read_fn, which is called with \p user, a buffer
+/// and the buffer size, and must return the number of bytes read, zero at
+/// the end of the input or less than zero on error.
+
+int easyyaml_parse_reader (long (*read_fn)(void *, char *, size_t), void * user, easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_parse_reader_opts(read_fn, user, ys, cfg, NULL);
+}
+
+
+/// Parse YAML read by \p read_fn, with options.
+
+int easyyaml_parse_reader_opts (long (*read_fn)(void *, char *, size_t), void * user, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_input input;
+  memset(&input, 0, sizeof(easyyaml_input));
+  input.read_fn    = read_fn;
+  input.user       = user;
+  input.buf_size   = opts == NULL || opts->read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : opts->read_buffer_size;
+  input.decompress = opts == NULL ? EASYYAML_DECOMPRESS_NONE : opts->decompress;
+
+  input.buf = (char *) malloc(input.buf_size);
+  if (input.buf == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &input.buf_size, "out of memory", "out of memory allocating read buffer");
+
   yaml_parser_t parser;
   int par_init_retval = yaml_parser_initialize(&parser);
   if (par_init_retval == 0) {
-    fclose(fh);
+    free(input.buf);
     return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
                          "yaml_parser_initialize() returned error",
                          "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
   }
-  yaml_parser_set_input_file(&parser, fh);
+  yaml_parser_set_input(&parser, &input_read, &input);
 
-  int parse_retval = parse(&parser, ys, cfg);
+  int parse_retval = parse(&parser, &input, ys, cfg, opts);
 
   yaml_parser_delete(&parser);
-  fclose(fh);
+  input_free(&input);
 
   return parse_retval;
 }
@@ -81,6 +1184,14 @@ int easyyaml_parse_file (const char * filename, easyyaml_schema * ys, void * cfg
 /// Parse the zero byte terminated YAML string.
 
 int easyyaml_parse_string (const char * input_string, easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_parse_string_opts(input_string, ys, cfg, NULL);
+}
+
+
+/// Parse the zero byte terminated YAML string, with options.
+
+int easyyaml_parse_string_opts (const char * input_string, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
 {
   yaml_parser_t parser;
   int par_init_retval = yaml_parser_initialize(&parser);
@@ -90,7 +1201,7 @@ int easyyaml_parse_string (const char * input_string, easyyaml_schema * ys, void
                          "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
   yaml_parser_set_input_string(&parser, (const unsigned char *) input_string, strlen(input_string));
 
-  int retval = parse(&parser, ys, cfg);
+  int retval = parse(&parser, NULL, ys, cfg, opts);
 
   yaml_parser_delete(&parser);
 
@@ -98,417 +1209,7968 @@ int easyyaml_parse_string (const char * input_string, easyyaml_schema * ys, void
 }
 
 
-/// Parse the YAML. Called from \ref easyyaml_parse_file or
-/// \ref easyyaml_parse_string to complete the parsing of the source.
+/// Parse JSON, of \p len bytes at \p buf (which need not be terminated),
+/// against the same schema as the equivalent YAML.
 
-int parse (yaml_parser_t * parser, easyyaml_schema * ys, void * cfg)
+int easyyaml_parse_json (const char * buf, size_t len, easyyaml_schema * ys, void * cfg)
 {
-  yaml_token_t token;
-  int scan_tok_retval;
+  return easyyaml_parse_json_opts(buf, len, ys, cfg, NULL);
+}
 
-  if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
-    return scan_tok_retval;
 
-  if (token.type != YAML_STREAM_START_TOKEN) {
-    int data[2] = {token.type, YAML_STREAM_START_TOKEN};
-    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                               "unexpected token at parse start",
-                               "expected libyaml stream start after open but read %s",
-                               tok_to_str(token.type));
-    yaml_token_delete(&token);
+/// Parse JSON, with options.
+
+int easyyaml_parse_json_opts (const char * buf, size_t len, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_json json;
+  memset(&json, 0, sizeof(json));
+  json.buf = (const unsigned char *) buf;
+  json.len = len;
+
+  easyyaml_engine engine;
+  engine_init(&engine, NULL, NULL, ys, cfg, opts);
+  engine.ctx.json = &json;
+
+  int retval = engine_run(&engine);
+
+  // The parse is complete at the end of the root object, so check there
+  // is nothing after it.
+  if (retval == EASYYAML_SUCCESS) {
+    json_skip_ws(&json);
+    if (json.pos < json.len) {
+      json_error(&json, "the end of the input");
+      retval = error_handler(EASYYAML_ERROR_JSON, &json, "invalid JSON", "%s", json.errmsg);
+    }
+  }
+
+  engine_free(&engine);
+  free(json.stack);
+
+  return retval;
+}
+
+
+/// Parse MessagePack, of \p len bytes at \p buf, against the same schema
+/// as the equivalent YAML (see \ref easyyaml_yaml_to_msgpack).
+
+int easyyaml_parse_msgpack (const char * buf, size_t len, easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_parse_msgpack_opts(buf, len, ys, cfg, NULL);
+}
+
+
+/// Parse MessagePack, with options.
+
+int easyyaml_parse_msgpack_opts (const char * buf, size_t len, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_msgpack mp;
+  memset(&mp, 0, sizeof(mp));
+  mp.buf = (const unsigned char *) buf;
+  mp.len = len;
+
+  easyyaml_engine engine;
+  engine_init(&engine, NULL, NULL, ys, cfg, opts);
+  engine.ctx.msgpack = &mp;
+
+  int retval = engine_run(&engine);
+
+  if (retval == EASYYAML_SUCCESS && mp.pos < mp.len) {
+    msgpack_error(&mp, "the end of the input");
+    retval = error_handler(EASYYAML_ERROR_MSGPACK, &mp, "invalid MessagePack", "%s", mp.errmsg);
+  }
+
+  engine_free(&engine);
+  free(mp.stack);
+
+  return retval;
+}
+
+
+/// Convert the zero byte terminated YAML string to MessagePack, for
+/// \ref easyyaml_parse_msgpack, setting \p out to the encoding (which the
+/// caller must free) and \p out_len to its length. Aliases are expanded,
+/// plain integers and booleans are encoded as such, and empty values as
+/// nil; any other scalar is a string.
+
+int easyyaml_yaml_to_msgpack (const char * input_string, char ** out, size_t * out_len)
+{
+  *out     = NULL;
+  *out_len = 0;
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0)
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  yaml_parser_set_input_string(&parser, (const unsigned char *) input_string, strlen(input_string));
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+
+  easyyaml_msgpack_out mp;
+  memset(&mp, 0, sizeof(mp));
 
+  int retval = msgpack_convert(&ctx, &mp);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+  free(mp.levels);
+  free(mp.headers);
+
+  if (retval != EASYYAML_SUCCESS) {
+    free(mp.buf);
     return retval;
   }
-  yaml_token_delete(&token);
 
-  if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
-    return scan_tok_retval;
+  *out     = (char *) mp.buf;
+  *out_len = mp.len;
 
-  if (token.type == YAML_STREAM_END_TOKEN) {
-    yaml_token_delete(&token);
+  return EASYYAML_SUCCESS;
+}
 
-    return EASYYAML_SUCCESS;
-  } else if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
-    yaml_token_delete(&token);
 
-    easyyaml_stack stack;
-    stack.key  = NULL;
-    stack.prev = NULL;
+/// Emit block style YAML, for the data \p cfg described by schema \p ys,
+/// into a buffer, setting \p out to it (zero byte terminated, and which
+/// the caller must free) and \p out_len to its length. The values are
+/// fetched by calling \p getter for each schema entry, as described in
+/// the README.
 
-    return rec_parse_obj(parser, ys, &stack, cfg);
-  } else {
-    int data[2] = {token.type, YAML_BLOCK_MAPPING_START_TOKEN};
-    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                               "unexpected token at parse start",
-                               "expected libyaml block mapping start after stream start but read %s",
-                               tok_to_str(token.type));
-    yaml_token_delete(&token);
+int easyyaml_emit_string (easyyaml_schema * ys, void * cfg, int (*getter)(easyyaml_stack *, const easyyaml_schema *, size_t, easyyaml_emit_value *, void *), char ** out, size_t * out_len)
+{
+  easyyaml_emitter em;
+  memset(&em, 0, sizeof(em));
+  em.fd     = -1;
+  em.getter = getter;
+
+  easyyaml_stack stack;
+  stack.key  = NULL;
+  stack.prev = NULL;
+  stack.id   = EASYYAML_NOID;
+  stack.hash = EASYYAML_PATH_HASH_ROOT;
+
+  int retval = emit_map(&em, ys, &stack, 0, cfg);
+  if (retval == EASYYAML_SUCCESS && (retval = emit_put(&em, "", 1)) == EASYYAML_SUCCESS)
+    em.len--;
+
+  free(em.headers);
+
+  if (retval != EASYYAML_SUCCESS) {
+    free(em.buf);
+    *out     = NULL;
+    *out_len = 0;
+
+    return retval;
+  }
+
+  *out     = em.buf;
+  *out_len = em.len;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Emit block style YAML to the file descriptor \p fd, which is written
+/// in large blocks.
+
+int easyyaml_emit_fd (int fd, easyyaml_schema * ys, void * cfg, int (*getter)(easyyaml_stack *, const easyyaml_schema *, size_t, easyyaml_emit_value *, void *))
+{
+  easyyaml_emitter em;
+  memset(&em, 0, sizeof(em));
+  em.fd     = fd;
+  em.getter = getter;
+  em.size   = DEFAULT_WRITE_BUFFER_LEN;
+
+  em.buf = (char *) malloc(em.size);
+  if (em.buf == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &em.size, "out of memory", "out of memory allocating write buffer");
+
+  easyyaml_stack stack;
+  stack.key  = NULL;
+  stack.prev = NULL;
+  stack.id   = EASYYAML_NOID;
+  stack.hash = EASYYAML_PATH_HASH_ROOT;
+
+  int retval = emit_map(&em, ys, &stack, 0, cfg);
+  if (retval == EASYYAML_SUCCESS)
+    retval = emit_flush(&em);
+
+  free(em.headers);
+  free(em.buf);
+
+  return retval;
+}
+
+
+/// Parse the zero byte terminated YAML string into a document image,
+/// setting \p out to the image (which the caller must free) and \p out_len
+/// to its length. The image can be copied anywhere (four byte aligned),
+/// such as into shared memory, and used with \ref easyyaml_image_open_buf.
+
+int easyyaml_image_build (const char * input_string, char ** out, size_t * out_len)
+{
+  *out     = NULL;
+  *out_len = 0;
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0)
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  yaml_parser_set_input_string(&parser, (const unsigned char *) input_string, strlen(input_string));
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+
+  int retval = image_build(&ctx, out, out_len);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+
+  return retval;
+}
+
+
+/// Parse a YAML file into a document image written to \p image_filename,
+/// for \ref easyyaml_image_open. The image is written to a temporary file
+/// then renamed into place, so it is never seen half written. Of the
+/// options, only the read buffer size, decompression and input limit
+/// apply.
+
+int easyyaml_image_build_file (const char * filename, const char * image_filename, const easyyaml_options * opts)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
+
+  easyyaml_input input;
+  memset(&input, 0, sizeof(easyyaml_input));
+  input.read_fn    = &fd_read;
+  input.user       = &fd;
+  input.buf_size   = opts == NULL || opts->read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : opts->read_buffer_size;
+  input.decompress = opts == NULL ? EASYYAML_DECOMPRESS_NONE : opts->decompress;
+  input.max_bytes  = opts == NULL ? 0 : opts->max_input_bytes;
+
+  input.buf = (char *) malloc(input.buf_size);
+  if (input.buf == NULL) {
+    close(fd);
+    return error_handler(EASYYAML_ERROR_NOMEM, &input.buf_size, "out of memory", "out of memory allocating read buffer");
+  }
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0) {
+    free(input.buf);
+    close(fd);
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  }
+  yaml_parser_set_input(&parser, &input_read, &input);
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+  ctx.input  = &input;
 
+  char * buf;
+  size_t len;
+  int retval = image_build(&ctx, &buf, &len);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+  input_free(&input);
+  close(fd);
+
+  if (retval != EASYYAML_SUCCESS)
     return retval;
+
+  retval = image_write_file(image_filename, buf, len);
+  free(buf);
+
+  return retval;
+}
+
+
+/// Open a document image file written by \ref easyyaml_image_build_file,
+/// mapping it read only, so that every process opening it shares the one
+/// copy. Returns NULL on error.
+
+easyyaml_image * easyyaml_image_open (const char * image_filename)
+{
+  int fd = open(image_filename, O_RDONLY);
+  if (fd < 0) {
+    error_handler(EASYYAML_ERROR_FILEOPEN, image_filename, strerror(errno), "error opening document image (%s)", strerror(errno));
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    error_handler(EASYYAML_ERROR_READ, &errno, strerror(errno), "error reading document image (%s)", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  size_t len = (size_t) st.st_size;
+  if (len < IMAGE_HEADER_LEN) {
+    error_handler(EASYYAML_ERROR_IMAGE, &len, "invalid document image", "invalid document image (truncated)");
+    close(fd);
+    return NULL;
+  }
+
+#ifdef EASYYAML_WITH_MMAP
+  void * map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    error_handler(EASYYAML_ERROR_READ, &errno, strerror(errno), "error mapping document image (%s)", strerror(errno));
+    return NULL;
+  }
+
+  easyyaml_image * image = image_open((const unsigned char *) map, len, map);
+  if (image == NULL)
+    munmap(map, len);
+#else
+  // Without mmap, each process reads its own copy.
+  char * map = (char *) malloc(len);
+  if (map == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &len, "out of memory", "out of memory reading document image");
+    close(fd);
+    return NULL;
+  }
+
+  size_t pos = 0;
+  while (pos < len) {
+    long n = fd_read(&fd, map + pos, len - pos);
+    if (n <= 0) {
+      error_handler(EASYYAML_ERROR_READ, &errno, "read error", "error reading document image (%s)",
+                    n == 0 ? "unexpected end of file" : strerror(errno));
+      free(map);
+      close(fd);
+      return NULL;
+    }
+    pos += (size_t) n;
   }
+  close(fd);
+
+  easyyaml_image * image = image_open((const unsigned char *) map, len, map);
+  if (image == NULL)
+    free(map);
+#endif
+
+  return image;
 }
 
 
-/// Recursive parse of a YAML map.
+/// Use a document image made by \ref easyyaml_image_build which is already
+/// in memory (four byte aligned), such as shared memory set up before
+/// forking. The image is not copied, so must outlive its use, and is not
+/// freed by \ref easyyaml_image_close. Returns NULL on error.
 
-int rec_parse_obj (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg)
+easyyaml_image * easyyaml_image_open_buf (const void * buf, size_t len)
 {
-  while (1) {
-    yaml_token_t token;
-    int scan_tok_retval;
+  return image_open((const unsigned char *) buf, len, NULL);
+}
 
-    if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
-      return scan_tok_retval;
 
-    if (token.type == YAML_BLOCK_END_TOKEN) {
-      yaml_token_delete(&token);
+/// Close a document image.
 
-      return EASYYAML_SUCCESS;
-    } else if (ys->type == EASYYAML_SCHEMA_END) {
-      yaml_token_delete(&token);
+void easyyaml_image_close (easyyaml_image * image)
+{
+  if (image->map != NULL) {
+#ifdef EASYYAML_WITH_MMAP
+    munmap(image->map, image->len);
+#else
+    free(image->map);
+#endif
+  }
+  free(image);
+}
 
-      char * stack_path = easyyaml_stack_path(stack);
-      void * data[2] = {ys, stack_path};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_NOCHILDREN, data,
-                                 "schema allows no children",
-                                 "schema permits no children at %s", stack_path);
 
-      if (retval != EASYYAML_SUCCESS)
-        return retval;
-    } else if (token.type == YAML_KEY_TOKEN) {
-      yaml_token_delete(&token);
+/// Return the root node of a document image.
 
-      if (ys[1].type == EASYYAML_SCHEMA_END && ys[0].key == NULL) {
-        int retval = rec_parse_obj_varkeys (parser, ys, stack, cfg);
+size_t easyyaml_image_root (const easyyaml_image * image)
+{
+  return image->root;
+}
 
-        if (retval != EASYYAML_SUCCESS)
-          return retval;
-      } else {
-        int retval = rec_parse_obj_fixedkeys (parser, ys, stack, cfg);
 
-        if (retval != EASYYAML_SUCCESS)
-          return retval;
-      }
-    } else {
-      char * stack_path = easyyaml_stack_path(stack);
-      char * str_tok = tok_to_str(token.type);
-      void * data[3] = {ys, stack_path, str_tok};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, data,
-                                 "unexpected key",
-                                 "key %s unexpected while parsing map at %s",
-                                 str_tok, stack_path);
+/// Look up the node at \p path from \p node, where the path is map keys
+/// and list indexes separated by slashes, as in \ref easyyaml_stack_path,
+/// the leading slash being optional (so an empty path or "/" is \p node
+/// itself). Returns zero if there is no such node.
 
-      if (retval != EASYYAML_SUCCESS)
-        return retval;
+size_t easyyaml_image_lookup (const easyyaml_image * image, size_t node, const char * path)
+{
+  if (*path == '/')
+    path++;
+
+  while (node != 0 && *path != '\0') {
+    size_t len = strcspn(path, "/");
+    uint32_t type = IMAGE_U32(image->buf, node);
+
+    if (type == IMAGE_MAP) {
+      node = image_find(image, node, path, len);
+    } else if (type == IMAGE_LST && len > 0 && len <= 9 && strspn(path, "0123456789") >= len) {
+      size_t i = (size_t) strtoul(path, NULL, 10);
+      node = i < IMAGE_U32(image->buf, node + 4) ? IMAGE_U32(image->buf, node + 8 + 4 * i) : 0;
+    } else {
+      node = 0;
     }
+
+    path += len;
+    if (*path == '/')
+      path++;
   }
+
+  return node;
 }
 
 
-/// Recursive parse YAML map variable keys.
+/// Return the type of a node, \ref EASYYAML_SCHEMA_STR, \ref EASYYAML_SCHEMA_MAP
+/// or \ref EASYYAML_SCHEMA_LST, or \ref EASYYAML_SCHEMA_END if it is empty
+/// or zero.
 
-int rec_parse_obj_varkeys (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg)
+int easyyaml_image_type (const easyyaml_image * image, size_t node)
 {
-  yaml_token_t token;
-  int scan_tok_retval;
+  switch (node == 0 ? IMAGE_NULL : IMAGE_U32(image->buf, node)) {
+  case IMAGE_STR:
+    return EASYYAML_SCHEMA_STR;
+  case IMAGE_MAP:
+    return EASYYAML_SCHEMA_MAP;
+  case IMAGE_LST:
+    return EASYYAML_SCHEMA_LST;
+  default:
+    return EASYYAML_SCHEMA_END;
+  }
+}
+
+
+/// Return the (zero byte terminated) scalar of a node, setting \p len to
+/// its length unless NULL, or return NULL if the node is not a scalar.
+
+const char * easyyaml_image_str (const easyyaml_image * image, size_t node, size_t * len)
+{
+  if (node == 0 || IMAGE_U32(image->buf, node) != IMAGE_STR)
+    return NULL;
+
+  if (len != NULL)
+    *len = IMAGE_U32(image->buf, node + 4);
+
+  return (const char *) image->buf + node + 8;
+}
+
+
+/// Return the number of entries or items of a map or list node, or zero
+/// for any other node.
+
+size_t easyyaml_image_count (const easyyaml_image * image, size_t node)
+{
+  if (node == 0 || IMAGE_U32(image->buf, node) == IMAGE_STR)
+    return 0;
+
+  return IMAGE_U32(image->buf, node + 4);
+}
+
+
+/// Return the value of entry \p i of a map node (in key order), setting
+/// \p key to its key unless NULL, or item \p i of a list node, setting
+/// \p key to NULL. Returns zero if there is no such entry or item.
+
+size_t easyyaml_image_child (const easyyaml_image * image, size_t node, size_t i, const char ** key)
+{
+  if (key != NULL)
+    *key = NULL;
+  if (i >= easyyaml_image_count(image, node))
+    return 0;
+
+  if (IMAGE_U32(image->buf, node) == IMAGE_LST)
+    return IMAGE_U32(image->buf, node + 8 + 4 * i);
+
+  if (key != NULL)
+    *key = (const char *) image->buf + IMAGE_U32(image->buf, node + 8 + 8 * i) + 8;
+
+  return IMAGE_U32(image->buf, node + 12 + 8 * i);
+}
+
+
+/// Create a router, which parses any document calling the handlers of the
+/// path patterns added to it (by \ref easyyaml_router_add) for the scalar
+/// values at paths they match. Returns NULL on error.
+
+easyyaml_router * easyyaml_router_new (void)
+{
+  easyyaml_router * router = (easyyaml_router *) calloc(1, sizeof(easyyaml_router));
+  if (router == NULL) {
+    size_t size = sizeof(easyyaml_router);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating router");
+  }
+
+  return router;
+}
+
+
+/// Add a path pattern, such as "/users/*/access" or
+/// "/services/*/limits/**", whose \p handler is called for each scalar
+/// value at a path it matches. A "*" segment matches any one key, a "**"
+/// segment any number of keys (including none), and any other segment
+/// that key. The pattern is copied, and the router recompiled when it is
+/// next used.
+
+int easyyaml_router_add (easyyaml_router * router, const char * pattern, void (*handler)(easyyaml_stack *, char *, void *))
+{
+  if (pattern[0] != '/')
+    return error_handler(EASYYAML_ERROR_ROUTE, pattern, "invalid route pattern",
+                         "route pattern %s does not start with /", pattern);
+
+  size_t segs_count = 0;
+  if (pattern[1] != '\0') {
+    for (const char * p = pattern; *p != '\0'; p++) {
+      if (*p == '/' && (p[1] == '/' || p[1] == '\0'))
+        return error_handler(EASYYAML_ERROR_ROUTE, pattern, "invalid route pattern",
+                             "route pattern %s has an empty segment", pattern);
+      segs_count += *p == '/';
+    }
+  }
+
+  if (router->routes_count == router->routes_size
+      && router_grow((void **) &router->routes, &router->routes_size, router->routes_count + 1, sizeof(easyyaml_route)) != EASYYAML_SUCCESS)
+    return EASYYAML_ERROR_NOMEM;
+
+  // The segments are copied into the block after the pointers to them.
+  size_t len = strlen(pattern);
+  char ** segs = (char **) malloc(segs_count * sizeof(char *) + len + 1);
+  if (segs == NULL) {
+    size_t size = segs_count * sizeof(char *) + len + 1;
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory adding route");
+  }
+  char * copy = (char *) (segs + segs_count);
+  memcpy(copy, pattern, len + 1);
+  for (size_t i = 0; i < segs_count; i++) {
+    *copy++ = '\0';
+    segs[i] = copy;
+    copy += strcspn(copy, "/");
+  }
+
+  easyyaml_route * route = &router->routes[router->routes_count++];
+  route->segs       = segs;
+  route->segs_count = segs_count;
+  route->first      = 0;
+  route->handler    = handler;
+  router->compiled  = 0;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Compile the patterns added to a router into a DFA over keys, so that
+/// finding the handlers for a value costs a lookup per key of its path,
+/// however many patterns there are. Done by the router's parse functions
+/// if the patterns have changed since.
+
+int easyyaml_router_compile (easyyaml_router * router)
+{
+  router_reset(router);
+
+  router->positions = 0;
+  for (size_t r = 0; r < router->routes_count; r++) {
+    router->routes[r].first = router->positions;
+    router->positions += router->routes[r].segs_count + 1;
+  }
+
+  size_t positions = router->positions == 0 ? 1 : router->positions;
+  router->pos_route = (size_t *) malloc(positions * sizeof(size_t));
+  router->pos_kind  = (unsigned char *) malloc(positions);
+  router->marks     = (unsigned char *) calloc(positions, 1);
+  router->scratch   = (size_t *) malloc(positions * sizeof(size_t));
+  if (router->pos_route == NULL || router->pos_kind == NULL || router->marks == NULL || router->scratch == NULL) {
+    router_reset(router);
+    return error_handler(EASYYAML_ERROR_NOMEM, &positions, "out of memory", "out of memory compiling router");
+  }
+
+  for (size_t r = 0; r < router->routes_count; r++) {
+    easyyaml_route * route = &router->routes[r];
+
+    for (size_t i = 0; i <= route->segs_count; i++) {
+      unsigned char kind = ROUTE_SEG_END;
+      if (i < route->segs_count)
+        kind = strcmp(route->segs[i], "**") == 0 ? ROUTE_SEG_DEEP : strcmp(route->segs[i], "*") == 0 ? ROUTE_SEG_ANY : ROUTE_SEG_KEY;
+      router->pos_route[route->first + i] = r;
+      router->pos_kind[route->first + i]  = kind;
+    }
+  }
+
+  // The empty set first, so that it is state 0, then the root's.
+  size_t state;
+  router->scratch_count = 0;
+  int retval = route_state(router, &state);
+  if (retval == EASYYAML_SUCCESS) {
+    for (size_t r = 0; r < router->routes_count; r++)
+      route_mark(router, router->routes[r].first);
+    route_close(router);
+    retval = route_state(router, &router->root);
+  }
+
+  // Expanding a state may add more, which are expanded in turn.
+  for (size_t s = 0; retval == EASYYAML_SUCCESS && s < router->states_count; s++)
+    retval = route_expand(router, s);
+
+  if (retval != EASYYAML_SUCCESS) {
+    router_reset(router);
+    return retval;
+  }
+  router->compiled = 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Return the number of states a router's patterns compiled into (zero if
+/// they are not compiled).
+
+size_t easyyaml_router_states (const easyyaml_router * router)
+{
+  return router->compiled ? router->states_count : 0;
+}
+
+
+/// Parse the zero byte terminated YAML string, calling the handlers of a
+/// router's patterns for the scalar values at the paths they match, each
+/// being passed the \p cfg.
+
+int easyyaml_router_parse_string (easyyaml_router * router, const char * input_string, void * cfg)
+{
+  if (!router->compiled) {
+    int retval = easyyaml_router_compile(router);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0)
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  yaml_parser_set_input_string(&parser, (const unsigned char *) input_string, strlen(input_string));
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+
+  int retval = route_walk(router, &ctx, cfg);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+
+  return retval;
+}
+
+
+/// Parse a YAML file with a router, as \ref easyyaml_router_parse_string.
+
+int easyyaml_router_parse_file (easyyaml_router * router, const char * filename, void * cfg)
+{
+  if (!router->compiled) {
+    int retval = easyyaml_router_compile(router);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
+
+  easyyaml_input input;
+  memset(&input, 0, sizeof(easyyaml_input));
+  input.read_fn  = &fd_read;
+  input.user     = &fd;
+  input.buf_size = DEFAULT_READ_BUFFER_LEN;
+
+  input.buf = (char *) malloc(input.buf_size);
+  if (input.buf == NULL) {
+    close(fd);
+    return error_handler(EASYYAML_ERROR_NOMEM, &input.buf_size, "out of memory", "out of memory allocating read buffer");
+  }
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0) {
+    free(input.buf);
+    close(fd);
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  }
+  yaml_parser_set_input(&parser, &input_read, &input);
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+  ctx.input  = &input;
+
+  int retval = route_walk(router, &ctx, cfg);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+  input_free(&input);
+  close(fd);
+
+  return retval;
+}
+
+
+/// Free a router and its patterns.
+
+void easyyaml_router_free (easyyaml_router * router)
+{
+  if (router == NULL)
+    return;
+
+  router_reset(router);
+  for (size_t r = 0; r < router->routes_count; r++)
+    free(router->routes[r].segs);
+  free(router->routes);
+  free(router);
+}
+
+
+/// Create a push parser, which parses YAML fed to it a chunk at a time
+/// by \ref easyyaml_push_feed, making callbacks as values are complete.
+/// Returns NULL on error.
+
+easyyaml_push * easyyaml_push_new (easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_push_new_opts(ys, cfg, NULL);
+}
+
+
+/// Create a push parser, with options.
+
+easyyaml_push * easyyaml_push_new_opts (easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+#ifdef EASYYAML_WITH_PUSH
+  easyyaml_push * push = (easyyaml_push *) calloc(1, sizeof(easyyaml_push));
+  if (push == NULL) {
+    size_t size = sizeof(easyyaml_push);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating push parser");
+    return NULL;
+  }
+
+  if (opts != NULL)
+    push->opts = *opts;
+  else
+    easyyaml_options_init(&push->opts);
+  push->ys  = ys;
+  push->cfg = cfg;
+
+  push->input.read_fn    = &push_read;
+  push->input.user       = push;
+  push->input.buf_size   = push->opts.read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : push->opts.read_buffer_size;
+  push->input.decompress = push->opts.decompress;
+
+  push->input.buf = (char *) malloc(push->input.buf_size);
+  if (push->input.buf == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &push->input.buf_size, "out of memory", "out of memory allocating read buffer");
+    push_free(push);
+    return NULL;
+  }
+
+  if (!coro_init(&push->coro, push->opts.push_stack_size, &push_main, push)) {
+    push_free(push);
+    return NULL;
+  }
+
+  int par_init_retval = yaml_parser_initialize(&push->parser);
+  if (par_init_retval == 0) {
+    error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                  "yaml_parser_initialize() returned error",
+                  "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+    push_free(push);
+    return NULL;
+  }
+  yaml_parser_set_input(&push->parser, &input_read, &push->input);
+
+  return push;
+#else
+  int dummy = 0;
+  error_handler(EASYYAML_ERROR_PUSH_UNSUPPORTED, &dummy, "not supported", "push parsing is not supported by this build");
+  return NULL;
+#endif
+}
+
+
+/// Feed the next chunk of input to a push parser, making any callbacks
+/// for values it completes. The chunk is consumed entirely before this
+/// returns, so need not be retained. Returns \ref EASYYAML_SUCCESS unless
+/// the parse has failed, in which case the error is returned (by this and
+/// all subsequent calls).
+
+int easyyaml_push_feed (easyyaml_push * push, const char * chunk, size_t len)
+{
+#ifdef EASYYAML_WITH_PUSH
+  if (push->coro.done || len == 0)
+    return push->retval;
+
+  push->chunk     = chunk;
+  push->chunk_len = len;
+
+  coro_resume(&push->coro);
+
+  push->chunk     = NULL;
+  push->chunk_len = 0;
+
+  return push->retval;
+#else
+  return EASYYAML_ERROR_PUSH_UNSUPPORTED;
+#endif
+}
+
+
+/// Signal the end of the input to a push parser, completing the parse,
+/// and free it. Returns the result of the parse.
+
+int easyyaml_push_finish (easyyaml_push * push)
+{
+#ifdef EASYYAML_WITH_PUSH
+  push->finished = 1;
+  if (!push->coro.done)
+    coro_resume(&push->coro);
+
+  int retval = push->retval;
+  push_free(push);
+
+  return retval;
+#else
+  return EASYYAML_ERROR_PUSH_UNSUPPORTED;
+#endif
+}
+
+
+/// Create a stepped parse of the zero byte terminated YAML string (which
+/// is copied), run a budget at a time by \ref easyyaml_step. Returns NULL
+/// on error.
+
+easyyaml_stepper * easyyaml_stepper_new_string (const char * input_string, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_stepper * stepper = stepper_new(opts);
+  if (stepper == NULL)
+    return NULL;
+
+  size_t len = strlen(input_string);
+  if ((stepper->input_string = strdup(input_string)) == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &len, "out of memory", "out of memory copying input");
+    easyyaml_stepper_free(stepper);
+    return NULL;
+  }
+  yaml_parser_set_input_string(&stepper->parser, (const unsigned char *) stepper->input_string, len);
+
+  engine_init(&stepper->engine, &stepper->parser, NULL, ys, cfg, &stepper->opts);
+
+  return stepper;
+}
+
+
+/// Create a stepped parse of the YAML file, run a budget at a time by
+/// \ref easyyaml_step. Returns NULL on error.
+
+easyyaml_stepper * easyyaml_stepper_new_file (const char * filename, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
+    return NULL;
+  }
+
+  easyyaml_stepper * stepper = stepper_new(opts);
+  if (stepper == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  stepper->input.read_fn    = &fd_read;
+  stepper->input.fd         = fd;
+  stepper->input.user       = &stepper->input.fd;
+  stepper->input.buf_size   = stepper->opts.read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : stepper->opts.read_buffer_size;
+  stepper->input.decompress = stepper->opts.decompress;
+  stepper->has_input        = 1;
+
+  if ((stepper->input.buf = (char *) malloc(stepper->input.buf_size)) == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &stepper->input.buf_size, "out of memory", "out of memory allocating read buffer");
+    easyyaml_stepper_free(stepper);
+    return NULL;
+  }
+  yaml_parser_set_input(&stepper->parser, &input_read, &stepper->input);
+
+  engine_init(&stepper->engine, &stepper->parser, &stepper->input, ys, cfg, &stepper->opts);
+
+  return stepper;
+}
+
+
+/// Run a stepped parse until it completes or the budget is spent, which
+/// is \p max_tokens tokens and/or \p max_ns nanoseconds (either may be zero
+/// for no limit). At least one map or list entry is parsed per step, even
+/// if that overruns the budget. Returns \ref EASYYAML_MORE_PENDING if the
+/// budget was spent first, otherwise the result of the parse (as do all
+/// subsequent calls).
+
+int easyyaml_step (easyyaml_stepper * stepper, size_t max_tokens, uint64_t max_ns)
+{
+  easyyaml_ctx * ctx = &stepper->engine.ctx;
+
+  ctx->token_budget = max_tokens != 0;
+  ctx->tokens_left  = max_tokens;
+  ctx->deadline_ns  = max_ns == 0 ? 0 : now_ns() + max_ns;
+
+  return engine_run(&stepper->engine);
+}
+
+
+/// Free a stepped parse, whether or not it has completed.
+
+void easyyaml_stepper_free (easyyaml_stepper * stepper)
+{
+  engine_free(&stepper->engine);
+  yaml_parser_delete(&stepper->parser);
+  if (stepper->has_input) {
+    close(stepper->input.fd);
+    input_free(&stepper->input);
+  }
+  free(stepper->input_string);
+  free(stepper);
+}
+
+
+/// Create a reusable parser of documents against the schema, with options
+/// (which may be NULL, and are copied). Parsing with it saves setting up
+/// and tearing down a libyaml parser (and its buffers) per document. A
+/// parser may only be used by one thread at a time, see
+/// \ref easyyaml_parser_pool_new for one per thread. Returns NULL on error.
+
+easyyaml_parser * easyyaml_parser_new (easyyaml_schema * ys, const easyyaml_options * opts)
+{
+  easyyaml_parser * parser = (easyyaml_parser *) calloc(1, sizeof(easyyaml_parser));
+  if (parser == NULL) {
+    size_t size = sizeof(easyyaml_parser);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating parser");
+    return NULL;
+  }
+
+  if (opts != NULL)
+    parser->opts = *opts;
+  else
+    easyyaml_options_init(&parser->opts);
+  parser->ys = ys;
+
+  if (schema_compile(ys) != EASYYAML_SUCCESS) {
+    free(parser);
+    return NULL;
+  }
+
+  int par_init_retval = yaml_parser_initialize(&parser->parser);
+  if (par_init_retval == 0) {
+    error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                  "yaml_parser_initialize() returned error",
+                  "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+    free(parser);
+    return NULL;
+  }
+
+#ifdef EASYYAML_WITH_REWIND
+  int major;
+  int minor;
+  int patch;
+  yaml_get_version(&major, &minor, &patch);
+  parser->rewind = major == 0 && minor == 2 && patch >= 1;
+#endif
+
+  return parser;
+}
+
+
+/// Parse the YAML document of \p len bytes at \p buf (which need not be
+/// terminated) with a reusable parser.
+
+int easyyaml_parser_parse (easyyaml_parser * parser, const char * buf, size_t len, void * cfg)
+{
+  if (parser->used) {
+#ifdef EASYYAML_WITH_REWIND
+    if (parser->rewind)
+      parser_rewind(&parser->parser);
+    else
+#endif
+    {
+      yaml_parser_delete(&parser->parser);
+      int par_init_retval = yaml_parser_initialize(&parser->parser);
+      if (par_init_retval == 0) {
+        // Left empty, for the next parse to initialise again (or
+        // easyyaml_parser_free).
+        memset(&parser->parser, 0, sizeof(yaml_parser_t));
+        return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                             "yaml_parser_initialize() returned error",
+                             "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+      }
+    }
+  }
+  parser->used = 1;
+  yaml_parser_set_input_string(&parser->parser, (const unsigned char *) buf, len);
+
+  // The schema was compiled when the parser was created.
+  easyyaml_engine * engine = &parser->engine;
+  engine_init(engine, &parser->parser, NULL, parser->ys, cfg, &parser->opts);
+  engine->symtab      = parser->symtab;
+  engine->keep_symtab = 1;
+  engine->compiled    = 1;
+
+  int retval = engine_run(engine);
+
+  engine_free(engine);
+  parser->symtab = engine->symtab;
+
+  return retval;
+}
+
+
+/// Free a reusable parser (not one from a pool, which are freed with it).
+
+void easyyaml_parser_free (easyyaml_parser * parser)
+{
+  symtab_free(&parser->symtab);
+  yaml_parser_delete(&parser->parser);
+  free(parser);
+}
+
+
+/// Create a pool of reusable parsers against the schema, with options
+/// (which may be NULL, and are copied), one per thread, created on its
+/// first \ref easyyaml_parser_pool_get and freed when the thread exits (or
+/// with the pool). Returns NULL on error.
+
+easyyaml_parser_pool * easyyaml_parser_pool_new (easyyaml_schema * ys, const easyyaml_options * opts)
+{
+  easyyaml_parser_pool * pool = (easyyaml_parser_pool *) calloc(1, sizeof(easyyaml_parser_pool));
+  if (pool == NULL) {
+    size_t size = sizeof(easyyaml_parser_pool);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating parser pool");
+    return NULL;
+  }
+
+  if (opts != NULL)
+    pool->opts = *opts;
+  else
+    easyyaml_options_init(&pool->opts);
+  pool->ys = ys;
+
+  if (schema_compile(ys) != EASYYAML_SUCCESS) {
+    free(pool);
+    return NULL;
+  }
+
+#ifdef EASYYAML_WITH_THREADS
+  int err = pthread_key_create(&pool->key, &parser_pool_release);
+  if (err != 0) {
+    error_handler(EASYYAML_ERROR_NOMEM, &err, "out of memory", "could not create parser pool key (%s)", strerror(err));
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+  return pool;
+}
+
+
+/// The calling thread's parser from a pool, created if it has none. Returns
+/// NULL on error.
+
+easyyaml_parser * easyyaml_parser_pool_get (easyyaml_parser_pool * pool)
+{
+#ifdef EASYYAML_WITH_THREADS
+  easyyaml_parser * parser = (easyyaml_parser *) pthread_getspecific(pool->key);
+#else
+  easyyaml_parser * parser = pool->parsers;
+#endif
+  if (parser != NULL)
+    return parser;
+
+  if ((parser = easyyaml_parser_new(pool->ys, &pool->opts)) == NULL)
+    return NULL;
+  parser->pool = pool;
+
+#ifdef EASYYAML_WITH_THREADS
+  int err = pthread_setspecific(pool->key, parser);
+  if (err != 0) {
+    error_handler(EASYYAML_ERROR_NOMEM, &err, "out of memory", "could not set thread's parser (%s)", strerror(err));
+    easyyaml_parser_free(parser);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+#endif
+  parser->next = pool->parsers;
+  if (pool->parsers != NULL)
+    pool->parsers->prev = parser;
+  pool->parsers = parser;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&pool->lock);
+#endif
+
+  return parser;
+}
+
+
+/// Free a pool and all its parsers. No thread may be using the pool, or
+/// exiting, at the time.
+
+void easyyaml_parser_pool_free (easyyaml_parser_pool * pool)
+{
+#ifdef EASYYAML_WITH_THREADS
+  pthread_key_delete(pool->key);
+  pthread_mutex_destroy(&pool->lock);
+#endif
+
+  while (pool->parsers != NULL) {
+    easyyaml_parser * parser = pool->parsers;
+    pool->parsers = parser->next;
+    easyyaml_parser_free(parser);
+  }
+  free(pool);
+}
+
+
+/// Create a cursor over the zero byte terminated YAML string (which is
+/// copied), its events read one at a time by \ref easyyaml_next, and if
+/// \p ys is not NULL, validated against the schema (whose handlers are not
+/// called). Returns NULL on error.
+
+easyyaml_cursor * easyyaml_cursor_new_string (const char * input_string, easyyaml_schema * ys, const easyyaml_options * opts)
+{
+  easyyaml_cursor * cursor = cursor_new(opts);
+  if (cursor == NULL)
+    return NULL;
+
+  size_t len = strlen(input_string);
+  if ((cursor->input_string = strdup(input_string)) == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &len, "out of memory", "out of memory copying input");
+    easyyaml_cursor_free(cursor);
+    return NULL;
+  }
+  yaml_parser_set_input_string(&cursor->parser, (const unsigned char *) cursor->input_string, len);
+
+  engine_init(&cursor->engine, &cursor->parser, NULL, ys, NULL, &cursor->opts);
+
+  return cursor;
+}
+
+
+/// Create a cursor over the YAML file, as \ref easyyaml_cursor_new_string.
+/// Returns NULL on error.
+
+easyyaml_cursor * easyyaml_cursor_new_file (const char * filename, easyyaml_schema * ys, const easyyaml_options * opts)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
+    return NULL;
+  }
+
+  easyyaml_cursor * cursor = cursor_new(opts);
+  if (cursor == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  cursor->input.read_fn    = &fd_read;
+  cursor->input.fd         = fd;
+  cursor->input.user       = &cursor->input.fd;
+  cursor->input.buf_size   = cursor->opts.read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : cursor->opts.read_buffer_size;
+  cursor->input.decompress = cursor->opts.decompress;
+  cursor->has_input        = 1;
+
+  if ((cursor->input.buf = (char *) malloc(cursor->input.buf_size)) == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, &cursor->input.buf_size, "out of memory", "out of memory allocating read buffer");
+    easyyaml_cursor_free(cursor);
+    return NULL;
+  }
+  yaml_parser_set_input(&cursor->parser, &input_read, &cursor->input);
+
+  engine_init(&cursor->engine, &cursor->parser, &cursor->input, ys, NULL, &cursor->opts);
+
+  return cursor;
+}
+
+
+/// Read the next event of a cursor into \p ev: the start or end of a map
+/// or list, or a scalar, with its key (if an entry of a map), its path and
+/// depth (the number of maps and lists it is in), and if validated, its
+/// schema entry and for an integer or enum, its value. The key, scalar and
+/// path are valid until the next call. After the end of the root map, the
+/// event is \ref EASYYAML_EVENT_END. Returns the result of the parse once
+/// it has failed or ended (as do all subsequent calls), which in collect
+/// mode is the first error collected.
+
+int easyyaml_next (easyyaml_cursor * cursor, easyyaml_event * ev)
+{
+  easyyaml_engine * engine = &cursor->engine;
+  int retval = EASYYAML_SUCCESS;
+
+  memset(ev, 0, sizeof(easyyaml_event));
+  if (engine->done)
+    return engine->retval;
+
+  sink_release(engine);
+
+  // Step the engine until it passes an event to the sink (none has the
+  // type of the end), or the root map has ended.
+  engine->ev = ev;
+  while (retval == EASYYAML_SUCCESS && ev->type == EASYYAML_EVENT_END && (!engine->started || engine->depth > 0))
+    retval = engine_step(engine);
+  engine->ev = NULL;
+
+  if (retval == EASYYAML_SUCCESS && ev->type != EASYYAML_EVENT_END)
+    return EASYYAML_SUCCESS;
+
+  return engine_finish(engine, retval);
+}
+
+
+/// Free a cursor, whether or not it has reached the end.
+
+void easyyaml_cursor_free (easyyaml_cursor * cursor)
+{
+  engine_free(&cursor->engine);
+  yaml_parser_delete(&cursor->parser);
+  if (cursor->has_input) {
+    close(cursor->input.fd);
+    input_free(&cursor->input);
+  }
+  free(cursor->input_string);
+  free(cursor);
+}
+
+
+/// Create a config holder, holding the current version of a config
+/// structure of \p cfg_size bytes, each version parsed into a fresh zeroed
+/// structure by \ref easyyaml_holder_load_file (etc), and published to
+/// readers without them ever blocking. Anything the handlers allocate in a
+/// version should be freed by \p cfg_free (if not NULL), which is called
+/// before the version itself is freed. Returns NULL on error.
+
+easyyaml_holder * easyyaml_holder_new (size_t cfg_size, void (*cfg_free)(void *))
+{
+#ifdef EASYYAML_WITH_HOLDER
+  easyyaml_holder * holder = (easyyaml_holder *) calloc(1, sizeof(easyyaml_holder));
+  if (holder == NULL) {
+    size_t size = sizeof(easyyaml_holder);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating holder");
+    return NULL;
+  }
+
+  atomic_init(&holder->current, NULL);
+  atomic_init(&holder->epoch, 1);
+  pthread_mutex_init(&holder->lock, NULL);
+  holder->cfg_size = cfg_size == 0 ? 1 : cfg_size;
+  holder->cfg_free = cfg_free;
+
+  return holder;
+#else
+  int dummy = 0;
+  error_handler(EASYYAML_ERROR_HOLDER_UNSUPPORTED, &dummy, "not supported", "config holders are not supported by this build");
+  return NULL;
+#endif
+}
+
+
+/// Parse the YAML file into a new version of the holder's config, and if
+/// it parses, publish it, replacing the current version (which is freed
+/// once no reader can be using it). If not, the current version is kept.
+
+int easyyaml_holder_load_file (easyyaml_holder * holder, const char * filename, easyyaml_schema * ys, const easyyaml_options * opts)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  void * cfg = calloc(1, holder->cfg_size);
+  if (cfg == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &holder->cfg_size, "out of memory", "out of memory allocating config");
+
+  return holder_publish(holder, cfg, easyyaml_parse_file_opts(filename, ys, cfg, opts));
+#else
+  return EASYYAML_ERROR_HOLDER_UNSUPPORTED;
+#endif
+}
+
+
+/// Parse the zero byte terminated YAML string into a new version of the
+/// holder's config, as for \ref easyyaml_holder_load_file.
+
+int easyyaml_holder_load_string (easyyaml_holder * holder, const char * input_string, easyyaml_schema * ys, const easyyaml_options * opts)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  void * cfg = calloc(1, holder->cfg_size);
+  if (cfg == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &holder->cfg_size, "out of memory", "out of memory allocating config");
+
+  return holder_publish(holder, cfg, easyyaml_parse_string_opts(input_string, ys, cfg, opts));
+#else
+  return EASYYAML_ERROR_HOLDER_UNSUPPORTED;
+#endif
+}
+
+
+/// Free any replaced versions which no reader can still be using (which
+/// is also done by each load), returning the number still held back.
+
+size_t easyyaml_holder_reclaim (easyyaml_holder * holder)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  pthread_mutex_lock(&holder->lock);
+  size_t held = holder_reclaim(holder);
+  pthread_mutex_unlock(&holder->lock);
+
+  return held;
+#else
+  return 0;
+#endif
+}
+
+
+/// Free the holder, its readers and all versions of its config. There
+/// must be no readers in a read section.
+
+void easyyaml_holder_free (easyyaml_holder * holder)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  while (holder->retired != NULL) {
+    easyyaml_version * version = holder->retired;
+    holder->retired = version->next;
+    holder_cfg_free(holder, version->cfg);
+    free(version);
+  }
+  holder_cfg_free(holder, atomic_load(&holder->current));
+
+  while (holder->readers != NULL) {
+    easyyaml_holder_reader * reader = holder->readers;
+    holder->readers = reader->next;
+    free(reader);
+  }
+
+  pthread_mutex_destroy(&holder->lock);
+  free(holder);
+#endif
+}
+
+
+/// Register a reader of the holder, for one thread at a time to use (one
+/// per reading thread, typically). Returns NULL on error.
+
+easyyaml_holder_reader * easyyaml_holder_reader_new (easyyaml_holder * holder)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  easyyaml_holder_reader * reader;
+
+  pthread_mutex_lock(&holder->lock);
+
+  for (reader = holder->readers; reader != NULL; reader = reader->next)
+    if (atomic_load(&reader->in_use) == 0)
+      break;
+
+  if (reader == NULL) {
+    reader = (easyyaml_holder_reader *) malloc(sizeof(easyyaml_holder_reader));
+    if (reader != NULL) {
+      reader->holder = holder;
+      atomic_init(&reader->epoch, 0);
+      reader->next    = holder->readers;
+      holder->readers = reader;
+    }
+  }
+  if (reader != NULL)
+    atomic_store(&reader->in_use, 1);
+
+  pthread_mutex_unlock(&holder->lock);
+
+  if (reader == NULL) {
+    size_t size = sizeof(easyyaml_holder_reader);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating holder reader");
+  }
+
+  return reader;
+#else
+  return NULL;
+#endif
+}
+
+
+/// Enter a read section, returning the current version of the config (or
+/// NULL if none has been loaded), which remains valid until the matching
+/// \ref easyyaml_holder_exit, even if it is replaced in the meantime. Never
+/// blocks, and read sections must not be nested.
+
+const void * easyyaml_holder_enter (easyyaml_holder_reader * reader)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  easyyaml_holder * holder = reader->holder;
+
+  // The epoch must be visible before the config is loaded, so a reload
+  // replacing the config it loads will see the epoch (both sequentially
+  // consistent).
+  atomic_store(&reader->epoch, atomic_load_explicit(&holder->epoch, memory_order_relaxed));
+
+  return atomic_load(&holder->current);
+#else
+  return NULL;
+#endif
+}
+
+
+/// Leave a read section, after which the config returned by
+/// \ref easyyaml_holder_enter may be freed.
+
+void easyyaml_holder_exit (easyyaml_holder_reader * reader)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+#endif
+}
+
+
+/// Unregister a reader, which must not be in a read section, for reuse.
+
+void easyyaml_holder_reader_free (easyyaml_holder_reader * reader)
+{
+#ifdef EASYYAML_WITH_HOLDER
+  atomic_store(&reader->epoch, 0);
+  atomic_store(&reader->in_use, 0);
+#endif
+}
+
+
+/// Create a profile, which when set in the options of a parse collects
+/// the time spent in each handler and scanning each part of the document,
+/// by schema entry, over every parse it is used for. Returns NULL on
+/// error.
+
+easyyaml_profile * easyyaml_profile_new (void)
+{
+  easyyaml_profile * profile = (easyyaml_profile *) calloc(1, sizeof(easyyaml_profile));
+  if (profile == NULL) {
+    size_t size = sizeof(easyyaml_profile);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating profile");
+  }
+
+  return profile;
+}
+
+
+/// Discard everything collected by a profile.
+
+void easyyaml_profile_reset (easyyaml_profile * profile)
+{
+  for (size_t i = 0; i < profile->count; i++)
+    free((char *) profile->entries[i].path);
+  free(profile->entries);
+  free(profile->slots);
+  memset(profile, 0, sizeof(easyyaml_profile));
+}
+
+
+/// Free a profile.
+
+void easyyaml_profile_free (easyyaml_profile * profile)
+{
+  easyyaml_profile_reset(profile);
+  free(profile);
+}
+
+
+/// Copy the stats of up to \p max schema entries to \p out, in descending
+/// order of total time (\ref EASYYAML_PROFILE_BY_TIME) or number of handler
+/// calls (\ref EASYYAML_PROFILE_BY_CALLS), returning the number copied. The
+/// paths remain valid until the profile is reset or freed.
+
+size_t easyyaml_profile_stats (const easyyaml_profile * profile, easyyaml_profile_entry * out, size_t max, int order)
+{
+  easyyaml_profile_entry * sorted = (easyyaml_profile_entry *) malloc((profile->count + 1) * sizeof(easyyaml_profile_entry));
+  if (sorted == NULL) {
+    size_t size = profile->count;
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory sorting profile");
+    return 0;
+  }
+
+  if (profile->count > 0)
+    memcpy(sorted, profile->entries, profile->count * sizeof(easyyaml_profile_entry));
+  qsort(sorted, profile->count, sizeof(easyyaml_profile_entry),
+        order == EASYYAML_PROFILE_BY_CALLS ? &profile_cmp_calls : &profile_cmp_time);
+
+  size_t count = profile->count < max ? profile->count : max;
+  if (count > 0)
+    memcpy(out, sorted, count * sizeof(easyyaml_profile_entry));
+  free(sorted);
+
+  return count;
+}
+
+
+/// Write a report of the \p max hottest schema entries, in the order given
+/// as for \ref easyyaml_profile_stats, to the file descriptor \p fd.
+
+int easyyaml_profile_dump (const easyyaml_profile * profile, int fd, size_t max, int order)
+{
+  easyyaml_profile_entry * stats = (easyyaml_profile_entry *) malloc((max + 1) * sizeof(easyyaml_profile_entry));
+  if (stats == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &max, "out of memory", "out of memory dumping profile");
+  size_t count = easyyaml_profile_stats(profile, stats, max, order);
+
+  size_t line_size = MAX_STACKPATH_LEN + 256;
+  char * line = (char *) malloc(line_size);
+  if (line == NULL) {
+    free(stats);
+    return error_handler(EASYYAML_ERROR_NOMEM, &line_size, "out of memory", "out of memory dumping profile");
+  }
+
+  int retval = EASYYAML_SUCCESS;
+  for (size_t i = 0; i <= count && retval == EASYYAML_SUCCESS; i++) {
+    int len;
+
+    if (i == 0) {
+      len = snprintf(line, line_size, "%10s %9s %9s %9s %9s %9s %10s %9s  %s\n",
+                     "total ms", "calls", "call ms", "p50 us", "p99 us", "max us",
+                     "tokens", "scan ms", "path");
+    } else {
+      const easyyaml_profile_entry * e = &stats[i - 1];
+      len = snprintf(line, line_size, "%10.3f %9llu %9.3f %9.1f %9.1f %9.1f %10llu %9.3f  %s%s%s%s\n",
+                     (double) (e->call_ns + e->scan_ns) / 1e6, (unsigned long long) e->calls,
+                     (double) e->call_ns / 1e6,
+                     (double) profile_percentile(e->call_hist, e->calls, 50, e->call_max_ns) / 1e3,
+                     (double) profile_percentile(e->call_hist, e->calls, 99, e->call_max_ns) / 1e3,
+                     (double) e->call_max_ns / 1e3, (unsigned long long) e->tokens,
+                     (double) e->scan_ns / 1e6, e->path,
+                     e->ys != NULL && e->ys->descr != NULL ? " (" : "",
+                     e->ys != NULL && e->ys->descr != NULL ? e->ys->descr : "",
+                     e->ys != NULL && e->ys->descr != NULL ? ")" : "");
+    }
+    if (len < 0 || (size_t) len >= line_size)
+      len = (int) strlen(line);
+
+    for (size_t pos = 0; pos < (size_t) len; ) {
+      ssize_t n = write(fd, line + pos, (size_t) len - pos);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        retval = error_handler(EASYYAML_ERROR_WRITE, &errno, "write error",
+                               "error writing profile (%s)", strerror(errno));
+        break;
+      }
+      pos += (size_t) n;
+    }
+  }
+
+  free(line);
+  free(stats);
+
+  return retval;
+}
+
+
+/// Parse the YAML. Called from \ref easyyaml_parse_file or
+/// \ref easyyaml_parse_string (etc) to complete the parsing of the source.
+
+int parse (yaml_parser_t * parser, easyyaml_input * input, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_engine engine;
+  engine_init(&engine, parser, input, ys, cfg, opts);
+
+  int retval = engine_run(&engine);
+
+  engine_free(&engine);
+
+  return retval;
+}
+
+
+#ifdef EASYYAML_WITH_HOLDER
+/// Publish the newly parsed \p cfg if the parse result \p retval is
+/// success (otherwise freeing it), retiring the version it replaces, and
+/// free any retired versions no longer in use. Returns \p retval.
+
+int holder_publish (easyyaml_holder * holder, void * cfg, int retval)
+{
+  easyyaml_version * version = NULL;
+
+  if (retval == EASYYAML_SUCCESS && (version = (easyyaml_version *) malloc(sizeof(easyyaml_version))) == NULL) {
+    size_t size = sizeof(easyyaml_version);
+    retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory retiring config");
+  }
+  if (retval != EASYYAML_SUCCESS) {
+    holder_cfg_free(holder, cfg);
+    return retval;
+  }
+
+  pthread_mutex_lock(&holder->lock);
+
+  // Readers entering after the epoch is advanced load the new version.
+  version->cfg = atomic_exchange(&holder->current, cfg);
+  if (version->cfg != NULL) {
+    version->retired = atomic_fetch_add(&holder->epoch, 1);
+    version->next    = holder->retired;
+    holder->retired  = version;
+  } else {
+    free(version);
+  }
+  holder_reclaim(holder);
+
+  pthread_mutex_unlock(&holder->lock);
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Free the retired versions which no reader in a read section entered
+/// early enough to be using, returning the number left. Called with the
+/// holder locked.
+
+size_t holder_reclaim (easyyaml_holder * holder)
+{
+  uint64_t oldest = UINT64_MAX;
+
+  for (easyyaml_holder_reader * reader = holder->readers; reader != NULL; reader = reader->next) {
+    uint64_t epoch = atomic_load(&reader->epoch);
+    if (epoch != 0 && epoch < oldest)
+      oldest = epoch;
+  }
+
+  easyyaml_version ** link = &holder->retired;
+  size_t held = 0;
+
+  while (*link != NULL) {
+    easyyaml_version * version = *link;
+
+    if (version->retired < oldest) {
+      *link = version->next;
+      holder_cfg_free(holder, version->cfg);
+      free(version);
+    } else {
+      link = &version->next;
+      held++;
+    }
+  }
+
+  return held;
+}
+
+
+/// Free a version of the holder's config.
+
+void holder_cfg_free (easyyaml_holder * holder, void * cfg)
+{
+  if (cfg != NULL && holder->cfg_free != NULL)
+    holder->cfg_free(cfg);
+  free(cfg);
+}
+#endif
+
+
+/// Make the stats of schema entry \p ys (NULL for the document outside any
+/// entry) current, adding them, with the path of \p stack, if this is
+/// the first time the entry has been seen.
+
+int profile_enter (easyyaml_ctx * ctx, const easyyaml_schema * ys, easyyaml_stack * stack)
+{
+  easyyaml_profile * profile = ctx->profile;
+  size_t mask = profile->slots_size - 1;
+  size_t slot = ((uintptr_t) ys >> 4) * 0x9e3779b97f4a7c15ull;
+
+  if (profile->slots_size > 0) {
+    for (slot &= mask; profile->slots[slot] != 0; slot = (slot + 1) & mask) {
+      if (profile->entries[profile->slots[slot] - 1].ys == ys) {
+        ctx->prof = profile->slots[slot] - 1;
+        return EASYYAML_SUCCESS;
+      }
+    }
+  }
+
+  // Keep the table at most half full, rehashing into a larger one.
+  if (profile->count + 1 > profile->slots_size / 2) {
+    size_t size = profile->slots_size == 0 ? 64 : profile->slots_size * 2;
+    size_t * slots = (size_t *) calloc(size, sizeof(size_t));
+    if (slots == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing profile");
+
+    for (size_t i = 0; i < profile->count; i++) {
+      size_t j = (((uintptr_t) profile->entries[i].ys >> 4) * 0x9e3779b97f4a7c15ull) & (size - 1);
+      while (slots[j] != 0)
+        j = (j + 1) & (size - 1);
+      slots[j] = i + 1;
+    }
+    free(profile->slots);
+    profile->slots      = slots;
+    profile->slots_size = size;
+
+    mask = size - 1;
+    slot = (((uintptr_t) ys >> 4) * 0x9e3779b97f4a7c15ull) & mask;
+    while (profile->slots[slot] != 0)
+      slot = (slot + 1) & mask;
+  }
+
+  if (profile->count == profile->size) {
+    size_t size = profile->size == 0 ? 32 : profile->size * 2;
+    easyyaml_profile_entry * entries = (easyyaml_profile_entry *) realloc(profile->entries, size * sizeof(easyyaml_profile_entry));
+    if (entries == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing profile");
+    profile->entries = entries;
+    profile->size    = size;
+  }
+
+  size_t path_len = stack_path_len(stack) + 1;
+  char * path = (char *) malloc(path_len);
+  if (path == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &path_len, "out of memory", "out of memory copying profile path");
+  stack_render(stack, path, path_len);
+
+  easyyaml_profile_entry * entry = &profile->entries[profile->count];
+  memset(entry, 0, sizeof(easyyaml_profile_entry));
+  entry->ys   = ys;
+  entry->path = path;
+
+  profile->slots[slot] = ++profile->count;
+  ctx->prof = profile->count - 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Scan the next token (as \ref parser_tok), timing it against the
+/// current schema entry.
+
+int profile_scan (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  uint64_t start_ns = now_ns();
+  int retval = parser_tok(ctx, token);
+  uint64_t ns = now_ns() - start_ns;
+
+  easyyaml_profile_entry * entry = &ctx->profile->entries[ctx->prof];
+  entry->tokens++;
+  entry->scan_ns += ns;
+  if (ns > entry->scan_max_ns)
+    entry->scan_max_ns = ns;
+  profile_hist(entry->scan_hist, ns);
+
+  return retval;
+}
+
+
+/// Record a handler call, started at \p start_ns, against the stats at
+/// index \p prof.
+
+void profile_call (easyyaml_ctx * ctx, size_t prof, uint64_t start_ns)
+{
+  uint64_t ns = now_ns() - start_ns;
+  easyyaml_profile_entry * entry = &ctx->profile->entries[prof];
+
+  entry->calls++;
+  entry->call_ns += ns;
+  if (ns > entry->call_max_ns)
+    entry->call_max_ns = ns;
+  profile_hist(entry->call_hist, ns);
+}
+
+
+/// Count \p ns in a histogram, bucket \c i of which counts times from
+/// 2^i up to 2^(i+1) nanoseconds (the first and last also counting
+/// anything shorter or longer).
+
+void profile_hist (uint64_t * hist, uint64_t ns)
+{
+  int bucket = 0;
+
+  while (ns > 1 && bucket < EASYYAML_PROFILE_BUCKETS - 1) {
+    ns >>= 1;
+    bucket++;
+  }
+  hist[bucket]++;
+}
+
+
+/// Estimate the \p pct percentile of the \p count times in a histogram,
+/// as the upper bound of its bucket, or the longest time \p max_ns if
+/// that is less.
+
+uint64_t profile_percentile (const uint64_t * hist, uint64_t count, int pct, uint64_t max_ns)
+{
+  uint64_t seen = 0;
+  int i;
+
+  if (count == 0)
+    return 0;
+
+  for (i = 0; i < EASYYAML_PROFILE_BUCKETS - 1; i++) {
+    seen += hist[i];
+    if (seen * 100 >= count * (uint64_t) pct)
+      break;
+  }
+
+  uint64_t bound = (uint64_t) 2 << i;
+
+  return bound < max_ns ? bound : max_ns;
+}
+
+
+/// Order profile stats by descending total time.
+
+int profile_cmp_time (const void * a, const void * b)
+{
+  uint64_t ta = ((const easyyaml_profile_entry *) a)->call_ns + ((const easyyaml_profile_entry *) a)->scan_ns;
+  uint64_t tb = ((const easyyaml_profile_entry *) b)->call_ns + ((const easyyaml_profile_entry *) b)->scan_ns;
+
+  return ta > tb ? -1 : ta < tb ? 1 : 0;
+}
+
+
+/// Order profile stats by descending handler calls, then tokens scanned.
+
+int profile_cmp_calls (const void * a, const void * b)
+{
+  const easyyaml_profile_entry * ea = (const easyyaml_profile_entry *) a;
+  const easyyaml_profile_entry * eb = (const easyyaml_profile_entry *) b;
+
+  if (ea->calls != eb->calls)
+    return ea->calls > eb->calls ? -1 : 1;
+
+  return ea->tokens > eb->tokens ? -1 : ea->tokens < eb->tokens ? 1 : 0;
+}
+
+
+/// Initialise a parse engine.
+
+void engine_init (easyyaml_engine * engine, yaml_parser_t * parser, easyyaml_input * input, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  memset(engine, 0, offsetof(easyyaml_engine, inline_frames));
+  engine->ctx.parser = parser;
+  engine->ctx.input  = input;
+  engine->ctx.opts   = opts;
+  engine->ys         = ys;
+  engine->cfg        = cfg;
+
+  if (opts != NULL && opts->frame_buf != NULL) {
+    engine->frames      = (easyyaml_frame *) opts->frame_buf;
+    engine->frames_size = opts->frame_buf_size / sizeof(easyyaml_frame);
+    engine->frames_user = 1;
+  } else {
+    engine->frames      = engine->inline_frames;
+    engine->frames_size = sizeof(engine->inline_frames) / sizeof(easyyaml_frame);
+  }
+
+  easyyaml_errors * errors = opts == NULL ? NULL : opts->errors;
+  engine->errors_before = errors == NULL ? 0 : errors->count;
+
+  if (opts != NULL) {
+    engine->ctx.limited = opts->max_scalar_len != 0 || opts->max_keys != 0 || opts->max_time_ns != 0;
+    if (opts->max_time_ns != 0)
+      engine->ctx.limit_deadline_ns = now_ns() + opts->max_time_ns;
+    if (input != NULL)
+      input->max_bytes = opts->max_input_bytes;
+    engine->ctx.profile = opts->profile;
+  }
+}
+
+
+/// Run the parse, until it completes, fails, or the budget (if any) is
+/// spent, in which case \ref EASYYAML_MORE_PENDING is returned and the
+/// parse may be resumed by calling again. The result of a completed parse
+/// is returned by all subsequent calls.
+
+int engine_run (easyyaml_engine * engine)
+{
+  if (engine->done)
+    return engine->retval;
+
+  int retval;
+
+  do
+    retval = engine_step(engine);
+  while (retval == EASYYAML_SUCCESS && engine->depth > 0 && !budget_spent(&engine->ctx));
+
+  if (retval == EASYYAML_SUCCESS && engine->depth > 0)
+    return EASYYAML_MORE_PENDING;
+
+  return engine_finish(engine, retval);
+}
+
+
+/// Take one step of the parse: start it, or parse the next entry (or
+/// item) of the innermost frame.
+
+int engine_step (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+
+  if (ctx->profile != NULL && engine->depth > 0)
+    ctx->prof = engine->frames[engine->depth - 1].prof;
+
+  if (!engine->started)
+    return engine_start(engine);
+  else if (engine->frames[engine->depth - 1].type == FRAME_OBJ)
+    return step_obj(engine);
+  else if (engine->frames[engine->depth - 1].type == FRAME_LIST)
+    return step_list(engine);
+  else
+    return step_rec(engine);
+}
+
+
+/// Finish the parse with result \p retval, freeing the engine. The result
+/// is kept, to be returned by any later calls.
+
+int engine_finish (easyyaml_engine * engine, int retval)
+{
+  // In collect mode a parse which recorded errors fails with the first.
+  const easyyaml_options * opts = engine->ctx.opts;
+  easyyaml_errors * errors = opts == NULL ? NULL : opts->errors;
+  if (retval == EASYYAML_SUCCESS && errors != NULL && errors->count > engine->errors_before)
+    retval = errors->list[engine->errors_before].code;
+
+  engine_free(engine);
+  engine->done   = 1;
+  engine->retval = retval;
+
+  return retval;
+}
+
+
+/// Free everything held by a parse engine, complete or not.
+
+void engine_free (easyyaml_engine * engine)
+{
+  sink_release(engine);
+  while (engine->depth > 0)
+    pop_frame(engine);
+
+  if (engine->ctx.has_pending) {
+    yaml_token_delete(&engine->ctx.pending);
+    engine->ctx.has_pending = 0;
+  }
+
+  if (engine->frames != engine->inline_frames && !engine->frames_user)
+    free(engine->frames);
+  engine->frames      = engine->inline_frames;
+  engine->frames_size = sizeof(engine->inline_frames) / sizeof(easyyaml_frame);
+  engine->frames_user = 0;
+
+  if (engine->keep_symtab)
+    symtab_clear(&engine->symtab);
+  else
+    symtab_free(&engine->symtab);
+  anchors_free(&engine->ctx.anchors);
+
+  free(engine->set_keys);
+  engine->set_keys       = NULL;
+  engine->set_keys_count = 0;
+  engine->set_keys_size  = 0;
+}
+
+
+/// Read the start of the stream, and the root map.
+
+int engine_start (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  yaml_token_t token;
+  int scan_tok_retval;
+
+  engine->started = 1;
+
+  // The schema's enum tables are compiled before the parse, which only
+  // reads them.
+  if (!engine->compiled) {
+    int retval = schema_compile(engine->ys);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+    engine->compiled = 1;
+  }
+
+  if (ctx->profile != NULL) {
+    easyyaml_stack root;
+    root.key  = NULL;
+    root.prev = NULL;
+    root.id   = EASYYAML_NOID;
+    root.hash = EASYYAML_PATH_HASH_ROOT;
+
+    int retval = profile_enter(ctx, NULL, &root);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  // Streamed input is counted as it is read, a string is checked up front.
+  const easyyaml_options * opts = ctx->opts;
+  if (opts != NULL && opts->max_input_bytes != 0 && ctx->input == NULL) {
+    size_t len = ctx->json != NULL ? ctx->json->len
+               : ctx->msgpack != NULL ? ctx->msgpack->len
+               : (size_t) (ctx->parser->input.string.end - ctx->parser->input.string.start);
+    if (len > opts->max_input_bytes)
+      return error_handler(EASYYAML_ERROR_LIMIT_INPUT, &len, "input too large",
+                           "input of %lu bytes exceeds the limit of %lu bytes",
+                           (unsigned long) len, (unsigned long) opts->max_input_bytes);
+  }
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type != YAML_STREAM_START_TOKEN) {
+    int data[2] = {token.type, YAML_STREAM_START_TOKEN};
+    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                               "unexpected token at parse start",
+                               "expected libyaml stream start after open but read %s",
+                               tok_to_str(token.type));
+    yaml_token_delete(&token);
+
+    return retval;
+  }
+  yaml_token_delete(&token);
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type == YAML_STREAM_END_TOKEN) {
+    yaml_token_delete(&token);
+
+    return EASYYAML_SUCCESS;
+  } else if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
+    yaml_token_delete(&token);
+
+    easyyaml_stack stack;
+    stack.key  = NULL;
+    stack.prev = NULL;
+    stack.id   = EASYYAML_NOID;
+    stack.hash = EASYYAML_PATH_HASH_ROOT;
+
+    int retval = push_frame(engine, FRAME_OBJ, engine->ys, &stack, 1, engine->cfg, NULL);
+    if (retval == EASYYAML_SUCCESS && engine->ev != NULL)
+      sink_begin(engine, NULL);
+
+    return retval;
+  } else {
+    int data[2] = {token.type, YAML_BLOCK_MAPPING_START_TOKEN};
+    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                               "unexpected token at parse start",
+                               "expected libyaml block mapping start after stream start but read %s",
+                               tok_to_str(token.type));
+    yaml_token_delete(&token);
+
+    return retval;
+  }
+}
+
+
+/// Push a map or list frame, for schema \p ys. If \p own_node is set the
+/// frame takes a copy of the \p stack node (whose \c prev must be the
+/// enclosing frame's stack), otherwise it shares the enclosing frame's. The
+/// frame takes ownership of \p key_token (if not NULL), whose value is
+/// the key of the node.
+
+int push_frame (easyyaml_engine * engine, int type, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, void * cfg, yaml_token_t * key_token)
+{
+  const easyyaml_options * opts = engine->ctx.opts;
+  if (opts != NULL && opts->max_depth != 0 && engine->depth >= opts->max_depth) {
+    // The path may be the key token's, so is rendered before it is deleted.
+    int retval = error_handler(EASYYAML_ERROR_LIMIT_DEPTH, &engine->depth, "nesting too deep",
+                               "nesting exceeds the limit of %lu at %s",
+                               (unsigned long) opts->max_depth, easyyaml_stack_path(stack));
+    if (key_token != NULL)
+      yaml_token_delete(key_token);
+    return retval;
+  }
+
+  if (engine->depth == engine->frames_size) {
+    int retval = grow_frames(engine);
+    if (retval != EASYYAML_SUCCESS) {
+      if (key_token != NULL)
+        yaml_token_delete(key_token);
+      return retval;
+    }
+  }
+
+  easyyaml_frame * frame = &engine->frames[engine->depth++];
+  frame->type     = type;
+  frame->ys       = ys;
+  frame->cfg      = cfg;
+  frame->own_node = own_node;
+  frame->in_entry = 0;
+  frame->pos      = 0;
+  frame->recs     = NULL;
+  frame->rec_count = 0;
+  frame->rec_cap  = 0;
+  frame->merges   = 0;
+  frame->set_keys_start = engine->set_keys_count;
+  frame->prof     = engine->ctx.prof;
+  frame->has_key_token = key_token != NULL;
+  if (key_token != NULL)
+    frame->key_token = *key_token;
+
+  // The enclosing frame's stack is taken from the frame itself rather than
+  // from \p stack, as growing the frames may have moved it.
+  easyyaml_stack * prev = engine->depth > 1 ? frame[-1].stack : NULL;
+  if (own_node) {
+    frame->node.key  = stack->key;
+    frame->node.prev = prev;
+    frame->node.id   = stack->id;
+    frame->node.hash = stack->hash;
+    frame->stack     = &frame->node;
+  } else {
+    frame->stack = prev;
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Pop the innermost frame.
+
+void pop_frame (easyyaml_engine * engine)
+{
+  easyyaml_frame * frame = &engine->frames[--engine->depth];
+
+  engine->set_keys_count = frame->set_keys_start;
+  if (frame->has_key_token)
+    yaml_token_delete(&frame->key_token);
+  if (frame->type == FRAME_REC)
+    recs_free(frame->ys, frame->recs, frame->rec_count);
+}
+
+
+/// Grow the frame stack (unless it is caller supplied), re-linking the
+/// stack nodes, which point into it.
+
+int grow_frames (easyyaml_engine * engine)
+{
+  size_t size = engine->frames_size * 2;
+
+  if (engine->frames_user)
+    return error_handler(EASYYAML_ERROR_NOMEM, &engine->frames_size, "frame stack exhausted",
+                         "frame stack exhausted (nesting depth %lu)", (unsigned long) engine->depth);
+
+  easyyaml_frame * frames;
+  if (engine->frames == engine->inline_frames) {
+    if ((frames = (easyyaml_frame *) malloc(size * sizeof(easyyaml_frame))) != NULL)
+      memcpy(frames, engine->frames, engine->depth * sizeof(easyyaml_frame));
+  } else {
+    frames = (easyyaml_frame *) realloc(engine->frames, size * sizeof(easyyaml_frame));
+  }
+  if (frames == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing frame stack");
+
+  engine->frames      = frames;
+  engine->frames_size = size;
+
+  for (size_t i = 0; i < engine->depth; i++) {
+    easyyaml_stack * prev = i == 0 ? NULL : frames[i - 1].stack;
+
+    if (frames[i].own_node) {
+      frames[i].node.prev = prev;
+      frames[i].stack     = &frames[i].node;
+    } else {
+      frames[i].stack = prev;
+    }
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Parse the next entry of the map in the innermost frame.
+
+int step_obj (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  easyyaml_schema * ys = frame->ys;
+  yaml_token_t token;
+  int scan_tok_retval;
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type == YAML_BLOCK_END_TOKEN) {
+    yaml_token_delete(&token);
+    if (frame->merges > 0) {
+      frame->merges--;
+    } else {
+      if (engine->ev != NULL)
+        sink_end(engine);
+      pop_frame(engine);
+    }
+
+    return EASYYAML_SUCCESS;
+  } else if (ys != NULL && ys->type == EASYYAML_SCHEMA_END) {
+    if (token.type != YAML_KEY_TOKEN) {
+      int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_NOCHILDREN, ys, frame->stack, NULL, token.type);
+      if (retval == EASYYAML_SUCCESS)
+        return skip_node(ctx, &token);
+
+      yaml_token_delete(&token);
+      return retval;
+    }
+    yaml_token_delete(&token);
+
+    yaml_token_t key_token;
+    if ((scan_tok_retval = scan_tok(ctx, &key_token)) != EASYYAML_SUCCESS)
+      return scan_tok_retval;
+
+    int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_NOCHILDREN, ys, frame->stack,
+                              key_token.type == YAML_SCALAR_TOKEN ? (char *) key_token.data.scalar.value : NULL,
+                              key_token.type);
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_node(ctx, &key_token);
+    else
+      yaml_token_delete(&key_token);
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_value(ctx);
+
+    return retval;
+  } else if (token.type == YAML_KEY_TOKEN) {
+    yaml_token_delete(&token);
+
+    // Without a schema (a cursor's), every key is a variable key.
+    if (ys == NULL || (ys[1].type == EASYYAML_SCHEMA_END && ys[0].key == NULL))
+      return step_obj_varkey(engine);
+    else
+      return step_obj_fixedkey(engine);
+  } else {
+    int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, ys, frame->stack, NULL, token.type);
+    if (retval == EASYYAML_SUCCESS)
+      return skip_node(ctx, &token);
+
+    yaml_token_delete(&token);
+    return retval;
+  }
+}
+
+
+/// Parse a map entry with a variable key, whose key token has been read.
+
+int step_obj_varkey (easyyaml_engine * engine)
+{
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  yaml_token_t token;
+  easyyaml_stack stack;
+  int have_key;
+
+  int retval = scan_varkey(engine, &token, &stack, &have_key);
+  if (retval != EASYYAML_SUCCESS || !have_key)
+    return retval;
+
+  return enter_value(engine, frame->ys, &stack, 1, frame->cfg, &token);
+}
+
+
+/// Read the variable key of a map entry (whose key token has been read)
+/// and the value token following it. If \p have_key is set on return,
+/// \p token holds the key (which the caller must delete), and \p stack is
+/// the node for it, otherwise the entry has been skipped (or the return
+/// value is an error).
+
+int scan_varkey (easyyaml_engine * engine, yaml_token_t * token, easyyaml_stack * stack, int * have_key)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  int scan_tok_retval;
+
+  *have_key = 0;
+
+  if ((scan_tok_retval = scan_tok(ctx, token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token->type != YAML_SCALAR_TOKEN) {
+    int data[2] = {token->type, YAML_SCALAR_TOKEN};
+    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                               "unexpected token parsing body",
+                               "expected libyaml map variable key scalar but read %s at %s",
+                               tok_to_str(token->type), easyyaml_stack_path(frame->stack));
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_node(ctx, token);
+    else
+      yaml_token_delete(token);
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_value(ctx);
+
+    return retval;
+  }
+
+  if (is_merge_key(token)) {
+    yaml_token_delete(token);
+    return enter_merge(engine);
+  }
+
+  yaml_token_t token2;
+
+  if ((scan_tok_retval = scan_tok(ctx, &token2)) != EASYYAML_SUCCESS) {
+    yaml_token_delete(token);
+    return scan_tok_retval;
+  }
+
+  if (token2.type != YAML_VALUE_TOKEN) {
+    yaml_token_delete(&token2);
+
+    int data[2] = {token2.type, YAML_VALUE_TOKEN};
+    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                               "unexpected token parsing body",
+                               "expected libyaml map variable key value but read %s at %s",
+                               tok_to_str(token2.type), easyyaml_stack_path(frame->stack));
+    if (retval != EASYYAML_SUCCESS) {
+      yaml_token_delete(token);
+      return retval;
+    }
+  } else {
+    yaml_token_delete(&token2);
+  }
+
+  stack->key  = (char *) token->data.scalar.value;
+  stack->prev = frame->stack;
+  stack->hash = stack_hash(frame->stack->hash, stack->key, token->data.scalar.length);
+
+  int retval = intern_key(&engine->symtab, stack->key, token->data.scalar.length, &stack->id);
+  int merged_over = 0;
+  if (retval == EASYYAML_SUCCESS)
+    retval = set_key(engine, stack->id, &merged_over);
+  if (retval != EASYYAML_SUCCESS || merged_over) {
+    yaml_token_delete(token);
+    if (retval == EASYYAML_SUCCESS && (retval = scan_tok(ctx, token)) == EASYYAML_SUCCESS)
+      retval = skip_node(ctx, token);
+    return retval;
+  }
+
+  *have_key = 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Parse a map entry with a fixed key, whose key token has been read.
+
+int step_obj_fixedkey (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  yaml_token_t token;
+  int scan_tok_retval;
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type != YAML_SCALAR_TOKEN) {
+    int data[2] = {token.type, YAML_SCALAR_TOKEN};
+    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                               "unexpected token parsing body",
+                               "expected libyaml map fixed key scalar but read %s at %s",
+                               tok_to_str(token.type), easyyaml_stack_path(frame->stack));
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_node(ctx, &token);
+    else
+      yaml_token_delete(&token);
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_value(ctx);
+
+    return retval;
+  }
+
+  if (is_merge_key(&token)) {
+    yaml_token_delete(&token);
+    return enter_merge(engine);
+  }
+
+  for (easyyaml_schema * ys2 = frame->ys; ys2->type != EASYYAML_SCHEMA_END; ys2++) {
+    if (strcmp(ys2->key, (char *) token.data.scalar.value) == 0) {
+      yaml_token_t token2;
+      int merged_over;
+
+      yaml_token_delete(&token);
+
+      int retval = set_key(engine, (size_t) (ys2 - frame->ys), &merged_over);
+      if (retval != EASYYAML_SUCCESS)
+        return retval;
+      if (merged_over)
+        return skip_value(ctx);
+
+      if ((scan_tok_retval = scan_tok(ctx, &token2)) != EASYYAML_SUCCESS)
+        return scan_tok_retval;
+
+      if (token2.type != YAML_VALUE_TOKEN) {
+        yaml_token_delete(&token2);
+
+        int data[2] = {token2.type, YAML_VALUE_TOKEN};
+        int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                                   "unexpected token parsing body",
+                                   "expected libyaml map fixed key value but read %s at %s",
+                                   tok_to_str(token2.type), easyyaml_stack_path(frame->stack));
+        if (retval != EASYYAML_SUCCESS)
+          return retval;
+      } else {
+        yaml_token_delete(&token2);
+      }
+
+      easyyaml_stack stack;
+      stack.key  = ys2->key;
+      stack.prev = frame->stack;
+      stack.id   = EASYYAML_NOID;
+      stack.hash = stack_hash(frame->stack->hash, ys2->key, strlen(ys2->key));
+
+      return enter_value(engine, ys2, &stack, 1, frame->cfg, NULL);
+    }
+  }
+
+  int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, frame->ys, frame->stack,
+                            (char *) token.data.scalar.value, token.type);
+  yaml_token_delete(&token);
+
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  return skip_value(ctx);
+}
+
+
+/// Whether the key \p token of a map entry is a merge key ("<<", unquoted).
+
+int is_merge_key (yaml_token_t * token)
+{
+  return token->data.scalar.style == YAML_PLAIN_SCALAR_STYLE && token->data.scalar.length == 2
+    && strcmp((char *) token->data.scalar.value, "<<") == 0;
+}
+
+
+/// Note that the map in the innermost frame sets \p key (see
+/// \ref easyyaml_set_key), setting \p merged_over if the entry is merged
+/// in but the map (or a shallower merge) has set the key already, so it
+/// is to be skipped, as a map's own entries override those merged into it
+/// wherever the merge key is.
+
+int set_key (easyyaml_engine * engine, size_t key, int * merged_over)
+{
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+
+  *merged_over = 0;
+
+  if (frame->merges > 0) {
+    int noted = 0;
+    for (size_t i = frame->set_keys_start; i < engine->set_keys_count; i++) {
+      if (engine->set_keys[i].key != key)
+        continue;
+      if (engine->set_keys[i].merges < frame->merges) {
+        *merged_over = 1;
+        return EASYYAML_SUCCESS;
+      }
+      noted |= engine->set_keys[i].merges == frame->merges;
+    }
+    if (noted)
+      return EASYYAML_SUCCESS;
+  }
+
+  if (engine->set_keys_count == engine->set_keys_size) {
+    size_t size = engine->set_keys_size == 0 ? 64 : engine->set_keys_size * 2;
+    easyyaml_set_key * set_keys = (easyyaml_set_key *) realloc(engine->set_keys, size * sizeof(easyyaml_set_key));
+    if (set_keys == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory noting keys at %s",
+                           easyyaml_stack_path(frame->stack));
+    engine->set_keys      = set_keys;
+    engine->set_keys_size = size;
+  }
+  engine->set_keys[engine->set_keys_count].key    = key;
+  engine->set_keys[engine->set_keys_count].merges = frame->merges;
+  engine->set_keys_count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Enter the value of a merge key, whose key has been read, which must be
+/// a map (usually an alias). Its entries are parsed as entries of the map
+/// in the innermost frame, the end of it being counted off by the frame's
+/// \c merges.
+
+int enter_merge (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  yaml_token_t token;
+  int scan_tok_retval;
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type == YAML_VALUE_TOKEN) {
+    yaml_token_delete(&token);
+    if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      return scan_tok_retval;
+  }
+
+  if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
+    yaml_token_delete(&token);
+    frame->merges++;
+
+    return EASYYAML_SUCCESS;
+  }
+
+  int data[2] = {token.type, YAML_BLOCK_MAPPING_START_TOKEN};
+  int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                             "unexpected token parsing merge key",
+                             "expected libyaml block mapping start for merge key but read %s at %s",
+                             tok_to_str(token.type), easyyaml_stack_path(frame->stack));
+  if (retval == EASYYAML_SUCCESS)
+    retval = skip_node(ctx, &token);
+  else
+    yaml_token_delete(&token);
+
+  return retval;
+}
+
+
+/// Parse the next item (or the next value of the current item) of the
+/// list in the innermost frame.
+
+int step_list (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+
+  if (!frame->in_entry) {
+    yaml_token_t token;
+    int scan_tok_retval;
+
+    if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      return scan_tok_retval;
+
+    if (token.type == YAML_BLOCK_END_TOKEN) {
+      yaml_token_delete(&token);
+      if (engine->ev != NULL)
+        sink_end(engine);
+      pop_frame(engine);
+
+      return EASYYAML_SUCCESS;
+    }
+    if (token.type != YAML_BLOCK_ENTRY_TOKEN) {
+      int data[2] = {token.type, YAML_VALUE_TOKEN};
+      int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                                 "unexpected token parsing body",
+                                 "expected block entry while parsing list but read %s at %s",
+                                 tok_to_str(token.type), easyyaml_stack_path(frame->stack));
+      if (retval != EASYYAML_SUCCESS) {
+        yaml_token_delete(&token);
+        return retval;
+      }
+    }
+    yaml_token_delete(&token);
+
+    frame->in_entry = 1;
+    frame->pos      = 0;
+  }
+
+  // Each item is parsed against every schema entry in turn, or without a
+  // schema, once.
+  easyyaml_schema * ys = frame->ys == NULL ? NULL : &frame->ys[frame->pos];
+  if (ys == NULL ? frame->pos > 0 : ys->type == EASYYAML_SCHEMA_END) {
+    frame->in_entry = 0;
+    return EASYYAML_SUCCESS;
+  }
+  frame->pos++;
+
+  return enter_value(engine, ys, frame->stack, 0, frame->cfg, NULL);
+}
+
+
+/// Parse the next entry of the records map in the innermost frame, each
+/// entry being bound into a record (see \ref EASYYAML_RECORDS) whose
+/// fields are parsed with the record as the \c cfg, and the records being
+/// passed to the handler one at a time as each completes, or all together
+/// at the end of the map.
+
+int step_rec (easyyaml_engine * engine)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  easyyaml_schema * ys = frame->ys;
+  void (*handler)(easyyaml_stack *, void *, size_t, void *) = (void (*)(easyyaml_stack *, void *, size_t, void *)) ys->rec_handler;
+  yaml_token_t token;
+  int scan_tok_retval;
+
+  // A cursor's records are not bound (see below), so none are passed on.
+  if (engine->ev != NULL)
+    handler = NULL;
+
+  if (frame->in_entry) {
+    frame->in_entry = 0;
+    if (ys->type == EASYYAML_SCHEMA_REC && handler != NULL) {
+      uint64_t start_ns = ctx->profile != NULL ? now_ns() : 0;
+      frame->rec_count = 0;
+      handler(frame->stack, frame->recs, 1, frame->cfg);
+      if (ctx->profile != NULL)
+        profile_call(ctx, frame->prof, start_ns);
+    } else if (ys->type == EASYYAML_SCHEMA_REC) {
+      recs_free(ys, frame->recs, 1);
+      frame->rec_count = 0;
+    }
+  }
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  if (token.type == YAML_BLOCK_END_TOKEN && frame->merges > 0) {
+    yaml_token_delete(&token);
+    frame->merges--;
+
+    return EASYYAML_SUCCESS;
+  } else if (token.type == YAML_BLOCK_END_TOKEN) {
+    yaml_token_delete(&token);
+    if (ys->type == EASYYAML_SCHEMA_RECS && handler != NULL) {
+      uint64_t start_ns = ctx->profile != NULL ? now_ns() : 0;
+      handler(frame->stack, frame->recs, frame->rec_count, frame->cfg);
+      if (ctx->profile != NULL)
+        profile_call(ctx, frame->prof, start_ns);
+      frame->recs      = NULL;
+      frame->rec_count = 0;
+    }
+    if (engine->ev != NULL)
+      sink_end(engine);
+    pop_frame(engine);
+
+    return EASYYAML_SUCCESS;
+  } else if (token.type != YAML_KEY_TOKEN) {
+    int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, ys, frame->stack, NULL, token.type);
+    if (retval == EASYYAML_SUCCESS)
+      return skip_node(ctx, &token);
+
+    yaml_token_delete(&token);
+    return retval;
+  }
+  yaml_token_delete(&token);
+
+  easyyaml_stack stack;
+  int have_key;
+
+  int retval = scan_varkey(engine, &token, &stack, &have_key);
+  if (retval != EASYYAML_SUCCESS || !have_key)
+    return retval;
+
+  yaml_token_t token2;
+  if ((scan_tok_retval = scan_tok(ctx, &token2)) != EASYYAML_SUCCESS) {
+    yaml_token_delete(&token);
+    return scan_tok_retval;
+  }
+
+  if (token2.type != YAML_BLOCK_MAPPING_START_TOKEN) {
+    retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_MANDATES_MAP, ys, &stack, NULL, token2.type);
+    if (retval == EASYYAML_SUCCESS)
+      retval = skip_node(ctx, &token2);
+    else
+      yaml_token_delete(&token2);
+    yaml_token_delete(&token);
+
+    return retval;
+  }
+  yaml_token_delete(&token2);
+
+  // A cursor only reads a record's fields, so no record is bound and the
+  // records array is never grown.
+  if (engine->ev != NULL) {
+    retval = push_frame(engine, FRAME_OBJ, ys->data, &stack, 1, NULL, &token);
+    if (retval == EASYYAML_SUCCESS)
+      sink_begin(engine, ys);
+
+    return retval;
+  }
+
+  if (frame->rec_count == frame->rec_cap) {
+    size_t cap = frame->rec_cap == 0 ? 8 : frame->rec_cap * 2;
+    char * recs = (char *) realloc(frame->recs, cap * ys->rec_size);
+    if (recs == NULL) {
+      yaml_token_delete(&token);
+      return error_handler(EASYYAML_ERROR_NOMEM, &cap, "out of memory", "out of memory growing records at %s",
+                           easyyaml_stack_path(frame->stack));
+    }
+    frame->recs    = recs;
+    frame->rec_cap = cap;
+  }
+
+  size_t key_len = token.data.scalar.length;
+  char * key = (char *) malloc(key_len + 1);
+  if (key == NULL) {
+    yaml_token_delete(&token);
+    return error_handler(EASYYAML_ERROR_NOMEM, &key_len, "out of memory",
+                         "out of memory copying record key at %s", easyyaml_stack_path(frame->stack));
+  }
+  memcpy(key, token.data.scalar.value, key_len + 1);
+
+  char * rec = frame->recs + frame->rec_count++ * ys->rec_size;
+  memset(rec, 0, ys->rec_size);
+  memcpy(rec + ys->rec_key_offset, &key, sizeof(key));
+  frame->in_entry = 1;
+
+  return push_frame(engine, FRAME_OBJ, ys->data, &stack, 1, rec, &token);
+}
+
+
+/// Free \p count records (and their keys) of records schema entry \p ys,
+/// and the array holding them.
+
+void recs_free (easyyaml_schema * ys, char * recs, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    char * key;
+    memcpy(&key, recs + i * ys->rec_size + ys->rec_key_offset, sizeof(key));
+    free(key);
+  }
+  free(recs);
+}
+
+
+/// Parse a value against schema entry \p ys, calling its handler if it is
+/// a scalar, or pushing a frame if it is a map or list. With an event
+/// sink, the sink is passed the scalar, or the start of the map or list,
+/// instead, and \p ys may be NULL (see \ref enter_any). The \p stack and
+/// \p own_node arguments are as for \ref push_frame, and \p key_token (if
+/// not NULL) is consumed. The innermost frame may move, so must not be
+/// referenced after this returns.
+
+int enter_value (easyyaml_engine * engine, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, void * cfg, yaml_token_t * key_token)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  yaml_token_t token;
+  int scan_tok_retval;
+  int err_code;
+  uint64_t start_ns = 0;
+
+  if (ctx->profile != NULL && (scan_tok_retval = profile_enter(ctx, ys, stack)) != EASYYAML_SUCCESS) {
+    if (key_token != NULL)
+      yaml_token_delete(key_token);
+    return scan_tok_retval;
+  }
+
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS) {
+    if (key_token != NULL)
+      yaml_token_delete(key_token);
+    return scan_tok_retval;
+  }
+
+  if (ys == NULL)
+    return enter_any(engine, stack, own_node, key_token, &token);
+
+  if (ys->type == EASYYAML_SCHEMA_STR) {
+    if (token.type == YAML_SCALAR_TOKEN && engine->ev != NULL) {
+      sink_scalar(engine, ys, stack, own_node, key_token, &token, 0);
+
+      return EASYYAML_SUCCESS;
+    } else if (token.type == YAML_SCALAR_TOKEN) {
+      if (ys->data != NULL && ctx->profile != NULL)
+        start_ns = now_ns();
+      if (ys->data != NULL)
+        ((void (*)(easyyaml_stack *, char *, void *)) ys->data)(stack, (char *) token.data.scalar.value, cfg);
+      if (ys->data != NULL && ctx->profile != NULL)
+        profile_call(ctx, ctx->prof, start_ns);
+      yaml_token_delete(&token);
+      if (key_token != NULL)
+        yaml_token_delete(key_token);
+
+      return EASYYAML_SUCCESS;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_STRING;
+  } else if (ys->type == EASYYAML_SCHEMA_INT) {
+    if (token.type == YAML_SCALAR_TOKEN && engine->ev != NULL) {
+      sink_scalar(engine, ys, stack, own_node, key_token, &token, atoi((char *) token.data.scalar.value));
+
+      return EASYYAML_SUCCESS;
+    } else if (token.type == YAML_SCALAR_TOKEN) {
+      if (ys->data != NULL && ctx->profile != NULL)
+        start_ns = now_ns();
+      if (ys->data != NULL)
+        ((void (*)(easyyaml_stack *, int, void *)) ys->data)(stack, atoi((char *) token.data.scalar.value), cfg);
+      if (ys->data != NULL && ctx->profile != NULL)
+        profile_call(ctx, ctx->prof, start_ns);
+      yaml_token_delete(&token);
+      if (key_token != NULL)
+        yaml_token_delete(key_token);
+
+      return EASYYAML_SUCCESS;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_INT;
+  } else if (ys->type == EASYYAML_SCHEMA_ENUM) {
+    easyyaml_enum * table = (easyyaml_enum *) ys->data;
+    int value;
+
+    if (token.type == YAML_SCALAR_TOKEN
+        && easyyaml_enum_lookup(table, (char *) token.data.scalar.value, token.data.scalar.length, &value)) {
+      if (engine->ev != NULL) {
+        sink_scalar(engine, ys, stack, own_node, key_token, &token, value);
+
+        return EASYYAML_SUCCESS;
+      }
+      if (ys->enum_handler != NULL && ctx->profile != NULL)
+        start_ns = now_ns();
+      if (ys->enum_handler != NULL)
+        ((void (*)(easyyaml_stack *, int, void *)) ys->enum_handler)(stack, value, cfg);
+      if (ys->enum_handler != NULL && ctx->profile != NULL)
+        profile_call(ctx, ctx->prof, start_ns);
+      yaml_token_delete(&token);
+      if (key_token != NULL)
+        yaml_token_delete(key_token);
+
+      return EASYYAML_SUCCESS;
+    }
+
+    // An unknown value is reported with the value as the key, the scalar
+    // has been consumed so there is nothing to skip.
+    if (token.type == YAML_SCALAR_TOKEN) {
+      int retval = schema_error(ctx, EASYYAML_ERROR_SCHEMA_MANDATES_ENUM, ys, stack,
+                                (char *) token.data.scalar.value, token.type);
+      yaml_token_delete(&token);
+      if (key_token != NULL)
+        yaml_token_delete(key_token);
+
+      return retval;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_ENUM;
+  } else if (ys->type == EASYYAML_SCHEMA_MAP) {
+    if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
+      yaml_token_delete(&token);
+
+      int retval = push_frame(engine, FRAME_OBJ, ys->data, stack, own_node, cfg, key_token);
+      if (retval == EASYYAML_SUCCESS && engine->ev != NULL)
+        sink_begin(engine, ys);
+
+      return retval;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_MAP;
+  } else if (ys->type == EASYYAML_SCHEMA_LST) {
+    if (token.type == YAML_BLOCK_SEQUENCE_START_TOKEN) {
+      yaml_token_delete(&token);
+
+      int retval = push_frame(engine, FRAME_LIST, ys->data, stack, own_node, cfg, key_token);
+      if (retval == EASYYAML_SUCCESS && engine->ev != NULL)
+        sink_begin(engine, ys);
+
+      return retval;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_LIST;
+  } else if (ys->type == EASYYAML_SCHEMA_REC || ys->type == EASYYAML_SCHEMA_RECS) {
+    if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
+      yaml_token_delete(&token);
+
+      int retval = push_frame(engine, FRAME_REC, ys, stack, own_node, cfg, key_token);
+      if (retval == EASYYAML_SUCCESS && engine->ev != NULL)
+        sink_begin(engine, ys);
+
+      return retval;
+    }
+    err_code = EASYYAML_ERROR_SCHEMA_MANDATES_MAP;
+  } else {
+    err_code = EASYYAML_ERROR_SCHEMA_INVALID;
+  }
+
+  // The node does not match the schema, if the error is quashed (or
+  // collected) skip the node and carry on.
+
+  int retval = schema_error(ctx, err_code, ys, stack, NULL, token.type);
+  if (retval == EASYYAML_SUCCESS)
+    retval = skip_node(ctx, &token);
+  else
+    yaml_token_delete(&token);
+
+  if (key_token != NULL)
+    yaml_token_delete(key_token);
+
+  return retval;
+}
+
+
+/// Parse a value without a schema (only a cursor's engine, which has an
+/// event sink, parses without one), whose first token \p token has been
+/// read: a scalar, a map or a list, anything else being unexpected. An
+/// empty value is an empty scalar, its end being left for the enclosing
+/// map or list. The arguments are otherwise as for \ref enter_value.
+
+int enter_any (easyyaml_engine * engine, easyyaml_stack * stack, int own_node, yaml_token_t * key_token, yaml_token_t * token)
+{
+  easyyaml_ctx * ctx = &engine->ctx;
+  int retval;
+
+  if (token->type == YAML_SCALAR_TOKEN) {
+    sink_scalar(engine, NULL, stack, own_node, key_token, token, 0);
+
+    return EASYYAML_SUCCESS;
+  } else if (token->type == YAML_KEY_TOKEN || token->type == YAML_BLOCK_END_TOKEN
+             || token->type == YAML_BLOCK_ENTRY_TOKEN) {
+    unscan_tok(ctx, token);
+    sink_scalar(engine, NULL, stack, own_node, key_token, NULL, 0);
+
+    return EASYYAML_SUCCESS;
+  } else if (token->type == YAML_BLOCK_MAPPING_START_TOKEN || token->type == YAML_BLOCK_SEQUENCE_START_TOKEN) {
+    int type = token->type == YAML_BLOCK_MAPPING_START_TOKEN ? FRAME_OBJ : FRAME_LIST;
+    yaml_token_delete(token);
+
+    retval = push_frame(engine, type, NULL, stack, own_node, NULL, key_token);
+    if (retval == EASYYAML_SUCCESS)
+      sink_begin(engine, NULL);
+
+    return retval;
+  }
+
+  int data[2] = {token->type, YAML_SCALAR_TOKEN};
+  retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data, "unexpected token parsing body",
+                         "expected libyaml value but read %s at %s",
+                         tok_to_str(token->type), easyyaml_stack_path(stack));
+  if (retval == EASYYAML_SUCCESS)
+    retval = skip_node(ctx, token);
+  else
+    yaml_token_delete(token);
+
+  if (key_token != NULL)
+    yaml_token_delete(key_token);
+
+  return retval;
+}
+
+
+/// Pass a scalar to the event sink, read against schema entry \p ys (if
+/// not NULL), with value \p token (or if NULL, empty) and integer or enum
+/// value \p num. The tokens (both consumed) are kept until the next step,
+/// and the \p stack node (for a map entry, as it is the caller's) copied.
+
+void sink_scalar (easyyaml_engine * engine, easyyaml_schema * ys, easyyaml_stack * stack, int own_node, yaml_token_t * key_token, yaml_token_t * token, int num)
+{
+  easyyaml_event * ev = engine->ev;
+
+  if (own_node) {
+    engine->ev_stack = *stack;
+    stack = &engine->ev_stack;
+  }
+  if (key_token != NULL) {
+    engine->ev_key     = *key_token;
+    engine->has_ev_key = 1;
+  }
+  if (token != NULL) {
+    engine->ev_value     = *token;
+    engine->has_ev_value = 1;
+  }
+
+  ev->type  = EASYYAML_EVENT_SCALAR;
+  ev->key   = own_node ? stack->key : NULL;
+  ev->str   = token == NULL ? "" : (const char *) token->data.scalar.value;
+  ev->len   = token == NULL ? 0 : token->data.scalar.length;
+  ev->num   = num;
+  ev->ys    = ys;
+  ev->stack = stack;
+  ev->depth = engine->depth;
+}
+
+
+/// Pass the start of the map or list in the innermost frame, just pushed
+/// for schema entry \p ys (NULL for the root map, or without a schema), to
+/// the event sink.
+
+void sink_begin (easyyaml_engine * engine, easyyaml_schema * ys)
+{
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  easyyaml_event * ev = engine->ev;
+
+  ev->type  = frame->type == FRAME_LIST ? EASYYAML_EVENT_LIST_BEGIN : EASYYAML_EVENT_MAP_BEGIN;
+  ev->key   = frame->own_node ? frame->stack->key : NULL;
+  ev->ys    = ys;
+  ev->stack = frame->stack;
+  ev->depth = engine->depth - 1;
+}
+
+
+/// Pass the end of the map or list in the innermost frame, about to be
+/// popped, to the event sink, keeping its key token until the next step.
+
+void sink_end (easyyaml_engine * engine)
+{
+  easyyaml_frame * frame = &engine->frames[engine->depth - 1];
+  easyyaml_event * ev = engine->ev;
+
+  if (frame->has_key_token) {
+    engine->ev_key       = frame->key_token;
+    engine->has_ev_key   = 1;
+    frame->has_key_token = 0;
+  }
+
+  ev->type  = frame->type == FRAME_LIST ? EASYYAML_EVENT_LIST_END : EASYYAML_EVENT_MAP_END;
+  ev->key   = frame->own_node ? frame->stack->key : NULL;
+  ev->stack = frame->stack;
+  ev->depth = engine->depth - 1;
+}
+
+
+/// Release the tokens the last event passed to the sink refers to.
+
+void sink_release (easyyaml_engine * engine)
+{
+  if (engine->has_ev_key) {
+    yaml_token_delete(&engine->ev_key);
+    engine->has_ev_key = 0;
+  }
+  if (engine->has_ev_value) {
+    yaml_token_delete(&engine->ev_value);
+    engine->has_ev_value = 0;
+  }
+}
+
+
+/// Hash an enum value name: FNV-1a (64 bit), finished with the splitmix64
+/// mixer, so both halves of the hash are usable.
+
+uint64_t enum_hash (const char * str, size_t len)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char) str[i]) * 0x100000001b3ull;
+
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebull;
+  hash ^= hash >> 31;
+
+  return hash;
+}
+
+
+/// The slot of an enum value with hash \p hash, in a bucket displaced by
+/// \p disp, for a table of size \p mask + 1.
+
+size_t enum_slot (uint64_t hash, uint32_t disp, size_t mask)
+{
+  return (size_t) (((hash ^ (disp * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull) >> 32) & mask;
+}
+
+
+/// Order buckets (given as pairs of size and start) largest first.
+
+int enum_bucket_cmp (const void * a, const void * b)
+{
+  const size_t * x = (const size_t *) a;
+  const size_t * y = (const size_t *) b;
+
+  if (x[0] != y[0])
+    return x[0] < y[0] ? 1 : -1;
+
+  return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+
+/// Place the values of each bucket in the hash (its slots cleared), the
+/// largest buckets first, each with the first displacement which puts all
+/// its values in distinct empty slots. The buckets are the runs of
+/// \p order from \p starts, given as (size, start) pairs, and \p slots
+/// has room for the largest. Returns 0 if a bucket could not be placed,
+/// so the hash must be made larger.
+
+int enum_place (easyyaml_enum_hash * hash, const uint64_t * hashes, const size_t * order, const size_t * starts, size_t bucket_count, size_t * slots)
+{
+  for (size_t b = 0; b < bucket_count; b++) {
+    size_t size  = starts[2 * b];
+    const size_t * members = order + starts[2 * b + 1];
+    if (size == 0)
+      break;
+
+    uint32_t disp;
+    for (disp = 0; disp < ENUM_MAX_DISP; disp++) {
+      size_t i;
+      for (i = 0; i < size; i++) {
+        slots[i] = enum_slot(hashes[members[i]], disp, hash->mask);
+        if (hash->slots[slots[i]] != 0)
+          break;
+        size_t j;
+        for (j = 0; j < i && slots[j] != slots[i]; j++)
+          ;
+        if (j < i)
+          break;
+      }
+      if (i == size)
+        break;
+    }
+    if (disp == ENUM_MAX_DISP)
+      return 0;
+
+    hash->disps[(hashes[members[0]] >> 32) % hash->buckets] = disp;
+    for (size_t i = 0; i < size; i++)
+      hash->slots[slots[i]] = (uint32_t) members[i] + 1;
+  }
+
+  return 1;
+}
+
+
+/// Compile an enum table (its \c values set, ending with one with a NULL
+/// name) into a minimal-probe perfect hash, so each lookup is one hash and
+/// one string compare. Parses compile the tables of their schema (if they
+/// are not already) before they start, so this need only be called to
+/// catch errors early, or to recompile a table whose values have changed
+/// (which no parse may be using at the time).
+
+int easyyaml_enum_compile (easyyaml_enum * table)
+{
+  size_t count = 0;
+
+  easyyaml_enum_free(table);
+  while (table->values[count].name != NULL)
+    count++;
+
+  size_t buckets = count / 2 + 1;
+  size_t size = 2;
+  while (size < 2 * count)
+    size *= 2;
+
+  easyyaml_enum_hash * hash = (easyyaml_enum_hash *) calloc(1, sizeof(easyyaml_enum_hash));
+  if (hash == NULL) {
+    size_t hash_size = sizeof(easyyaml_enum_hash);
+    return error_handler(EASYYAML_ERROR_NOMEM, &hash_size, "out of memory", "out of memory compiling enum");
+  }
+  table->hash = hash;
+
+  uint64_t * hashes = (uint64_t *) malloc((count + 1) * sizeof(uint64_t));
+  size_t * order    = (size_t *) malloc((count + 1) * sizeof(size_t));
+  size_t * placed   = (size_t *) malloc((count + 1) * sizeof(size_t));
+  size_t * starts   = (size_t *) calloc(2 * buckets, sizeof(size_t));
+  hash->disps       = (uint32_t *) calloc(buckets, sizeof(uint32_t));
+  hash->lens        = (size_t *) malloc((count + 1) * sizeof(size_t));
+  if (hashes == NULL || order == NULL || placed == NULL || starts == NULL || hash->disps == NULL || hash->lens == NULL) {
+    free(hashes);
+    free(order);
+    free(placed);
+    free(starts);
+    enum_release(table);
+    return error_handler(EASYYAML_ERROR_NOMEM, table, "out of memory", "out of memory compiling enum");
+  }
+  table->count  = count;
+  hash->buckets = buckets;
+
+  // Group the values by bucket (counting sort), checking for duplicates
+  // within each bucket.
+  for (size_t i = 0; i < count; i++) {
+    hash->lens[i] = strlen(table->values[i].name);
+    hashes[i] = enum_hash(table->values[i].name, hash->lens[i]);
+    starts[2 * ((hashes[i] >> 32) % buckets)]++;
+  }
+  for (size_t b = 0, start = 0; b < buckets; b++) {
+    starts[2 * b + 1] = start;
+    start += starts[2 * b];
+  }
+  for (size_t i = 0; i < count; i++)
+    order[starts[2 * ((hashes[i] >> 32) % buckets) + 1]++] = i;
+
+  int retval = EASYYAML_SUCCESS;
+  for (size_t b = 0; b < buckets && retval == EASYYAML_SUCCESS; b++) {
+    starts[2 * b + 1] -= starts[2 * b];
+    for (size_t i = 0; i < starts[2 * b] && retval == EASYYAML_SUCCESS; i++) {
+      for (size_t j = 0; j < i; j++) {
+        size_t x = order[starts[2 * b + 1] + i];
+        size_t y = order[starts[2 * b + 1] + j];
+        if (hashes[x] == hashes[y]) {
+          retval = error_handler(EASYYAML_ERROR_SCHEMA_INVALID, table, "duplicate enum value",
+                                 "enum value %s duplicates (or collides with) %s", table->values[x].name, table->values[y].name);
+          if (retval == EASYYAML_SUCCESS)
+            retval = EASYYAML_ERROR_SCHEMA_INVALID;
+          break;
+        }
+      }
+    }
+  }
+  qsort(starts, buckets, 2 * sizeof(size_t), &enum_bucket_cmp);
+
+  // Place the buckets, doubling the table until they fit (which with
+  // distinct hashes it soon does).
+  while (retval == EASYYAML_SUCCESS) {
+    if (size > ENUM_MAX_LOAD * (count + 1)) {
+      retval = error_handler(EASYYAML_ERROR_SCHEMA_INVALID, table, "enum not compiled",
+                             "enum of %lu values could not be compiled", (unsigned long) count);
+      if (retval == EASYYAML_SUCCESS)
+        retval = EASYYAML_ERROR_SCHEMA_INVALID;
+      break;
+    }
+
+    uint32_t * slots = (uint32_t *) realloc(hash->slots, size * sizeof(uint32_t));
+    if (slots == NULL) {
+      retval = error_handler(EASYYAML_ERROR_NOMEM, table, "out of memory", "out of memory compiling enum");
+      break;
+    }
+    memset(slots, 0, size * sizeof(uint32_t));
+    hash->slots = slots;
+    hash->mask  = size - 1;
+
+    if (enum_place(hash, hashes, order, starts, buckets, placed))
+      break;
+    size *= 2;
+  }
+
+  free(hashes);
+  free(order);
+  free(placed);
+  free(starts);
+  if (retval != EASYYAML_SUCCESS)
+    enum_release(table);
+
+  return retval;
+}
+
+
+/// Look up the value named by the \p len characters at \p str in a
+/// compiled enum table, setting \p value to it. Returns 1 if the name is
+/// one of the table's, 0 if not.
+
+int easyyaml_enum_lookup (const easyyaml_enum * table, const char * str, size_t len, int * value)
+{
+  const easyyaml_enum_hash * hash = table->hash;
+  if (hash == NULL)
+    return 0;
+
+  uint64_t h = enum_hash(str, len);
+  uint32_t index = hash->slots[enum_slot(h, hash->disps[(h >> 32) % hash->buckets], hash->mask)];
+  if (index == 0)
+    return 0;
+
+  // The scalar may have NULs in it, so compare lengths, not terminators.
+  const easyyaml_enum_value * ev = &table->values[index - 1];
+  if (hash->lens[index - 1] != len || memcmp(ev->name, str, len) != 0)
+    return 0;
+
+  *value = ev->value;
+
+  return 1;
+}
+
+
+/// Free the memory used by a compiled enum table (its values are left, so
+/// it may be compiled again). Schemas compiled before are compiled again,
+/// and so their tables checked, by their next parse.
+
+void easyyaml_enum_free (easyyaml_enum * table)
+{
+  if (table->hash == NULL)
+    return;
+
+  enum_release(table);
+#ifdef EASYYAML_WITH_ATOMICS
+  atomic_fetch_add_explicit(&schema_generation, 1, memory_order_release);
+#else
+  schema_generation++;
+#endif
+}
+
+
+/// Free the hash of an enum table, which no schema has been compiled with
+/// (so unlike \ref easyyaml_enum_free, starting no new generation).
+
+void enum_release (easyyaml_enum * table)
+{
+  easyyaml_enum_hash * hash = table->hash;
+  if (hash == NULL)
+    return;
+
+  free(hash->slots);
+  free(hash->disps);
+  free(hash->lens);
+  free(hash);
+  table->hash  = NULL;
+  table->count = 0;
+}
+
+
+/// Compile the enum tables of a schema, and of the schemas under it, which
+/// are not compiled yet. Parses compile their schema before they start,
+/// so the same schema may be parsed in several threads at once (so long
+/// as its tables are not compiled or freed explicitly while it is). The
+/// schema is walked once, under a lock, after which its first entry holds
+/// the generation it was compiled in, and later parses only compare that
+/// with the current one. Freeing a compiled table starts a new
+/// generation, so every schema is walked again.
+
+int schema_compile (easyyaml_schema * ys)
+{
+  if (ys == NULL)
+    return EASYYAML_SUCCESS;
+
+#ifdef EASYYAML_WITH_ATOMICS
+  unsigned int generation = atomic_load_explicit(&schema_generation, memory_order_acquire);
+  if (atomic_load_explicit((atomic_uint *) &ys->compiled, memory_order_acquire) == generation)
+    return EASYYAML_SUCCESS;
+#endif
+
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_lock(&schema_compile_lock);
+#endif
+  int retval = EASYYAML_SUCCESS;
+#ifdef EASYYAML_WITH_ATOMICS
+  generation = atomic_load_explicit(&schema_generation, memory_order_acquire);
+  if (atomic_load_explicit((atomic_uint *) &ys->compiled, memory_order_relaxed) != generation) {
+    retval = schema_compile_walk(ys, NULL);
+    // Tables recompiled by the walk may have started a new generation.
+    generation = atomic_load_explicit(&schema_generation, memory_order_relaxed);
+    if (retval == EASYYAML_SUCCESS)
+      atomic_store_explicit((atomic_uint *) &ys->compiled, generation, memory_order_release);
+  }
+#else
+  if (ys->compiled != schema_generation) {
+    retval = schema_compile_walk(ys, NULL);
+    if (retval == EASYYAML_SUCCESS)
+      ys->compiled = schema_generation;
+  }
+#endif
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&schema_compile_lock);
+#endif
+
+  return retval;
+}
+
+
+/// Compile the enum tables of schema \p ys and those under it, less any
+/// of \p ancestors (a chain of the schemas above it, so that a schema
+/// which includes itself is walked once).
+
+int schema_compile_walk (easyyaml_schema * ys, const easyyaml_schema_chain * ancestors)
+{
+  const easyyaml_schema_chain self = { ys, ancestors };
+
+  for (const easyyaml_schema_chain * a = ancestors; a != NULL; a = a->prev) {
+    if (a->ys == ys)
+      return EASYYAML_SUCCESS;
+  }
+
+  for (easyyaml_schema * entry = ys; entry->type != EASYYAML_SCHEMA_END; entry++) {
+    int retval = EASYYAML_SUCCESS;
+
+    if (entry->type == EASYYAML_SCHEMA_ENUM) {
+      easyyaml_enum * table = (easyyaml_enum *) entry->data;
+      if (table->hash == NULL)
+        retval = easyyaml_enum_compile(table);
+    } else if (entry->type == EASYYAML_SCHEMA_MAP || entry->type == EASYYAML_SCHEMA_LST
+               || entry->type == EASYYAML_SCHEMA_REC || entry->type == EASYYAML_SCHEMA_RECS) {
+      if (entry->data != NULL)
+        retval = schema_compile_walk((easyyaml_schema *) entry->data, &self);
+    }
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Intern a variable key, setting \p id to its ID, the same for every
+/// occurrence of the key in the parse, and one more than the highest so
+/// far for a key not seen before.
+
+int intern_key (easyyaml_symtab * symtab, const char * key, size_t len, size_t * id)
+{
+  if (symtab->count * 4 >= symtab->slots_size * 3) {
+    int retval = symtab_grow_slots(symtab);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  uint64_t hash = siphash(symtab->sip_key, (const unsigned char *) key, len);
+  size_t mask = symtab->slots_size - 1;
+  size_t i = hash & mask;
+
+  for (; symtab->slots[i] != 0; i = (i + 1) & mask) {
+    easyyaml_symbol * sym = &symtab->symbols[symtab->slots[i] - 1];
+    if (sym->hash == hash && sym->len == len && memcmp(symtab->strs + sym->offset, key, len) == 0) {
+      *id = symtab->slots[i] - 1;
+      return EASYYAML_SUCCESS;
+    }
+  }
+
+  if (symtab->count == symtab->symbols_size) {
+    size_t size = symtab->symbols_size == 0 ? 16 : symtab->symbols_size * 2;
+    easyyaml_symbol * symbols = (easyyaml_symbol *) realloc(symtab->symbols, size * sizeof(easyyaml_symbol));
+    if (symbols == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing key symbol table");
+    symtab->symbols      = symbols;
+    symtab->symbols_size = size;
+  }
+
+  if (symtab->strs_len + len + 1 > symtab->strs_size) {
+    size_t size = symtab->strs_size == 0 ? 256 : symtab->strs_size;
+    while (size < symtab->strs_len + len + 1)
+      size *= 2;
+    char * strs = (char *) realloc(symtab->strs, size);
+    if (strs == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing key symbol table");
+    symtab->strs      = strs;
+    symtab->strs_size = size;
+  }
+
+  easyyaml_symbol * sym = &symtab->symbols[symtab->count];
+  sym->hash   = hash;
+  sym->offset = symtab->strs_len;
+  sym->len    = len;
+  memcpy(symtab->strs + symtab->strs_len, key, len);
+  symtab->strs[symtab->strs_len + len] = '\0';
+  symtab->strs_len += len + 1;
+
+  *id = symtab->count++;
+  symtab->slots[i] = *id + 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Double the slots of a symbol table (allocating and seeding it the first
+/// time), re-inserting the symbols by their stored hashes.
+
+int symtab_grow_slots (easyyaml_symtab * symtab)
+{
+  size_t size = symtab->slots_size == 0 ? 32 : symtab->slots_size * 2;
+
+  size_t * slots = (size_t *) calloc(size, sizeof(size_t));
+  if (slots == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing key symbol table");
+
+  if (symtab->slots_size == 0)
+    symtab_seed(symtab);
+
+  for (size_t id = 0; id < symtab->count; id++) {
+    size_t i = symtab->symbols[id].hash & (size - 1);
+    while (slots[i] != 0)
+      i = (i + 1) & (size - 1);
+    slots[i] = id + 1;
+  }
+
+  free(symtab->slots);
+  symtab->slots      = slots;
+  symtab->slots_size = size;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Pick a random SipHash key for a symbol table, falling back on the time
+/// and addresses (mixed by splitmix64) if no random source is available.
+
+void symtab_seed (easyyaml_symtab * symtab)
+{
+#ifdef EASYYAML_WITH_GETRANDOM
+  if (getrandom(symtab->sip_key, sizeof(symtab->sip_key), GRND_NONBLOCK) == sizeof(symtab->sip_key))
+    return;
+#endif
+
+  uint64_t x = now_ns() ^ (uint64_t) (uintptr_t) symtab ^ ((uint64_t) getpid() << 32);
+  for (int i = 0; i < 2; i++) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    symtab->sip_key[i] = z ^ (z >> 31);
+  }
+}
+
+
+/// Empty a symbol table, keeping its memory (and SipHash key) for reuse.
+
+void symtab_clear (easyyaml_symtab * symtab)
+{
+  if (symtab->slots != NULL)
+    memset(symtab->slots, 0, symtab->slots_size * sizeof(size_t));
+  symtab->count    = 0;
+  symtab->strs_len = 0;
+}
+
+
+/// Free a symbol table, leaving it empty (and reusable).
+
+void symtab_free (easyyaml_symtab * symtab)
+{
+  free(symtab->slots);
+  free(symtab->symbols);
+  free(symtab->strs);
+  memset(symtab, 0, sizeof(*symtab));
+}
+
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) do {                                   \
+    v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32);    \
+    v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                           \
+    v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                           \
+    v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32);    \
+  } while (0)
+
+
+/// SipHash-1-3 of \p data, keyed by \p key.
+
+uint64_t siphash (const uint64_t key[2], const unsigned char * data, size_t len)
+{
+  uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+  const unsigned char * end = data + (len & ~(size_t) 7);
+  uint64_t m;
+
+  for (; data != end; data += 8) {
+    m = 0;
+    for (int i = 0; i < 8; i++)
+      m |= (uint64_t) data[i] << (8 * i);
+    v3 ^= m;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  m = (uint64_t) len << 56;
+  for (int i = 0; i < (int) (len & 7); i++)
+    m |= (uint64_t) data[i] << (8 * i);
+  v3 ^= m;
+  SIP_ROUND(v0, v1, v2, v3);
+  v0 ^= m;
+
+  v2 ^= 0xff;
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+  SIP_ROUND(v0, v1, v2, v3);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/// Whether the budget set for the parse (see \ref easyyaml_step) is spent.
+
+int budget_spent (easyyaml_ctx * ctx)
+{
+  if (ctx->token_budget && ctx->tokens_left == 0)
+    return 1;
+
+  return ctx->deadline_ns != 0 && now_ns() >= ctx->deadline_ns;
+}
+
+
+/// Check the limits on scalar length, the number of keys and the time
+/// taken (see \ref easyyaml_options), against a token just scanned. The
+/// clock is only read every so many tokens, to keep this cheap. If a limit
+/// is exceeded the token is deleted.
+
+int check_limits (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  const easyyaml_options * opts = ctx->opts;
+  int retval = EASYYAML_SUCCESS;
+
+  if (token->type == YAML_SCALAR_TOKEN && opts->max_scalar_len != 0 && token->data.scalar.length > opts->max_scalar_len) {
+    retval = error_handler(EASYYAML_ERROR_LIMIT_SCALAR, &token->data.scalar.length, "scalar too long",
+                           "scalar of %lu bytes at line %lu exceeds the limit of %lu bytes",
+                           (unsigned long) token->data.scalar.length, (unsigned long) token->start_mark.line + 1,
+                           (unsigned long) opts->max_scalar_len);
+  } else if (token->type == YAML_KEY_TOKEN && opts->max_keys != 0 && ++ctx->keys > opts->max_keys) {
+    retval = error_handler(EASYYAML_ERROR_LIMIT_KEYS, &ctx->keys, "too many keys",
+                           "number of keys at line %lu exceeds the limit of %lu",
+                           (unsigned long) token->start_mark.line + 1, (unsigned long) opts->max_keys);
+  } else if (opts->max_time_ns != 0 && (++ctx->tokens & 63) == 0 && now_ns() >= ctx->limit_deadline_ns) {
+    retval = error_handler(EASYYAML_ERROR_LIMIT_TIME, &opts->max_time_ns, "parse took too long",
+                           "parse exceeds the time limit of %lu ns at line %lu",
+                           (unsigned long) opts->max_time_ns, (unsigned long) token->start_mark.line + 1);
+  }
+
+  if (retval != EASYYAML_SUCCESS)
+    yaml_token_delete(token);
+
+  return retval;
+}
+
+
+/// Scan the next token, from the parser, or from the replay of an anchored
+/// node at an alias (or an included file), or the token pushed back (see
+/// \ref unscan_tok). Anchors, aliases and includes are dealt with here, so
+/// are never returned.
+
+int scan_tok (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  if (ctx->has_pending) {
+    *token = ctx->pending;
+    ctx->has_pending = 0;
+    ctx->mark = token->start_mark;
+
+    return EASYYAML_SUCCESS;
+  }
+
+  easyyaml_anchors * anchors = &ctx->anchors;
+  int retval;
+
+  while (1) {
+    int have_token = 1;
+
+    if (anchors->replays_count > 0) {
+      retval = replay_tok(ctx, token, &have_token);
+      if (retval == EASYYAML_SUCCESS && have_token && include_tag(ctx, token))
+        retval = include_start(ctx, token, &have_token);
+    } else if ((retval = ctx->profile == NULL ? parser_tok(ctx, token) : profile_scan(ctx, token)) != EASYYAML_SUCCESS) {
+      return retval;
+    } else if (token->type == YAML_ANCHOR_TOKEN) {
+      retval = anchor_start(ctx, token);
+      have_token = 0;
+    } else if (token->type == YAML_ALIAS_TOKEN) {
+      retval = anchor_alias(ctx, token, &have_token);
+    } else if (include_tag(ctx, token)) {
+      retval = include_start(ctx, token, &have_token);
+    } else if (anchors->active_count > 0) {
+      if ((retval = anchor_record(ctx, token, 0)) != EASYYAML_SUCCESS)
+        yaml_token_delete(token);
+    }
+
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+    if (have_token)
+      break;
+  }
+
+  ctx->mark = token->start_mark;
+  if (ctx->tokens_left != 0)
+    ctx->tokens_left--;
+  if (ctx->limited)
+    return check_limits(ctx, token);
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Scan the next token from the parser.
+
+int parser_tok (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  if (ctx->json != NULL) {
+    if (json_tok(ctx->json, token))
+      return EASYYAML_SUCCESS;
+
+    return error_handler(EASYYAML_ERROR_JSON, ctx->json, "invalid JSON", "%s", ctx->json->errmsg);
+  }
+  if (ctx->msgpack != NULL) {
+    if (msgpack_tok(ctx->msgpack, token))
+      return EASYYAML_SUCCESS;
+
+    return error_handler(EASYYAML_ERROR_MSGPACK, ctx->msgpack, "invalid MessagePack", "%s", ctx->msgpack->errmsg);
+  }
+
+  int scan_tok_retval = yaml_parser_scan(ctx->parser, token);
+
+  if (scan_tok_retval != 0)
+    return EASYYAML_SUCCESS;
+
+  // A read or decompression error fails the scan, report the cause.
+  if (ctx->input != NULL && ctx->input->err_code != EASYYAML_SUCCESS)
+    return error_handler(ctx->input->err_code, ctx->input, ctx->input->errmsg, "%s", ctx->input->errmsg);
+
+  int retval = error_handler(EASYYAML_ERROR_LIBYAML_SCAN, &scan_tok_retval,
+                             "yaml_parser_scan() returned error",
+                             "error scanning token (yaml_parser_scan() returned %d)",
+                             scan_tok_retval);
+
+  easyyaml_log(EASYYAML_LOG_LEVEL_TRACE, "YAML scan read token %s", tok_to_str(token->type));
+
+  return retval;
+}
+
+
+/// Decode the next token of the innermost replay, setting \p have_token
+/// if there is one (otherwise the replay is complete, or an alias in it
+/// has started another). The tokens take the mark of the alias.
+
+int replay_tok (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+  easyyaml_replay * replay = &anchors->replays[anchors->replays_count - 1];
+  const unsigned char * p = anchors->list[replay->anchor].buf + replay->pos;
+
+  *have_token = 0;
+
+  if (replay->pos == replay->end) {
+    anchors->replays_count--;
+    return EASYYAML_SUCCESS;
+  }
+
+  int type = *p++;
+
+  if (type == YAML_ALIAS_TOKEN) {
+    size_t alias;
+    memcpy(&alias, p, sizeof(alias));
+    replay->pos += 1 + sizeof(alias);
+
+    return replay_push(ctx, anchors->list[replay->anchor].base + alias, replay->mark);
+  }
+
+  memset(token, 0, sizeof(*token));
+  token->type       = type;
+  token->start_mark = replay->mark;
+  token->end_mark   = replay->mark;
+
+  if (type == YAML_SCALAR_TOKEN) {
+    size_t len;
+    memcpy(&len, p + 1, sizeof(len));
+
+    // Tokens are freed by libyaml, which uses plain malloc and free.
+    unsigned char * value = (unsigned char *) malloc(len + 1);
+    if (value == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &len, "out of memory", "out of memory replaying alias");
+    memcpy(value, p + 1 + sizeof(len), len);
+    value[len] = '\0';
+
+    token->data.scalar.value  = value;
+    token->data.scalar.length = len;
+    token->data.scalar.style  = (yaml_scalar_style_t) p[0];
+    replay->pos += 2 + sizeof(len) + len;
+  } else if (type == YAML_TAG_TOKEN) {
+    size_t handle_len;
+    size_t suffix_len;
+    memcpy(&handle_len, p, sizeof(handle_len));
+    memcpy(&suffix_len, p + sizeof(handle_len) + handle_len, sizeof(suffix_len));
+
+    unsigned char * handle = (unsigned char *) malloc(handle_len + 1);
+    unsigned char * suffix = (unsigned char *) malloc(suffix_len + 1);
+    if (handle == NULL || suffix == NULL) {
+      free(handle);
+      free(suffix);
+      return error_handler(EASYYAML_ERROR_NOMEM, &suffix_len, "out of memory", "out of memory replaying alias");
+    }
+    memcpy(handle, p + sizeof(handle_len), handle_len);
+    handle[handle_len] = '\0';
+    memcpy(suffix, p + 2 * sizeof(handle_len) + handle_len, suffix_len);
+    suffix[suffix_len] = '\0';
+
+    token->data.tag.handle = handle;
+    token->data.tag.suffix = suffix;
+    replay->pos += 1 + 2 * sizeof(handle_len) + handle_len + suffix_len;
+  } else {
+    replay->pos++;
+  }
+
+  *have_token = 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Start a replay of (complete) anchor \p anchor, for an alias at \p mark.
+
+int replay_push (easyyaml_ctx * ctx, size_t anchor, yaml_mark_t mark)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+
+  if (anchors->replays_count == anchors->replays_size) {
+    size_t size = anchors->replays_size == 0 ? 8 : anchors->replays_size * 2;
+    easyyaml_replay * replays = (easyyaml_replay *) realloc(anchors->replays, size * sizeof(easyyaml_replay));
+    if (replays == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory replaying alias");
+    anchors->replays      = replays;
+    anchors->replays_size = size;
+  }
+
+  easyyaml_replay * replay = &anchors->replays[anchors->replays_count++];
+  replay->anchor = anchor;
+  replay->pos    = 0;
+  replay->end    = anchors->list[anchor].len;
+  replay->mark   = mark;
+  replay->include = 0;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Start capturing the node following anchor \p token (which is consumed).
+
+int anchor_start (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+  const char * name = (const char *) token->data.anchor.value;
+  size_t id;
+
+  int retval = intern_key(&anchors->names, name, strlen(name), &id);
+  yaml_token_delete(token);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  if (id >= anchors->latest_size) {
+    size_t size = anchors->latest_size == 0 ? 16 : anchors->latest_size * 2;
+    size_t * latest = (size_t *) realloc(anchors->latest, size * sizeof(size_t));
+    if (latest == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing anchors");
+    anchors->latest      = latest;
+    anchors->latest_size = size;
+  }
+
+  if (anchors->active_count == anchors->active_size) {
+    size_t size = anchors->active_size == 0 ? 8 : anchors->active_size * 2;
+    size_t * active = (size_t *) realloc(anchors->active, size * sizeof(size_t));
+    if (active == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing anchors");
+    anchors->active      = active;
+    anchors->active_size = size;
+  }
+
+  size_t anchor;
+  if ((retval = anchor_new(anchors, &anchor)) != EASYYAML_SUCCESS)
+    return retval;
+  anchors->latest[id] = anchor;
+  anchors->active[anchors->active_count++] = anchor;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Add an anchor (empty and pending) to the list, setting \p anchor to its
+/// index.
+
+int anchor_new (easyyaml_anchors * anchors, size_t * anchor)
+{
+  if (anchors->count == anchors->size) {
+    size_t size = anchors->size == 0 ? 16 : anchors->size * 2;
+    easyyaml_anchor * list = (easyyaml_anchor *) realloc(anchors->list, size * sizeof(easyyaml_anchor));
+    if (list == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing anchors");
+    anchors->list = list;
+    anchors->size = size;
+  }
+
+  memset(&anchors->list[anchors->count], 0, sizeof(easyyaml_anchor));
+  anchors->list[anchors->count].state = ANCHOR_PENDING;
+  *anchor = anchors->count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Start the replay of the node anchored by the name of alias \p token
+/// (which is consumed), recording the alias in any captures in progress.
+/// If the anchor is unknown (or its node is incomplete) and the error is
+/// quashed, \p token is replaced by an empty scalar. With \c keep_aliases
+/// (loading an include) the node is not replayed, but \p token kept, with
+/// the anchor in \c alias.
+
+int anchor_alias (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+  const char * name = (const char *) token->data.alias.value;
+  size_t id;
+
+  *have_token = 0;
+
+  int retval = intern_key(&anchors->names, name, strlen(name), &id);
+  if (retval != EASYYAML_SUCCESS) {
+    yaml_token_delete(token);
+    return retval;
+  }
+
+  if (id >= anchors->latest_size || anchors->latest[id] >= anchors->count
+      || anchors->list[anchors->latest[id]].state != ANCHOR_COMPLETE) {
+    retval = error_handler(EASYYAML_ERROR_ALIAS, name, "unknown alias",
+                           "alias '%s' at line %lu refers to no (complete) anchor",
+                           name, (unsigned long) token->start_mark.line + 1);
+    yaml_mark_t mark = token->start_mark;
+    yaml_token_delete(token);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+
+    memset(token, 0, sizeof(*token));
+    token->type = YAML_SCALAR_TOKEN;
+    token->start_mark = mark;
+    token->end_mark   = mark;
+    token->data.scalar.style = YAML_PLAIN_SCALAR_STYLE;
+    if ((token->data.scalar.value = (unsigned char *) calloc(1, 1)) == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, token, "out of memory", "out of memory replacing alias");
+    *have_token = 1;
+
+    if (anchors->active_count > 0 && (retval = anchor_record(ctx, token, 0)) != EASYYAML_SUCCESS)
+      yaml_token_delete(token);
+
+    return retval;
+  }
+
+  size_t anchor = anchors->latest[id];
+  yaml_mark_t mark = token->start_mark;
+
+  if (anchors->active_count > 0)
+    retval = anchor_record(ctx, token, anchor);
+  if (retval == EASYYAML_SUCCESS && ctx->keep_aliases) {
+    ctx->alias  = anchor;
+    *have_token = 1;
+    return EASYYAML_SUCCESS;
+  }
+  yaml_token_delete(token);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  return replay_push(ctx, anchor, mark);
+}
+
+
+/// Record \p token (or, for an alias, anchor \p alias) in the captures
+/// in progress, retiring those which are then complete.
+
+int anchor_record (easyyaml_ctx * ctx, yaml_token_t * token, size_t alias)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+  int type = token->type;
+  size_t n = 0;
+
+  for (size_t i = 0; i < anchors->active_count; i++) {
+    easyyaml_anchor * anchor = &anchors->list[anchors->active[i]];
+
+    if (anchor->state == ANCHOR_PENDING) {
+      if (type == YAML_BLOCK_MAPPING_START_TOKEN || type == YAML_BLOCK_SEQUENCE_START_TOKEN)
+        anchor->state = ANCHOR_CAPTURING;
+      else if (type != YAML_SCALAR_TOKEN && type != YAML_ALIAS_TOKEN)
+        anchor->state = ANCHOR_ABANDONED;
+    } else if (type == YAML_STREAM_END_TOKEN) {
+      anchor->state = ANCHOR_ABANDONED;
+    }
+
+    if (anchor->state == ANCHOR_ABANDONED) {
+      free(anchor->buf);
+      anchor->buf = NULL;
+      anchor->len = anchor->size = 0;
+      continue;
+    }
+
+    int retval = anchor_encode(anchor, token, alias);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+
+    if (type == YAML_BLOCK_MAPPING_START_TOKEN || type == YAML_BLOCK_SEQUENCE_START_TOKEN)
+      anchor->depth++;
+    else if (type == YAML_BLOCK_END_TOKEN)
+      anchor->depth--;
+
+    if (anchor->depth == 0)
+      anchor->state = ANCHOR_COMPLETE;
+    else
+      anchors->active[n++] = anchors->active[i];
+  }
+
+  anchors->active_count = n;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Append the encoding of \p token (or, for an alias, anchor \p alias) to
+/// the captured tokens of \p anchor: its type, then for a scalar its
+/// style and value, for a tag its handle and suffix, and for an alias the
+/// anchor.
+
+int anchor_encode (easyyaml_anchor * anchor, yaml_token_t * token, size_t alias)
+{
+  int type = token->type;
+  unsigned char t = (unsigned char) type;
+  int retval = anchor_append(anchor, &t, 1);
+
+  if (retval == EASYYAML_SUCCESS && type == YAML_SCALAR_TOKEN) {
+    unsigned char style = (unsigned char) token->data.scalar.style;
+    size_t len = token->data.scalar.length;
+    if ((retval = anchor_append(anchor, &style, 1)) == EASYYAML_SUCCESS
+        && (retval = anchor_append(anchor, &len, sizeof(len))) == EASYYAML_SUCCESS)
+      retval = anchor_append(anchor, token->data.scalar.value, len);
+  } else if (retval == EASYYAML_SUCCESS && type == YAML_TAG_TOKEN) {
+    const char * handle = token->data.tag.handle == NULL ? "" : (const char *) token->data.tag.handle;
+    const char * suffix = token->data.tag.suffix == NULL ? "" : (const char *) token->data.tag.suffix;
+    size_t handle_len = strlen(handle);
+    size_t suffix_len = strlen(suffix);
+    if ((retval = anchor_append(anchor, &handle_len, sizeof(handle_len))) == EASYYAML_SUCCESS
+        && (retval = anchor_append(anchor, handle, handle_len)) == EASYYAML_SUCCESS
+        && (retval = anchor_append(anchor, &suffix_len, sizeof(suffix_len))) == EASYYAML_SUCCESS)
+      retval = anchor_append(anchor, suffix, suffix_len);
+  } else if (retval == EASYYAML_SUCCESS && type == YAML_ALIAS_TOKEN) {
+    retval = anchor_append(anchor, &alias, sizeof(alias));
+  }
+
+  return retval;
+}
+
+
+/// Append \p len bytes to the captured tokens of \p anchor.
+
+int anchor_append (easyyaml_anchor * anchor, const void * data, size_t len)
+{
+  if (anchor->len + len > anchor->size) {
+    size_t size = anchor->size == 0 ? 64 : anchor->size;
+    while (size < anchor->len + len)
+      size *= 2;
+    unsigned char * buf = (unsigned char *) realloc(anchor->buf, size);
+    if (buf == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory capturing anchor");
+    anchor->buf  = buf;
+    anchor->size = size;
+  }
+
+  memcpy(anchor->buf + anchor->len, data, len);
+  anchor->len += len;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Free the anchors of a parse, leaving them empty.
+
+void anchors_free (easyyaml_anchors * anchors)
+{
+  for (size_t i = 0; i < anchors->count; i++) {
+    if (anchors->list[i].fragment != NULL)
+      fragment_release(anchors->list[i].fragment);
+    else if (!anchors->list[i].borrowed)
+      free(anchors->list[i].buf);
+  }
+  free(anchors->list);
+  free(anchors->latest);
+  free(anchors->active);
+  free(anchors->replays);
+  symtab_free(&anchors->names);
+  memset(anchors, 0, sizeof(*anchors));
+}
+
+
+/// Whether \p token is an include tag, and includes are enabled.
+
+int include_tag (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  return token->type == YAML_TAG_TOKEN && ctx->opts != NULL && ctx->opts->includes != NULL
+      && strcmp((const char *) token->data.tag.handle, "!") == 0
+      && strcmp((const char *) token->data.tag.suffix, "include") == 0;
+}
+
+
+/// Start the replay of the file included by include tag \p token (which
+/// is consumed) and the path following it, from the same source. The
+/// file becomes an anchor, so a capture in progress records it as an
+/// alias, and its tokens take the mark of the include.
+
+int include_start (easyyaml_ctx * ctx, yaml_token_t * token, int * have_token)
+{
+  easyyaml_anchors * anchors = &ctx->anchors;
+  int replayed = anchors->replays_count > 0;
+  unsigned long line = (unsigned long) token->start_mark.line + 1;
+  yaml_mark_t mark = token->start_mark;
+  yaml_token_t path;
+  int have_path = 1;
+  int retval;
+
+  *have_token = 0;
+  yaml_token_delete(token);
+
+  memset(&path, 0, sizeof(path));
+  if (replayed)
+    retval = replay_tok(ctx, &path, &have_path);
+  else
+    retval = parser_tok(ctx, &path);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  if (!have_path || path.type != YAML_SCALAR_TOKEN) {
+    if (have_path)
+      yaml_token_delete(&path);
+    return error_handler(EASYYAML_ERROR_INCLUDE, &mark, "include without a path",
+                         "!include at line %lu is not followed by a path", line);
+  }
+
+  // An include nested this deep in included files is most likely a cycle.
+  size_t depth = 0;
+  for (size_t i = 0; i < anchors->replays_count; i++)
+    depth += anchors->replays[i].include;
+  if (depth >= INCLUDE_MAX_DEPTH) {
+    retval = error_handler(EASYYAML_ERROR_INCLUDE, path.data.scalar.value, "includes nested too deep",
+                           "include of %s at line %lu nested too deep (a cycle?)",
+                           (char *) path.data.scalar.value, line);
+    yaml_token_delete(&path);
+    return retval;
+  }
+
+  easyyaml_fragment * fragment;
+  retval = include_get(ctx->opts->includes, (const char *) path.data.scalar.value, &fragment);
+  yaml_token_delete(&path);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  size_t anchor;
+  if ((retval = anchor_new(anchors, &anchor)) != EASYYAML_SUCCESS) {
+    fragment_release(fragment);
+    return retval;
+  }
+  anchors->list[anchor].buf      = fragment->buf;
+  anchors->list[anchor].len      = fragment->len;
+  anchors->list[anchor].state    = ANCHOR_COMPLETE;
+  anchors->list[anchor].base     = anchor + 1;
+  anchors->list[anchor].fragment = fragment;
+
+  // The fragment's anchors follow it, for the aliases in it to refer to.
+  for (size_t i = 0; i < fragment->anchors_count; i++) {
+    size_t local;
+    if ((retval = anchor_new(anchors, &local)) != EASYYAML_SUCCESS)
+      return retval;
+    anchors->list[local].buf      = fragment->anchors[i].buf;
+    anchors->list[local].len      = fragment->anchors[i].len;
+    anchors->list[local].state    = fragment->anchors[i].state;
+    anchors->list[local].base     = anchor + 1;
+    anchors->list[local].borrowed = 1;
+  }
+
+  if (!replayed && anchors->active_count > 0) {
+    yaml_token_t alias;
+    memset(&alias, 0, sizeof(alias));
+    alias.type = YAML_ALIAS_TOKEN;
+    if ((retval = anchor_record(ctx, &alias, anchor)) != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  if ((retval = replay_push(ctx, anchor, mark)) != EASYYAML_SUCCESS)
+    return retval;
+  anchors->replays[anchors->replays_count - 1].include = 1;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Get the fragment of the file at \p path (relative to the base directory
+/// of \p includes, unless absolute), with a reference the caller must
+/// release, from the cache if it is current, otherwise loading it (and
+/// replacing any older version in the cache).
+
+int include_get (easyyaml_includes * includes, const char * path, easyyaml_fragment ** fragment)
+{
+  size_t base_len = includes->base_dir == NULL || path[0] == '/' ? 0 : strlen(includes->base_dir);
+  char * filename = (char *) malloc(base_len + strlen(path) + 2);
+  struct stat st;
+  int retval;
+
+  if (filename == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, path, "out of memory", "out of memory including %s", path);
+  if (base_len > 0)
+    sprintf(filename, "%s/%s", includes->base_dir, path);
+  else
+    strcpy(filename, path);
+
+  if (stat(filename, &st) != 0) {
+    retval = error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno),
+                           "error opening included file %s (%s)", filename, strerror(errno));
+    free(filename);
+    return retval;
+  }
+
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_lock(&includes->lock);
+#endif
+  for (size_t i = 0; i < includes->count; i++) {
+    easyyaml_fragment * cached = includes->list[i];
+    if (cached->dev == st.st_dev && cached->ino == st.st_ino && cached->size == st.st_size
+        && cached->mtime == st.st_mtim.tv_sec && cached->mtime_ns == st.st_mtim.tv_nsec) {
+      cached->refs++;
+      includes->hits++;
+#ifdef EASYYAML_WITH_THREADS
+      pthread_mutex_unlock(&includes->lock);
+#endif
+      free(filename);
+      *fragment = cached;
+      return EASYYAML_SUCCESS;
+    }
+  }
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&includes->lock);
+#endif
+
+  // Loaded without the lock, so files load in parallel, if two parses
+  // load the same file at once the latter replaces the former.
+  retval = fragment_load(includes, filename, fragment);
+  free(filename);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_lock(&includes->lock);
+#endif
+  size_t i;
+  for (i = 0; i < includes->count; i++) {
+    if (includes->list[i]->dev == (*fragment)->dev && includes->list[i]->ino == (*fragment)->ino)
+      break;
+  }
+  if (i == includes->count && includes->count == includes->size) {
+    size_t size = includes->size == 0 ? 16 : includes->size * 2;
+    easyyaml_fragment ** list = (easyyaml_fragment **) realloc(includes->list, size * sizeof(easyyaml_fragment *));
+    if (list == NULL) {
+#ifdef EASYYAML_WITH_THREADS
+      pthread_mutex_unlock(&includes->lock);
+#endif
+      fragment_free(*fragment);
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing include cache");
+    }
+    includes->list = list;
+    includes->size = size;
+  }
+
+  easyyaml_fragment * replaced = i < includes->count ? includes->list[i] : NULL;
+  if (replaced == NULL)
+    includes->count++;
+  includes->list[i] = *fragment;
+  (*fragment)->refs++;
+  includes->scans++;
+  if (replaced != NULL && --replaced->refs == 0)
+    fragment_free(replaced);
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&includes->lock);
+#endif
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Load the file \p filename into a new fragment (with one reference),
+/// scanning it into the encoding of its tokens, less those of the stream
+/// and document. Its aliases are kept as references to its anchors, as
+/// they are within anchored nodes, so are only expanded as the fragment is
+/// replayed (where the parse's limits apply). A file included by it is
+/// not loaded, but its path noted, to load when the fragment is replayed
+/// (or preloaded).
+
+int fragment_load (easyyaml_includes * includes, const char * filename, easyyaml_fragment ** fragment)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno),
+                         "error opening included file %s (%s)", filename, strerror(errno));
+
+  struct stat st;
+  easyyaml_fragment * frag = (easyyaml_fragment *) calloc(1, sizeof(easyyaml_fragment));
+  easyyaml_input input;
+  memset(&input, 0, sizeof(easyyaml_input));
+  input.read_fn  = &fd_read;
+  input.user     = &fd;
+  input.buf_size = DEFAULT_READ_BUFFER_LEN;
+  input.buf      = (char *) malloc(input.buf_size);
+
+  if (frag == NULL || input.buf == NULL) {
+    free(frag);
+    free(input.buf);
+    close(fd);
+    return error_handler(EASYYAML_ERROR_NOMEM, filename, "out of memory", "out of memory loading included file %s", filename);
+  }
+  if (fstat(fd, &st) != 0) {
+    int retval = error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno),
+                               "error opening included file %s (%s)", filename, strerror(errno));
+    free(frag);
+    free(input.buf);
+    close(fd);
+    return retval;
+  }
+  frag->owner    = includes;
+  frag->dev      = st.st_dev;
+  frag->ino      = st.st_ino;
+  frag->mtime    = st.st_mtim.tv_sec;
+  frag->mtime_ns = st.st_mtim.tv_nsec;
+  frag->size     = st.st_size;
+  frag->refs     = 1;
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0) {
+    free(frag);
+    free(input.buf);
+    close(fd);
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  }
+  yaml_parser_set_input(&parser, &input_read, &input);
+
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser       = &parser;
+  ctx.input        = &input;
+  ctx.keep_aliases = 1;
+
+  easyyaml_anchor enc;
+  memset(&enc, 0, sizeof(enc));
+  yaml_token_t token;
+  int included = 0;
+  int retval;
+
+  while ((retval = scan_tok(&ctx, &token)) == EASYYAML_SUCCESS) {
+    int type = token.type;
+
+    if (type == YAML_SCALAR_TOKEN && included) {
+      char ** paths = (char **) realloc(frag->paths, (frag->paths_count + 1) * sizeof(char *));
+      if (paths == NULL || (paths[frag->paths_count] = strdup((char *) token.data.scalar.value)) == NULL) {
+        if (paths != NULL)
+          frag->paths = paths;
+        yaml_token_delete(&token);
+        retval = error_handler(EASYYAML_ERROR_NOMEM, filename, "out of memory", "out of memory loading included file %s", filename);
+        break;
+      }
+      frag->paths = paths;
+      frag->paths_count++;
+    }
+    included = type == YAML_TAG_TOKEN && strcmp((const char *) token.data.tag.handle, "!") == 0
+            && strcmp((const char *) token.data.tag.suffix, "include") == 0;
+
+    if (type != YAML_STREAM_START_TOKEN && type != YAML_STREAM_END_TOKEN
+        && type != YAML_DOCUMENT_START_TOKEN && type != YAML_DOCUMENT_END_TOKEN)
+      retval = anchor_encode(&enc, &token, type == YAML_ALIAS_TOKEN ? ctx.alias : 0);
+    yaml_token_delete(&token);
+
+    if (retval != EASYYAML_SUCCESS || type == YAML_STREAM_END_TOKEN)
+      break;
+  }
+
+  if (retval == EASYYAML_SUCCESS && enc.len == 0)
+    retval = error_handler(EASYYAML_ERROR_INCLUDE, filename, "included file empty",
+                           "included file %s is empty", filename);
+
+  // The fragment keeps the anchors, which its aliases refer to.
+  frag->anchors       = ctx.anchors.list;
+  frag->anchors_count = ctx.anchors.count;
+  ctx.anchors.list  = NULL;
+  ctx.anchors.count = 0;
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+  input_free(&input);
+  close(fd);
+
+  frag->buf = enc.buf;
+  frag->len = enc.len;
+  if (retval != EASYYAML_SUCCESS) {
+    fragment_free(frag);
+    return retval;
+  }
+  *fragment = frag;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Release a reference to a fragment, freeing it with the last.
+
+void fragment_release (easyyaml_fragment * fragment)
+{
+  easyyaml_includes * includes = fragment->owner;
+
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_lock(&includes->lock);
+#endif
+  size_t refs = --fragment->refs;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&includes->lock);
+#endif
+  (void) includes;
+
+  if (refs == 0)
+    fragment_free(fragment);
+}
+
+
+/// Free a fragment.
+
+void fragment_free (easyyaml_fragment * fragment)
+{
+  for (size_t i = 0; i < fragment->paths_count; i++)
+    free(fragment->paths[i]);
+  free(fragment->paths);
+  for (size_t i = 0; i < fragment->anchors_count; i++)
+    free(fragment->anchors[i].buf);
+  free(fragment->anchors);
+  free(fragment->buf);
+  free(fragment);
+}
+
+
+/// Create an include cache, for the files included with "!include" by the
+/// parses it is given to (see \ref easyyaml_options), whose paths are
+/// relative to \p base_dir (or the working directory if NULL). Returns
+/// NULL on error.
+
+easyyaml_includes * easyyaml_includes_new (const char * base_dir)
+{
+  easyyaml_includes * includes = (easyyaml_includes *) calloc(1, sizeof(easyyaml_includes));
+  if (includes == NULL) {
+    error_handler(EASYYAML_ERROR_NOMEM, NULL, "out of memory", "out of memory allocating include cache");
+    return NULL;
+  }
+
+  if (base_dir != NULL && (includes->base_dir = strdup(base_dir)) == NULL) {
+    free(includes);
+    error_handler(EASYYAML_ERROR_NOMEM, NULL, "out of memory", "out of memory allocating include cache");
+    return NULL;
+  }
+
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_init(&includes->lock, NULL);
+#endif
+
+  return includes;
+}
+
+
+/// Load the \p count files at \p paths into an include cache (unless
+/// current already), and the files they include, and so on. The files of
+/// each level are loaded in parallel (where threads are supported).
+
+int easyyaml_includes_preload (easyyaml_includes * includes, const char ** paths, size_t count)
+{
+  easyyaml_preload preload;
+  memset(&preload, 0, sizeof(preload));
+  preload.includes = includes;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_init(&preload.lock, NULL);
+#endif
+
+  for (size_t i = 0; i < count && preload.retval == EASYYAML_SUCCESS; i++)
+    preload.retval = preload_add(&preload, paths[i]);
+
+  while (preload.retval == EASYYAML_SUCCESS && preload.next < preload.count) {
+    preload.end = preload.count;
+
+#ifdef EASYYAML_WITH_THREADS
+    pthread_t threads[INCLUDE_THREADS - 1];
+    size_t wave = preload.end - preload.next;
+    size_t started = 0;
+    while (started < INCLUDE_THREADS - 1 && started + 1 < wave
+           && pthread_create(&threads[started], NULL, &preload_worker, &preload) == 0)
+      started++;
+    preload_worker(&preload);
+    for (size_t i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+#else
+    preload_worker(&preload);
+#endif
+    preload.next = preload.end;
+  }
+
+  for (size_t i = 0; i < preload.count; i++)
+    free(preload.paths[i]);
+  free(preload.paths);
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_destroy(&preload.lock);
+#endif
+
+  return preload.retval;
+}
+
+
+/// Load the files of the current wave of a preload (see \ref
+/// easyyaml_preload) until there are none left, adding the files they
+/// include to the next.
+
+void * preload_worker (void * arg)
+{
+  easyyaml_preload * preload = (easyyaml_preload *) arg;
+
+  while (1) {
+#ifdef EASYYAML_WITH_THREADS
+    pthread_mutex_lock(&preload->lock);
+#endif
+    const char * path = preload->next < preload->end && preload->retval == EASYYAML_SUCCESS
+                      ? preload->paths[preload->next++] : NULL;
+#ifdef EASYYAML_WITH_THREADS
+    pthread_mutex_unlock(&preload->lock);
+#endif
+    if (path == NULL)
+      break;
+
+    easyyaml_fragment * fragment = NULL;
+    int retval = include_get(preload->includes, path, &fragment);
+
+#ifdef EASYYAML_WITH_THREADS
+    pthread_mutex_lock(&preload->lock);
+#endif
+    if (retval == EASYYAML_SUCCESS) {
+      for (size_t i = 0; i < fragment->paths_count && retval == EASYYAML_SUCCESS; i++)
+        retval = preload_add(preload, fragment->paths[i]);
+    }
+    if (retval != EASYYAML_SUCCESS && preload->retval == EASYYAML_SUCCESS)
+      preload->retval = retval;
+#ifdef EASYYAML_WITH_THREADS
+    pthread_mutex_unlock(&preload->lock);
+#endif
+
+    if (fragment != NULL)
+      fragment_release(fragment);
+  }
+
+  return NULL;
+}
+
+
+/// Add \p path to the paths of a preload, unless seen already (the lock
+/// is held).
+
+int preload_add (easyyaml_preload * preload, const char * path)
+{
+  for (size_t i = 0; i < preload->count; i++) {
+    if (strcmp(preload->paths[i], path) == 0)
+      return EASYYAML_SUCCESS;
+  }
+
+  if (preload->count == preload->size) {
+    size_t size = preload->size == 0 ? 16 : preload->size * 2;
+    char ** paths = (char **) realloc(preload->paths, size * sizeof(char *));
+    if (paths == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory preloading includes");
+    preload->paths = paths;
+    preload->size  = size;
+  }
+
+  if ((preload->paths[preload->count] = strdup(path)) == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, path, "out of memory", "out of memory preloading includes");
+  preload->count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Get the number of files an include cache has scanned, and the number
+/// of includes it has served without scanning.
+
+void easyyaml_includes_stats (easyyaml_includes * includes, size_t * scans, size_t * hits)
+{
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_lock(&includes->lock);
+#endif
+  *scans = includes->scans;
+  *hits  = includes->hits;
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_unlock(&includes->lock);
+#endif
+}
+
+
+/// Free an include cache, which no parse may still be using.
+
+void easyyaml_includes_free (easyyaml_includes * includes)
+{
+  if (includes == NULL)
+    return;
+
+  for (size_t i = 0; i < includes->count; i++)
+    fragment_free(includes->list[i]);
+  free(includes->list);
+  free(includes->base_dir);
+#ifdef EASYYAML_WITH_THREADS
+  pthread_mutex_destroy(&includes->lock);
+#endif
+  free(includes);
+}
+
+
+/// Parse a stack of \p count layered YAML files against a schema, each
+/// overriding the ones before, as \ref easyyaml_parse_layers_opts.
+
+int easyyaml_parse_layers (const char ** filenames, size_t count, easyyaml_schema * ys, void * cfg)
+{
+  return easyyaml_parse_layers_opts(filenames, count, ys, cfg, NULL);
+}
+
+
+/// Parse a stack of \p count layered YAML files against a schema, with
+/// options. The files are merged as they are read, the maps of later files
+/// merged into those of earlier ones, and their scalars and lists replacing
+/// those at the same path, then the result is parsed (by replaying it as
+/// an anchored node is), so each handler is called once, with the winning
+/// value.
+
+int easyyaml_parse_layers_opts (const char ** filenames, size_t count, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts)
+{
+  easyyaml_layers layers;
+  memset(&layers, 0, sizeof(layers));
+
+  size_t root;
+  int retval = layers_node(&layers, &root);
+  if (retval == EASYYAML_SUCCESS)
+    layers.nodes[root].type = LAYER_MAP;
+
+  for (size_t i = 0; i < count && retval == EASYYAML_SUCCESS; i++)
+    retval = layers_read(&layers, filenames[i], opts);
+
+  easyyaml_anchor enc;
+  memset(&enc, 0, sizeof(enc));
+  if (retval == EASYYAML_SUCCESS)
+    retval = layers_encode(&layers, &enc);
+  layers_free(&layers);
+  if (retval != EASYYAML_SUCCESS) {
+    free(enc.buf);
+    return retval;
+  }
+
+  // The parser is never read, the whole document being replayed.
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0) {
+    free(enc.buf);
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  }
+  yaml_parser_set_input_string(&parser, (const unsigned char *) "", 0);
+
+  easyyaml_engine engine;
+  engine_init(&engine, &parser, NULL, ys, cfg, opts);
+
+  size_t anchor;
+  yaml_mark_t mark;
+  memset(&mark, 0, sizeof(mark));
+  if ((retval = anchor_new(&engine.ctx.anchors, &anchor)) == EASYYAML_SUCCESS) {
+    engine.ctx.anchors.list[anchor].buf   = enc.buf;
+    engine.ctx.anchors.list[anchor].len   = enc.len;
+    engine.ctx.anchors.list[anchor].state = ANCHOR_COMPLETE;
+    enc.buf = NULL;
+    retval = replay_push(&engine.ctx, anchor, mark);
+  }
+  free(enc.buf);
+
+  if (retval == EASYYAML_SUCCESS)
+    retval = engine_run(&engine);
+
+  engine_free(&engine);
+  yaml_parser_delete(&parser);
+
+  return retval;
+}
+
+
+/// Read the layer \p filename into a layered document.
+
+int layers_read (easyyaml_layers * layers, const char * filename, const easyyaml_options * opts)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return error_handler(EASYYAML_ERROR_FILEOPEN, filename, strerror(errno), "error opening config file (%s)", strerror(errno));
+
+  easyyaml_input input;
+  memset(&input, 0, sizeof(easyyaml_input));
+  input.read_fn    = &fd_read;
+  input.user       = &fd;
+  input.buf_size   = opts == NULL || opts->read_buffer_size == 0 ? DEFAULT_READ_BUFFER_LEN : opts->read_buffer_size;
+  input.decompress = opts == NULL ? EASYYAML_DECOMPRESS_NONE : opts->decompress;
+
+  input.buf = (char *) malloc(input.buf_size);
+  if (input.buf == NULL) {
+    close(fd);
+    return error_handler(EASYYAML_ERROR_NOMEM, &input.buf_size, "out of memory", "out of memory allocating read buffer");
+  }
+
+  yaml_parser_t parser;
+  int par_init_retval = yaml_parser_initialize(&parser);
+  if (par_init_retval == 0) {
+    free(input.buf);
+    close(fd);
+    return error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                         "yaml_parser_initialize() returned error",
+                         "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+  }
+  yaml_parser_set_input(&parser, &input_read, &input);
+
+  // The options give the layers their includes, the limits apply to the
+  // merged document.
+  easyyaml_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.parser = &parser;
+  ctx.input  = &input;
+  ctx.opts   = opts;
+
+  int retval = layers_walk(layers, &ctx);
+
+  anchors_free(&ctx.anchors);
+  yaml_parser_delete(&parser);
+  input_free(&input);
+  close(fd);
+
+  return retval;
+}
+
+
+/// Read the tokens of a layer into a layered document. The node whose
+/// value comes next (\c target) is that of the entry whose key was just
+/// read, or of the item just started, or for a merge key the map itself.
+/// Within the layer a map's own entries override those merged into it
+/// (see \ref set_key), so the entries set are noted, as their nodes.
+
+int layers_walk (easyyaml_layers * layers, easyyaml_ctx * ctx)
+{
+  easyyaml_layer_level * levels = NULL;
+  size_t levels_size = 0;
+  size_t depth       = 0;
+  easyyaml_set_key * set = NULL;
+  size_t set_count   = 0;
+  size_t set_size    = 0;
+  size_t target      = LAYER_NIL;
+  int merge          = 0;
+  int retval         = EASYYAML_SUCCESS;
+  int done           = 0;
+
+  while (retval == EASYYAML_SUCCESS && !done) {
+    yaml_token_t token;
+
+    if ((retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      break;
+
+    easyyaml_layer_level * top = depth > 0 ? &levels[depth - 1] : NULL;
+    int type = token.type;
+
+    // An entry or item ended without a value has none.
+    if (target != LAYER_NIL && !merge && (type == YAML_KEY_TOKEN || type == YAML_BLOCK_ENTRY_TOKEN || type == YAML_BLOCK_END_TOKEN)) {
+      layers_reset(layers, target, LAYER_NONE);
+      target = LAYER_NIL;
+    }
+
+    if (top != NULL && top->want_key && type != YAML_SCALAR_TOKEN)
+      type = YAML_NO_TOKEN;
+
+    switch (type) {
+    case YAML_STREAM_START_TOKEN:
+    case YAML_DOCUMENT_START_TOKEN:
+    case YAML_DOCUMENT_END_TOKEN:
+    case YAML_VALUE_TOKEN:
+      break;
+
+    case YAML_STREAM_END_TOKEN:
+      done = 1;
+      break;
+
+    case YAML_KEY_TOKEN:
+      if (top == NULL || !top->map)
+        goto unexpected;
+      top->want_key = 1;
+      break;
+
+    case YAML_BLOCK_ENTRY_TOKEN:
+      if (top == NULL || top->map)
+        goto unexpected;
+      if ((retval = layers_node(layers, &target)) != EASYYAML_SUCCESS)
+        break;
+      if (layers->nodes[top->node].last == LAYER_NIL)
+        layers->nodes[top->node].first = target;
+      else
+        layers->nodes[layers->nodes[top->node].last].next = target;
+      layers->nodes[top->node].last = target;
+      break;
+
+    case YAML_SCALAR_TOKEN:
+      if (top != NULL && top->want_key) {
+        top->want_key = 0;
+        merge = is_merge_key(&token);
+        if (merge) {
+          target = top->node;
+          break;
+        }
+        if ((retval = layers_entry(layers, top->node, &token, &target)) != EASYYAML_SUCCESS)
+          break;
+
+        // Skip an entry merged over, and replace (rather than merge into)
+        // one merged in before the map set it.
+        int merged_over = 0;
+        int merged_in   = 0;
+        int noted       = 0;
+        for (size_t i = top->set_start; i < set_count; i++) {
+          if (set[i].key != target)
+            continue;
+          merged_over |= set[i].merges < top->merges;
+          merged_in   |= set[i].merges > top->merges;
+          noted       |= set[i].merges == top->merges;
+        }
+        if (merged_over) {
+          target = LAYER_NIL;
+          retval = skip_value(ctx);
+          break;
+        }
+        if (merged_in && !noted)
+          layers_reset(layers, target, LAYER_NONE);
+        if (!noted) {
+          if (set_count == set_size) {
+            size_t size = set_size == 0 ? 64 : set_size * 2;
+            easyyaml_set_key * new_set = (easyyaml_set_key *) realloc(set, size * sizeof(easyyaml_set_key));
+            if (new_set == NULL) {
+              retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory layering document");
+              break;
+            }
+            set      = new_set;
+            set_size = size;
+          }
+          set[set_count].key    = target;
+          set[set_count].merges = top->merges;
+          set_count++;
+        }
+        break;
+      }
+      if (target == LAYER_NIL || merge)
+        goto unexpected;
+
+      layers_reset(layers, target, LAYER_SCALAR);
+      layers->nodes[target].value     = token.data.scalar.value;
+      layers->nodes[target].value_len = token.data.scalar.length;
+      layers->nodes[target].style     = token.data.scalar.style;
+      token.data.scalar.value = NULL;
+      target = LAYER_NIL;
+      break;
+
+    case YAML_BLOCK_MAPPING_START_TOKEN:
+    case YAML_BLOCK_SEQUENCE_START_TOKEN:
+      if (depth == 0 && type == YAML_BLOCK_MAPPING_START_TOKEN)
+        target = 0;
+      if (target == LAYER_NIL || (merge && type != YAML_BLOCK_MAPPING_START_TOKEN))
+        goto unexpected;
+
+      if (depth == levels_size) {
+        size_t size = levels_size == 0 ? 32 : levels_size * 2;
+        easyyaml_layer_level * new_levels = (easyyaml_layer_level *) realloc(levels, size * sizeof(easyyaml_layer_level));
+        if (new_levels == NULL) {
+          retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting layered document");
+          break;
+        }
+        levels      = new_levels;
+        levels_size = size;
+      }
+
+      // Maps merge, lists replace, and a merge key's map is its map's.
+      if (type == YAML_BLOCK_SEQUENCE_START_TOKEN)
+        layers_reset(layers, target, LAYER_LIST);
+      else if (!merge && layers->nodes[target].type != LAYER_MAP)
+        layers_reset(layers, target, LAYER_MAP);
+
+      top = &levels[depth++];
+      top->node      = target;
+      top->map       = type == YAML_BLOCK_MAPPING_START_TOKEN;
+      top->want_key  = 0;
+      top->merges    = merge ? top[-1].merges + 1 : 0;
+      top->set_start = merge ? top[-1].set_start : set_count;
+      target = LAYER_NIL;
+      merge  = 0;
+      break;
+
+    case YAML_BLOCK_END_TOKEN:
+      if (depth > 0) {
+        if (levels[--depth].merges == 0)
+          set_count = levels[depth].set_start;
+        break;
+      }
+      // Fall through.
+
+    default:
+    unexpected: {
+      int data[2] = {token.type, YAML_SCALAR_TOKEN};
+      retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                             "unexpected token layering document",
+                             "expected libyaml block token or scalar but read %s in layer",
+                             tok_to_str(token.type));
+    }
+    }
+
+    yaml_token_delete(&token);
+  }
+
+  free(levels);
+  free(set);
+
+  return retval;
+}
+
+
+/// Add an empty node to a layered document, setting \p node to its index.
+
+int layers_node (easyyaml_layers * layers, size_t * node)
+{
+  if (layers->count == layers->size) {
+    size_t size = layers->size == 0 ? 64 : layers->size * 2;
+    easyyaml_layer_node * nodes = (easyyaml_layer_node *) realloc(layers->nodes, size * sizeof(easyyaml_layer_node));
+    if (nodes == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing layered document");
+    layers->nodes = nodes;
+    layers->size  = size;
+  }
+
+  easyyaml_layer_node * n = &layers->nodes[layers->count];
+  memset(n, 0, sizeof(easyyaml_layer_node));
+  n->first = n->last = n->next = LAYER_NIL;
+  *node = layers->count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Find the entry of map \p map with key \p key (whose value is taken if
+/// the entry is new), adding it if there is none, setting \p node to it.
+
+int layers_entry (easyyaml_layers * layers, size_t map, yaml_token_t * key, size_t * node)
+{
+  size_t len = 2 * sizeof(size_t) + key->data.scalar.length;
+
+  if (len > layers->keybuf_size) {
+    size_t size = layers->keybuf_size == 0 ? 256 : layers->keybuf_size;
+    while (size < len)
+      size *= 2;
+    unsigned char * keybuf = (unsigned char *) realloc(layers->keybuf, size);
+    if (keybuf == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing layered document");
+    layers->keybuf      = keybuf;
+    layers->keybuf_size = size;
+  }
+  memcpy(layers->keybuf, &map, sizeof(size_t));
+  memcpy(layers->keybuf + sizeof(size_t), &layers->nodes[map].gen, sizeof(size_t));
+  memcpy(layers->keybuf + 2 * sizeof(size_t), key->data.scalar.value, key->data.scalar.length);
+
+  size_t id;
+  size_t count = layers->keys.count;
+  int retval = intern_key(&layers->keys, (const char *) layers->keybuf, len, &id);
+  if (retval != EASYYAML_SUCCESS)
+    return retval;
+
+  if (id < count) {
+    *node = layers->bindings[id];
+    return EASYYAML_SUCCESS;
+  }
+
+  if (id >= layers->bindings_size) {
+    size_t size = layers->bindings_size == 0 ? 64 : layers->bindings_size * 2;
+    size_t * bindings = (size_t *) realloc(layers->bindings, size * sizeof(size_t));
+    if (bindings == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory growing layered document");
+    layers->bindings      = bindings;
+    layers->bindings_size = size;
+  }
+
+  if ((retval = layers_node(layers, node)) != EASYYAML_SUCCESS)
+    return retval;
+  layers->bindings[id] = *node;
+
+  easyyaml_layer_node * n = &layers->nodes[*node];
+  n->key       = key->data.scalar.value;
+  n->key_len   = key->data.scalar.length;
+  n->key_style = key->data.scalar.style;
+  key->data.scalar.value = NULL;
+
+  if (layers->nodes[map].last == LAYER_NIL)
+    layers->nodes[map].first = *node;
+  else
+    layers->nodes[layers->nodes[map].last].next = *node;
+  layers->nodes[map].last = *node;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Reset \p node to an empty node of type \p type (keeping its key and
+/// its place in its map or list), dropping its value or entries.
+
+void layers_reset (easyyaml_layers * layers, size_t node, int type)
+{
+  easyyaml_layer_node * n = &layers->nodes[node];
+
+  free(n->value);
+  n->value = NULL;
+  n->value_len = 0;
+  n->type  = type;
+  n->first = n->last = LAYER_NIL;
+  n->gen++;
+}
+
+
+/// Encode a layered document as the tokens libyaml would scan from it, in
+/// the form of an anchored node (see \ref anchor_record). The entries of
+/// maps are in the order their keys were first read.
+
+int layers_encode (easyyaml_layers * layers, easyyaml_anchor * enc)
+{
+  size_t * stack = (size_t *) malloc(64 * sizeof(size_t));
+  size_t stack_size = 64;
+  size_t depth = 0;
+  int retval;
+
+  if (stack == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &stack_size, "out of memory", "out of memory encoding layered document");
+
+  // Each level holds the container and the next of its children to write.
+  if ((retval = layers_put(enc, YAML_STREAM_START_TOKEN, NULL, 0, 0)) == EASYYAML_SUCCESS
+      && (retval = layers_put(enc, YAML_BLOCK_MAPPING_START_TOKEN, NULL, 0, 0)) == EASYYAML_SUCCESS) {
+    stack[depth++] = 0;
+    stack[depth++] = layers->nodes[0].first;
+  }
+
+  while (retval == EASYYAML_SUCCESS && depth > 0) {
+    size_t parent = stack[depth - 2];
+    size_t child  = stack[depth - 1];
+
+    if (child == LAYER_NIL) {
+      retval = layers_put(enc, YAML_BLOCK_END_TOKEN, NULL, 0, 0);
+      depth -= 2;
+      continue;
+    }
+
+    easyyaml_layer_node * n = &layers->nodes[child];
+    stack[depth - 1] = n->next;
+
+    if (layers->nodes[parent].type == LAYER_MAP) {
+      if ((retval = layers_put(enc, YAML_KEY_TOKEN, NULL, 0, 0)) != EASYYAML_SUCCESS
+          || (retval = layers_put(enc, YAML_SCALAR_TOKEN, n->key, n->key_len, n->key_style)) != EASYYAML_SUCCESS
+          || (retval = layers_put(enc, YAML_VALUE_TOKEN, NULL, 0, 0)) != EASYYAML_SUCCESS)
+        break;
+    } else if ((retval = layers_put(enc, YAML_BLOCK_ENTRY_TOKEN, NULL, 0, 0)) != EASYYAML_SUCCESS) {
+      break;
+    }
+
+    if (n->type == LAYER_SCALAR) {
+      retval = layers_put(enc, YAML_SCALAR_TOKEN, n->value, n->value_len, n->style);
+    } else if (n->type == LAYER_MAP || n->type == LAYER_LIST) {
+      retval = layers_put(enc, n->type == LAYER_MAP ? YAML_BLOCK_MAPPING_START_TOKEN : YAML_BLOCK_SEQUENCE_START_TOKEN, NULL, 0, 0);
+
+      if (retval == EASYYAML_SUCCESS && depth + 2 > stack_size) {
+        size_t size = stack_size * 2;
+        size_t * new_stack = (size_t *) realloc(stack, size * sizeof(size_t));
+        if (new_stack == NULL) {
+          retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory encoding layered document");
+          break;
+        }
+        stack      = new_stack;
+        stack_size = size;
+      }
+      stack[depth++] = child;
+      stack[depth++] = n->first;
+    }
+  }
+
+  if (retval == EASYYAML_SUCCESS)
+    retval = layers_put(enc, YAML_STREAM_END_TOKEN, NULL, 0, 0);
+  free(stack);
+
+  return retval;
+}
+
+
+/// Append a token of type \p type (and for a scalar, \p value of \p len
+/// with \p style) to an encoding.
+
+int layers_put (easyyaml_anchor * enc, int type, const unsigned char * value, size_t len, int style)
+{
+  yaml_token_t token;
+
+  memset(&token, 0, sizeof(token));
+  token.type = type;
+  if (type == YAML_SCALAR_TOKEN) {
+    token.data.scalar.value  = (unsigned char *) (value == NULL ? (const unsigned char *) "" : value);
+    token.data.scalar.length = len;
+    token.data.scalar.style  = (yaml_scalar_style_t) style;
+  }
+
+  return anchor_encode(enc, &token, 0);
+}
+
+
+/// Free a layered document.
+
+void layers_free (easyyaml_layers * layers)
+{
+  for (size_t i = 0; i < layers->count; i++) {
+    free(layers->nodes[i].key);
+    free(layers->nodes[i].value);
+  }
+  free(layers->nodes);
+  free(layers->bindings);
+  free(layers->keybuf);
+  symtab_free(&layers->keys);
+}
+
+
+/// Produce the next token of JSON input, returning zero (with the error
+/// in \c errmsg) if the JSON is invalid. Objects and arrays become block
+/// mappings and sequences, strings double quoted scalars, and numbers
+/// and literals plain scalars.
+
+int json_tok (easyyaml_json * json, yaml_token_t * token)
+{
+  memset(token, 0, sizeof(*token));
+
+  if (json->state != JSON_START)
+    json_skip_ws(json);
+
+  token->start_mark.index  = json->pos;
+  token->start_mark.line   = json->line;
+  token->start_mark.column = json->pos - json->line_start;
+  token->end_mark          = token->start_mark;
+
+  int c = json->pos < json->len ? json->buf[json->pos] : -1;
+  char top = json->depth == 0 ? 0 : json->stack[json->depth - 1];
+
+  switch (json->state) {
+  case JSON_START:
+    token->type = YAML_STREAM_START_TOKEN;
+    token->data.stream_start.encoding = YAML_UTF8_ENCODING;
+    json->state = JSON_VALUE;
+    return 1;
+
+  case JSON_VALUE:
+    if (c == '{' || c == '[') {
+      if (!json_push(json, (char) c))
+        return 0;
+      json->pos++;
+      token->type = c == '{' ? YAML_BLOCK_MAPPING_START_TOKEN : YAML_BLOCK_SEQUENCE_START_TOKEN;
+      json->state = c == '{' ? JSON_OBJ_FIRST : JSON_ARR_FIRST;
+      return 1;
+    }
+    json->state = JSON_AFTER;
+    return c == '"' ? json_string(json, token) : json_literal(json, token);
+
+  case JSON_OBJ_FIRST:
+    if (c == '}') {
+      json->depth--;
+      json->pos++;
+      token->type = YAML_BLOCK_END_TOKEN;
+      json->state = JSON_AFTER;
+      return 1;
+    }
+    token->type = YAML_KEY_TOKEN;
+    json->state = JSON_KEY;
+    return 1;
+
+  case JSON_KEY:
+    if (c != '"')
+      return json_error(json, "a string key");
+    json->state = JSON_COLON;
+    return json_string(json, token);
+
+  case JSON_COLON:
+    if (c != ':')
+      return json_error(json, "':'");
+    json->pos++;
+    token->type = YAML_VALUE_TOKEN;
+    json->state = JSON_VALUE;
+    return 1;
+
+  case JSON_ARR_FIRST:
+    if (c == ']') {
+      json->depth--;
+      json->pos++;
+      token->type = YAML_BLOCK_END_TOKEN;
+      json->state = JSON_AFTER;
+      return 1;
+    }
+    token->type = YAML_BLOCK_ENTRY_TOKEN;
+    json->state = JSON_VALUE;
+    return 1;
+
+  case JSON_AFTER:
+    if (top == 0) {
+      if (c != -1)
+        return json_error(json, "the end of the input");
+      token->type = YAML_STREAM_END_TOKEN;
+      json->state = JSON_DONE;
+      return 1;
+    }
+    if (c == ',') {
+      json->pos++;
+      token->type = top == '{' ? YAML_KEY_TOKEN : YAML_BLOCK_ENTRY_TOKEN;
+      json->state = top == '{' ? JSON_KEY : JSON_VALUE;
+      return 1;
+    }
+    if (c != (top == '{' ? '}' : ']'))
+      return json_error(json, top == '{' ? "',' or '}'" : "',' or ']'");
+    json->depth--;
+    json->pos++;
+    token->type = YAML_BLOCK_END_TOKEN;
+    return 1;
+
+  default:
+    token->type = YAML_STREAM_END_TOKEN;
+    return 1;
+  }
+}
+
+
+/// Skip JSON whitespace, counting lines. With SSE2 sixteen bytes are
+/// classified at a time, which pays off for indented JSON.
+
+void json_skip_ws (easyyaml_json * json)
+{
+  const unsigned char * buf = json->buf;
+  size_t pos = json->pos;
+  size_t len = json->len;
+
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  while (pos + 16 <= len && buf[pos] <= ' ') {
+    __m128i v = _mm_loadu_si128((const __m128i *) (buf + pos));
+    __m128i v_nl = _mm_cmpeq_epi8(v, nl);
+    __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+                              _mm_or_si128(v_nl, _mm_cmpeq_epi8(v, cr)));
+    unsigned int ws_mask = (unsigned int) _mm_movemask_epi8(ws);
+    unsigned int nl_mask = (unsigned int) _mm_movemask_epi8(v_nl);
+    unsigned int skip = ws_mask == 0xffff ? 16 : (unsigned int) __builtin_ctz(~ws_mask);
+
+    nl_mask &= (1u << skip) - 1;
+    if (nl_mask != 0) {
+      json->line += __builtin_popcount(nl_mask);
+      json->line_start = pos + 32 - __builtin_clz(nl_mask);
+    }
+    pos += skip;
+    if (skip < 16) {
+      json->pos = pos;
+      return;
+    }
+  }
+#endif
+
+  for (; pos < len; pos++) {
+    if (buf[pos] == '\n') {
+      json->line++;
+      json->line_start = pos + 1;
+    } else if (buf[pos] != ' ' && buf[pos] != '\t' && buf[pos] != '\r') {
+      break;
+    }
+  }
+
+  json->pos = pos;
+}
+
+
+/// Read a JSON string (at its opening quote) into a double quoted scalar
+/// \p token, unescaping it. With SSE2 the run up to the first quote,
+/// backslash or control character is found sixteen bytes at a time, and
+/// copied in one go.
+
+int json_string (easyyaml_json * json, yaml_token_t * token)
+{
+  const unsigned char * buf = json->buf;
+  size_t len = json->len;
+  size_t pos = ++json->pos;
+  unsigned char * out = NULL;
+  size_t out_len = 0;
+  size_t out_size = 0;
+
+  while (1) {
+    size_t run = pos;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    while (run + 16 <= len) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (buf + run));
+      __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                  _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+      unsigned int mask = (unsigned int) _mm_movemask_epi8(stop);
+      if (mask != 0) {
+        run += __builtin_ctz(mask);
+        break;
+      }
+      run += 16;
+    }
+#endif
+    while (run < len && buf[run] != '"' && buf[run] != '\\' && buf[run] >= 0x20)
+      run++;
+
+    if (run == len) {
+      free(out);
+      json->pos = run;
+      return json_error(json, "'\"' closing string");
+    }
+    if (buf[run] < 0x20) {
+      free(out);
+      json->pos = run;
+      return json_error(json, "no control characters in string");
+    }
+
+    // Room for the run, and for an escape (at most four bytes of UTF-8).
+    if (out_len + (run - pos) + 5 > out_size) {
+      size_t size = out_size == 0 ? 32 : out_size;
+      while (size < out_len + (run - pos) + 5)
+        size *= 2;
+      unsigned char * out2 = (unsigned char *) realloc(out, size);
+      if (out2 == NULL) {
+        free(out);
+        snprintf(json->errmsg, sizeof(json->errmsg), "out of memory reading string at line %lu",
+                 (unsigned long) json->line + 1);
+        return 0;
+      }
+      out = out2;
+      out_size = size;
+    }
+    memcpy(out + out_len, buf + pos, run - pos);
+    out_len += run - pos;
+    pos = run + 1;
+
+    if (buf[run] == '"')
+      break;
+
+    // An escape.
+    int c = pos < len ? buf[pos++] : -1;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      out[out_len++] = (unsigned char) c;
+      continue;
+    case 'b':
+      out[out_len++] = '\b';
+      continue;
+    case 'f':
+      out[out_len++] = '\f';
+      continue;
+    case 'n':
+      out[out_len++] = '\n';
+      continue;
+    case 'r':
+      out[out_len++] = '\r';
+      continue;
+    case 't':
+      out[out_len++] = '\t';
+      continue;
+    case 'u':
+      break;
+    default:
+      free(out);
+      json->pos = pos - 1;
+      return json_error(json, "a valid escape");
+    }
+
+    unsigned long cp = 0;
+    for (int units = 0; units < 2; units++) {
+      unsigned long u = 0;
+      for (int i = 0; i < 4; i++, pos++) {
+        int h = pos < len ? buf[pos] : -1;
+        int d = h >= '0' && h <= '9' ? h - '0' : h >= 'a' && h <= 'f' ? h - 'a' + 10 : h >= 'A' && h <= 'F' ? h - 'A' + 10 : -1;
+        if (d < 0) {
+          free(out);
+          json->pos = pos;
+          return json_error(json, "four hex digits");
+        }
+        u = u << 4 | (unsigned long) d;
+      }
+      if (units == 0) {
+        cp = u;
+        if (cp == 0) {
+          free(out);
+          json->pos = pos - 6;
+          return json_error(json, "no NUL characters in string");
+        }
+        if (cp >= 0xdc00 && cp <= 0xdfff) {
+          free(out);
+          json->pos = pos - 6;
+          return json_error(json, "a high surrogate before a low surrogate");
+        }
+        if (cp < 0xd800 || cp > 0xdbff)
+          break;
+        if (pos + 1 >= len || buf[pos] != '\\' || buf[pos + 1] != 'u') {
+          free(out);
+          json->pos = pos;
+          return json_error(json, "a low surrogate");
+        }
+        pos += 2;
+      } else if (u < 0xdc00 || u > 0xdfff) {
+        free(out);
+        json->pos = pos;
+        return json_error(json, "a low surrogate");
+      } else {
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (u - 0xdc00);
+      }
+    }
+
+    if (cp < 0x80) {
+      out[out_len++] = (unsigned char) cp;
+    } else if (cp < 0x800) {
+      out[out_len++] = (unsigned char) (0xc0 | cp >> 6);
+      out[out_len++] = (unsigned char) (0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+      out[out_len++] = (unsigned char) (0xe0 | cp >> 12);
+      out[out_len++] = (unsigned char) (0x80 | (cp >> 6 & 0x3f));
+      out[out_len++] = (unsigned char) (0x80 | (cp & 0x3f));
+    } else {
+      out[out_len++] = (unsigned char) (0xf0 | cp >> 18);
+      out[out_len++] = (unsigned char) (0x80 | (cp >> 12 & 0x3f));
+      out[out_len++] = (unsigned char) (0x80 | (cp >> 6 & 0x3f));
+      out[out_len++] = (unsigned char) (0x80 | (cp & 0x3f));
+    }
+  }
+
+  if (out == NULL && (out = (unsigned char *) malloc(1)) == NULL) {
+    snprintf(json->errmsg, sizeof(json->errmsg), "out of memory reading string at line %lu",
+             (unsigned long) json->line + 1);
+    return 0;
+  }
+  out[out_len] = '\0';
+
+  json->pos = pos;
+  token->type = YAML_SCALAR_TOKEN;
+  token->data.scalar.value  = out;
+  token->data.scalar.length = out_len;
+  token->data.scalar.style  = YAML_DOUBLE_QUOTED_SCALAR_STYLE;
+
+  return 1;
+}
+
+
+/// Read a JSON number, or true, false or null, into a plain scalar \p token.
+
+int json_literal (easyyaml_json * json, yaml_token_t * token)
+{
+  const unsigned char * buf = json->buf;
+  size_t len = json->len;
+  size_t start = json->pos;
+  size_t pos = start;
+
+  if (pos < len && (buf[pos] == 't' || buf[pos] == 'f' || buf[pos] == 'n')) {
+    const char * word = buf[pos] == 't' ? "true" : buf[pos] == 'f' ? "false" : "null";
+    size_t word_len = strlen(word);
+    if (len - pos < word_len || memcmp(buf + pos, word, word_len) != 0)
+      return json_error(json, "a value");
+    pos += word_len;
+  } else {
+    if (pos < len && buf[pos] == '-')
+      pos++;
+    if (pos < len && buf[pos] == '0') {
+      pos++;
+    } else if (pos < len && buf[pos] >= '1' && buf[pos] <= '9') {
+      while (pos < len && buf[pos] >= '0' && buf[pos] <= '9')
+        pos++;
+    } else {
+      json->pos = pos;
+      return json_error(json, "a value");
+    }
+    if (pos < len && buf[pos] == '.') {
+      size_t digits = ++pos;
+      while (pos < len && buf[pos] >= '0' && buf[pos] <= '9')
+        pos++;
+      if (pos == digits) {
+        json->pos = pos;
+        return json_error(json, "a digit");
+      }
+    }
+    if (pos < len && (buf[pos] == 'e' || buf[pos] == 'E')) {
+      pos++;
+      if (pos < len && (buf[pos] == '+' || buf[pos] == '-'))
+        pos++;
+      size_t digits = pos;
+      while (pos < len && buf[pos] >= '0' && buf[pos] <= '9')
+        pos++;
+      if (pos == digits) {
+        json->pos = pos;
+        return json_error(json, "a digit");
+      }
+    }
+  }
+
+  unsigned char * value = (unsigned char *) malloc(pos - start + 1);
+  if (value == NULL) {
+    snprintf(json->errmsg, sizeof(json->errmsg), "out of memory reading value at line %lu",
+             (unsigned long) json->line + 1);
+    return 0;
+  }
+  memcpy(value, buf + start, pos - start);
+  value[pos - start] = '\0';
+
+  json->pos = pos;
+  token->type = YAML_SCALAR_TOKEN;
+  token->data.scalar.value  = value;
+  token->data.scalar.length = pos - start;
+  token->data.scalar.style  = YAML_PLAIN_SCALAR_STYLE;
+
+  return 1;
+}
+
+
+/// Push the \p bracket of an object or array being opened.
+
+int json_push (easyyaml_json * json, char bracket)
+{
+  if (json->depth == json->stack_size) {
+    size_t size = json->stack_size == 0 ? 32 : json->stack_size * 2;
+    char * stack = (char *) realloc(json->stack, size);
+    if (stack == NULL) {
+      snprintf(json->errmsg, sizeof(json->errmsg), "out of memory nesting at line %lu",
+               (unsigned long) json->line + 1);
+      return 0;
+    }
+    json->stack      = stack;
+    json->stack_size = size;
+  }
+
+  json->stack[json->depth++] = bracket;
+
+  return 1;
+}
+
+
+/// Set the error message for invalid JSON, where \p expected was expected
+/// at the current position, returning zero.
+
+int json_error (easyyaml_json * json, const char * expected)
+{
+  snprintf(json->errmsg, sizeof(json->errmsg), "invalid JSON at line %lu column %lu, expected %s",
+           (unsigned long) json->line + 1, (unsigned long) (json->pos - json->line_start + 1), expected);
+
+  return 0;
+}
+
+
+/// Produce the next token of MessagePack input, returning zero (with the
+/// error in \c errmsg) if it is invalid. Maps and arrays become block
+/// mappings and sequences, and everything else a plain scalar.
+
+int msgpack_tok (easyyaml_msgpack * mp, yaml_token_t * token)
+{
+  while (1) {
+    memset(token, 0, sizeof(*token));
+
+    // There are no lines, so the column is the offset.
+    token->start_mark.index  = mp->pos;
+    token->start_mark.column = mp->pos;
+    token->end_mark          = token->start_mark;
+
+    easyyaml_msgpack_level * top = mp->depth == 0 ? NULL : &mp->stack[mp->depth - 1];
+    size_t count;
+    int container;
+
+    switch (mp->state) {
+    case MSGPACK_START:
+      token->type = YAML_STREAM_START_TOKEN;
+      token->data.stream_start.encoding = YAML_UTF8_ENCODING;
+      mp->state = MSGPACK_VALUE;
+      return 1;
+
+    case MSGPACK_VALUE:
+      if ((container = msgpack_container(mp, &count)) < 0)
+        return 0;
+      mp->state = MSGPACK_AFTER;
+      if (container == 0 && mp->buf[mp->pos] == 0xc0) {
+        mp->pos++;
+        continue;
+      } else if (container == 0) {
+        return msgpack_scalar(mp, token);
+      }
+      if (mp->depth == mp->stack_size) {
+        size_t size = mp->stack_size == 0 ? 32 : mp->stack_size * 2;
+        easyyaml_msgpack_level * stack = (easyyaml_msgpack_level *) realloc(mp->stack, size * sizeof(easyyaml_msgpack_level));
+        if (stack == NULL) {
+          snprintf(mp->errmsg, sizeof(mp->errmsg), "out of memory nesting at offset %lu",
+                   (unsigned long) mp->pos);
+          return 0;
+        }
+        mp->stack      = stack;
+        mp->stack_size = size;
+      }
+      mp->stack[mp->depth].count = count;
+      mp->stack[mp->depth].map   = container == 1;
+      mp->depth++;
+      token->type = container == 1 ? YAML_BLOCK_MAPPING_START_TOKEN : YAML_BLOCK_SEQUENCE_START_TOKEN;
+      return 1;
+
+    case MSGPACK_KEY:
+      if ((container = msgpack_container(mp, &count)) < 0)
+        return 0;
+      if (container != 0 || mp->buf[mp->pos] == 0xc0)
+        return msgpack_error(mp, "a scalar key");
+      mp->state = MSGPACK_COLON;
+      return msgpack_scalar(mp, token);
+
+    case MSGPACK_COLON:
+      token->type = YAML_VALUE_TOKEN;
+      mp->state = MSGPACK_VALUE;
+      return 1;
+
+    case MSGPACK_AFTER:
+      if (top == NULL) {
+        token->type = YAML_STREAM_END_TOKEN;
+        mp->state = MSGPACK_DONE;
+      } else if (top->count == 0) {
+        mp->depth--;
+        token->type = YAML_BLOCK_END_TOKEN;
+      } else {
+        top->count--;
+        token->type = top->map ? YAML_KEY_TOKEN : YAML_BLOCK_ENTRY_TOKEN;
+        mp->state = top->map ? MSGPACK_KEY : MSGPACK_VALUE;
+      }
+      return 1;
+
+    default:
+      token->type = YAML_STREAM_END_TOKEN;
+      return 1;
+    }
+  }
+}
+
+
+/// Read a MessagePack string, binary, number or boolean into a plain
+/// scalar \p token, numbers and booleans as they would be written in YAML.
+
+int msgpack_scalar (easyyaml_msgpack * mp, yaml_token_t * token)
+{
+  const unsigned char * p = mp->buf + mp->pos;
+  unsigned char c = p[0];
+  size_t head = 1;
+  size_t body = 0;
+  char num[32];
+  const unsigned char * data = (const unsigned char *) num;
+
+  if (c <= 0x7f) {
+    snprintf(num, sizeof(num), "%d", c);
+  } else if (c >= 0xe0) {
+    snprintf(num, sizeof(num), "%d", (int) (signed char) c);
+  } else if (c == 0xc2 || c == 0xc3) {
+    snprintf(num, sizeof(num), "%s", c == 0xc3 ? "true" : "false");
+  } else if (c >= 0xa0 && c <= 0xbf) {
+    body = c & 0x1f;
+    data = p + head;
+  } else if (c == 0xd9 || c == 0xda || c == 0xdb || c == 0xc4 || c == 0xc5 || c == 0xc6) {
+    head += c == 0xd9 || c == 0xc4 ? 1 : c == 0xda || c == 0xc5 ? 2 : 4;
+    if (!msgpack_need(mp, head))
+      return 0;
+    body = msgpack_be(p + 1, head - 1);
+    data = p + head;
+  } else if (c >= 0xcc && c <= 0xd3) {
+    head += (size_t) 1 << ((c - 0xcc) & 3);
+    if (!msgpack_need(mp, head))
+      return 0;
+    uint64_t v = msgpack_be(p + 1, head - 1);
+    if (c <= 0xcf) {
+      snprintf(num, sizeof(num), "%llu", (unsigned long long) v);
+    } else {
+      // Sign extend the big endian two's complement value.
+      int shift = 64 - 8 * (int) (head - 1);
+      snprintf(num, sizeof(num), "%lld", (long long) ((int64_t) (v << shift) >> shift));
+    }
+  } else if (c == 0xca || c == 0xcb) {
+    head += c == 0xca ? 4 : 8;
+    if (!msgpack_need(mp, head))
+      return 0;
+    uint64_t v = msgpack_be(p + 1, head - 1);
+    if (c == 0xca) {
+      uint32_t v32 = (uint32_t) v;
+      float f;
+      memcpy(&f, &v32, sizeof(f));
+      snprintf(num, sizeof(num), "%.9g", f);
+    } else {
+      double d;
+      memcpy(&d, &v, sizeof(d));
+      snprintf(num, sizeof(num), "%.17g", d);
+    }
+  } else {
+    return msgpack_error(mp, "a supported type");
+  }
+
+  if (!msgpack_need(mp, head + body))
+    return 0;
+
+  size_t len = data == (const unsigned char *) num ? strlen(num) : body;
+  unsigned char * value = (unsigned char *) malloc(len + 1);
+  if (value == NULL) {
+    snprintf(mp->errmsg, sizeof(mp->errmsg), "out of memory reading value at offset %lu",
+             (unsigned long) mp->pos);
+    return 0;
+  }
+  if (len > 0)
+    memcpy(value, data, len);
+  value[len] = '\0';
+
+  mp->pos += head + body;
+  token->type = YAML_SCALAR_TOKEN;
+  token->data.scalar.value  = value;
+  token->data.scalar.length = len;
+  token->data.scalar.style  = YAML_PLAIN_SCALAR_STYLE;
+
+  return 1;
+}
+
+
+/// Read the header of a MessagePack map or array, setting \p count to its
+/// number of entries or items, returning 1 for a map, 2 for an array,
+/// zero for any other value (which is not read) and -1 on error.
+
+int msgpack_container (easyyaml_msgpack * mp, size_t * count)
+{
+  if (!msgpack_need(mp, 1))
+    return -1;
+
+  unsigned char c = mp->buf[mp->pos];
+  int type = (c & 0xf0) == 0x80 || c == 0xde || c == 0xdf ? 1
+           : (c & 0xf0) == 0x90 || c == 0xdc || c == 0xdd ? 2
+           : 0;
+  if (type == 0)
+    return 0;
+
+  size_t head = c == 0xde || c == 0xdc ? 3 : c == 0xdf || c == 0xdd ? 5 : 1;
+  if (!msgpack_need(mp, head))
+    return -1;
+  *count = head == 1 ? (size_t) (c & 0x0f) : (size_t) msgpack_be(mp->buf + mp->pos + 1, head - 1);
+  mp->pos += head;
+
+  return type;
+}
+
+
+/// Check there are at least \p n more bytes of MessagePack input, returning
+/// zero (with the error in \c errmsg) if not.
+
+int msgpack_need (easyyaml_msgpack * mp, size_t n)
+{
+  if (mp->len - mp->pos >= n)
+    return 1;
+
+  return msgpack_error(mp, "more input");
+}
+
+
+/// Read the \p n byte big endian unsigned integer at \p p.
+
+uint64_t msgpack_be (const unsigned char * p, size_t n)
+{
+  uint64_t v = 0;
+
+  for (size_t i = 0; i < n; i++)
+    v = v << 8 | p[i];
+
+  return v;
+}
+
+
+/// Set the error message for invalid MessagePack, where \p expected was
+/// expected at the current position, returning zero.
+
+int msgpack_error (easyyaml_msgpack * mp, const char * expected)
+{
+  snprintf(mp->errmsg, sizeof(mp->errmsg), "invalid MessagePack at offset %lu, expected %s",
+           (unsigned long) mp->pos, expected);
+
+  return 0;
+}
+
+
+/// Convert the YAML tokens of \p ctx to MessagePack in \p out.
+
+int msgpack_convert (easyyaml_ctx * ctx, easyyaml_msgpack_out * out)
+{
+  // Set where a node is due, which if empty is written as nil.
+  int node_due = 0;
+
+  while (1) {
+    yaml_token_t token;
+    int scan_tok_retval;
+    int retval = EASYYAML_SUCCESS;
+
+    if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      return scan_tok_retval;
+
+    int type = token.type;
+    if (node_due && type != YAML_SCALAR_TOKEN && type != YAML_BLOCK_MAPPING_START_TOKEN
+        && type != YAML_BLOCK_SEQUENCE_START_TOKEN) {
+      if ((retval = msgpack_reserve(out, 1)) != EASYYAML_SUCCESS) {
+        yaml_token_delete(&token);
+        return retval;
+      }
+      out->buf[out->len++] = 0xc0;
+    }
+    node_due = 0;
+
+    switch (type) {
+    case YAML_STREAM_START_TOKEN:
+    case YAML_VALUE_TOKEN:
+      node_due = 1;
+      break;
+
+    case YAML_STREAM_END_TOKEN:
+      yaml_token_delete(&token);
+      return msgpack_finish(out);
+
+    case YAML_KEY_TOKEN:
+    case YAML_BLOCK_ENTRY_TOKEN:
+      if (out->depth > 0)
+        out->levels[out->depth - 1].count++;
+      node_due = 1;
+      break;
+
+    case YAML_SCALAR_TOKEN:
+      retval = msgpack_put_scalar(out, &token);
+      break;
+
+    case YAML_BLOCK_MAPPING_START_TOKEN:
+    case YAML_BLOCK_SEQUENCE_START_TOKEN:
+      if (out->depth == out->levels_size) {
+        size_t size = out->levels_size == 0 ? 32 : out->levels_size * 2;
+        easyyaml_msgpack_level * levels = (easyyaml_msgpack_level *) realloc(out->levels, size * sizeof(easyyaml_msgpack_level));
+        if (levels == NULL) {
+          retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting MessagePack");
+          break;
+        }
+        out->levels      = levels;
+        out->levels_size = size;
+      }
+      if (out->headers_count == out->headers_size) {
+        size_t size = out->headers_size == 0 ? 32 : out->headers_size * 2;
+        easyyaml_msgpack_header * headers = (easyyaml_msgpack_header *) realloc(out->headers, size * sizeof(easyyaml_msgpack_header));
+        if (headers == NULL) {
+          retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting MessagePack");
+          break;
+        }
+        out->headers      = headers;
+        out->headers_size = size;
+      }
+      out->headers[out->headers_count].start = out->len;
+      out->levels[out->depth].start = out->headers_count++;
+      out->levels[out->depth].count = 0;
+      out->levels[out->depth].map   = type == YAML_BLOCK_MAPPING_START_TOKEN;
+      out->depth++;
+      break;
+
+    case YAML_BLOCK_END_TOKEN:
+      if (out->depth > 0) {
+        retval = msgpack_close(out);
+        break;
+      }
+      // Fall through.
+
+    default: {
+      int data[2] = {type, YAML_SCALAR_TOKEN};
+      retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                             "unexpected token converting to MessagePack",
+                             "expected libyaml block token or scalar but read %s",
+                             tok_to_str(type));
+    }
+    }
+
+    yaml_token_delete(&token);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+}
+
+
+/// Write the scalar \p token as MessagePack, as an integer or boolean if
+/// it is a plain one (written the way it would be read back).
+
+int msgpack_put_scalar (easyyaml_msgpack_out * out, yaml_token_t * token)
+{
+  const char * value = (const char * ) token->data.scalar.value;
+  size_t len = token->data.scalar.length;
+  int retval;
+
+  if (token->data.scalar.style == YAML_PLAIN_SCALAR_STYLE) {
+    if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+      if ((retval = msgpack_reserve(out, 1)) != EASYYAML_SUCCESS)
+        return retval;
+      out->buf[out->len++] = value[0] == 't' ? 0xc3 : 0xc2;
+
+      return EASYYAML_SUCCESS;
+    }
+
+    // Only integers in canonical form, so they are read back unchanged.
+    const char * digits = value[0] == '-' ? value + 1 : value;
+    size_t n = strspn(digits, "0123456789");
+    if (n > 0 && n <= 18 && digits[n] == '\0' && (digits[0] != '0' || (n == 1 && digits == value))) {
+      long long v = strtoll(value, NULL, 10);
+      unsigned char * p;
+
+      if ((retval = msgpack_reserve(out, 9)) != EASYYAML_SUCCESS)
+        return retval;
+      p = out->buf + out->len;
+      if (v >= -32 && v <= 127) {
+        p[0] = (unsigned char) v;
+        out->len += 1;
+      } else {
+        int bytes = v >= INT8_MIN && v <= INT8_MAX ? 1 : v >= INT16_MIN && v <= INT16_MAX ? 2
+                  : v >= INT32_MIN && v <= INT32_MAX ? 4 : 8;
+        p[0] = bytes == 1 ? 0xd0 : bytes == 2 ? 0xd1 : bytes == 4 ? 0xd2 : 0xd3;
+        for (int i = 0; i < bytes; i++)
+          p[1 + i] = (unsigned char) ((uint64_t) v >> (8 * (bytes - 1 - i)));
+        out->len += 1 + bytes;
+      }
+
+      return EASYYAML_SUCCESS;
+    }
+  }
+
+  if ((retval = msgpack_put_header(out, 0xa0, len)) != EASYYAML_SUCCESS
+      || (retval = msgpack_reserve(out, len)) != EASYYAML_SUCCESS)
+    return retval;
+  if (len > 0)
+    memcpy(out->buf + out->len, value, len);
+  out->len += len;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Write the header of a string (\p base 0xa0), map (0x80) or array (0x90)
+/// of size \p n, in the smallest form.
+
+int msgpack_put_header (easyyaml_msgpack_out * out, int base, size_t n)
+{
+  int retval;
+
+  if ((retval = msgpack_reserve(out, 5)) != EASYYAML_SUCCESS)
+    return retval;
+  out->len += msgpack_header(out->buf + out->len, base, n);
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Encode the header of a string, map or array (as for
+/// \ref msgpack_put_header) at \p p, returning its length (at most five).
+
+size_t msgpack_header (unsigned char * p, int base, size_t n)
+{
+  size_t fix = base == 0xa0 ? 32 : 16;
+
+  if (n < fix) {
+    p[0] = (unsigned char) (base | n);
+    return 1;
+  } else if (base == 0xa0 && n < 0x100) {
+    p[0] = 0xd9;
+    p[1] = (unsigned char) n;
+    return 2;
+  } else if (n < 0x10000) {
+    p[0] = base == 0xa0 ? 0xda : base == 0x80 ? 0xde : 0xdc;
+    p[1] = (unsigned char) (n >> 8);
+    p[2] = (unsigned char) n;
+    return 3;
+  } else {
+    p[0] = base == 0xa0 ? 0xdb : base == 0x80 ? 0xdf : 0xdd;
+    p[1] = (unsigned char) (n >> 24);
+    p[2] = (unsigned char) (n >> 16);
+    p[3] = (unsigned char) (n >> 8);
+    p[4] = (unsigned char) n;
+    return 5;
+  }
+}
+
+
+/// Close the innermost map or array, setting its header aside.
+
+int msgpack_close (easyyaml_msgpack_out * out)
+{
+  easyyaml_msgpack_level * level = &out->levels[--out->depth];
+  easyyaml_msgpack_header * header = &out->headers[level->start];
+
+  header->len = (unsigned char) msgpack_header(header->bytes, level->map ? 0x80 : 0x90, level->count);
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Put the headers of all the maps and arrays in place, working back from
+/// the end so that each byte is moved once.
+
+int msgpack_finish (easyyaml_msgpack_out * out)
+{
+  size_t extra = 0;
+  int retval;
+
+  for (size_t i = 0; i < out->headers_count; i++)
+    extra += out->headers[i].len;
+  if ((retval = msgpack_reserve(out, extra)) != EASYYAML_SUCCESS)
+    return retval;
+
+  size_t end = out->len;
+  size_t dst = out->len + extra;
+  for (size_t i = out->headers_count; i-- > 0;) {
+    const easyyaml_msgpack_header * header = &out->headers[i];
+
+    dst -= end - header->start;
+    memmove(out->buf + dst, out->buf + header->start, end - header->start);
+    dst -= header->len;
+    memcpy(out->buf + dst, header->bytes, header->len);
+    end = header->start;
+  }
+  out->len += extra;
+  out->headers_count = 0;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Make room for \p n more bytes of MessagePack output.
+
+int msgpack_reserve (easyyaml_msgpack_out * out, size_t n)
+{
+  if (out->size - out->len >= n)
+    return EASYYAML_SUCCESS;
+
+  size_t size = out->size == 0 ? 1024 : out->size;
+  while (size - out->len < n)
+    size *= 2;
+
+  unsigned char * buf = (unsigned char *) realloc(out->buf, size);
+  if (buf == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory writing MessagePack");
+
+  out->buf  = buf;
+  out->size = size;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Emit the entries of the map (or records map) \p ys for \p cfg, whose
+/// node is \p stack, at \p indent.
+
+int emit_map (easyyaml_emitter * em, easyyaml_schema * ys, easyyaml_stack * stack, size_t indent, void * cfg)
+{
+  int retval;
+
+  for (; ys->type != EASYYAML_SCHEMA_END; ys++) {
+    easyyaml_emit_value val;
+
+    // A fixed key is asked for once, a variable key until there are no more.
+    for (size_t i = 0; ys->key == NULL || i == 0; i++) {
+      memset(&val, 0, sizeof(val));
+      val.cfg = cfg;
+      if (!em->getter(stack, ys, i, &val, cfg))
+        break;
+
+      const char * key = ys->key != NULL ? ys->key : val.key;
+      if (key == NULL)
+        return error_handler(EASYYAML_ERROR_SCHEMA_INVALID, ys, "no key to emit",
+                             "no key for variable key entry %s at %s", ys->descr, easyyaml_stack_path(stack));
+      if ((retval = emit_node(em, ys, key, &val, stack, indent)) != EASYYAML_SUCCESS)
+        return retval;
+    }
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Emit the map entry with \p key (or the list item, if NULL) and value
+/// \p val against schema entry \p ys, in the map or list whose node is
+/// \p stack, at \p indent.
+
+int emit_node (easyyaml_emitter * em, easyyaml_schema * ys, const char * key, easyyaml_emit_value * val, easyyaml_stack * stack, size_t indent)
+{
+  char num[16];
+  int retval;
+
+  if (ys->type == EASYYAML_SCHEMA_STR || ys->type == EASYYAML_SCHEMA_INT || ys->type == EASYYAML_SCHEMA_ENUM) {
+    const char * str = val->str;
+    size_t len;
+
+    if (ys->type == EASYYAML_SCHEMA_INT) {
+      len = (size_t) snprintf(num, sizeof(num), "%d", val->num);
+      str = num;
+    } else if (ys->type == EASYYAML_SCHEMA_ENUM) {
+      const easyyaml_enum_value * ev = ((easyyaml_enum *) ys->data)->values;
+      while (ev->name != NULL && ev->value != val->num)
+        ev++;
+      if (ev->name == NULL)
+        return error_handler(EASYYAML_ERROR_SCHEMA_INVALID, ys, "no enum value to emit",
+                             "no value of %s for %d at %s", ys->descr, val->num, easyyaml_stack_path(stack));
+      str = ev->name;
+      len = strlen(str);
+    } else if (str == NULL) {
+      return error_handler(EASYYAML_ERROR_SCHEMA_INVALID, ys, "no string to emit",
+                           "no string for %s at %s", ys->descr, easyyaml_stack_path(stack));
+    } else {
+      len = strlen(str);
+    }
+
+    if ((retval = emit_line_start(em, key, indent)) != EASYYAML_SUCCESS
+        || (retval = emit_scalar(em, str, len)) != EASYYAML_SUCCESS)
+      return retval;
+
+    return emit_put(em, "\n", 1);
+  }
+
+  // The map or list header is pending until something is written in it,
+  // and dropped if nothing is.
+  size_t level = em->headers_count;
+  if ((retval = emit_header(em, key, indent)) != EASYYAML_SUCCESS)
+    return retval;
+
+  // A map entry is a node of its own, a list item shares the list's.
+  easyyaml_stack node;
+  easyyaml_stack * child = stack;
+  if (key != NULL) {
+    node.key  = (char *) key;
+    node.prev = stack;
+    node.id   = EASYYAML_NOID;
+    node.hash = stack_hash(stack->hash, key, strlen(key));
+    child = &node;
+  }
+
+  if (ys->type == EASYYAML_SCHEMA_MAP) {
+    retval = emit_map(em, (easyyaml_schema *) ys->data, child, indent + 2, val->cfg);
+  } else if (ys->type == EASYYAML_SCHEMA_LST) {
+    easyyaml_schema * item_ys = (easyyaml_schema *) ys->data;
+    easyyaml_emit_value item;
+
+    for (size_t i = 0; retval == EASYYAML_SUCCESS && item_ys->type != EASYYAML_SCHEMA_END; i++) {
+      memset(&item, 0, sizeof(item));
+      item.cfg = val->cfg;
+      if (!em->getter(child, item_ys, i, &item, val->cfg))
+        break;
+      retval = emit_node(em, item_ys, NULL, &item, child, indent + 2);
+    }
+  } else if (ys->type == EASYYAML_SCHEMA_REC || ys->type == EASYYAML_SCHEMA_RECS) {
+    // The records are bound, so emitted straight from the array.
+    for (size_t i = 0; retval == EASYYAML_SUCCESS && i < val->rec_count; i++) {
+      char * rec = (char *) val->recs + i * ys->rec_size;
+      easyyaml_stack rec_node;
+      size_t rec_level = em->headers_count;
+
+      memcpy(&rec_node.key, rec + ys->rec_key_offset, sizeof(rec_node.key));
+      rec_node.prev = child;
+      rec_node.id   = i;
+      rec_node.hash = rec_node.key == NULL ? child->hash : stack_hash(child->hash, rec_node.key, strlen(rec_node.key));
+      if (rec_node.key == NULL)
+        retval = error_handler(EASYYAML_ERROR_SCHEMA_INVALID, ys, "no key to emit",
+                               "no key for record %lu of %s at %s", (unsigned long) i, ys->descr, easyyaml_stack_path(child));
+      if (retval == EASYYAML_SUCCESS)
+        retval = emit_header(em, rec_node.key, indent + 2);
+      if (retval == EASYYAML_SUCCESS)
+        retval = emit_map(em, (easyyaml_schema *) ys->data, &rec_node, indent + 4, rec);
+      em->headers_count = rec_level;
+      if (em->headers_written > rec_level)
+        em->headers_written = rec_level;
+    }
+  } else {
+    retval = error_handler(EASYYAML_ERROR_SCHEMA_INVALID, ys, "invalid schema type",
+                           "invalid type %d for %s at %s", ys->type, ys->descr, easyyaml_stack_path(stack));
+  }
+
+  em->headers_count = level;
+  if (em->headers_written > level)
+    em->headers_written = level;
+
+  return retval;
+}
+
+
+/// Add a pending map or list header, a \p key (or a list item indicator,
+/// if NULL) at \p indent.
+
+int emit_header (easyyaml_emitter * em, const char * key, size_t indent)
+{
+  if (em->headers_count == em->headers_size) {
+    size_t size = em->headers_size == 0 ? 16 : em->headers_size * 2;
+    easyyaml_emit_header * headers = (easyyaml_emit_header *) realloc(em->headers, size * sizeof(easyyaml_emit_header));
+    if (headers == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting emitted YAML");
+    em->headers      = headers;
+    em->headers_size = size;
+  }
+
+  em->headers[em->headers_count].key    = key;
+  em->headers[em->headers_count].indent = indent;
+  em->headers_count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Start a line for a map entry with \p key (or a list item, if NULL) at
+/// \p indent, first writing any pending headers. Following a list item
+/// indicator, its first entry goes on the same line.
+
+int emit_line_start (easyyaml_emitter * em, const char * key, size_t indent)
+{
+  static const char spaces[] = "                                ";
+  int retval;
+
+  while (em->headers_written <= em->headers_count) {
+    int is_header = em->headers_written < em->headers_count;
+    const char * line_key = is_header ? em->headers[em->headers_written].key : key;
+    size_t line_indent = is_header ? em->headers[em->headers_written].indent : indent;
+
+    if (em->in_item) {
+      em->in_item = 0;
+    } else {
+      for (size_t n = line_indent; n > 0; n -= n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1)
+        if ((retval = emit_put(em, spaces, n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1)) != EASYYAML_SUCCESS)
+          return retval;
+    }
+
+    if (line_key == NULL) {
+      retval = emit_put(em, "- ", 2);
+      em->in_item = is_header;
+    } else if ((retval = emit_scalar(em, line_key, strlen(line_key))) == EASYYAML_SUCCESS) {
+      retval = is_header ? emit_put(em, ":\n", 2) : emit_put(em, ": ", 2);
+    }
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+
+    if (!is_header)
+      break;
+    em->headers_written++;
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Characters which may be in a plain scalar, as a bitmap (letters, digits,
+/// space, "_./+-=()$;,<>^~@", and UTF-8 beyond ASCII, less what
+/// \ref emit_utf8 finds must be escaped).
+
+static const uint32_t emit_plain_chars[8] = {
+  0x00000000, 0x7bfffb11, 0xc7ffffff, 0x47fffffe, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff
+};
+
+
+/// Write a scalar, plain if it would be read back unchanged, otherwise
+/// double quoted and escaped.
+
+int emit_scalar (easyyaml_emitter * em, const char * str, size_t len)
+{
+  const unsigned char * s = (const unsigned char *) str;
+  int plain = len > 0 && s[len - 1] != ' ' && s[0] != ' ' && s[0] != '.' && s[0] != '<' && s[0] != '>'
+              && s[0] != '~' && s[0] != '@' && (s[0] != '-' || (len > 1 && s[1] != ' '));
+  size_t i;
+
+  for (i = 0; plain && i < len; i++) {
+    plain = (emit_plain_chars[s[i] >> 5] >> (s[i] & 31)) & 1;
+    if (plain && s[i] >= 0x80) {
+      char esc[8];
+      i += emit_utf8(s + i, len - i, esc) - 1;
+      plain = esc[0] == '\0';
+    }
+  }
+
+  if (plain)
+    return emit_put(em, str, len);
+
+  int retval = emit_put(em, "\"", 1);
+  size_t run = 0;
+
+  // Copy runs of characters which need no escaping in one go.
+  for (i = 0; retval == EASYYAML_SUCCESS && i < len; i++) {
+    unsigned char c = s[i];
+    size_t n = 1;
+    char esc[8];
+
+    if (c >= 0x80) {
+      n = emit_utf8(s + i, len - i, esc);
+      if (esc[0] == '\0') {
+        i += n - 1;
+        continue;
+      }
+    } else if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f) {
+      continue;
+    } else if (c == '"' || c == '\\') {
+      snprintf(esc, sizeof(esc), "\\%c", c);
+    } else if (c == '\n' || c == '\t' || c == '\r') {
+      snprintf(esc, sizeof(esc), "\\%c", c == '\n' ? 'n' : c == '\t' ? 't' : 'r');
+    } else {
+      snprintf(esc, sizeof(esc), "\\x%02x", c);
+    }
+
+    if ((retval = emit_put(em, str + run, i - run)) == EASYYAML_SUCCESS)
+      retval = emit_put(em, esc, strlen(esc));
+    i += n - 1;
+    run = i + 1;
+  }
+
+  if (retval == EASYYAML_SUCCESS)
+    retval = emit_put(em, str + run, len - run);
+  if (retval == EASYYAML_SUCCESS)
+    retval = emit_put(em, "\"", 1);
+
+  return retval;
+}
+
+
+/// Read the UTF-8 character (of the \p len bytes) at \p s, returning its
+/// length, and setting \p esc to the escape it must be written as in a
+/// double quoted scalar, or to "" if it may be written as it is. Those
+/// which libyaml would read as line breaks (NEL, LS and PS), or not read
+/// at all (C1 controls, the BOM and non-characters) are escaped. A byte
+/// which is not valid UTF-8 is escaped as the code point of its value, as
+/// nothing else can be read back.
+
+size_t emit_utf8 (const unsigned char * s, size_t len, char * esc)
+{
+  size_t n = s[0] >= 0xc2 && s[0] <= 0xdf ? 2 : s[0] >= 0xe0 && s[0] <= 0xef ? 3 : s[0] >= 0xf0 && s[0] <= 0xf4 ? 4 : 0;
+  uint32_t cp = n == 2 ? s[0] & 0x1f : n == 3 ? s[0] & 0x0f : s[0] & 0x07;
+
+  for (size_t i = 1; i < n; i++) {
+    if (i >= len || (s[i] & 0xc0) != 0x80) {
+      n = 0;
+      break;
+    }
+    cp = cp << 6 | (s[i] & 0x3f);
+  }
+
+  // Overlong forms, surrogates and beyond U+10FFFF are not valid either.
+  if (n == 0 || (n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff))) {
+    snprintf(esc, 8, "\\x%02x", s[0]);
+    return 1;
+  }
+
+  if (cp == 0x85)
+    strcpy(esc, "\\N");
+  else if (cp == 0x2028)
+    strcpy(esc, "\\L");
+  else if (cp == 0x2029)
+    strcpy(esc, "\\P");
+  else if (cp < 0xa0)
+    snprintf(esc, 8, "\\x%02x", (unsigned int) cp);
+  else if (cp == 0xfeff || cp == 0xfffe || cp == 0xffff)
+    snprintf(esc, 8, "\\u%04X", (unsigned int) (cp & 0xffff));
+  else
+    esc[0] = '\0';
+
+  return n;
+}
+
+
+/// Append \p len bytes of output, growing the buffer, or if emitting to a
+/// file descriptor, writing it out when full (and writing anything larger
+/// than the buffer straight out).
+
+int emit_put (easyyaml_emitter * em, const char * data, size_t len)
+{
+  if (em->size - em->len < len) {
+    int retval;
+
+    if (em->fd >= 0) {
+      if ((retval = emit_flush(em)) != EASYYAML_SUCCESS)
+        return retval;
+      if (len > em->size) {
+        char * buf = em->buf;
+        size_t buf_len = em->len;
+        em->buf = (char *) data;
+        em->len = len;
+        retval = emit_flush(em);
+        em->buf = buf;
+        em->len = buf_len;
+
+        return retval;
+      }
+    } else {
+      size_t size = em->size == 0 ? 4096 : em->size;
+      while (size - em->len < len)
+        size *= 2;
+
+      char * buf = (char *) realloc(em->buf, size);
+      if (buf == NULL)
+        return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory emitting YAML");
+      em->buf  = buf;
+      em->size = size;
+    }
+  }
+
+  if (len > 0)
+    memcpy(em->buf + em->len, data, len);
+  em->len += len;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Write out the output buffered for a file descriptor.
+
+int emit_flush (easyyaml_emitter * em)
+{
+  size_t pos = 0;
+
+  while (pos < em->len) {
+    ssize_t n = write(em->fd, em->buf + pos, em->len - pos);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return error_handler(EASYYAML_ERROR_WRITE, &errno, "write error",
+                           "error writing emitted YAML (%s)", strerror(errno));
+    pos += (size_t) n;
+  }
+  em->len = 0;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Build a document image from the YAML tokens of \p ctx, setting \p out
+/// to it (which the caller must free) and \p out_len to its length.
+
+int image_build (easyyaml_ctx * ctx, char ** out, size_t * out_len)
+{
+  easyyaml_image_out image;
+  memset(&image, 0, sizeof(image));
+
+  // The header is filled in at the end.
+  int retval = image_reserve(&image, IMAGE_HEADER_LEN);
+  if (retval == EASYYAML_SUCCESS) {
+    memset(image.buf, 0, IMAGE_HEADER_LEN);
+    image.len = IMAGE_HEADER_LEN;
+    retval = image_convert(ctx, &image);
+  }
+
+  free(image.offsets);
+  free(image.levels);
+
+  if (retval != EASYYAML_SUCCESS) {
+    free(image.buf);
+    return retval;
+  }
+
+  *out     = (char *) image.buf;
+  *out_len = image.len;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Convert the YAML tokens of \p ctx to document image nodes in \p out.
+
+int image_convert (easyyaml_ctx * ctx, easyyaml_image_out * out)
+{
+  // Set where a node is due, which if empty is written as a null node.
+  int node_due = 0;
+
+  while (1) {
+    yaml_token_t token;
+    int scan_tok_retval;
+    int retval = EASYYAML_SUCCESS;
+
+    if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      return scan_tok_retval;
+
+    int type = token.type;
+    if (node_due && type != YAML_SCALAR_TOKEN && type != YAML_BLOCK_MAPPING_START_TOKEN
+        && type != YAML_BLOCK_SEQUENCE_START_TOKEN) {
+      if ((retval = image_put_node(out, IMAGE_NULL, NULL, 0)) != EASYYAML_SUCCESS) {
+        yaml_token_delete(&token);
+        return retval;
+      }
+    }
+    node_due = 0;
+
+    switch (type) {
+    case YAML_STREAM_START_TOKEN:
+    case YAML_VALUE_TOKEN:
+      node_due = 1;
+      break;
+
+    case YAML_STREAM_END_TOKEN: {
+      uint32_t * header = (uint32_t *) out->buf;
+      header[0] = IMAGE_MAGIC;
+      header[1] = (uint32_t) out->len;
+      header[2] = out->offsets[0];
+      yaml_token_delete(&token);
+      return EASYYAML_SUCCESS;
+    }
+
+    case YAML_KEY_TOKEN:
+      // A key without a value has an empty one.
+      if (out->depth > 0 && (out->offsets_count - out->levels[out->depth - 1].first) % 2 != 0)
+        retval = image_put_node(out, IMAGE_NULL, NULL, 0);
+      node_due = 1;
+      break;
+
+    case YAML_BLOCK_ENTRY_TOKEN:
+      node_due = 1;
+      break;
+
+    case YAML_SCALAR_TOKEN:
+      // A merge key is marked by a zero offset, its map's entries being
+      // merged in when the map it is in is closed.
+      if (is_merge_key(&token) && out->depth > 0 && out->levels[out->depth - 1].map
+          && (out->offsets_count - out->levels[out->depth - 1].first) % 2 == 0)
+        retval = image_push_offset(out, 0);
+      else
+        retval = image_put_node(out, IMAGE_STR, (const char *) token.data.scalar.value, token.data.scalar.length);
+      break;
+
+    case YAML_BLOCK_MAPPING_START_TOKEN:
+    case YAML_BLOCK_SEQUENCE_START_TOKEN:
+      if (out->depth == out->levels_size) {
+        size_t size = out->levels_size == 0 ? 32 : out->levels_size * 2;
+        easyyaml_image_level * levels = (easyyaml_image_level *) realloc(out->levels, size * sizeof(easyyaml_image_level));
+        if (levels == NULL) {
+          retval = error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting document image");
+          break;
+        }
+        out->levels      = levels;
+        out->levels_size = size;
+      }
+      out->levels[out->depth].first = out->offsets_count;
+      out->levels[out->depth].map   = type == YAML_BLOCK_MAPPING_START_TOKEN;
+      out->depth++;
+      break;
+
+    case YAML_BLOCK_END_TOKEN:
+      if (out->depth > 0) {
+        retval = image_close(out);
+        break;
+      }
+      // Fall through.
+
+    default: {
+      int data[2] = {type, YAML_SCALAR_TOKEN};
+      retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                             "unexpected token building document image",
+                             "expected libyaml block token or scalar but read %s",
+                             tok_to_str(type));
+    }
+    }
+
+    yaml_token_delete(&token);
+    if (retval != EASYYAML_SUCCESS)
+      return retval;
+  }
+}
+
+
+/// Write a scalar or (with \p type \c IMAGE_NULL) empty node, pushing its
+/// offset.
+
+int image_put_node (easyyaml_image_out * out, uint32_t type, const char * data, size_t len)
+{
+  size_t node_len = type == IMAGE_NULL ? 8 : 8 + ((len + 4) & ~(size_t) 3);
+  int retval;
+
+  if ((retval = image_reserve(out, node_len)) != EASYYAML_SUCCESS)
+    return retval;
+
+  size_t offset = out->len;
+  uint32_t * p = (uint32_t *) (out->buf + offset);
+  p[0] = type;
+  p[1] = (uint32_t) len;
+  if (type != IMAGE_NULL) {
+    memset(out->buf + offset + node_len - 4, 0, 4);
+    if (len > 0)
+      memcpy(out->buf + offset + 8, data, len);
+  }
+  out->len += node_len;
+
+  return image_push_offset(out, offset);
+}
+
+
+/// Push the offset of a node onto the stack of children of the open maps
+/// and lists.
+
+int image_push_offset (easyyaml_image_out * out, size_t offset)
+{
+  if (out->offsets_count == out->offsets_size) {
+    size_t size = out->offsets_size == 0 ? 256 : out->offsets_size * 2;
+    uint32_t * offsets = (uint32_t *) realloc(out->offsets, size * sizeof(uint32_t));
+    if (offsets == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory building document image");
+    out->offsets      = offsets;
+    out->offsets_size = size;
+  }
+  out->offsets[out->offsets_count++] = (uint32_t) offset;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Close the innermost map or list, writing its node (with the entries
+/// of a map sorted by key) in place of its children's offsets. The
+/// entries of the maps of a map's merge keys are merged into it, except
+/// those with a key which the map has itself.
+
+int image_close (easyyaml_image_out * out)
+{
+  easyyaml_image_level * level = &out->levels[--out->depth];
+  int retval;
+
+  if (level->map && (out->offsets_count - level->first) % 2 != 0
+      && (retval = image_put_node(out, IMAGE_NULL, NULL, 0)) != EASYYAML_SUCCESS)
+    return retval;
+
+  size_t children_count = out->offsets_count - level->first;
+  const uint32_t * children = out->offsets + level->first;
+  size_t n = children_count;
+  size_t count = n / 2;
+
+  if (level->map) {
+    for (size_t i = 0; i < children_count; i += 2) {
+      if (children[i] != 0)
+        continue;
+      uint32_t merge_off = children[i + 1];
+      if (IMAGE_U32(out->buf, merge_off) != IMAGE_MAP)
+        return error_handler(EASYYAML_ERROR_IMAGE, &merge_off, "merge key value is not a map",
+                             "document image merge keys must have maps");
+      count += IMAGE_U32(out->buf, merge_off + 4);
+      count--;
+    }
+    n = 2 * count;
+  }
+
+  if ((retval = image_reserve(out, 8 + 4 * n)) != EASYYAML_SUCCESS)
+    return retval;
+
+  size_t offset = out->len;
+  uint32_t * p = (uint32_t *) (out->buf + offset);
+
+  if (level->map) {
+    easyyaml_image_entry * entries = (easyyaml_image_entry *) malloc((count == 0 ? 1 : count) * sizeof(easyyaml_image_entry));
+    if (entries == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, &count, "out of memory", "out of memory sorting document image map");
+
+    size_t entries_count = 0;
+    for (size_t i = 0; i < children_count; i += 2) {
+      uint32_t key_off = children[i];
+      if (key_off == 0) {
+        uint32_t merge_off = children[i + 1];
+        size_t merge_count = IMAGE_U32(out->buf, merge_off + 4);
+        for (size_t j = 0; j < merge_count; j++) {
+          easyyaml_image_entry * entry = &entries[entries_count++];
+          entry->key_off   = IMAGE_U32(out->buf, merge_off + 8 + 8 * j);
+          entry->value_off = IMAGE_U32(out->buf, merge_off + 12 + 8 * j);
+          entry->key       = (const char *) out->buf + entry->key_off + 8;
+          entry->key_len   = IMAGE_U32(out->buf, entry->key_off + 4);
+          entry->merged    = 1;
+        }
+        continue;
+      }
+      if (IMAGE_U32(out->buf, key_off) != IMAGE_STR) {
+        free(entries);
+        return error_handler(EASYYAML_ERROR_IMAGE, &key_off, "map key is not a scalar",
+                             "document image map keys must be scalars");
+      }
+      easyyaml_image_entry * entry = &entries[entries_count++];
+      entry->key       = (const char *) out->buf + key_off + 8;
+      entry->key_len   = IMAGE_U32(out->buf, key_off + 4);
+      entry->key_off   = key_off;
+      entry->value_off = children[i + 1];
+      entry->merged    = 0;
+    }
+    qsort(entries, count, sizeof(easyyaml_image_entry), &image_entry_cmp);
+
+    // Merged entries sort before the map's own with the same key, which
+    // replace them.
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+      size_t last = i;
+      while (last + 1 < count && image_key_cmp(entries[i].key, entries[i].key_len,
+                                               entries[last + 1].key, entries[last + 1].key_len) == 0)
+        last++;
+      for (size_t j = i; j <= last; j++) {
+        if (entries[j].merged && !entries[last].merged)
+          continue;
+        p[2 + 2 * kept] = entries[j].key_off;
+        p[3 + 2 * kept] = entries[j].value_off;
+        kept++;
+      }
+      i = last;
+    }
+    free(entries);
+
+    p[0] = IMAGE_MAP;
+    p[1] = (uint32_t) kept;
+    n = 2 * kept;
+  } else {
+    p[0] = IMAGE_LST;
+    p[1] = (uint32_t) n;
+    if (n > 0)
+      memcpy(p + 2, children, 4 * n);
+  }
+  out->len += 8 + 4 * n;
+
+  out->offsets_count = level->first;
+
+  return image_push_offset(out, offset);
+}
+
+
+/// Make room for \p n more bytes of document image, which is limited to
+/// what offsets can address.
+
+int image_reserve (easyyaml_image_out * out, size_t n)
+{
+  if (n > UINT32_MAX - out->len)
+    return error_handler(EASYYAML_ERROR_IMAGE, &n, "document image too large",
+                         "document image exceeds %lu bytes", (unsigned long) UINT32_MAX);
+  if (out->len + n <= out->size)
+    return EASYYAML_SUCCESS;
+
+  size_t size = out->size == 0 ? 4096 : out->size;
+  while (size < out->len + n)
+    size *= 2;
+
+  unsigned char * buf = (unsigned char *) realloc(out->buf, size);
+  if (buf == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory building document image");
+  out->buf  = buf;
+  out->size = size;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Write a document image to a temporary file beside \p image_filename,
+/// then rename it into place.
+
+int image_write_file (const char * image_filename, const char * buf, size_t len)
+{
+  size_t name_len = strlen(image_filename) + 8;
+  char * tmp_name = (char *) malloc(name_len);
+  if (tmp_name == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &name_len, "out of memory", "out of memory writing document image");
+  snprintf(tmp_name, name_len, "%s.XXXXXX", image_filename);
+
+  int fd = mkstemp(tmp_name);
+  if (fd < 0) {
+    int retval = error_handler(EASYYAML_ERROR_FILEOPEN, tmp_name, strerror(errno),
+                               "error creating document image (%s)", strerror(errno));
+    free(tmp_name);
+    return retval;
+  }
+
+  size_t pos = 0;
+  int err = 0;
+  while (pos < len && err == 0) {
+    ssize_t n = write(fd, buf + pos, len - pos);
+
+    if (n < 0 && errno != EINTR)
+      err = errno;
+    else if (n > 0)
+      pos += (size_t) n;
+  }
+  if (close(fd) != 0 && err == 0)
+    err = errno;
+  if (err == 0 && rename(tmp_name, image_filename) != 0)
+    err = errno;
+
+  if (err != 0) {
+    unlink(tmp_name);
+    free(tmp_name);
+    return error_handler(EASYYAML_ERROR_WRITE, &err, "write error",
+                         "error writing document image (%s)", strerror(err));
+  }
+  free(tmp_name);
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Check the document image \p buf, and if it is valid return a new image
+/// handle for it, owning \p map (if not NULL). Returns NULL on error.
+
+easyyaml_image * image_open (const unsigned char * buf, size_t len, void * map)
+{
+  char errmsg[128];
+  int retval = image_check(buf, len, errmsg, sizeof(errmsg));
+  if (retval != EASYYAML_SUCCESS) {
+    error_handler(retval, &len, errmsg, "invalid document image (%s)", errmsg);
+    return NULL;
+  }
+
+  easyyaml_image * image = (easyyaml_image *) malloc(sizeof(easyyaml_image));
+  if (image == NULL) {
+    size_t size = sizeof(easyyaml_image);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory opening document image");
+    return NULL;
+  }
+  image->buf  = buf;
+  image->len  = len;
+  image->root = IMAGE_U32(buf, 8);
+  image->map  = map;
+
+  return image;
+}
+
+
+/// Check that a document image is well formed, so that it can be used
+/// without bounds checks: every node lies within it, and every offset is
+/// of an earlier node (with map keys being scalars). This is a single
+/// pass over the nodes, marking where each starts. Returns \ref
+/// EASYYAML_ERROR_IMAGE with the reason in \p errmsg if not.
+
+int image_check (const unsigned char * buf, size_t len, char * errmsg, size_t errmsg_len)
+{
+  const char * reason = NULL;
+
+  if ((uintptr_t) buf % 4 != 0)
+    reason = "not four byte aligned";
+  else if (len < IMAGE_HEADER_LEN || len % 4 != 0 || len > UINT32_MAX)
+    reason = "bad length";
+  else if (IMAGE_U32(buf, 0) != IMAGE_MAGIC)
+    reason = "bad magic number";
+  else if (IMAGE_U32(buf, 4) != len)
+    reason = "length mismatch";
+  if (reason != NULL) {
+    snprintf(errmsg, errmsg_len, "%s", reason);
+    return EASYYAML_ERROR_IMAGE;
+  }
+
+  // One bit per four bytes, set where a node starts.
+  size_t starts_len = len / 32 + 1;
+  unsigned char * starts = (unsigned char *) calloc(starts_len, 1);
+  if (starts == NULL) {
+    snprintf(errmsg, errmsg_len, "out of memory checking document image");
+    return EASYYAML_ERROR_NOMEM;
+  }
+
+  size_t offset = IMAGE_HEADER_LEN;
+  while (offset < len && reason == NULL) {
+    if (len - offset < 8) {
+      reason = "truncated node";
+      break;
+    }
+
+    uint32_t type = IMAGE_U32(buf, offset);
+    size_t n = IMAGE_U32(buf, offset + 4);
+    size_t space = len - offset - 8;
+    size_t next = 0;
+
+    if (type == IMAGE_NULL) {
+      if (n != 0)
+        reason = "bad empty node";
+      next = offset + 8;
+    } else if (type == IMAGE_STR) {
+      if (n >= space || buf[offset + 8 + n] != '\0')
+        reason = "bad scalar";
+      next = offset + 8 + ((n + 4) & ~(size_t) 3);
+    } else if (type == IMAGE_MAP || type == IMAGE_LST) {
+      size_t per = type == IMAGE_MAP ? 2 : 1;
+      if (n > space / (4 * per)) {
+        reason = "truncated map or list";
+        break;
+      }
+      for (size_t i = 0; i < n * per && reason == NULL; i++) {
+        size_t child = IMAGE_U32(buf, offset + 8 + 4 * i);
+        if (child >= offset || child % 4 != 0 || !(starts[child / 32] & (1 << (child / 4 % 8))))
+          reason = "bad offset";
+        else if (per == 2 && i % 2 == 0 && IMAGE_U32(buf, child) != IMAGE_STR)
+          reason = "map key is not a scalar";
+      }
+      next = offset + 8 + 4 * n * per;
+    } else {
+      reason = "bad node type";
+    }
+
+    starts[offset / 32] |= (unsigned char) (1 << (offset / 4 % 8));
+    offset = next;
+  }
+
+  size_t root = IMAGE_U32(buf, 8);
+  if (reason == NULL && (root >= len || root % 4 != 0 || !(starts[root / 32] & (1 << (root / 4 % 8)))))
+    reason = "bad root";
+  free(starts);
+
+  if (reason != NULL) {
+    snprintf(errmsg, errmsg_len, "%s", reason);
+    return EASYYAML_ERROR_IMAGE;
+  }
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Find the value of \p key in map \p node, by binary search (taking the
+/// last of duplicate keys, as parsing would). Returns zero if not found.
+
+size_t image_find (const easyyaml_image * image, size_t node, const char * key, size_t len)
+{
+  const unsigned char * buf = image->buf;
+  size_t lo = 0;
+  size_t hi = IMAGE_U32(buf, node + 4);
+
+  // Find the first entry after the key.
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t key_off = IMAGE_U32(buf, node + 8 + 8 * mid);
+
+    if (image_key_cmp((const char *) buf + key_off + 8, IMAGE_U32(buf, key_off + 4), key, len) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return 0;
+
+  size_t key_off = IMAGE_U32(buf, node + 8 + 8 * (lo - 1));
+  if (image_key_cmp((const char *) buf + key_off + 8, IMAGE_U32(buf, key_off + 4), key, len) != 0)
+    return 0;
+
+  return IMAGE_U32(buf, node + 12 + 8 * (lo - 1));
+}
+
+
+/// Order document image map keys (bytewise, then by length).
+
+int image_key_cmp (const char * a, size_t a_len, const char * b, size_t b_len)
+{
+  int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (cmp != 0)
+    return cmp;
+
+  return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+
+/// Order document image map entries by key, keeping duplicate keys in
+/// document order.
+
+int image_entry_cmp (const void * a, const void * b)
+{
+  const easyyaml_image_entry * ea = (const easyyaml_image_entry *) a;
+  const easyyaml_image_entry * eb = (const easyyaml_image_entry *) b;
+  int cmp = image_key_cmp(ea->key, ea->key_len, eb->key, eb->key_len);
+  if (cmp != 0)
+    return cmp;
+  if (ea->merged != eb->merged)
+    return eb->merged - ea->merged;
+
+  return ea->key_off < eb->key_off ? -1 : ea->key_off > eb->key_off ? 1 : 0;
+}
+
+
+/// Free a router's compiled states, leaving its patterns.
+
+void router_reset (easyyaml_router * router)
+{
+  free(router->states);
+  free(router->slots);
+  free(router->trans);
+  free(router->sets);
+  free(router->matches);
+  free(router->pos_route);
+  free(router->pos_kind);
+  free(router->marks);
+  free(router->scratch);
+
+  easyyaml_route * routes = router->routes;
+  size_t routes_count     = router->routes_count;
+  size_t routes_size      = router->routes_size;
+  memset(router, 0, sizeof(easyyaml_router));
+  router->routes       = routes;
+  router->routes_count = routes_count;
+  router->routes_size  = routes_size;
+}
+
+
+/// Grow the array \p arr of \p size elements of \p elem_size bytes to
+/// hold at least \p need, doubling it as many times as that takes.
+
+int router_grow (void ** arr, size_t * size, size_t need, size_t elem_size)
+{
+  size_t new_size = *size == 0 ? 16 : *size * 2;
+  while (new_size < need)
+    new_size *= 2;
+
+  void * new_arr = realloc(*arr, new_size * elem_size);
+  if (new_arr == NULL) {
+    size_t bytes = new_size * elem_size;
+    return error_handler(EASYYAML_ERROR_NOMEM, &bytes, "out of memory", "out of memory compiling router");
+  }
+
+  *arr  = new_arr;
+  *size = new_size;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Add route position \p pos to the set being built in the router's
+/// \c scratch, unless it is there already.
+
+void route_mark (easyyaml_router * router, size_t pos)
+{
+  if (router->marks[pos])
+    return;
+
+  router->marks[pos] = 1;
+  router->scratch[router->scratch_count++] = pos;
+}
+
+
+/// Close the set being built under "**" matching no keys, and sort it.
+
+void route_close (easyyaml_router * router)
+{
+  for (size_t i = 0; i < router->scratch_count; i++) {
+    if (router->pos_kind[router->scratch[i]] == ROUTE_SEG_DEEP)
+      route_mark(router, router->scratch[i] + 1);
+  }
+
+  for (size_t i = 0; i < router->scratch_count; i++)
+    router->marks[router->scratch[i]] = 0;
+  qsort(router->scratch, router->scratch_count, sizeof(size_t), &route_pos_cmp);
+}
+
+
+/// Build the set of route positions reached from those of \p state on the
+/// key \p key of length \p len, or on a key matching no literal segment if
+/// \p key is NULL, in the router's \c scratch.
+
+void route_move (easyyaml_router * router, size_t state, const char * key, size_t len)
+{
+  const easyyaml_route_state * st = &router->states[state];
+
+  router->scratch_count = 0;
+  for (size_t i = 0; i < st->set_count; i++) {
+    size_t pos = router->sets[st->set + i];
+
+    switch (router->pos_kind[pos]) {
+    case ROUTE_SEG_DEEP:
+      route_mark(router, pos);
+      break;
+
+    case ROUTE_SEG_ANY:
+      route_mark(router, pos + 1);
+      break;
+
+    case ROUTE_SEG_KEY: {
+      const easyyaml_route * route = &router->routes[router->pos_route[pos]];
+      const char * seg = route->segs[pos - route->first];
+      if (key != NULL && image_key_cmp(seg, strlen(seg), key, len) == 0)
+        route_mark(router, pos + 1);
+      break;
+    }
+    }
+  }
+
+  route_close(router);
+}
+
+
+/// Find the state of the set in the router's \c scratch, adding it (to be
+/// expanded) if it is new, setting \p state to its index.
+
+int route_state (easyyaml_router * router, size_t * state)
+{
+  uint64_t hash = EASYYAML_PATH_HASH_ROOT;
+  for (size_t i = 0; i < router->scratch_count; i++)
+    hash = (hash ^ router->scratch[i]) * 0x100000001b3ull;
+
+  if (router->slots_size > 0) {
+    size_t mask = router->slots_size - 1;
+
+    for (size_t i = hash & mask; router->slots[i] != 0; i = (i + 1) & mask) {
+      const easyyaml_route_state * st = &router->states[router->slots[i] - 1];
+      if (st->set_hash == hash && st->set_count == router->scratch_count
+          && (st->set_count == 0 || memcmp(router->sets + st->set, router->scratch, st->set_count * sizeof(size_t)) == 0)) {
+        *state = router->slots[i] - 1;
+        return EASYYAML_SUCCESS;
+      }
+    }
+  }
+
+  // Keep the table at most half full, rehashing into a larger one.
+  if ((router->states_count + 1) * 2 > router->slots_size) {
+    size_t size   = router->slots_size == 0 ? 64 : router->slots_size * 2;
+    size_t * slots = (size_t *) calloc(size, sizeof(size_t));
+    if (slots == NULL) {
+      size_t bytes = size * sizeof(size_t);
+      return error_handler(EASYYAML_ERROR_NOMEM, &bytes, "out of memory", "out of memory compiling router");
+    }
+    for (size_t s = 0; s < router->states_count; s++) {
+      size_t i = router->states[s].set_hash & (size - 1);
+      while (slots[i] != 0)
+        i = (i + 1) & (size - 1);
+      slots[i] = s + 1;
+    }
+    free(router->slots);
+    router->slots      = slots;
+    router->slots_size = size;
+  }
+
+  if (router->states_count == router->states_size
+      && router_grow((void **) &router->states, &router->states_size, router->states_count + 1, sizeof(easyyaml_route_state)) != EASYYAML_SUCCESS)
+    return EASYYAML_ERROR_NOMEM;
+  if (router->sets_count + router->scratch_count > router->sets_size
+      && router_grow((void **) &router->sets, &router->sets_size, router->sets_count + router->scratch_count, sizeof(size_t)) != EASYYAML_SUCCESS)
+    return EASYYAML_ERROR_NOMEM;
+
+  easyyaml_route_state * st = &router->states[router->states_count];
+  memset(st, 0, sizeof(easyyaml_route_state));
+  st->set       = router->sets_count;
+  st->set_count = router->scratch_count;
+  st->set_hash  = hash;
+  if (router->scratch_count > 0)
+    memcpy(router->sets + router->sets_count, router->scratch, router->scratch_count * sizeof(size_t));
+  router->sets_count += router->scratch_count;
+
+  size_t i = hash & (router->slots_size - 1);
+  while (router->slots[i] != 0)
+    i = (i + 1) & (router->slots_size - 1);
+  router->slots[i] = router->states_count + 1;
+
+  *state = router->states_count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Fill in the transitions, the state for other keys and the matches of
+/// \p state, adding the states it leads to.
+
+int route_expand (easyyaml_router * router, size_t state)
+{
+  int retval;
+
+  // A transition for each distinct literal key of the set's positions.
+  size_t trans = router->trans_count;
+  for (size_t i = 0; i < router->states[state].set_count; i++) {
+    size_t pos = router->sets[router->states[state].set + i];
+    if (router->pos_kind[pos] != ROUTE_SEG_KEY)
+      continue;
+
+    if (router->trans_count == router->trans_size
+        && (retval = router_grow((void **) &router->trans, &router->trans_size, router->trans_count + 1, sizeof(easyyaml_route_trans))) != EASYYAML_SUCCESS)
+      return retval;
+
+    const easyyaml_route * route = &router->routes[router->pos_route[pos]];
+    easyyaml_route_trans * tr = &router->trans[router->trans_count++];
+    tr->key  = route->segs[pos - route->first];
+    tr->len  = strlen(tr->key);
+    tr->next = 0;
+  }
+
+  if (router->trans_count > trans)
+    qsort(router->trans + trans, router->trans_count - trans, sizeof(easyyaml_route_trans), &route_trans_cmp);
+  size_t trans_count = 0;
+  for (size_t i = trans; i < router->trans_count; i++) {
+    if (trans_count == 0 || route_trans_cmp(&router->trans[trans + trans_count - 1], &router->trans[i]) != 0)
+      router->trans[trans + trans_count++] = router->trans[i];
+  }
+  router->trans_count = trans + trans_count;
+
+  for (size_t i = trans; i < router->trans_count; i++) {
+    route_move(router, state, router->trans[i].key, router->trans[i].len);
+    if ((retval = route_state(router, &router->trans[i].next)) != EASYYAML_SUCCESS)
+      return retval;
+  }
+
+  size_t other;
+  route_move(router, state, NULL, 0);
+  if ((retval = route_state(router, &other)) != EASYYAML_SUCCESS)
+    return retval;
+
+  // The positions are in route order, so the matches are too.
+  size_t matches = router->matches_count;
+  for (size_t i = 0; i < router->states[state].set_count; i++) {
+    size_t pos = router->sets[router->states[state].set + i];
+    if (router->pos_kind[pos] != ROUTE_SEG_END)
+      continue;
+
+    if (router->matches_count == router->matches_size
+        && (retval = router_grow((void **) &router->matches, &router->matches_size, router->matches_count + 1, sizeof(size_t))) != EASYYAML_SUCCESS)
+      return retval;
+    router->matches[router->matches_count++] = router->pos_route[pos];
+  }
+
+  easyyaml_route_state * st = &router->states[state];
+  st->trans         = trans;
+  st->trans_count   = trans_count;
+  st->other         = other;
+  st->matches       = matches;
+  st->matches_count = router->matches_count - matches;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Order route positions.
+
+int route_pos_cmp (const void * a, const void * b)
+{
+  size_t pa = *(const size_t *) a;
+  size_t pb = *(const size_t *) b;
+
+  return pa < pb ? -1 : pa > pb ? 1 : 0;
+}
+
+
+/// Order router transitions by key.
+
+int route_trans_cmp (const void * a, const void * b)
+{
+  const easyyaml_route_trans * ta = (const easyyaml_route_trans *) a;
+  const easyyaml_route_trans * tb = (const easyyaml_route_trans *) b;
+
+  return image_key_cmp(ta->key, ta->len, tb->key, tb->len);
+}
+
+
+/// Return the state a router moves to from \p state on the key \p key of
+/// length \p len, by a binary search of its transitions.
+
+size_t route_next (const easyyaml_router * router, size_t state, const char * key, size_t len)
+{
+  const easyyaml_route_state * st = &router->states[state];
+  const easyyaml_route_trans * trans = router->trans + st->trans;
+  size_t lo = 0;
+  size_t hi = st->trans_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = image_key_cmp(trans[mid].key, trans[mid].len, key, len);
+
+    if (cmp == 0)
+      return trans[mid].next;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return st->other;
+}
+
+
+/// Walk the YAML tokens of \p ctx with a compiled router, keeping the
+/// router state of each open map and list, and of each map's current key,
+/// and calling the handlers matching each scalar value's state.
+
+int route_walk (easyyaml_router * router, easyyaml_ctx * ctx, void * cfg)
+{
+  easyyaml_route_level * levels = NULL;
+  size_t levels_size = 0;
+  size_t depth       = 0;
+  int retval         = EASYYAML_SUCCESS;
+  int done           = 0;
+
+  easyyaml_stack root;
+  root.key  = NULL;
+  root.prev = NULL;
+  root.id   = EASYYAML_NOID;
+  root.hash = EASYYAML_PATH_HASH_ROOT;
+
+  while (retval == EASYYAML_SUCCESS && !done) {
+    yaml_token_t token;
+
+    if ((retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+      break;
+
+    easyyaml_route_level * top = depth > 0 ? &levels[depth - 1] : NULL;
+    size_t state = router->root;
+    easyyaml_stack * stack = &root;
+    if (top != NULL && top->map && !top->merge && !top->want_key) {
+      state = top->node_state;
+      stack = &top->node;
+    } else if (top != NULL) {
+      state = top->state;
+      stack = top->stack;
+    }
+
+    // Only scalar keys can be routed.
+    int type = token.type;
+    if (top != NULL && top->want_key && type != YAML_SCALAR_TOKEN)
+      type = YAML_NO_TOKEN;
+
+    switch (type) {
+    case YAML_STREAM_START_TOKEN:
+    case YAML_VALUE_TOKEN:
+    case YAML_BLOCK_ENTRY_TOKEN:
+      break;
+
+    case YAML_STREAM_END_TOKEN:
+      done = 1;
+      break;
+
+    case YAML_KEY_TOKEN:
+      if (top != NULL && top->map) {
+        if (top->has_key_token)
+          yaml_token_delete(&top->key_token);
+        top->has_key_token = 0;
+        top->want_key      = 1;
+      }
+      break;
+
+    case YAML_SCALAR_TOKEN:
+      if (top != NULL && top->want_key) {
+        top->want_key = 0;
+        top->merge    = is_merge_key(&token);
+        if (!top->merge) {
+          top->node.key    = (char *) token.data.scalar.value;
+          top->node.prev   = top->stack;
+          top->node.id     = EASYYAML_NOID;
+          top->node.hash   = stack_hash(top->stack->hash, top->node.key, token.data.scalar.length);
+          top->node_state  = route_next(router, top->state, top->node.key, token.data.scalar.length);
+          top->key_token     = token;
+          top->has_key_token = 1;
+          continue;
+        }
+        break;
+      }
+
+      for (size_t i = 0; i < router->states[state].matches_count; i++) {
+        const easyyaml_route * route = &router->routes[router->matches[router->states[state].matches + i]];
+        route->handler(stack, (char *) token.data.scalar.value, cfg);
+      }
+      break;
+
+    case YAML_BLOCK_MAPPING_START_TOKEN:
+    case YAML_BLOCK_SEQUENCE_START_TOKEN:
+      if (depth == levels_size && (retval = route_push(&levels, &levels_size, depth, &root)) != EASYYAML_SUCCESS)
+        break;
+      // The enclosing path may have moved with the levels.
+      stack = depth == 0 ? &root : levels[depth - 1].map && !levels[depth - 1].merge ? &levels[depth - 1].node : levels[depth - 1].stack;
+      top = &levels[depth++];
+      top->map           = token.type == YAML_BLOCK_MAPPING_START_TOKEN;
+      top->want_key      = 0;
+      top->merge         = 0;
+      top->state         = state;
+      top->stack         = stack;
+      top->node_state    = 0;
+      top->has_key_token = 0;
+      break;
+
+    case YAML_BLOCK_END_TOKEN:
+      if (depth > 0) {
+        if (top->has_key_token)
+          yaml_token_delete(&top->key_token);
+        depth--;
+        break;
+      }
+      // Fall through.
+
+    default: {
+      int data[2] = {token.type, YAML_SCALAR_TOKEN};
+      retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
+                             "unexpected token routing document",
+                             "expected libyaml block token or scalar but read %s at %s",
+                             tok_to_str(token.type), easyyaml_stack_path(stack));
+    }
+    }
+
+    yaml_token_delete(&token);
+  }
+
+  while (depth > 0) {
+    if (levels[--depth].has_key_token)
+      yaml_token_delete(&levels[depth].key_token);
+  }
+  free(levels);
+
+  return retval;
+}
+
+
+/// Grow the levels of a router walk at \p depth, relinking the paths of
+/// the levels (each of which points at its enclosing level's node).
+
+int route_push (easyyaml_route_level ** levels, size_t * levels_size, size_t depth, easyyaml_stack * root)
+{
+  size_t size = *levels_size == 0 ? 32 : *levels_size * 2;
+  easyyaml_route_level * new_levels = (easyyaml_route_level *) realloc(*levels, size * sizeof(easyyaml_route_level));
+  if (new_levels == NULL)
+    return error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory nesting routed document");
+
+  for (size_t i = 0; i < depth; i++) {
+    easyyaml_route_level * prev = i > 0 ? &new_levels[i - 1] : NULL;
+    new_levels[i].stack = prev == NULL ? root : prev->map && !prev->merge ? &prev->node : prev->stack;
+    if (new_levels[i].map && !new_levels[i].merge)
+      new_levels[i].node.prev = new_levels[i].stack;
+  }
+
+  *levels      = new_levels;
+  *levels_size = size;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Reader for \ref easyyaml_parse_fd.
+
+long fd_read (void * user, char * buf, size_t len)
+{
+  while (1) {
+    ssize_t n = read(*(int *) user, buf, len);
+
+    if (n >= 0 || errno != EINTR)
+      return n;
+  }
+}
+
+
+#ifdef EASYYAML_WITH_PUSH
+/// Initialise a coroutine to run \p fn with \p arg, on a stack of
+/// \p stack_size bytes (or the default if zero). Returns zero on error.
+
+int coro_init (easyyaml_coro * coro, size_t stack_size, void (*fn)(void *), void * arg)
+{
+  coro->fn  = fn;
+  coro->arg = arg;
+
+  // The stack has a guard page below it, so that an overflow faults
+  // rather than overwriting the heap.
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (stack_size == 0)
+    stack_size = DEFAULT_PUSH_STACK_LEN;
+  coro->stack_size = (stack_size + page_size - 1) / page_size * page_size + page_size;
+  coro->stack = mmap(NULL, coro->stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (coro->stack == MAP_FAILED) {
+    coro->stack = NULL;
+    error_handler(EASYYAML_ERROR_NOMEM, &stack_size, "out of memory", "out of memory allocating parse stack");
+    return 0;
+  }
+  mprotect(coro->stack, page_size, PROT_NONE);
+
+  // makecontext only passes int arguments, so the pointer is split in two.
+  uint64_t coro_ptr = (uintptr_t) coro;
+  getcontext(&coro->coro_uc);
+  coro->coro_uc.uc_stack.ss_sp   = coro->stack;
+  coro->coro_uc.uc_stack.ss_size = coro->stack_size;
+  coro->coro_uc.uc_link          = &coro->caller_uc;
+  makecontext(&coro->coro_uc, (void (*)(void)) &coro_main, 2,
+              (unsigned int) (coro_ptr >> 32), (unsigned int) (coro_ptr & 0xffffffff));
+
+  return 1;
+}
+
+
+/// Coroutine entry point, returning to the caller (by the context link)
+/// when done.
+
+void coro_main (unsigned int coro_hi, unsigned int coro_lo)
+{
+  easyyaml_coro * coro = (easyyaml_coro *) (uintptr_t) (((uint64_t) coro_hi << 32) | coro_lo);
+
+  coro->fn(coro->arg);
+  coro->done = 1;
+}
+
+
+/// Switch to the coroutine, until it yields or is done.
+
+void coro_resume (easyyaml_coro * coro)
+{
+  swapcontext(&coro->caller_uc, &coro->coro_uc);
+}
+
+
+/// Switch from the coroutine back to the caller.
+
+void coro_yield (easyyaml_coro * coro)
+{
+  swapcontext(&coro->coro_uc, &coro->caller_uc);
+}
+
+
+/// Free a coroutine's stack.
+
+void coro_free (easyyaml_coro * coro)
+{
+  if (coro->stack != NULL)
+    munmap(coro->stack, coro->stack_size);
+}
+
+
+/// Push parser read function (see \ref easyyaml_input), switching back to
+/// the caller until more input is fed, or the input is finished.
+
+long push_read (void * user, char * buf, size_t len)
+{
+  easyyaml_push * push = (easyyaml_push *) user;
+
+  while (push->chunk_len == 0 && !push->finished)
+    coro_yield(&push->coro);
+
+  size_t n = push->chunk_len < len ? push->chunk_len : len;
+  if (n > 0)
+    memcpy(buf, push->chunk, n);
+  push->chunk     += n;
+  push->chunk_len -= n;
+
+  return n;
+}
+
+
+/// Push parser coroutine function.
+
+void push_main (void * arg)
+{
+  easyyaml_push * push = (easyyaml_push *) arg;
+
+  push->retval = parse(&push->parser, &push->input, push->ys, push->cfg, &push->opts);
+}
+
+
+/// Free a push parser, and everything it owns.
+
+void push_free (easyyaml_push * push)
+{
+  if (push->parser.read_handler != NULL)
+    yaml_parser_delete(&push->parser);
+  coro_free(&push->coro);
+  input_free(&push->input);
+  free(push);
+}
+#endif
+
+
+/// Allocate a stepped parse, less its input and engine. Returns NULL on
+/// error.
+
+easyyaml_stepper * stepper_new (const easyyaml_options * opts)
+{
+  easyyaml_stepper * stepper = (easyyaml_stepper *) calloc(1, sizeof(easyyaml_stepper));
+  if (stepper == NULL) {
+    size_t size = sizeof(easyyaml_stepper);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating stepped parse");
+    return NULL;
+  }
+
+  if (opts != NULL)
+    stepper->opts = *opts;
+  else
+    easyyaml_options_init(&stepper->opts);
+
+  int par_init_retval = yaml_parser_initialize(&stepper->parser);
+  if (par_init_retval == 0) {
+    error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                  "yaml_parser_initialize() returned error",
+                  "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+    free(stepper);
+    return NULL;
+  }
+
+  return stepper;
+}
+
+
+#ifdef EASYYAML_WITH_REWIND
+/// Rewind a libyaml parser, as \c yaml_parser_delete then
+/// \c yaml_parser_initialize would, but keeping its buffers, token queue
+/// and stacks (as allocated, and grown). Input may then be set again. This
+/// depends on the layout of \c yaml_parser_t, so is only built for the
+/// libyaml versions it is known for (see configure.ac), and only used if
+/// the library loaded is one of them too.
+
+void parser_rewind (yaml_parser_t * parser)
+{
+  yaml_parser_t kept = *parser;
+
+  for (yaml_token_t * token = kept.tokens.head; token != kept.tokens.tail; token++)
+    yaml_token_delete(token);
+  for (yaml_tag_directive_t * tag = kept.tag_directives.start; tag != kept.tag_directives.top; tag++) {
+    free(tag->handle);
+    free(tag->prefix);
+  }
+
+  memset(parser, 0, sizeof(yaml_parser_t));
+
+  parser->raw_buffer.start   = kept.raw_buffer.start;
+  parser->raw_buffer.end     = kept.raw_buffer.end;
+  parser->raw_buffer.pointer = parser->raw_buffer.last = kept.raw_buffer.start;
+  parser->buffer.start       = kept.buffer.start;
+  parser->buffer.end         = kept.buffer.end;
+  parser->buffer.pointer     = parser->buffer.last = kept.buffer.start;
+  parser->tokens.start       = kept.tokens.start;
+  parser->tokens.end         = kept.tokens.end;
+  parser->tokens.head        = parser->tokens.tail = kept.tokens.start;
+  parser->indents.start      = kept.indents.start;
+  parser->indents.end        = kept.indents.end;
+  parser->indents.top        = kept.indents.start;
+  parser->simple_keys.start  = kept.simple_keys.start;
+  parser->simple_keys.end    = kept.simple_keys.end;
+  parser->simple_keys.top    = kept.simple_keys.start;
+  parser->states.start       = kept.states.start;
+  parser->states.end         = kept.states.end;
+  parser->states.top         = kept.states.start;
+  parser->marks.start        = kept.marks.start;
+  parser->marks.end          = kept.marks.end;
+  parser->marks.top          = kept.marks.start;
+  parser->tag_directives.start = kept.tag_directives.start;
+  parser->tag_directives.end   = kept.tag_directives.end;
+  parser->tag_directives.top   = kept.tag_directives.start;
+}
+#endif
+
+
+#ifdef EASYYAML_WITH_THREADS
+/// Free a thread's parser from a pool, as the thread exits.
+
+void parser_pool_release (void * arg)
+{
+  easyyaml_parser * parser = (easyyaml_parser *) arg;
+  easyyaml_parser_pool * pool = parser->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  if (parser->prev != NULL)
+    parser->prev->next = parser->next;
+  else
+    pool->parsers = parser->next;
+  if (parser->next != NULL)
+    parser->next->prev = parser->prev;
+  pthread_mutex_unlock(&pool->lock);
+
+  easyyaml_parser_free(parser);
+}
+#endif
+
+
+/// Allocate a cursor, less its input and engine. Returns NULL on error.
+
+easyyaml_cursor * cursor_new (const easyyaml_options * opts)
+{
+  easyyaml_cursor * cursor = (easyyaml_cursor *) calloc(1, sizeof(easyyaml_cursor));
+  if (cursor == NULL) {
+    size_t size = sizeof(easyyaml_cursor);
+    error_handler(EASYYAML_ERROR_NOMEM, &size, "out of memory", "out of memory allocating cursor");
+    return NULL;
+  }
+
+  if (opts != NULL)
+    cursor->opts = *opts;
+  else
+    easyyaml_options_init(&cursor->opts);
+
+  int par_init_retval = yaml_parser_initialize(&cursor->parser);
+  if (par_init_retval == 0) {
+    error_handler(EASYYAML_ERROR_LIBYAML_INIT, &par_init_retval,
+                  "yaml_parser_initialize() returned error",
+                  "could not initialise libyaml parser (yaml_parser_initialize() returned %d)", par_init_retval);
+    free(cursor);
+    return NULL;
+  }
+
+  return cursor;
+}
+
+
+/// Monotonic clock time, in nanoseconds.
+
+uint64_t now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/// Refill the input buffer if it has been consumed. Returns zero on error.
+
+int input_fill (easyyaml_input * input)
+{
+  if (input->buf_pos < input->buf_len || input->eof)
+    return 1;
+
+  long n = input->read_fn(input->user, input->buf, input->buf_size);
+  if (n < 0) {
+    char errmsg[128];
+    snprintf(errmsg, sizeof(errmsg), "error reading input (%s)", strerror(errno));
+    return input_error(input, EASYYAML_ERROR_READ, errmsg);
+  }
+
+  input->buf_pos = 0;
+  input->buf_len = n;
+  input->eof     = n == 0;
+
+  return 1;
+}
+
+
+/// Record an input error, reported by \ref scan_tok. Returns zero.
+
+int input_error (easyyaml_input * input, int err_code, const char * errmsg)
+{
+  input->err_code = err_code;
+  snprintf(input->errmsg, sizeof(input->errmsg), "%s", errmsg);
+
+  return 0;
+}
+
+
+/// libyaml read handler, copies or decompresses from the input buffer,
+/// counting the bytes passed to libyaml against the input size limit.
+
+int input_read (void * data, unsigned char * buffer, size_t size, size_t * size_read)
+{
+  easyyaml_input * input = (easyyaml_input *) data;
+
+  if (!input_decode(input, buffer, size, size_read))
+    return 0;
+
+  input->total_bytes += *size_read;
+  if (input->max_bytes != 0 && input->total_bytes > input->max_bytes) {
+    char errmsg[128];
+    snprintf(errmsg, sizeof(errmsg), "input exceeds the limit of %lu bytes", (unsigned long) input->max_bytes);
+    return input_error(input, EASYYAML_ERROR_LIMIT_INPUT, errmsg);
+  }
+
+  return 1;
+}
 
-  if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
-    return scan_tok_retval;
 
-  if (token.type != YAML_SCALAR_TOKEN) {
-    yaml_token_delete(&token);
+/// Copy or decompress from the input buffer into \p buffer. Returns zero
+/// on error.
 
-    int data[2] = {token.type, YAML_SCALAR_TOKEN};
-    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                               "unexpected token parsing body",
-                               "expected libyaml map variable key scalar but read %s at %s",
-                               tok_to_str(token.type), easyyaml_stack_path(stack));
-    if (retval != EASYYAML_SUCCESS)
-      return retval;
-  }
+int input_decode (easyyaml_input * input, unsigned char * buffer, size_t size, size_t * size_read)
+{
+  *size_read = 0;
+  if (!input_fill(input))
+    return 0;
+
+  if (input->decompress == EASYYAML_DECOMPRESS_AUTO) {
+    // Detect the compression from the magic number, reading on until
+    // there are enough bytes to tell (the first read almost always has).
+    while (input->buf_len - input->buf_pos < 4 && !input->eof && input->buf_pos == 0) {
+      long n = input->read_fn(input->user, input->buf + input->buf_len, input->buf_size - input->buf_len);
+      if (n < 0)
+        return input_error(input, EASYYAML_ERROR_READ, "error reading input");
+      input->buf_len += n;
+      input->eof = n == 0;
+    }
 
-  yaml_token_t token2;
+    unsigned char * magic = (unsigned char *) input->buf + input->buf_pos;
+    size_t avail = input->buf_len - input->buf_pos;
 
-  if ((scan_tok_retval = scan_tok(parser, &token2)) != EASYYAML_SUCCESS) {
-    yaml_token_delete(&token);
-    return scan_tok_retval;
+    if (avail >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+      input->decompress = EASYYAML_DECOMPRESS_GZIP;
+    else if (avail >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+      input->decompress = EASYYAML_DECOMPRESS_ZSTD;
+    else
+      input->decompress = EASYYAML_DECOMPRESS_NONE;
   }
 
-  if (token2.type != YAML_VALUE_TOKEN) {
-    yaml_token_delete(&token2);
-    yaml_token_delete(&token);
+  if (input->decompress == EASYYAML_DECOMPRESS_NONE) {
+    size_t avail = input->buf_len - input->buf_pos;
+    size_t n = avail < size ? avail : size;
 
-    int data[2] = {token2.type, YAML_VALUE_TOKEN};
-    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                               "unexpected token parsing body",
-                               "expected libyaml map variable key value but read %s at %s",
-                               tok_to_str(token2.type), easyyaml_stack_path(stack));
-    if (retval != EASYYAML_SUCCESS)
-      return retval;
+    memcpy(buffer, input->buf + input->buf_pos, n);
+    input->buf_pos += n;
+    *size_read = n;
+
+    return 1;
   }
-  yaml_token_delete(&token2);
 
-  easyyaml_stack stack2;
-  stack2.key  = (char *) token.data.scalar.value;
-  stack2.prev = stack;
+#ifdef EASYYAML_WITH_GZIP
+  if (input->decompress == EASYYAML_DECOMPRESS_GZIP) {
+    if (!input->zs_init) {
+      if (inflateInit2(&input->zs, 16 + MAX_WBITS) != Z_OK)
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, "could not initialise gzip decompression");
+      input->zs_init = 1;
+    }
 
-  int retval = rec_parse(parser, ys, &stack2, cfg);
-  yaml_token_delete(&token);
+    input->zs.next_out  = buffer;
+    input->zs.avail_out = size;
+
+    while (input->zs.avail_out == size) {
+      if (!input_fill(input))
+        return 0;
+      if (input->eof && !input->in_frame)
+        break;
+
+      input->zs.next_in  = (unsigned char *) input->buf + input->buf_pos;
+      input->zs.avail_in = input->buf_len - input->buf_pos;
+
+      int z_retval = inflate(&input->zs, Z_NO_FLUSH);
+      input->buf_pos = input->buf_len - input->zs.avail_in;
+
+      if (z_retval == Z_STREAM_END) {
+        // Concatenated gzip members decompress as one stream.
+        inflateReset(&input->zs);
+        input->in_frame = 0;
+      } else if (z_retval == Z_BUF_ERROR && input->eof) {
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, "truncated gzip input");
+      } else if (z_retval != Z_OK && z_retval != Z_BUF_ERROR) {
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, input->zs.msg != NULL ? input->zs.msg : "gzip decompression failed");
+      } else {
+        input->in_frame = 1;
+      }
+    }
 
-  return retval;
-}
+    *size_read = size - input->zs.avail_out;
 
+    return 1;
+  }
+#endif
+
+#ifdef EASYYAML_WITH_ZSTD
+  if (input->decompress == EASYYAML_DECOMPRESS_ZSTD) {
+    if (input->zds == NULL) {
+      if ((input->zds = ZSTD_createDStream()) == NULL)
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, "could not initialise zstd decompression");
+      ZSTD_initDStream(input->zds);
+    }
 
-/// Recursive parse YAML map fixed keys.
+    ZSTD_outBuffer out = {buffer, size, 0};
 
-int rec_parse_obj_fixedkeys (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg)
-{
-  yaml_token_t token;
-  int scan_tok_retval;
+    while (out.pos == 0) {
+      if (!input_fill(input))
+        return 0;
+      if (input->eof && !input->in_frame)
+        break;
 
-  if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
-    return scan_tok_retval;
+      ZSTD_inBuffer in = {input->buf, input->buf_len, input->buf_pos};
+      size_t zstd_retval = ZSTD_decompressStream(input->zds, &out, &in);
+      input->buf_pos = in.pos;
 
-  if (token.type != YAML_SCALAR_TOKEN) {
-    int data[2] = {token.type, YAML_SCALAR_TOKEN};
-    int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                               "unexpected token parsing body",
-                               "expected libyaml map fixed key scalar but read %s at %s",
-                               tok_to_str(token.type), easyyaml_stack_path(stack));
-    if (retval != EASYYAML_SUCCESS) {
-      yaml_token_delete(&token);
-      return retval;
+      if (ZSTD_isError(zstd_retval))
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, ZSTD_getErrorName(zstd_retval));
+
+      input->in_frame = zstd_retval != 0;
+      if (input->eof && out.pos == 0 && input->in_frame)
+        return input_error(input, EASYYAML_ERROR_DECOMPRESS, "truncated zstd input");
     }
+
+    *size_read = out.pos;
+
+    return 1;
   }
+#endif
 
-  for (easyyaml_schema * ys2 = ys; ys2->type != EASYYAML_SCHEMA_END; ys2++) {
-    if (strcmp(ys2->key, (char *) token.data.scalar.value) == 0) {
-      yaml_token_t token2;
+  return input_error(input, EASYYAML_ERROR_DECOMPRESS, "decompression method not supported by this build");
+}
 
-      if ((scan_tok_retval = scan_tok(parser, &token2)) != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return scan_tok_retval;
-      }
 
-      if (token2.type != YAML_VALUE_TOKEN) {
-        yaml_token_delete(&token2);
+/// Free the input buffer and decompression state.
 
-        int data[2] = {token2.type, YAML_VALUE_TOKEN};
-        int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                                   "unexpected token parsing body",
-                                   "expected libyaml map fixed key value but read %s at %s",
-                                   tok_to_str(token2.type), easyyaml_stack_path(stack));
-        if (retval != EASYYAML_SUCCESS) {
-          yaml_token_delete(&token);
-          yaml_token_delete(&token2);
-          return retval;
-        }
-      }
-      yaml_token_delete(&token);
-      yaml_token_delete(&token2);
+void input_free (easyyaml_input * input)
+{
+#ifdef EASYYAML_WITH_GZIP
+  if (input->zs_init)
+    inflateEnd(&input->zs);
+#endif
+#ifdef EASYYAML_WITH_ZSTD
+  if (input->zds != NULL)
+    ZSTD_freeDStream(input->zds);
+#endif
+  free(input->buf);
+}
 
-      easyyaml_stack stack2;
-      stack2.key  = ys2->key;
-      stack2.prev = stack;
-      return rec_parse(parser, ys2, &stack2, cfg);
-    }
-  }
 
-  char * stack_path = easyyaml_stack_path(stack);
-  char * str_tok = tok_to_str(token.type);
-  void * data[3] = {ys, stack_path, str_tok};
-  int retval = error_handler(EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY, data,
-                             "unexpected key",
-                             "key %s unexpected while parsing map at %s",
-                             str_tok, stack_path);
-  yaml_token_delete(&token);
+/// Push a token back, to be returned by the next \ref scan_tok call.
 
-  return retval;
+void unscan_tok (easyyaml_ctx * ctx, yaml_token_t * token)
+{
+  ctx->pending = *token;
+  ctx->has_pending = 1;
 }
 
 
-/// Recursive parse of a YAML list.
+/// Skip the rest of a node, whose first token is \p token (which is
+/// consumed). Used to carry on after a quashed or collected schema error.
+/// A token which ends or follows an empty node is pushed back for the
+/// enclosing map or list.
 
-int rec_parse_list (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg)
+int skip_node (easyyaml_ctx * ctx, yaml_token_t * token)
 {
-  while (1) {
-    yaml_token_t token;
+  if (token->type == YAML_KEY_TOKEN || token->type == YAML_VALUE_TOKEN
+      || token->type == YAML_BLOCK_END_TOKEN || token->type == YAML_BLOCK_ENTRY_TOKEN
+      || token->type == YAML_STREAM_END_TOKEN) {
+    unscan_tok(ctx, token);
+    return EASYYAML_SUCCESS;
+  }
+
+  int depth = token->type == YAML_BLOCK_MAPPING_START_TOKEN || token->type == YAML_BLOCK_SEQUENCE_START_TOKEN;
+  yaml_token_delete(token);
+
+  while (depth > 0) {
+    yaml_token_t token2;
     int scan_tok_retval;
 
-    if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
+    if ((scan_tok_retval = scan_tok(ctx, &token2)) != EASYYAML_SUCCESS)
       return scan_tok_retval;
 
-    if (token.type == YAML_BLOCK_END_TOKEN) {
-      yaml_token_delete(&token);
-
+    if (token2.type == YAML_BLOCK_MAPPING_START_TOKEN || token2.type == YAML_BLOCK_SEQUENCE_START_TOKEN) {
+      depth++;
+    } else if (token2.type == YAML_BLOCK_END_TOKEN) {
+      depth--;
+    } else if (token2.type == YAML_STREAM_END_TOKEN) {
+      unscan_tok(ctx, &token2);
       return EASYYAML_SUCCESS;
     }
-    if (token.type != YAML_BLOCK_ENTRY_TOKEN) {
-      int data[2] = {token.type, YAML_VALUE_TOKEN};
-      int retval = error_handler(EASYYAML_ERROR_PARSE_UNEXPECTED, data,
-                                 "unexpected token parsing body",
-                                 "expected block entry while parsing list but read %s at %s",
-                                 tok_to_str(token.type), easyyaml_stack_path(stack));
-      if (retval != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return retval;
-      }
-    }
-    yaml_token_delete(&token);
-
-    for (easyyaml_schema * ys2 = ys; ys2->type != EASYYAML_SCHEMA_END; ys2++) {
-      int rec_result = rec_parse(parser, ys2, stack, cfg);
-      if (rec_result != EASYYAML_SUCCESS)
-        return rec_result;
-    }
+    yaml_token_delete(&token2);
   }
+
+  return EASYYAML_SUCCESS;
 }
 
 
-/// Recursive parse of a YAML something (could be anything in this context).
+/// Skip the value of a map entry whose key has been read.
 
-int rec_parse (yaml_parser_t * parser, easyyaml_schema * ys, easyyaml_stack * stack, void * cfg)
+int skip_value (easyyaml_ctx * ctx)
 {
   yaml_token_t token;
   int scan_tok_retval;
 
-  if ((scan_tok_retval = scan_tok(parser, &token)) != EASYYAML_SUCCESS)
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
     return scan_tok_retval;
 
-  if (ys->type == EASYYAML_SCHEMA_STR) {
-    if (token.type == YAML_SCALAR_TOKEN) {
-      if (ys->data != NULL)
-        ((void (*)(easyyaml_stack *, char *, void *)) ys->data)(stack, (char *) token.data.scalar.value, cfg);
-    } else {
-      char * stack_path = easyyaml_stack_path(stack);
-      char * str_tok = tok_to_str(token.type);
-      void * data[3] = {ys, stack_path, str_tok};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_MANDATES_STRING, data,
-                                 "string mandated by schema",
-                                 "%s (%s) must be a string at %s",
-                                 ys->key, ys->descr, stack_path);
-      if (retval != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return retval;
-      }
-    }
-  } else if (ys->type == EASYYAML_SCHEMA_INT) {
-    if (token.type == YAML_SCALAR_TOKEN) {
-      if (ys->data != NULL)
-        ((void (*)(easyyaml_stack *, int, void *)) ys->data)(stack, atoi((char *) token.data.scalar.value), cfg);
-    } else {
-      char * stack_path = easyyaml_stack_path(stack);
-      char * str_tok = tok_to_str(token.type);
-      void * data[3] = {ys, stack_path, str_tok};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_MANDATES_INT, data,
-                                 "integer mandated by schema",
-                                 "%s (%s) must be an integer at %s",
-                                 ys->key, ys->descr, stack_path);
-      if (retval != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return retval;
-      }
-    }
-  } else if (ys->type == EASYYAML_SCHEMA_MAP) {
-    if (token.type == YAML_BLOCK_MAPPING_START_TOKEN) {
-      int rec_result = rec_parse_obj(parser, ys->data, stack, cfg);
-      if (rec_result != EASYYAML_SUCCESS)
-        return rec_result;
-    } else {
-      char * stack_path = easyyaml_stack_path(stack);
-      char * str_tok = tok_to_str(token.type);
-      void * data[3] = {ys, stack_path, str_tok};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_MANDATES_MAP, data,
-                                 "map mandated by schema",
-                                 "%s (%s) must be a map at %s",
-                                 ys->key, ys->descr, stack_path);
-      if (retval != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return retval;
-      }
-    }
-  } else if (ys->type == EASYYAML_SCHEMA_LST) {
-    if (token.type == YAML_BLOCK_SEQUENCE_START_TOKEN) {
-      int rec_result = rec_parse_list(parser, ys->data, stack, cfg);
-      if (rec_result != EASYYAML_SUCCESS)
-        return rec_result;
-    } else {
-      char * stack_path = easyyaml_stack_path(stack);
-      char * str_tok = tok_to_str(token.type);
-      void * data[3] = {ys, stack_path, str_tok};
-      int retval = error_handler(EASYYAML_ERROR_SCHEMA_MANDATES_LIST, data,
-                                 "list mandated by schema",
-                                 "%s (%s) must be a list at %s",
-                                 ys->key, ys->descr, stack_path);
-      if (retval != EASYYAML_SUCCESS) {
-        yaml_token_delete(&token);
-        return retval;
-      }
-    }
-  } else {
-    char * stack_path = easyyaml_stack_path(stack);
-    void * data[2] = {ys, stack_path};
-    int retval = error_handler(EASYYAML_ERROR_SCHEMA_INVALID, data,
-                               "schema invalid",
-                               "schema has invalid/corrupt type %d at %s",
-                               ys->type, stack_path);
-    if (retval != EASYYAML_SUCCESS) {
-      yaml_token_delete(&token);
-      return retval;
-    }
+  if (token.type != YAML_VALUE_TOKEN) {
+    unscan_tok(ctx, &token);
+    return EASYYAML_SUCCESS;
   }
-
   yaml_token_delete(&token);
 
-  return EASYYAML_SUCCESS;
+  if ((scan_tok_retval = scan_tok(ctx, &token)) != EASYYAML_SUCCESS)
+    return scan_tok_retval;
+
+  return skip_node(ctx, &token);
 }
 
 
-/// Wrapper for yaml_parser_scan, with logging added.
+/// Return a string representing the given libyaml token.
 
-int scan_tok (yaml_parser_t * parser, yaml_token_t * token)
+char * easyyaml_stack_path (easyyaml_stack * stack)
 {
-  int scan_tok_retval = yaml_parser_scan(parser, token);
+  static char buf[MAX_STACKPATH_LEN];
 
-  if (scan_tok_retval != 0)
-    return EASYYAML_SUCCESS;
+  stack_render(stack, buf, MAX_STACKPATH_LEN);
 
-  int retval = error_handler(EASYYAML_ERROR_LIBYAML_SCAN, &scan_tok_retval,
-                             "yaml_parser_scan() returned error",
-                             "error scanning token (yaml_parser_scan() returned %d)",
-                             scan_tok_retval);
+  return buf;
+}
 
-  easyyaml_log(EASYYAML_LOG_LEVEL_TRACE, "YAML scan read token %s", tok_to_str(token->type));
 
-  return retval;
+/// Return the length of the string \ref easyyaml_stack_path would render
+/// (without truncation).
+
+size_t stack_path_len (easyyaml_stack * stack)
+{
+  size_t len = 0;
+
+  for (; stack != NULL && stack->key != NULL; stack = stack->prev)
+    len += strlen(stack->key) + 1;
+
+  return len == 0 ? 1 : len;
 }
 
 
-/// Return a string representing the given libyaml token.
+/// Render the stack path into \p buf (truncating it to fit), called by
+/// \ref easyyaml_stack_path. The stack is walked from the innermost key
+/// outwards, so the keys are placed from the end of the path backwards.
 
-char * easyyaml_stack_path (easyyaml_stack * stack)
+void stack_render (easyyaml_stack * stack, char * buf, size_t buf_size)
 {
-  static char buf[MAX_STACKPATH_LEN];
+  size_t len = stack_path_len(stack);
+  size_t end = len;
 
   if (stack->key == NULL)
-    snprintf(buf, MAX_STACKPATH_LEN, "/");
-  else
-    stack_render_rec(stack, buf, buf + MAX_STACKPATH_LEN);
+    buf[0] = '/';
 
-  return buf;
+  for (; stack != NULL && stack->key != NULL; stack = stack->prev) {
+    size_t key_len = strlen(stack->key);
+    size_t start = end - key_len - 1;
+
+    if (start < buf_size - 1) {
+      size_t n = end < buf_size - 1 ? end - start : buf_size - 1 - start;
+      buf[start] = '/';
+      memcpy(buf + start + 1, stack->key, n - 1);
+    }
+    end = start;
+  }
+
+  buf[len < buf_size - 1 ? len : buf_size - 1] = '\0';
 }
 
 
-/// Recursively render the stack, called by \ref easyyaml_stack_path.
+/// Extend the path hash \p hash of a stack entry by the key \p key of
+/// length \p len of a child entry: the FNV-1a (64 bit) hash of the path
+/// string continued with '/' and the key, so that it equals the hash of
+/// the path the child would render.
 
-char * stack_render_rec (easyyaml_stack * stack, char * buf, char * buf_of)
+uint64_t stack_hash (uint64_t hash, const char * key, size_t len)
 {
-  if (stack->key == NULL)
-    return buf;
+  hash = (hash ^ '/') * 0x100000001b3ull;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char) key[i]) * 0x100000001b3ull;
+
+  return hash;
+}
 
-  snprintf(stack_render_rec(stack->prev, buf, buf_of), buf_of - buf, "/%s", stack->key);
 
-  return buf + strlen(buf);
+/// Hash a path as rendered by \ref easyyaml_stack_path, to compare with
+/// the \c hash of a stack entry. The root path "/" hashes as the empty
+/// string, \ref EASYYAML_PATH_HASH_ROOT.
+
+uint64_t easyyaml_path_hash (const char * path)
+{
+  uint64_t hash = EASYYAML_PATH_HASH_ROOT;
+
+  if (strcmp(path, "/") == 0)
+    return hash;
+
+  for (; *path != '\0'; path++)
+    hash = (hash ^ (unsigned char) *path) * 0x100000001b3ull;
+
+  return hash;
 }
 
 
@@ -608,3 +9270,186 @@ int error_handler (int err_code, const void * data, const char * reason, const c
   alt_errhandler(err_code, data, reason, errmsg);
   return err_code;
 }
+
+
+/// Handle a schema error. In collect mode (\ref easyyaml_options errors
+/// set) the error is recorded without formatting a message and the parse
+/// carries on, otherwise the message is formatted and the error handled
+/// by \ref error_handler.
+
+int schema_error (easyyaml_ctx * ctx, int err_code, easyyaml_schema * ys, easyyaml_stack * stack, const char * key, int tok)
+{
+  if (ctx->opts != NULL && ctx->opts->errors != NULL)
+    return errors_add(ctx->opts->errors, err_code, &ctx->mark, ys, stack, key, tok);
+
+  char * stack_path = easyyaml_stack_path(stack);
+  char * str_tok = tok_to_str(tok);
+  void * data[3] = {ys, stack_path, str_tok};
+  char errmsg[MAX_LOGMSG_LEN];
+  const char * reason;
+
+  switch (err_code) {
+  case EASYYAML_ERROR_SCHEMA_NOCHILDREN:      reason = "schema allows no children"; break;
+  case EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY:  reason = "unexpected key"; break;
+  case EASYYAML_ERROR_SCHEMA_MANDATES_STRING: reason = "string mandated by schema"; break;
+  case EASYYAML_ERROR_SCHEMA_MANDATES_INT:    reason = "integer mandated by schema"; break;
+  case EASYYAML_ERROR_SCHEMA_MANDATES_MAP:    reason = "map mandated by schema"; break;
+  case EASYYAML_ERROR_SCHEMA_MANDATES_LIST:   reason = "list mandated by schema"; break;
+  case EASYYAML_ERROR_SCHEMA_MANDATES_ENUM:   reason = "enum value mandated by schema"; break;
+  default:                                    reason = "schema invalid"; break;
+  }
+
+  return error_handler(err_code, data, reason, "%s",
+                       format_error(err_code, ys, stack_path, key, tok, errmsg, MAX_LOGMSG_LEN));
+}
+
+
+/// Format the message for a schema error.
+
+char * format_error (int err_code, const easyyaml_schema * ys, const char * path, const char * key, int tok, char * buf, size_t len)
+{
+  switch (err_code) {
+  case EASYYAML_ERROR_SCHEMA_NOCHILDREN:
+    if (key != NULL)
+      snprintf(buf, len, "schema permits no children at %s (found key %s)", path, key);
+    else
+      snprintf(buf, len, "schema permits no children at %s", path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY:
+    snprintf(buf, len, "key %s unexpected while parsing map at %s", key != NULL ? key : tok_to_str(tok), path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_MANDATES_STRING:
+    snprintf(buf, len, "%s (%s) must be a string at %s", ys->key, ys->descr, path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_MANDATES_INT:
+    snprintf(buf, len, "%s (%s) must be an integer at %s", ys->key, ys->descr, path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_MANDATES_MAP:
+    snprintf(buf, len, "%s (%s) must be a map at %s", ys->key, ys->descr, path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_MANDATES_LIST:
+    snprintf(buf, len, "%s (%s) must be a list at %s", ys->key, ys->descr, path);
+    break;
+
+  case EASYYAML_ERROR_SCHEMA_MANDATES_ENUM:
+    snprintf(buf, len, "%s (%s) must be one of its values at %s (found %s)", ys->key, ys->descr, path,
+             key != NULL ? key : tok_to_str(tok));
+    break;
+
+  default:
+    snprintf(buf, len, "schema has invalid/corrupt type %d at %s", ys->type, path);
+    break;
+  }
+
+  return buf;
+}
+
+
+/// Initialise an error list (for collect mode).
+
+void easyyaml_errors_init (easyyaml_errors * errors)
+{
+  memset(errors, 0, sizeof(easyyaml_errors));
+}
+
+
+/// Free the memory used by an error list (the list may be reused after).
+
+void easyyaml_errors_free (easyyaml_errors * errors)
+{
+  free(errors->list);
+  free(errors->paths);
+  easyyaml_errors_init(errors);
+}
+
+
+/// Record an error in the error list. The path (and key if there is one)
+/// are copied to the list's string buffer, consecutive errors at the same
+/// path share one copy.
+
+int errors_add (easyyaml_errors * errors, int err_code, yaml_mark_t * mark, easyyaml_schema * ys, easyyaml_stack * stack, const char * key, int tok)
+{
+  size_t path_len = stack_path_len(stack);
+  size_t key_len  = key == NULL ? 0 : strlen(key) + 1;
+
+  if (errors->count == errors->size) {
+    size_t size = errors->size == 0 ? 16 : errors->size * 2;
+    easyyaml_error * list = (easyyaml_error *) realloc(errors->list, size * sizeof(easyyaml_error));
+    if (list == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, errors, "out of memory", "out of memory collecting errors");
+    errors->list = list;
+    errors->size = size;
+  }
+
+  if (errors->paths_len + path_len + 1 + key_len > errors->paths_size) {
+    size_t size = errors->paths_size == 0 ? 1024 : errors->paths_size;
+    while (errors->paths_len + path_len + 1 + key_len > size)
+      size *= 2;
+    char * paths = (char *) realloc(errors->paths, size);
+    if (paths == NULL)
+      return error_handler(EASYYAML_ERROR_NOMEM, errors, "out of memory", "out of memory collecting errors");
+    errors->paths = paths;
+    errors->paths_size = size;
+  }
+
+  easyyaml_error * error = &errors->list[errors->count];
+  error->code   = err_code;
+  error->offset = mark->index;
+  error->line   = mark->line;
+  error->column = mark->column;
+  error->ys     = ys;
+  error->token  = tok;
+  error->path   = errors->paths_len;
+  error->key    = EASYYAML_ERROR_NOKEY;
+
+  char * path = errors->paths + errors->paths_len;
+  stack_render(stack, path, path_len + 1);
+
+  if (errors->count > 0 && strcmp(errors->paths + errors->list[errors->count - 1].path, path) == 0)
+    error->path = errors->list[errors->count - 1].path;
+  else
+    errors->paths_len += path_len + 1;
+
+  if (key != NULL) {
+    error->key = errors->paths_len;
+    memcpy(errors->paths + errors->paths_len, key, key_len);
+    errors->paths_len += key_len;
+  }
+
+  errors->count++;
+
+  return EASYYAML_SUCCESS;
+}
+
+
+/// Return the path at which a collected error occurred.
+
+const char * easyyaml_error_path (const easyyaml_errors * errors, size_t i)
+{
+  return errors->paths + errors->list[i].path;
+}
+
+
+/// Format the message for a collected error into \p buf (which is
+/// returned), only done on demand.
+
+char * easyyaml_error_message (const easyyaml_errors * errors, size_t i, char * buf, size_t len)
+{
+  const easyyaml_error * error = &errors->list[i];
+  int prefix_len = snprintf(buf, len, "line %lu column %lu: ",
+                            (unsigned long) error->line + 1, (unsigned long) error->column + 1);
+
+  if (prefix_len < 0 || (size_t) prefix_len >= len)
+    return buf;
+
+  format_error(error->code, error->ys, errors->paths + error->path,
+               error->key == EASYYAML_ERROR_NOKEY ? NULL : errors->paths + error->key,
+               error->token, buf + prefix_len, len - prefix_len);
+
+  return buf;
+}
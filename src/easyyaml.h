@@ -2,7 +2,17 @@
 #define EASYYAML_INCLUDED
 
 
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 #define EASYYAML_SUCCESS                      0x00000000
+#define EASYYAML_MORE_PENDING                 0x00000001
 #define EASYYAML_ERROR_FILEOPEN               0x00001001
 #define EASYYAML_ERROR_LIBYAML_INIT           0x00005002
 #define EASYYAML_ERROR_LIBYAML_SCAN           0x00005003
@@ -14,6 +24,24 @@
 #define EASYYAML_ERROR_SCHEMA_MANDATES_MAP    0x00002009
 #define EASYYAML_ERROR_SCHEMA_MANDATES_LIST   0x0000200a
 #define EASYYAML_ERROR_SCHEMA_INVALID         0x0000200b
+#define EASYYAML_ERROR_SCHEMA_MANDATES_ENUM   0x0000201c
+#define EASYYAML_ERROR_NOMEM                  0x0000100c
+#define EASYYAML_ERROR_READ                   0x0000100d
+#define EASYYAML_ERROR_DECOMPRESS             0x0000100e
+#define EASYYAML_ERROR_PUSH_UNSUPPORTED       0x0000100f
+#define EASYYAML_ERROR_LIMIT_INPUT            0x00001010
+#define EASYYAML_ERROR_LIMIT_DEPTH            0x00001011
+#define EASYYAML_ERROR_LIMIT_SCALAR           0x00001012
+#define EASYYAML_ERROR_LIMIT_KEYS             0x00001013
+#define EASYYAML_ERROR_LIMIT_TIME             0x00001014
+#define EASYYAML_ERROR_ALIAS                  0x00001015
+#define EASYYAML_ERROR_JSON                   0x00001016
+#define EASYYAML_ERROR_MSGPACK                0x00001017
+#define EASYYAML_ERROR_WRITE                  0x00001018
+#define EASYYAML_ERROR_HOLDER_UNSUPPORTED     0x00001019
+#define EASYYAML_ERROR_IMAGE                  0x0000101a
+#define EASYYAML_ERROR_ROUTE                  0x0000101b
+#define EASYYAML_ERROR_INCLUDE                0x0000101d
 
 #define EASYYAML_ERROR_FATAL_BITS             0x00001000
 #define EASYYAML_ERROR_SCHEMA_BITS            0x00002000
@@ -25,20 +53,58 @@
 #define EASYYAML_LOG_LEVEL_TRACE 0x0200
 
 
+#define EASYYAML_DECOMPRESS_NONE 0x0
+#define EASYYAML_DECOMPRESS_AUTO 0x1
+#define EASYYAML_DECOMPRESS_GZIP 0x2
+#define EASYYAML_DECOMPRESS_ZSTD 0x3
+
+
 #define EASYYAML_SCHEMA_END 0x0
 #define EASYYAML_SCHEMA_INT 0x1
 #define EASYYAML_SCHEMA_STR 0x2
 #define EASYYAML_SCHEMA_MAP 0x4
 #define EASYYAML_SCHEMA_LST 0x8
+#define EASYYAML_SCHEMA_REC 0x10
+#define EASYYAML_SCHEMA_RECS 0x20
+#define EASYYAML_SCHEMA_ENUM 0x40
+
+
+#define EASYYAML_EVENT_END        0x0
+#define EASYYAML_EVENT_MAP_BEGIN  0x1
+#define EASYYAML_EVENT_MAP_END    0x2
+#define EASYYAML_EVENT_LIST_BEGIN 0x3
+#define EASYYAML_EVENT_LIST_END   0x4
+#define EASYYAML_EVENT_SCALAR     0x5
+
+
+#define EASYYAML_PROFILE_BUCKETS  32
+#define EASYYAML_PROFILE_BY_TIME  0x1
+#define EASYYAML_PROFILE_BY_CALLS 0x2
 
 
 typedef struct easyyaml_stack_st easyyaml_stack;
 typedef struct easyyaml_schema_st easyyaml_schema;
+typedef struct easyyaml_error_st easyyaml_error;
+typedef struct easyyaml_errors_st easyyaml_errors;
+typedef struct easyyaml_options_st easyyaml_options;
+typedef struct easyyaml_emit_value_st easyyaml_emit_value;
+typedef struct easyyaml_event_st easyyaml_event;
+typedef struct easyyaml_profile_st easyyaml_profile;
+typedef struct easyyaml_profile_entry_st easyyaml_profile_entry;
+typedef struct easyyaml_enum_value_st easyyaml_enum_value;
+typedef struct easyyaml_enum_st easyyaml_enum;
+typedef struct easyyaml_enum_hash_st easyyaml_enum_hash;
+typedef struct easyyaml_includes_st easyyaml_includes;
+
 
+#define EASYYAML_NOID ((size_t) -1)
+#define EASYYAML_PATH_HASH_ROOT 0xcbf29ce484222325ull
 
 typedef struct easyyaml_stack_st {
   char *           key;
   easyyaml_stack * prev;
+  size_t           id;
+  uint64_t         hash;
 } easyyaml_stack;
 
 
@@ -47,16 +113,214 @@ typedef struct easyyaml_schema_st {
   int    type;
   void * data;
   char * descr;
+  size_t rec_size;
+  size_t rec_key_offset;
+  void * rec_handler;
+  void * enum_handler;
+  unsigned int compiled;
 } easyyaml_schema;
 
 
+typedef struct easyyaml_enum_value_st {
+  const char * name;
+  int          value;
+} easyyaml_enum_value;
+
+
+typedef struct easyyaml_enum_st {
+  const easyyaml_enum_value * values;
+  size_t                      count;
+  easyyaml_enum_hash *        hash;
+} easyyaml_enum;
+
+
+#define EASYYAML_ERROR_NOKEY ((size_t) -1)
+
+typedef struct easyyaml_error_st {
+  int                     code;
+  size_t                  offset;
+  size_t                  line;
+  size_t                  column;
+  size_t                  path;
+  size_t                  key;
+  const easyyaml_schema * ys;
+  int                     token;
+} easyyaml_error;
+
+
+typedef struct easyyaml_errors_st {
+  easyyaml_error * list;
+  size_t           count;
+  size_t           size;
+  char *           paths;
+  size_t           paths_len;
+  size_t           paths_size;
+} easyyaml_errors;
+
+
+typedef struct easyyaml_options_st {
+  easyyaml_errors * errors;
+  size_t            read_buffer_size;
+  int               decompress;
+  size_t            push_stack_size;
+  void *            frame_buf;
+  size_t            frame_buf_size;
+  size_t            max_input_bytes;
+  size_t            max_depth;
+  size_t            max_scalar_len;
+  size_t            max_keys;
+  uint64_t          max_time_ns;
+  easyyaml_profile * profile;
+  easyyaml_includes * includes;
+} easyyaml_options;
+
+
+typedef struct easyyaml_emit_value_st {
+  const char * key;
+  const char * str;
+  int          num;
+  void *       cfg;
+  void *       recs;
+  size_t       rec_count;
+} easyyaml_emit_value;
+
+
+typedef struct easyyaml_event_st {
+  int                     type;
+  const char *            key;
+  const char *            str;
+  size_t                  len;
+  int                     num;
+  const easyyaml_schema * ys;
+  easyyaml_stack *        stack;
+  size_t                  depth;
+} easyyaml_event;
+
+
+typedef struct easyyaml_profile_entry_st {
+  const easyyaml_schema * ys;
+  const char *            path;
+  uint64_t                calls;
+  uint64_t                call_ns;
+  uint64_t                call_max_ns;
+  uint64_t                call_hist[EASYYAML_PROFILE_BUCKETS];
+  uint64_t                tokens;
+  uint64_t                scan_ns;
+  uint64_t                scan_max_ns;
+  uint64_t                scan_hist[EASYYAML_PROFILE_BUCKETS];
+} easyyaml_profile_entry;
+
+
+typedef struct easyyaml_push_st easyyaml_push;
+typedef struct easyyaml_stepper_st easyyaml_stepper;
+typedef struct easyyaml_parser_st easyyaml_parser;
+typedef struct easyyaml_parser_pool_st easyyaml_parser_pool;
+typedef struct easyyaml_cursor_st easyyaml_cursor;
+typedef struct easyyaml_holder_st easyyaml_holder;
+typedef struct easyyaml_holder_reader_st easyyaml_holder_reader;
+typedef struct easyyaml_image_st easyyaml_image;
+typedef struct easyyaml_router_st easyyaml_router;
+
+
 extern void   easyyaml_set_loglevel (int loglevel);
 extern void   easyyaml_set_logger (void (*logger)(int, const char *));
 extern void   easyyaml_set_errhandler (int (*handler)(int, const void *, const char *, const char *));
 extern void   easyyaml_log (int level, const char *, ...);
 extern int    easyyaml_parse_file (const char * filename, easyyaml_schema * ys, void * cfg);
 extern int    easyyaml_parse_string (const char * input_string, easyyaml_schema * ys, void * cfg);
-extern char * easyyaml_stack_path (easyyaml_stack * stack);
+extern char *   easyyaml_stack_path (easyyaml_stack * stack);
+extern uint64_t easyyaml_path_hash (const char * path);
+
+extern int      easyyaml_enum_compile (easyyaml_enum * table);
+extern int      easyyaml_enum_lookup (const easyyaml_enum * table, const char * str, size_t len, int * value);
+extern void     easyyaml_enum_free (easyyaml_enum * table);
+
+extern void   easyyaml_options_init (easyyaml_options * opts);
+extern size_t easyyaml_frame_size (void);
+extern int    easyyaml_parse_file_opts (const char * filename, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_string_opts (const char * input_string, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_fd (int fd, easyyaml_schema * ys, void * cfg);
+extern int    easyyaml_parse_fd_opts (int fd, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_reader (long (*read_fn)(void *, char *, size_t), void * user, easyyaml_schema * ys, void * cfg);
+extern int    easyyaml_parse_reader_opts (long (*read_fn)(void *, char *, size_t), void * user, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_layers (const char ** filenames, size_t count, easyyaml_schema * ys, void * cfg);
+extern int    easyyaml_parse_layers_opts (const char ** filenames, size_t count, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_json (const char * buf, size_t len, easyyaml_schema * ys, void * cfg);
+extern int    easyyaml_parse_json_opts (const char * buf, size_t len, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_parse_msgpack (const char * buf, size_t len, easyyaml_schema * ys, void * cfg);
+extern int    easyyaml_parse_msgpack_opts (const char * buf, size_t len, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int    easyyaml_yaml_to_msgpack (const char * input_string, char ** out, size_t * out_len);
+
+extern int    easyyaml_emit_string (easyyaml_schema * ys, void * cfg, int (*getter)(easyyaml_stack *, const easyyaml_schema *, size_t, easyyaml_emit_value *, void *), char ** out, size_t * out_len);
+extern int    easyyaml_emit_fd (int fd, easyyaml_schema * ys, void * cfg, int (*getter)(easyyaml_stack *, const easyyaml_schema *, size_t, easyyaml_emit_value *, void *));
+
+extern int              easyyaml_image_build (const char * input_string, char ** out, size_t * out_len);
+extern int              easyyaml_image_build_file (const char * filename, const char * image_filename, const easyyaml_options * opts);
+extern easyyaml_image * easyyaml_image_open (const char * image_filename);
+extern easyyaml_image * easyyaml_image_open_buf (const void * buf, size_t len);
+extern void             easyyaml_image_close (easyyaml_image * image);
+extern size_t           easyyaml_image_root (const easyyaml_image * image);
+extern size_t           easyyaml_image_lookup (const easyyaml_image * image, size_t node, const char * path);
+extern int              easyyaml_image_type (const easyyaml_image * image, size_t node);
+extern const char *     easyyaml_image_str (const easyyaml_image * image, size_t node, size_t * len);
+extern size_t           easyyaml_image_count (const easyyaml_image * image, size_t node);
+extern size_t           easyyaml_image_child (const easyyaml_image * image, size_t node, size_t i, const char ** key);
+
+extern easyyaml_router * easyyaml_router_new (void);
+extern int               easyyaml_router_add (easyyaml_router * router, const char * pattern, void (*handler)(easyyaml_stack *, char *, void *));
+extern int               easyyaml_router_compile (easyyaml_router * router);
+extern size_t            easyyaml_router_states (const easyyaml_router * router);
+extern int               easyyaml_router_parse_string (easyyaml_router * router, const char * input_string, void * cfg);
+extern int               easyyaml_router_parse_file (easyyaml_router * router, const char * filename, void * cfg);
+extern void              easyyaml_router_free (easyyaml_router * router);
+
+extern easyyaml_includes * easyyaml_includes_new (const char * base_dir);
+extern int                 easyyaml_includes_preload (easyyaml_includes * includes, const char ** paths, size_t count);
+extern void                easyyaml_includes_stats (easyyaml_includes * includes, size_t * scans, size_t * hits);
+extern void                easyyaml_includes_free (easyyaml_includes * includes);
+
+extern easyyaml_push * easyyaml_push_new (easyyaml_schema * ys, void * cfg);
+extern easyyaml_push * easyyaml_push_new_opts (easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int             easyyaml_push_feed (easyyaml_push * push, const char * chunk, size_t len);
+extern int             easyyaml_push_finish (easyyaml_push * push);
+
+extern easyyaml_stepper * easyyaml_stepper_new_string (const char * input_string, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern easyyaml_stepper * easyyaml_stepper_new_file (const char * filename, easyyaml_schema * ys, void * cfg, const easyyaml_options * opts);
+extern int                easyyaml_step (easyyaml_stepper * stepper, size_t max_tokens, uint64_t max_ns);
+extern void               easyyaml_stepper_free (easyyaml_stepper * stepper);
+
+extern easyyaml_parser *      easyyaml_parser_new (easyyaml_schema * ys, const easyyaml_options * opts);
+extern int                    easyyaml_parser_parse (easyyaml_parser * parser, const char * buf, size_t len, void * cfg);
+extern void                   easyyaml_parser_free (easyyaml_parser * parser);
+extern easyyaml_parser_pool * easyyaml_parser_pool_new (easyyaml_schema * ys, const easyyaml_options * opts);
+extern easyyaml_parser *      easyyaml_parser_pool_get (easyyaml_parser_pool * pool);
+extern void                   easyyaml_parser_pool_free (easyyaml_parser_pool * pool);
+
+extern easyyaml_cursor * easyyaml_cursor_new_string (const char * input_string, easyyaml_schema * ys, const easyyaml_options * opts);
+extern easyyaml_cursor * easyyaml_cursor_new_file (const char * filename, easyyaml_schema * ys, const easyyaml_options * opts);
+extern int               easyyaml_next (easyyaml_cursor * cursor, easyyaml_event * ev);
+extern void              easyyaml_cursor_free (easyyaml_cursor * cursor);
+
+extern easyyaml_holder *        easyyaml_holder_new (size_t cfg_size, void (*cfg_free)(void *));
+extern int                      easyyaml_holder_load_file (easyyaml_holder * holder, const char * filename, easyyaml_schema * ys, const easyyaml_options * opts);
+extern int                      easyyaml_holder_load_string (easyyaml_holder * holder, const char * input_string, easyyaml_schema * ys, const easyyaml_options * opts);
+extern size_t                   easyyaml_holder_reclaim (easyyaml_holder * holder);
+extern void                     easyyaml_holder_free (easyyaml_holder * holder);
+extern easyyaml_holder_reader * easyyaml_holder_reader_new (easyyaml_holder * holder);
+extern const void *             easyyaml_holder_enter (easyyaml_holder_reader * reader);
+extern void                     easyyaml_holder_exit (easyyaml_holder_reader * reader);
+extern void                     easyyaml_holder_reader_free (easyyaml_holder_reader * reader);
+
+extern easyyaml_profile * easyyaml_profile_new (void);
+extern void               easyyaml_profile_reset (easyyaml_profile * profile);
+extern void               easyyaml_profile_free (easyyaml_profile * profile);
+extern size_t             easyyaml_profile_stats (const easyyaml_profile * profile, easyyaml_profile_entry * out, size_t max, int order);
+extern int                easyyaml_profile_dump (const easyyaml_profile * profile, int fd, size_t max, int order);
+
+extern void         easyyaml_errors_init (easyyaml_errors * errors);
+extern void         easyyaml_errors_free (easyyaml_errors * errors);
+extern const char * easyyaml_error_path (const easyyaml_errors * errors, size_t i);
+extern char *       easyyaml_error_message (const easyyaml_errors * errors, size_t i, char * buf, size_t len);
 
 
 #define EASYYAML_SCHEMA(name)              easyyaml_schema name[] = {
@@ -64,7 +328,18 @@ extern char * easyyaml_stack_path (easyyaml_stack * stack);
 #define EASYYAML_INT(name, handler, descr) { name, EASYYAML_SCHEMA_INT, handler, descr }
 #define EASYYAML_MAP(name, child, descr)   { name, EASYYAML_SCHEMA_MAP, child,   descr }
 #define EASYYAML_LST(name, child, descr)   { name, EASYYAML_SCHEMA_LST, child,   descr }
+#define EASYYAML_ENUM(name, handler, table, descr) \
+  { name, EASYYAML_SCHEMA_ENUM, table, descr, 0, 0, NULL, (void *) (handler) }
+#define EASYYAML_RECORDS(name, type, key_member, fields, handler, descr) \
+  { name, EASYYAML_SCHEMA_RECS, fields, descr, sizeof(type), offsetof(type, key_member), (void *) (handler) }
+#define EASYYAML_RECORD_EACH(name, type, key_member, fields, handler, descr) \
+  { name, EASYYAML_SCHEMA_REC, fields, descr, sizeof(type), offsetof(type, key_member), (void *) (handler) }
 #define EASYYAML_END()                     { 0, 0, 0 } }
 
 
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif // EASYYAML_INCLUDED
@@ -0,0 +1,451 @@
+/// \file
+/// \brief Header only C++ (C++17) wrapper for libeasyyaml.
+///
+/// Schemas are declared as constexpr objects built from member pointers
+/// and lambdas, for example:
+///
+///   static constexpr auto schema = easyyaml::schema<hello_config>(
+///     easyyaml::field("version", &hello_config::version),
+///     easyyaml::map("restapi", &hello_config::restapi,
+///       easyyaml::field("port", &restapi_config::port),
+///       easyyaml::str("ssl", [](restapi_config & c, std::string_view v) { c.ssl = v == "true"; }))
+///   );
+///
+///   easyyaml::parse_file<schema>(filename, cfg);
+///
+/// The schema is translated (once) into ordinary easyyaml_schema arrays
+/// and parsed by the C engine, but every handler is a trampoline specific
+/// to one schema entry, so member assignments and lambdas are resolved at
+/// compile time and inlined. Keys are hashed at compile time, but only so
+/// that duplicate keys in a map are rejected by a static_assert; keys read
+/// are still matched by the C engine, by string comparison.
+
+
+#ifndef EASYYAML_HPP_INCLUDED
+#define EASYYAML_HPP_INCLUDED
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "easyyaml.h"
+
+
+namespace easyyaml {
+
+
+/// FNV-1a (64 bit) hash of a string, usable at compile time.
+
+constexpr std::uint64_t hash (std::string_view str) noexcept
+{
+  std::uint64_t h = 0xcbf29ce484222325ull;
+
+  for (char c : str) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ull;
+  }
+
+  return h;
+}
+
+
+/// Hash the key of a stack entry (the same function as \ref hash), so
+/// that variable keys can be switched on against compile time hashes.
+
+inline std::uint64_t key_hash (const easyyaml_stack * stack) noexcept
+{
+  return stack->key == nullptr ? hash("") : hash(stack->key);
+}
+
+
+/// Hash a path as rendered by easyyaml_stack_path (the same function as
+/// easyyaml_path_hash), so that handlers can switch on the \c hash of the
+/// stack against compile time hashes of literal paths.
+
+constexpr std::uint64_t path_hash (std::string_view path) noexcept
+{
+  return path == "/" ? hash("") : hash(path);
+}
+
+static_assert(path_hash("/") == EASYYAML_PATH_HASH_ROOT, "path hashes should match the C engine's");
+
+
+namespace detail {
+
+
+/// Access the object itself (entries without a member pointer).
+
+struct self_access {
+  template <class Obj>
+  constexpr Obj & operator() (Obj & obj) const noexcept { return obj; }
+};
+
+
+/// Access a member of the object.
+
+template <class M>
+struct member_access {
+  M member;
+
+  template <class Obj>
+  constexpr auto & operator() (Obj & obj) const noexcept { return obj.*member; }
+};
+
+
+template <class T> struct member_type;
+template <class C, class T> struct member_type<T C::*> { using type = T; };
+
+
+/// Scalar kind tags, mapping to the C schema types.
+
+struct str_kind { static constexpr int type = EASYYAML_SCHEMA_STR; };
+struct int_kind { static constexpr int type = EASYYAML_SCHEMA_INT; };
+
+
+/// Assign a scalar to a member, used by \ref easyyaml::field.
+
+template <class M>
+struct member_setter {
+  M member;
+
+  template <class Obj>
+  void operator() (Obj & obj, std::string_view val) const
+  {
+    using T = typename member_type<M>::type;
+
+    if constexpr (std::is_same_v<T, bool>)
+      obj.*member = val == "true" || val == "yes" || val == "on" || val == "1";
+    else
+      obj.*member = T(val);
+  }
+
+  template <class Obj>
+  void operator() (Obj & obj, int val) const
+  {
+    using T = typename member_type<M>::type;
+
+    obj.*member = static_cast<T>(val);
+  }
+};
+
+
+/// Invoke a scalar handler, with or without the stack argument.
+
+template <class F, class Obj, class V>
+inline void invoke_handler (const F & fn, Obj & obj, V val, easyyaml_stack * stack)
+{
+  if constexpr (std::is_invocable_v<const F &, Obj &, V, easyyaml_stack *>)
+    fn(obj, val, stack);
+  else
+    fn(obj, val);
+}
+
+
+/// True if any two keys in the tuple of entries are the same.
+
+template <class Tuple, std::size_t... I>
+constexpr bool has_duplicate_keys (const Tuple & entries, std::index_sequence<I...>)
+{
+  const char *  keys[]   = {std::get<I>(entries).key..., nullptr};
+  std::uint64_t hashes[] = {(std::get<I>(entries).key == nullptr ? 0 : hash(std::get<I>(entries).key))..., 0};
+
+  for (std::size_t i = 0; i < sizeof...(I); i++)
+    for (std::size_t j = i + 1; j < sizeof...(I); j++)
+      if (keys[i] != nullptr && keys[j] != nullptr && hashes[i] == hashes[j]
+          && std::string_view(keys[i]) == std::string_view(keys[j]))
+        return true;
+
+  return false;
+}
+
+
+} // namespace detail
+
+
+/// A scalar (string or integer) schema entry.
+
+template <class Kind, class F>
+struct scalar_entry {
+  using kind = Kind;
+
+  const char * key;
+  F            fn;
+  const char * descr;
+
+  template <class Obj, class V>
+  void invoke (Obj & obj, V val, easyyaml_stack * stack) const
+  {
+    detail::invoke_handler(fn, obj, val, stack);
+  }
+};
+
+
+/// A map or list schema entry (\p Type is EASYYAML_SCHEMA_MAP or
+/// EASYYAML_SCHEMA_LST).
+
+template <int Type, class Access, class... Children>
+struct node_entry {
+  static constexpr int type = Type;
+
+  const char *            key;
+  Access                  access;
+  std::tuple<Children...> children;
+  const char *            descr;
+};
+
+
+/// The schema root, \p Cfg is the type of the configuration object.
+
+template <class Cfg, class... Children>
+struct schema_root {
+  using config_type = Cfg;
+  static constexpr int type = EASYYAML_SCHEMA_MAP;
+
+  const char *            key;
+  detail::self_access     access;
+  std::tuple<Children...> children;
+  const char *            descr;
+};
+
+
+/// Declare a schema root for configuration objects of type \p Cfg.
+
+template <class Cfg, class... Children>
+constexpr schema_root<Cfg, Children...> schema (Children... children)
+{
+  return {nullptr, {}, {children...}, "root"};
+}
+
+
+/// A string value, handled by \p fn(obj, std::string_view[, stack]).
+
+template <class F>
+constexpr scalar_entry<detail::str_kind, F> str (const char * key, F fn, const char * descr = "")
+{
+  return {key, fn, descr};
+}
+
+
+/// An integer value, handled by \p fn(obj, int[, stack]).
+
+template <class F>
+constexpr scalar_entry<detail::int_kind, F> integer (const char * key, F fn, const char * descr = "")
+{
+  return {key, fn, descr};
+}
+
+
+/// A value assigned directly to a member. Integral members are parsed as
+/// integers, bool and string (anything constructible from a string_view)
+/// members as strings.
+
+template <class C, class T>
+constexpr auto field (const char * key, T C::* member, const char * descr = "")
+{
+  using setter = detail::member_setter<T C::*>;
+
+  if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+    return scalar_entry<detail::int_kind, setter>{key, setter{member}, descr};
+  else
+    return scalar_entry<detail::str_kind, setter>{key, setter{member}, descr};
+}
+
+
+/// A map of the same object, or (if the second argument is a member
+/// pointer) a map of a member object.
+
+template <class First, class... Children>
+constexpr auto map (const char * key, First first, Children... children)
+{
+  if constexpr (std::is_member_object_pointer_v<First>)
+    return node_entry<EASYYAML_SCHEMA_MAP, detail::member_access<First>, Children...>{
+      key, {first}, {children...}, key == nullptr ? "map" : key};
+  else
+    return node_entry<EASYYAML_SCHEMA_MAP, detail::self_access, First, Children...>{
+      key, {}, {first, children...}, key == nullptr ? "map" : key};
+}
+
+
+/// A list of the same object, or (if the second argument is a member
+/// pointer) a list of a member object.
+
+template <class First, class... Children>
+constexpr auto list (const char * key, First first, Children... children)
+{
+  if constexpr (std::is_member_object_pointer_v<First>)
+    return node_entry<EASYYAML_SCHEMA_LST, detail::member_access<First>, Children...>{
+      key, {first}, {children...}, key == nullptr ? "list" : key};
+  else
+    return node_entry<EASYYAML_SCHEMA_LST, detail::self_access, First, Children...>{
+      key, {}, {first, children...}, key == nullptr ? "list" : key};
+}
+
+
+namespace detail {
+
+
+/// Resolve the entry at an index path from the root, at compile time.
+
+template <std::size_t... Path> struct at;
+
+template <>
+struct at<> {
+  template <class E>
+  static constexpr const E & entry (const E & e) { return e; }
+
+  template <class E, class Obj, class V>
+  static void call (const E & e, Obj & obj, V val, easyyaml_stack * stack)
+  {
+    e.invoke(obj, val, stack);
+  }
+};
+
+template <std::size_t I, std::size_t... Rest>
+struct at<I, Rest...> {
+  template <class E>
+  static constexpr const auto & entry (const E & e) { return at<Rest...>::entry(std::get<I>(e.children)); }
+
+  template <class E, class Obj, class V>
+  static void call (const E & e, Obj & obj, V val, easyyaml_stack * stack)
+  {
+    at<Rest...>::call(std::get<I>(e.children), e.access(obj), val, stack);
+  }
+};
+
+
+/// Per entry handler trampolines, called by the C engine.
+
+template <const auto & Root, std::size_t... Path>
+void str_trampoline (easyyaml_stack * stack, char * val, void * cfg)
+{
+  using cfg_t = typename std::decay_t<decltype(Root)>::config_type;
+
+  at<Path...>::call(Root, *static_cast<cfg_t *>(cfg), std::string_view(val), stack);
+}
+
+template <const auto & Root, std::size_t... Path>
+void int_trampoline (easyyaml_stack * stack, int val, void * cfg)
+{
+  using cfg_t = typename std::decay_t<decltype(Root)>::config_type;
+
+  at<Path...>::call(Root, *static_cast<cfg_t *>(cfg), val, stack);
+}
+
+
+template <const auto & Root, std::size_t... Path> struct c_table;
+
+
+/// Build the C schema entry for the entry at an index path.
+
+template <const auto & Root, std::size_t... Path>
+easyyaml_schema c_entry ()
+{
+  const auto & e = at<Path...>::entry(Root);
+  using E = std::decay_t<decltype(e)>;
+
+  easyyaml_schema ys = {};
+  ys.key   = const_cast<char *>(e.key);
+  ys.descr = const_cast<char *>(e.descr);
+
+  if constexpr (std::is_same_v<typename E::kind, str_kind>) {
+    ys.type = EASYYAML_SCHEMA_STR;
+    ys.data = reinterpret_cast<void *>(&str_trampoline<Root, Path...>);
+  } else if constexpr (std::is_same_v<typename E::kind, int_kind>) {
+    ys.type = EASYYAML_SCHEMA_INT;
+    ys.data = reinterpret_cast<void *>(&int_trampoline<Root, Path...>);
+  }
+
+  return ys;
+}
+
+
+/// Build (once) the C schema array for the map or list at an index path.
+
+template <const auto & Root, std::size_t... Path>
+struct c_table {
+  template <std::size_t... I>
+  static easyyaml_schema * build (std::index_sequence<I...>)
+  {
+    static easyyaml_schema table[] = {c_node<I>()..., {}};
+
+    return table;
+  }
+
+  template <std::size_t I>
+  static easyyaml_schema c_node ()
+  {
+    using child_t = std::decay_t<decltype(at<Path..., I>::entry(Root))>;
+
+    if constexpr (has_kind<child_t>(0)) {
+      return c_entry<Root, Path..., I>();
+    } else {
+      const auto & child = at<Path..., I>::entry(Root);
+      easyyaml_schema ys = {};
+      ys.key   = const_cast<char *>(child.key);
+      ys.type  = child_t::type;
+      ys.data  = c_table<Root, Path..., I>::get();
+      ys.descr = const_cast<char *>(child.descr);
+
+      return ys;
+    }
+  }
+
+  template <class E>
+  static constexpr bool has_kind (typename E::kind *) { return true; }
+
+  template <class E>
+  static constexpr bool has_kind (...) { return false; }
+
+  static easyyaml_schema * get ()
+  {
+    constexpr const auto & node = at<Path...>::entry(Root);
+    constexpr std::size_t  n    = std::tuple_size_v<std::decay_t<decltype(node.children)>>;
+
+    static_assert(!has_duplicate_keys(node.children, std::make_index_sequence<n>()),
+                  "easyyaml schema map has duplicate keys");
+
+    return build(std::make_index_sequence<n>());
+  }
+};
+
+
+} // namespace detail
+
+
+/// Return the C schema for a constexpr C++ schema (built on first use).
+
+template <const auto & Schema>
+easyyaml_schema * c_schema ()
+{
+  return detail::c_table<Schema>::get();
+}
+
+
+/// Open and parse a YAML file according to \p Schema.
+
+template <const auto & Schema>
+int parse_file (const char * filename, typename std::decay_t<decltype(Schema)>::config_type & cfg)
+{
+  return easyyaml_parse_file(filename, c_schema<Schema>(), &cfg);
+}
+
+
+/// Parse a zero byte terminated YAML string according to \p Schema.
+
+template <const auto & Schema>
+int parse_string (const char * input_string, typename std::decay_t<decltype(Schema)>::config_type & cfg)
+{
+  return easyyaml_parse_string(input_string, c_schema<Schema>(), &cfg);
+}
+
+
+} // namespace easyyaml
+
+
+#endif // EASYYAML_HPP_INCLUDED
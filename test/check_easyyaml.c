@@ -5,11 +5,31 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 
+#include "config.h"
 #include "easyyaml_check.h"
+#include "easyyaml_alloc.h"
 
 #include "easyyaml.h"
 
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#include <zstd.h>
+#endif
+#if defined(HAVE_UCONTEXT_H) && defined(HAVE_MAKECONTEXT) && defined(HAVE_SWAPCONTEXT)
+#define EASYYAML_WITH_PUSH_TESTS 1
+#endif
+#if defined(HAVE_STDATOMIC_H) && defined(HAVE_PTHREAD_H)
+#define EASYYAML_WITH_HOLDER_TESTS 1
+#endif
+#ifdef HAVE_PTHREAD_H
+#define EASYYAML_WITH_THREAD_TESTS 1
+#include <pthread.h>
+#endif
+
 
 #define SHOW_LOG_OUTPUT 1
 
@@ -342,6 +362,330 @@ START_TEST (handler_callback_stack_traces_path)
 }
 END_TEST
 
+int varkey_ids_handler_callcount = 0;
+
+void varkey_ids_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  varkey_ids_handler_callcount++;
+
+  ck_assert_uint_eq(stack->id, (size_t) atoi(val));
+  ck_assert_uint_eq(stack->prev->id, EASYYAML_NOID);
+}
+
+START_TEST (varkey_ids_dense_and_stable)
+{
+  static EASYYAML_SCHEMA(sub_ys)
+    EASYYAML_STR(NULL, varkey_ids_handler, "id of the key"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("a", sub_ys, "first map"),
+    EASYYAML_MAP("b", sub_ys, "second map"),
+    EASYYAML_END();
+
+  varkey_ids_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_string("a:\n  x: 0\n  y: 1\n  x: 0\nb:\n  y: 1\n  z: 2\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(varkey_ids_handler_callcount, 5);
+}
+END_TEST
+
+START_TEST (varkey_ids_many_keys)
+{
+  static EASYYAML_SCHEMA(sub_ys)
+    EASYYAML_STR(NULL, varkey_ids_handler, "id of the key"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("a", sub_ys, "first map"),
+    EASYYAML_MAP("b", sub_ys, "second map"),
+    EASYYAML_END();
+
+  size_t size = 64 * 1000;
+  char * input = (char *) malloc(size);
+  size_t len = 0;
+
+  len += snprintf(input + len, size - len, "a:\n");
+  for (int i = 0; i < 1000; i++)
+    len += snprintf(input + len, size - len, "  key%d: %d\n", i, i);
+  len += snprintf(input + len, size - len, "b:\n");
+  for (int i = 999; i >= 0; i--)
+    len += snprintf(input + len, size - len, "  key%d: %d\n", i, i);
+
+  varkey_ids_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_string(input, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(varkey_ids_handler_callcount, 2000);
+
+  free(input);
+}
+END_TEST
+
+typedef struct {
+  char * name;
+  int    port;
+  int    admin;
+  char   password[16];
+} test_record;
+
+typedef struct {
+  test_record * recs;
+  size_t        count;
+  int           calls;
+} test_records_cfg;
+
+void test_record_password_handler (easyyaml_stack * stack, char * val, test_record * rec)
+{
+  snprintf(rec->password, sizeof(rec->password), "%s", val);
+}
+
+void test_record_port_handler (easyyaml_stack * stack, int val, test_record * rec)
+{
+  rec->port = val;
+}
+
+void test_record_access_handler (easyyaml_stack * stack, char * val, test_record * rec)
+{
+  if (strcmp(val, "admin") == 0)
+    rec->admin = 1;
+}
+
+void test_records_handler (easyyaml_stack * stack, test_record * recs, size_t count, test_records_cfg * cfg)
+{
+  ck_assert_int_eq(strcmp(stack->key, "users"), 0);
+
+  cfg->recs  = recs;
+  cfg->count = count;
+  cfg->calls++;
+}
+
+void test_record_each_handler (easyyaml_stack * stack, test_record * rec, size_t count, test_records_cfg * cfg)
+{
+  ck_assert_uint_eq(count, 1);
+  ck_assert_int_eq(strcmp(rec->name, cfg->calls == 0 ? "michael" : "molly"), 0);
+  ck_assert_int_eq(rec->port, cfg->calls == 0 ? 80 : 0);
+  ck_assert_int_eq(rec->admin, cfg->calls == 0);
+
+  free(rec->name);
+  cfg->calls++;
+}
+
+static EASYYAML_SCHEMA(test_record_access_ys)
+  EASYYAML_STR(NULL, test_record_access_handler, "access"),
+  EASYYAML_END();
+
+static EASYYAML_SCHEMA(test_record_ys)
+  EASYYAML_STR("password", test_record_password_handler, "password"),
+  EASYYAML_INT("port",     test_record_port_handler,     "port"    ),
+  EASYYAML_LST("access",   test_record_access_ys,        "access"  ),
+  EASYYAML_END();
+
+START_TEST (parse_records_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_RECORDS("users", test_record, name, test_record_ys, test_records_handler, "users"),
+    EASYYAML_END();
+
+  test_records_cfg cfg = {NULL, 0, 0};
+
+  ck_assert_int_eq(easyyaml_parse_string("users:\n"
+                                         "  michael:\n    password: qwerty\n    port: 80\n    access:\n      - admin\n"
+                                         "  molly:\n    password: zxcvb\n",
+                                         ys, &cfg), EASYYAML_SUCCESS);
+  ck_assert_int_eq(cfg.calls, 1);
+  ck_assert_uint_eq(cfg.count, 2);
+  ck_assert_int_eq(strcmp(cfg.recs[0].name, "michael"), 0);
+  ck_assert_int_eq(strcmp(cfg.recs[0].password, "qwerty"), 0);
+  ck_assert_int_eq(cfg.recs[0].port, 80);
+  ck_assert_int_eq(cfg.recs[0].admin, 1);
+  ck_assert_int_eq(strcmp(cfg.recs[1].name, "molly"), 0);
+  ck_assert_int_eq(strcmp(cfg.recs[1].password, "zxcvb"), 0);
+  ck_assert_int_eq(cfg.recs[1].port, 0);
+  ck_assert_int_eq(cfg.recs[1].admin, 0);
+
+  for (size_t i = 0; i < cfg.count; i++)
+    free(cfg.recs[i].name);
+  free(cfg.recs);
+}
+END_TEST
+
+START_TEST (parse_records_many_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_RECORDS("users", test_record, name, test_record_ys, test_records_handler, "users"),
+    EASYYAML_END();
+
+  char input[8192] = "users:\n";
+  for (int i = 0; i < 100; i++)
+    snprintf(input + strlen(input), sizeof(input) - strlen(input), "  user%d:\n    port: %d\n", i, i);
+
+  test_records_cfg cfg = {NULL, 0, 0};
+
+  ck_assert_int_eq(easyyaml_parse_string(input, ys, &cfg), EASYYAML_SUCCESS);
+  ck_assert_uint_eq(cfg.count, 100);
+  for (size_t i = 0; i < cfg.count; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "user%d", (int) i);
+    ck_assert_int_eq(strcmp(cfg.recs[i].name, name), 0);
+    ck_assert_int_eq(cfg.recs[i].port, (int) i);
+    free(cfg.recs[i].name);
+  }
+  free(cfg.recs);
+}
+END_TEST
+
+START_TEST (parse_records_each_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_RECORD_EACH("users", test_record, name, test_record_ys, test_record_each_handler, "users"),
+    EASYYAML_END();
+
+  test_records_cfg cfg = {NULL, 0, 0};
+
+  ck_assert_int_eq(easyyaml_parse_string("users:\n"
+                                         "  michael:\n    port: 80\n    access:\n      - admin\n"
+                                         "  molly:\n    password: zxcvb\n",
+                                         ys, &cfg), EASYYAML_SUCCESS);
+  ck_assert_int_eq(cfg.calls, 2);
+}
+END_TEST
+
+int alias_port_sum = 0;
+int alias_port_calls = 0;
+
+void alias_port_handler (easyyaml_stack * stack, int val, void * extra)
+{
+  alias_port_sum += val;
+  alias_port_calls++;
+}
+
+char alias_host_paths[256];
+
+void alias_host_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  snprintf(alias_host_paths + strlen(alias_host_paths), sizeof(alias_host_paths) - strlen(alias_host_paths),
+           "%s=%s;", easyyaml_stack_path(stack), val);
+}
+
+static EASYYAML_SCHEMA(alias_svr_ys)
+  EASYYAML_INT("port", alias_port_handler, "port"),
+  EASYYAML_STR("host", alias_host_handler, "host"),
+  EASYYAML_END();
+
+START_TEST (parse_alias_scalar_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_INT("a", alias_port_handler, "a"),
+    EASYYAML_INT("b", alias_port_handler, "b"),
+    EASYYAML_END();
+
+  alias_port_sum = alias_port_calls = 0;
+  ck_assert_int_eq(easyyaml_parse_string("a: &p 80\nb: *p\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 2);
+  ck_assert_int_eq(alias_port_sum, 160);
+}
+END_TEST
+
+START_TEST (parse_alias_map_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("base", alias_svr_ys, "base"),
+    EASYYAML_MAP("copy", alias_svr_ys, "copy"),
+    EASYYAML_END();
+
+  alias_port_sum = alias_port_calls = 0;
+  alias_host_paths[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("base: &b\n  port: 80\n  host: x\ncopy: *b\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 2);
+  ck_assert_int_eq(alias_port_sum, 160);
+  ck_assert_str_eq(alias_host_paths, "/base/host=x;/copy/host=x;");
+}
+END_TEST
+
+START_TEST (parse_alias_nested_success)
+{
+  static EASYYAML_SCHEMA(list_ys)
+    EASYYAML_MAP(NULL, alias_svr_ys, "svr"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("a", alias_svr_ys, "a"),
+    EASYYAML_LST("b", list_ys, "b"),
+    EASYYAML_LST("c", list_ys, "c"),
+    EASYYAML_END();
+
+  alias_port_sum = alias_port_calls = 0;
+  ck_assert_int_eq(easyyaml_parse_string("a: &a\n  port: 1\nb: &b\n  - *a\n  - port: 2\nc: *b\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 5);
+  ck_assert_int_eq(alias_port_sum, 7);
+}
+END_TEST
+
+START_TEST (parse_merge_key_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("base", alias_svr_ys, "base"),
+    EASYYAML_MAP("svr",  alias_svr_ys, "svr"),
+    EASYYAML_END();
+
+  alias_port_sum = alias_port_calls = 0;
+  alias_host_paths[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("base: &b\n  port: 80\n  host: x\nsvr:\n  <<: *b\n  port: 81\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 3);
+  ck_assert_int_eq(alias_port_sum, 241);
+  ck_assert_str_eq(alias_host_paths, "/base/host=x;/svr/host=x;");
+}
+END_TEST
+
+START_TEST (parse_merge_key_varkey_success)
+{
+  static EASYYAML_SCHEMA(port_ys)
+    EASYYAML_INT(NULL, alias_port_handler, "port"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("base",  port_ys, "base"),
+    EASYYAML_MAP("ports", port_ys, "ports"),
+    EASYYAML_END();
+
+  alias_port_sum = alias_port_calls = 0;
+  ck_assert_int_eq(easyyaml_parse_string("base: &b\n  http: 80\nports:\n  <<: *b\n  https: 443\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 3);
+  ck_assert_int_eq(alias_port_sum, 603);
+}
+END_TEST
+
+START_TEST (parse_merge_key_override_success)
+{
+  static EASYYAML_SCHEMA(port_ys)
+    EASYYAML_INT(NULL, alias_port_handler, "port"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("a",     alias_svr_ys, "a"),
+    EASYYAML_MAP("b",     alias_svr_ys, "b"),
+    EASYYAML_MAP("svr",   alias_svr_ys, "svr"),
+    EASYYAML_MAP("base",  port_ys,      "base"),
+    EASYYAML_MAP("ports", port_ys,      "ports"),
+    EASYYAML_END();
+
+  // A map's own keys override merged ones, even before the merge key.
+  alias_port_sum = alias_port_calls = 0;
+  alias_host_paths[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("a: &a\n  port: 80\n  host: x\nsvr:\n  port: 81\n  <<: *a\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 2);
+  ck_assert_int_eq(alias_port_sum, 161);
+  ck_assert_str_eq(alias_host_paths, "/a/host=x;/svr/host=x;");
+
+  // As do those of a merged map over the maps merged into it.
+  alias_port_sum = alias_port_calls = 0;
+  ck_assert_int_eq(easyyaml_parse_string("a: &a\n  port: 1\nb: &b\n  port: 2\n  <<: *a\nsvr:\n  <<: *b\n", ys, NULL),
+                   EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 3);
+  ck_assert_int_eq(alias_port_sum, 5);
+
+  // Variable keys too.
+  alias_port_sum = alias_port_calls = 0;
+  ck_assert_int_eq(easyyaml_parse_string("base: &p\n  http: 80\n  https: 1\nports:\n  https: 443\n  <<: *p\n", ys, NULL),
+                   EASYYAML_SUCCESS);
+  ck_assert_int_eq(alias_port_calls, 4);
+  ck_assert_int_eq(alias_port_sum, 604);
+}
+END_TEST
+
 START_TEST (parse_badyaml_fails_errlogs)
 {
   static EASYYAML_SCHEMA(ys)
@@ -353,6 +697,54 @@ START_TEST (parse_badyaml_fails_errlogs)
 }
 END_TEST
 
+START_TEST (parse_records_notmap_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_RECORDS("users", test_record, name, test_record_ys, test_records_handler, "users"),
+    EASYYAML_END();
+
+  test_records_cfg cfg = {NULL, 0, 0};
+
+  ck_assert_int_eq(easyyaml_parse_string("users:\n  michael:\n    port: 80\n  molly: zxcvb\n", ys, &cfg),
+                   EASYYAML_ERROR_SCHEMA_MANDATES_MAP);
+  ck_assert_int_eq(g_log_count_errs, 1);
+  ck_assert_int_eq(cfg.calls, 0);
+}
+END_TEST
+
+START_TEST (parse_alias_unknown_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  ck_assert_int_eq(easyyaml_parse_string("foo: *nope\n", ys, NULL), EASYYAML_ERROR_ALIAS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (parse_alias_recursive_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("foo", alias_svr_ys, "foo"),
+    EASYYAML_END();
+
+  ck_assert_int_eq(easyyaml_parse_string("foo: &f\n  port: *f\n", ys, NULL), EASYYAML_ERROR_ALIAS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (parse_merge_notmap_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("foo", alias_svr_ys, "foo"),
+    EASYYAML_END();
+
+  ck_assert_int_eq(easyyaml_parse_string("foo:\n  <<: 1\n", ys, NULL), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
 START_TEST (parse_badschema_fails_errlogs)
 {
   static EASYYAML_SCHEMA(ys)
@@ -366,6 +758,175 @@ START_TEST (parse_badschema_fails_errlogs)
 }
 END_TEST
 
+// Build a document nesting maps (with key 'k') \p depth deep, ending
+// with 'leaf: val'.
+
+char * nested_doc (int depth)
+{
+  char * doc = malloc((size_t) depth * (depth + 4) + 64);
+  char * p = doc;
+
+  for (int i = 0; i < depth; i++)
+    p += sprintf(p, "%*sk:\n", i, "");
+  sprintf(p, "%*sleaf: val\n", depth, "");
+
+  return doc;
+}
+
+int nested_leaf_depth;
+
+void nested_leaf_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  ck_assert_str_eq(stack->key, "leaf");
+
+  nested_leaf_depth = 0;
+  for (easyyaml_stack * s = stack->prev; s != NULL && s->key != NULL; s = s->prev) {
+    ck_assert_str_eq(s->key, "k");
+    nested_leaf_depth++;
+  }
+
+  // The path is "/k" per level then "/leaf", truncated if too long.
+  char * path = easyyaml_stack_path(stack);
+  size_t path_len = nested_leaf_depth * 2 + 5;
+  ck_assert_uint_eq(strlen(path), path_len < MAX_STACKPATH_LEN ? path_len : MAX_STACKPATH_LEN - 1);
+  ck_assert(strncmp(path, "/k/", 3) == 0);
+  if (path_len < MAX_STACKPATH_LEN)
+    ck_assert_str_eq(path + path_len - 5, "/leaf");
+}
+
+START_TEST (parse_deep_nesting_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  char * doc = nested_doc(2000);
+
+  nested_leaf_depth = -1;
+  ck_assert_int_eq(easyyaml_parse_string(doc, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(nested_leaf_depth, 2000);
+
+  free(doc);
+}
+END_TEST
+
+static uint64_t path_hash_port;
+static uint64_t path_hash_version;
+static int      path_hash_ports;
+static int      path_hash_versions;
+static int      path_hash_others;
+
+void path_hash_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  // The rolling hash is that of the rendered path.
+  ck_assert(stack->hash == easyyaml_path_hash(easyyaml_stack_path(stack)));
+
+  if (stack->hash == path_hash_port)
+    path_hash_ports++;
+  else if (stack->hash == path_hash_version)
+    path_hash_versions++;
+  else
+    path_hash_others++;
+}
+
+START_TEST (parse_path_hash_success)
+{
+  static EASYYAML_SCHEMA(restapi_ys)
+    EASYYAML_STR("port", path_hash_handler, "port"),
+    EASYYAML_STR("host", path_hash_handler, "host"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(access_ys)
+    EASYYAML_STR(NULL, path_hash_handler, "access"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(user_ys)
+    EASYYAML_STR("uid", path_hash_handler, "uid"),
+    EASYYAML_LST("access", access_ys, "access"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(users_ys)
+    EASYYAML_MAP(NULL, user_ys, "user"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("version", path_hash_handler, "version"),
+    EASYYAML_MAP("restapi", restapi_ys, "restapi"),
+    EASYYAML_MAP("users", users_ys, "users"),
+    EASYYAML_END();
+  const char * input =
+    "version: 1\n"
+    "restapi:\n  port: 80\n  host: example.com\n"
+    "users:\n"
+    "  michael: &m\n    uid: 100\n    access:\n      - admin\n"
+    "  john:\n    <<: *m\n";
+  const char * json =
+    "{\"version\": \"1\", \"restapi\": {\"port\": \"80\"}, \"users\": {\"john\": {\"uid\": \"101\"}}}";
+
+  ck_assert(easyyaml_path_hash("/") == EASYYAML_PATH_HASH_ROOT);
+  ck_assert(easyyaml_path_hash("/restapi/port") != easyyaml_path_hash("/restapi/host"));
+  path_hash_port    = easyyaml_path_hash("/restapi/port");
+  path_hash_version = easyyaml_path_hash("/version");
+
+  path_hash_ports = path_hash_versions = path_hash_others = 0;
+  ck_assert_int_eq(easyyaml_parse_string(input, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(path_hash_ports, 1);
+  ck_assert_int_eq(path_hash_versions, 1);
+  ck_assert_int_eq(path_hash_others, 5);
+
+  path_hash_ports = path_hash_versions = path_hash_others = 0;
+  ck_assert_int_eq(easyyaml_parse_json(json, strlen(json), ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(path_hash_ports, 1);
+  ck_assert_int_eq(path_hash_versions, 1);
+  ck_assert_int_eq(path_hash_others, 1);
+}
+END_TEST
+
+START_TEST (parse_frame_buf_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  char frame_buf[8 * 512];
+  ck_assert_uint_le(easyyaml_frame_size() * 8, sizeof(frame_buf));
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.frame_buf      = frame_buf;
+  opts.frame_buf_size = easyyaml_frame_size() * 8;
+
+  char * doc = nested_doc(7);
+
+  nested_leaf_depth = -1;
+  ck_assert_int_eq(easyyaml_parse_string_opts(doc, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(nested_leaf_depth, 7);
+
+  free(doc);
+}
+END_TEST
+
+START_TEST (parse_frame_buf_exhausted_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  char frame_buf[8 * 512];
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.frame_buf      = frame_buf;
+  opts.frame_buf_size = easyyaml_frame_size() * 8;
+
+  char * doc = nested_doc(8);
+
+  ck_assert_int_eq(easyyaml_parse_string_opts(doc, ys, NULL, &opts), EASYYAML_ERROR_NOMEM);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  free(doc);
+}
+END_TEST
+
 START_TEST (parse_file_success)
 {
   static EASYYAML_SCHEMA(empty_ys)
@@ -454,32 +1015,2899 @@ START_TEST (parse_expected_int_fails_errlogs)
 }
 END_TEST
 
-START_TEST (stack_path_renders_empty_stack)
+int collect_errors_foo_handler_callcount = 0;
+
+void collect_errors_foo_handler (easyyaml_stack * stack, char * val, void * extra)
 {
-  easyyaml_stack stack1;
-  stack1.key  = NULL;
-  stack1.prev = NULL;
+  collect_errors_foo_handler_callcount++;
 
-  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack1), "/"), 0);
+  ck_assert_int_eq(strcmp(val, "fooval"), 0);
 }
-END_TEST
 
-START_TEST (stack_path_renders_nonempty_stack)
+START_TEST (collect_errors_reports_all)
 {
-  easyyaml_stack stack1;
-  stack1.key  = NULL;
-  stack1.prev = NULL;
-  easyyaml_stack stack2;
-  stack2.key  = "foo";
-  stack2.prev = &stack1;
+  static EASYYAML_SCHEMA(sub_ys)
+    EASYYAML_INT("bar", NULL, "bar test kvp"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("sub", sub_ys, "sub data"),
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
 
-  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack2), "/foo"), 0);
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
 
-  easyyaml_stack stack3;
-  stack3.key  = "bar";
-  stack3.prev = &stack2;
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_string_opts("sub:\n  naughty: 1\n  bar:\n    - 1\n  other: 2\nfoo: fooval\n",
+                                              ys, NULL, &opts),
+                   EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+  ck_assert_int_eq(g_log_count_errs, 0);
 
-  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack3), "/foo/bar"), 0);
+  ck_assert_int_eq(errors.count, 3);
+  ck_assert_int_eq(errors.list[0].code, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(errors.list[0].line, 1);
+  ck_assert_int_eq(errors.list[0].column, 2);
+  ck_assert_int_eq(errors.list[0].offset, 7);
+  ck_assert_int_eq(strcmp(easyyaml_error_path(&errors, 0), "/sub"), 0);
+  ck_assert_int_eq(errors.list[1].code, EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  ck_assert_int_eq(errors.list[1].line, 3);
+  ck_assert_int_eq(strcmp(easyyaml_error_path(&errors, 1), "/sub/bar"), 0);
+  ck_assert_int_eq(errors.list[2].code, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(strcmp(easyyaml_error_path(&errors, 2), "/sub"), 0);
+
+  char buf[256];
+  ck_assert_int_eq(strcmp(easyyaml_error_message(&errors, 0, buf, sizeof(buf)),
+                          "line 2 column 3: key naughty unexpected while parsing map at /sub"), 0);
+  ck_assert_int_eq(strcmp(easyyaml_error_message(&errors, 1, buf, sizeof(buf)),
+                          "line 4 column 5: bar (bar test kvp) must be an integer at /sub/bar"), 0);
+
+  easyyaml_errors_free(&errors);
+  ck_assert_int_eq(errors.count, 0);
+}
+END_TEST
+
+START_TEST (collect_errors_none_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("foo: fooval\n", ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(errors.count, 0);
+
+  easyyaml_errors_free(&errors);
+}
+END_TEST
+
+START_TEST (collect_errors_fatal_stops)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("nasty\n", ys, NULL, &opts), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_int_eq(errors.count, 0);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  easyyaml_errors_free(&errors);
+}
+END_TEST
+
+START_TEST (parse_quashed_error_skips_node)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_string("naughty:\n  deeper:\n    - 1\nfoo: fooval\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+  ck_assert_int_eq(g_errhandler_count, 1);
+}
+END_TEST
+
+// Reader callback, returning the input a chunk at a time.
+
+typedef struct test_reader_src_st {
+  const char * data;
+  size_t       len;
+  size_t       pos;
+  size_t       chunk;
+  int          fail;
+} test_reader_src;
+
+long test_reader (void * user, char * buf, size_t len)
+{
+  test_reader_src * src = (test_reader_src *) user;
+
+  if (src->fail)
+    return -1;
+
+  size_t n = src->len - src->pos;
+  if (n > len)
+    n = len;
+  if (n > src->chunk)
+    n = src->chunk;
+
+  memcpy(buf, src->data + src->pos, n);
+  src->pos += n;
+
+  return n;
+}
+
+START_TEST (parse_reader_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_INT("bar", NULL, "bar test kvp"),
+    EASYYAML_END();
+
+  const char * input = "bar: 123\nfoo: fooval\n";
+  test_reader_src src = {input, strlen(input), 0, 1, 0};
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.read_buffer_size = 3;
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+  ck_assert_int_eq(src.pos, src.len);
+}
+END_TEST
+
+START_TEST (parse_reader_read_error_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  test_reader_src src = {"foo: fooval\n", 12, 0, 12, 1};
+
+  ck_assert_int_eq(easyyaml_parse_reader(test_reader, &src, ys, NULL), EASYYAML_ERROR_READ);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (parse_fd_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  int fds[2];
+  ck_assert_int_eq(pipe(fds), 0);
+  ck_assert_int_eq(write(fds[1], "foo: fooval\n", 12), 12);
+  close(fds[1]);
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_fd(fds[0], ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+  close(fds[0]);
+}
+END_TEST
+
+START_TEST (parse_reader_uncompressed_auto_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  test_reader_src src = {"foo: fooval\n", 12, 0, 1, 0};
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.decompress = EASYYAML_DECOMPRESS_AUTO;
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+}
+END_TEST
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+// Gzip compress a string, returning a malloced buffer.
+
+unsigned char * test_gzip (const char * input, size_t * out_len)
+{
+  size_t size = strlen(input) + 1024;
+  unsigned char * gz = malloc(size);
+  z_stream zs;
+
+  memset(&zs, 0, sizeof(zs));
+  ck_assert_int_eq(deflateInit2(&zs, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+  zs.next_in   = (unsigned char *) input;
+  zs.avail_in  = strlen(input);
+  zs.next_out  = gz;
+  zs.avail_out = size;
+  ck_assert_int_eq(deflate(&zs, Z_FINISH), Z_STREAM_END);
+  *out_len = zs.total_out;
+  deflateEnd(&zs);
+
+  return gz;
+}
+
+size_t parse_reader_gzip_val_len;
+
+void parse_reader_gzip_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  parse_reader_gzip_val_len = strlen(val);
+}
+
+START_TEST (parse_reader_gzip_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", parse_reader_gzip_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  // Large enough that libyaml asks for input many times.
+  size_t val_len = 100000;
+  char * input = malloc(val_len + 16);
+  strcpy(input, "foo: ");
+  memset(input + 5, 'x', val_len);
+  strcpy(input + 5 + val_len, "\n");
+
+  size_t gz_len;
+  unsigned char * gz = test_gzip(input, &gz_len);
+
+  test_reader_src src = {(char *) gz, gz_len, 0, 7, 0};
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.decompress = EASYYAML_DECOMPRESS_AUTO;
+  opts.read_buffer_size = 64;
+
+  parse_reader_gzip_val_len = 0;
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(parse_reader_gzip_val_len, val_len);
+
+  free(input);
+  free(gz);
+}
+END_TEST
+
+START_TEST (parse_reader_gzip_truncated_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  size_t gz_len;
+  unsigned char * gz = test_gzip("foo: fooval\n", &gz_len);
+
+  test_reader_src src = {(char *) gz, gz_len - 4, 0, gz_len, 0};
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.decompress = EASYYAML_DECOMPRESS_GZIP;
+
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_ERROR_DECOMPRESS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  free(gz);
+}
+END_TEST
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+START_TEST (parse_reader_zstd_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  const char * input = "foo: fooval\n";
+  char zst[256];
+  size_t zst_len = ZSTD_compress(zst, sizeof(zst), input, strlen(input), 3);
+  ck_assert(!ZSTD_isError(zst_len));
+
+  test_reader_src src = {zst, zst_len, 0, 1, 0};
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.decompress = EASYYAML_DECOMPRESS_AUTO;
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+
+  src.pos = 0;
+  src.len = zst_len - 2;
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_ERROR_DECOMPRESS);
+}
+END_TEST
+#endif
+
+#ifdef EASYYAML_WITH_PUSH_TESTS
+START_TEST (push_bytewise_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_INT("bar", NULL, "bar test kvp"),
+    EASYYAML_END();
+
+  const char * input = "foo: fooval\nbar: 123\n";
+  const char * partial_end = strstr(input, "bar");
+
+  easyyaml_push * push = easyyaml_push_new(ys, NULL);
+  ck_assert(push != NULL);
+
+  collect_errors_foo_handler_callcount = 0;
+  for (const char * c = input; *c != '\0'; c++) {
+    // Values are delivered as soon as they are complete, not at the end.
+    if (c == partial_end + 1)
+      ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+    ck_assert_int_eq(easyyaml_push_feed(push, c, 1), EASYYAML_SUCCESS);
+  }
+
+  ck_assert_int_eq(easyyaml_push_finish(push), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+}
+END_TEST
+
+START_TEST (push_chunked_opts_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_INT("bar", NULL, "bar test kvp"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.read_buffer_size = 4;
+  opts.push_stack_size  = 65536;
+
+  easyyaml_push * push = easyyaml_push_new_opts(ys, NULL, &opts);
+  ck_assert(push != NULL);
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_push_feed(push, "foo: foo", 8), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_feed(push, "val\nbar: 1", 10), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_feed(push, "23\n", 3), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_finish(push), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+}
+END_TEST
+
+START_TEST (push_unknown_key_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_push * push = easyyaml_push_new(ys, NULL);
+  ck_assert(push != NULL);
+
+  ck_assert_int_eq(easyyaml_push_feed(push, "foo: x\n", 7), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_feed(push, "baz: 1\n", 7), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(easyyaml_push_feed(push, "foo: y\n", 7), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(easyyaml_push_finish(push), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (push_incomplete_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_push * push = easyyaml_push_new(ys, NULL);
+  ck_assert(push != NULL);
+
+  ck_assert_int_eq(easyyaml_push_feed(push, "foo: 'fooval", 12), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_finish(push), EASYYAML_ERROR_LIBYAML_SCAN);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (push_deep_nesting_small_stack_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.push_stack_size = 65536;
+
+  char * doc = nested_doc(1000);
+
+  easyyaml_push * push = easyyaml_push_new_opts(ys, NULL, &opts);
+  ck_assert(push != NULL);
+
+  nested_leaf_depth = -1;
+  for (size_t pos = 0, len = strlen(doc); pos < len; pos += 1000)
+    ck_assert_int_eq(easyyaml_push_feed(push, doc + pos, len - pos < 1000 ? len - pos : 1000), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_push_finish(push), EASYYAML_SUCCESS);
+  ck_assert_int_eq(nested_leaf_depth, 1000);
+
+  free(doc);
+}
+END_TEST
+
+START_TEST (step_token_budget_resumes)
+{
+  static EASYYAML_SCHEMA(sub_ys)
+    EASYYAML_STR(NULL, collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_LST("sub", sub_ys, "sub data"),
+    EASYYAML_END();
+
+  char input[4096] = "sub:\n";
+  for (int i = 0; i < 100; i++)
+    strcat(input, "  - fooval\n");
+
+  easyyaml_stepper * stepper = easyyaml_stepper_new_string(input, ys, NULL, NULL);
+  ck_assert(stepper != NULL);
+
+  collect_errors_foo_handler_callcount = 0;
+  int steps = 0;
+  int retval;
+  while ((retval = easyyaml_step(stepper, 10, 0)) == EASYYAML_MORE_PENDING) {
+    // Each step only gets so far, the rest is left for the next.
+    ck_assert_int_le(collect_errors_foo_handler_callcount, (steps + 1) * 10);
+    steps++;
+  }
+
+  ck_assert_int_eq(retval, EASYYAML_SUCCESS);
+  ck_assert_int_gt(steps, 10);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 100);
+  ck_assert_int_eq(easyyaml_step(stepper, 10, 0), EASYYAML_SUCCESS);
+
+  easyyaml_stepper_free(stepper);
+}
+END_TEST
+
+START_TEST (step_time_budget_resumes)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_stepper * stepper = easyyaml_stepper_new_string("foo: fooval\n", ys, NULL, NULL);
+  ck_assert(stepper != NULL);
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_step(stepper, 0, 1), EASYYAML_MORE_PENDING);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 0);
+  ck_assert_int_eq(easyyaml_step(stepper, 0, 0), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+
+  easyyaml_stepper_free(stepper);
+}
+END_TEST
+
+START_TEST (step_file_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", collect_errors_foo_handler, "foo test kvp"),
+    EASYYAML_END();
+
+  int fd = open("check_yaml_test_step_file.yaml", O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  ck_assert_int_ge(fd, 0);
+  ck_assert_int_eq(write(fd, "foo: fooval\n", strlen("foo: fooval\n")), strlen("foo: fooval\n"));
+  close(fd);
+
+  easyyaml_stepper * stepper = easyyaml_stepper_new_file("check_yaml_test_step_file.yaml", ys, NULL, NULL);
+  ck_assert(stepper != NULL);
+
+  collect_errors_foo_handler_callcount = 0;
+  ck_assert_int_eq(easyyaml_step(stepper, 1, 0), EASYYAML_MORE_PENDING);
+  ck_assert_int_eq(easyyaml_step(stepper, 0, 0), EASYYAML_SUCCESS);
+  ck_assert_int_eq(collect_errors_foo_handler_callcount, 1);
+
+  easyyaml_stepper_free(stepper);
+  unlink("check_yaml_test_step_file.yaml");
+}
+END_TEST
+
+START_TEST (step_unknown_key_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_stepper * stepper = easyyaml_stepper_new_string("foo: fooval\nbaz: 1\n", ys, NULL, NULL);
+  ck_assert(stepper != NULL);
+
+  int retval;
+  while ((retval = easyyaml_step(stepper, 1, 0)) == EASYYAML_MORE_PENDING)
+    ;
+
+  ck_assert_int_eq(retval, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(easyyaml_step(stepper, 1, 0), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  easyyaml_stepper_free(stepper);
+}
+END_TEST
+
+START_TEST (step_abandoned_frees)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_stepper * stepper = easyyaml_stepper_new_string("foo: fooval\n", ys, NULL, NULL);
+  ck_assert(stepper != NULL);
+
+  ck_assert_int_eq(easyyaml_step(stepper, 2, 0), EASYYAML_MORE_PENDING);
+  easyyaml_stepper_free(stepper);
+}
+END_TEST
+#endif
+
+START_TEST (limits_within_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_input_bytes = 1024;
+  opts.max_depth       = 4;
+  opts.max_scalar_len  = 4;
+  opts.max_keys        = 4;
+  opts.max_time_ns     = 60000000000ULL;
+
+  char * doc = nested_doc(3);
+
+  nested_leaf_depth = -1;
+  ck_assert_int_eq(easyyaml_parse_string_opts(doc, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(nested_leaf_depth, 3);
+
+  free(doc);
+}
+END_TEST
+
+START_TEST (limit_input_string_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_input_bytes = 11;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("foo: fooval\n", ys, NULL, &opts), EASYYAML_ERROR_LIMIT_INPUT);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  opts.max_input_bytes = 12;
+  ck_assert_int_eq(easyyaml_parse_string_opts("foo: fooval\n", ys, NULL, &opts), EASYYAML_SUCCESS);
+}
+END_TEST
+
+START_TEST (limit_input_reader_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  char input[4096] = "foo: ";
+  memset(input + 5, 'x', 4000);
+  test_reader_src src = {input, strlen(input), 0, 100, 0};
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_input_bytes = 1000;
+  opts.read_buffer_size = 256;
+
+  ck_assert_int_eq(easyyaml_parse_reader_opts(test_reader, &src, ys, NULL, &opts), EASYYAML_ERROR_LIMIT_INPUT);
+  ck_assert_int_eq(g_log_count_errs, 1);
+  ck_assert_uint_lt(src.pos, src.len);
+}
+END_TEST
+
+START_TEST (limit_depth_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("k", ys, "nested map"),
+    EASYYAML_STR("leaf", nested_leaf_handler, "leaf value"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_depth = 5;
+
+  char * doc = nested_doc(5);
+
+  ck_assert_int_eq(easyyaml_parse_string_opts(doc, ys, NULL, &opts), EASYYAML_ERROR_LIMIT_DEPTH);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  free(doc);
+}
+END_TEST
+
+START_TEST (limit_scalar_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_scalar_len = 5;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("foo: fooval\n", ys, NULL, &opts), EASYYAML_ERROR_LIMIT_SCALAR);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (limit_keys_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("foo", NULL, "foo test kvp"),
+    EASYYAML_INT("bar", NULL, "bar test kvp"),
+    EASYYAML_END();
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_keys = 1;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("foo: fooval\nbar: 1\n", ys, NULL, &opts), EASYYAML_ERROR_LIMIT_KEYS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (limit_keys_alias_expansion_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(node_ys)
+    EASYYAML_STR("v", NULL, "leaf"),
+    EASYYAML_MAP("a", node_ys, "node"),
+    EASYYAML_MAP("b", node_ys, "node"),
+    EASYYAML_MAP("c", node_ys, "node"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP(NULL, node_ys, "level"),
+    EASYYAML_END();
+
+  // Each level merges and refers to the previous one thrice, so the last
+  // expands to millions of keys.
+  char input[4096] = "l0: &l0\n  v: x\n";
+  for (int i = 1; i < 12; i++)
+    snprintf(input + strlen(input), sizeof(input) - strlen(input),
+             "l%d: &l%d\n  <<: *l%d\n  a: *l%d\n  b: *l%d\n  c: *l%d\n",
+             i, i, i - 1, i - 1, i - 1, i - 1);
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_keys = 100000;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, ys, NULL, &opts), EASYYAML_ERROR_LIMIT_KEYS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (limit_time_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(sub_ys)
+    EASYYAML_STR(NULL, NULL, "foo test kvp"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_LST("sub", sub_ys, "sub data"),
+    EASYYAML_END();
+
+  char input[4096] = "sub:\n";
+  for (int i = 0; i < 200; i++)
+    strcat(input, "  - x\n");
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.max_time_ns = 1;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, ys, NULL, &opts), EASYYAML_ERROR_LIMIT_TIME);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+char json_values[512];
+
+void json_value_handler (easyyaml_stack * stack, char * val, void * extra)
+{
+  snprintf(json_values + strlen(json_values), sizeof(json_values) - strlen(json_values),
+           "%s=%s;", easyyaml_stack_path(stack), val);
+}
+
+void json_int_handler (easyyaml_stack * stack, int val, void * extra)
+{
+  snprintf(json_values + strlen(json_values), sizeof(json_values) - strlen(json_values),
+           "%s=%d;", easyyaml_stack_path(stack), val);
+}
+
+static EASYYAML_SCHEMA(json_access_ys)
+  EASYYAML_STR(NULL, json_value_handler, "access"),
+  EASYYAML_END();
+
+static EASYYAML_SCHEMA(json_user_ys)
+  EASYYAML_STR("password", json_value_handler, "password"),
+  EASYYAML_INT("uid",      json_int_handler,   "uid"     ),
+  EASYYAML_LST("access",   json_access_ys,     "access"  ),
+  EASYYAML_END();
+
+static EASYYAML_SCHEMA(json_users_ys)
+  EASYYAML_MAP(NULL, json_user_ys, "user"),
+  EASYYAML_END();
+
+static EASYYAML_SCHEMA(json_ys)
+  EASYYAML_STR("version", json_value_handler, "version"),
+  EASYYAML_STR("ssl",     json_value_handler, "ssl"    ),
+  EASYYAML_MAP("users",   json_users_ys,      "users"  ),
+  EASYYAML_END();
+
+START_TEST (parse_json_success)
+{
+  const char * input =
+    "{\n"
+    "  \"version\": 1.2e3,\n"
+    "  \"ssl\": true,\n"
+    "  \"users\": {\n"
+    "    \"michael\": {\"password\": \"qw\\\"er\\\\ty\", \"uid\": -7, \"access\": [\"admin\", \"read\"]},\n"
+    "    \"molly\": {\"password\": \"caf\\u00e9 \\ud83d\\ude00\\n\", \"access\": []}\n"
+    "  }\n"
+    "}\n";
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_json(input, strlen(input), json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.2e3;/ssl=true;"
+                   "/users/michael/password=qw\"er\\ty;/users/michael/uid=-7;"
+                   "/users/michael/access=admin;/users/michael/access=read;"
+                   "/users/molly/password=caf\xc3\xa9 \xf0\x9f\x98\x80\n;");
+}
+END_TEST
+
+START_TEST (parse_json_long_strings_success)
+{
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("a", json_value_handler, "a"),
+    EASYYAML_STR("b", json_value_handler, "b"),
+    EASYYAML_END();
+
+  // Long enough runs (and whitespace) to take the vectorized paths, with
+  // the input not terminated where it ends.
+  char input[] = "{\"a\":\"0123456789abcdefghijklmnopqrstuvwxyz\\t0123456789abcdefghij\",                    \n\n"
+                 "                                 \"b\"   :   \"\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\"}XXXX";
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_json(input, strlen(input) - 4, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/a=0123456789abcdefghijklmnopqrstuvwxyz\t0123456789abcdefghij;"
+                   "/b=\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9;");
+}
+END_TEST
+
+START_TEST (parse_json_schema_fails_errlogs)
+{
+  const char * input = "{\"users\": {\"bob\": {\"uid\": [1]}}}";
+
+  ck_assert_int_eq(easyyaml_parse_json(input, strlen(input), json_ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  input = "{\"version\": \"1\", \"naughty\": 1}";
+  ck_assert_int_eq(easyyaml_parse_json(input, strlen(input), json_ys, NULL), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(g_log_count_errs, 2);
+}
+END_TEST
+
+START_TEST (parse_json_collect_errors_lines)
+{
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
+
+  const char * input = "{\n  \"naughty\": 1,\n  \"users\": {\n    \"bob\": {\"uid\": {\"x\": 1}, \"password\": \"pw\"}\n  }\n}";
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_json_opts(input, strlen(input), json_ys, NULL, &opts), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_str_eq(json_values, "/users/bob/password=pw;");
+  ck_assert_int_eq(errors.count, 2);
+  ck_assert_int_eq(errors.list[0].line, 1);
+  ck_assert_int_eq(errors.list[1].code, EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  ck_assert_int_eq(errors.list[1].line, 3);
+  ck_assert_int_eq(strcmp(easyyaml_error_path(&errors, 1), "/users/bob/uid"), 0);
+
+  easyyaml_errors_free(&errors);
+}
+END_TEST
+
+START_TEST (parse_json_syntax_fails_errlogs)
+{
+  const char * bad[] = {
+    "{\"version\": \"1\",}",
+    "{\"version\" \"1\"}",
+    "{\"version\": \"1\\q\"}",
+    "{\"version\": \"1}",
+    "{\"version\": 01}",
+    "{\"version\": tru}",
+    "{\"version\": \"1\"} x",
+    "{\"users\": {\"bob\": {\"access\": [\"a\" \"b\"]}}}",
+    "{\"version\": \"\\ude00\"}",
+    "{\"version\": \"x\\ude00\\ud83d\"}",
+    "{\"version\": \"\\ud83d\\u0041\"}",
+    "{\"version\": \"a\\u0000b\"}",
+  };
+
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    ck_assert_int_eq(easyyaml_parse_json(bad[i], strlen(bad[i]), json_ys, NULL), EASYYAML_ERROR_JSON);
+    ck_assert_int_eq(g_log_count_errs, (int) i + 1);
+  }
+}
+END_TEST
+
+START_TEST (msgpack_convert_success)
+{
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_yaml_to_msgpack("a: 1\nb: [x]\n", &out, &out_len), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_ptr_eq(out, NULL);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  ck_assert_int_eq(easyyaml_yaml_to_msgpack("a: -1\nb: \"7\"\nc:\nd:\n  - true\n  - 300\n", &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_int_eq(out_len, 18);
+  ck_assert_int_eq(memcmp(out, "\x84\xa1" "a\xff\xa1" "b\xa1" "7\xa1" "c\xc0\xa1" "d\x92\xc3\xd1\x01\x2c", out_len), 0);
+  free(out);
+
+  // Nested maps and arrays, each header put in front of its contents.
+  ck_assert_int_eq(easyyaml_yaml_to_msgpack("a:\n  - b:\n      - 1\n  - 2\nc: x\n", &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_int_eq(out_len, 14);
+  ck_assert_int_eq(memcmp(out, "\x82\xa1" "a\x92\x81\xa1" "b\x91\x01\x02\xa1" "c\xa1" "x", out_len), 0);
+  free(out);
+
+  // Headers longer than a byte.
+  char big[512] = "m:\n";
+  for (int i = 0; i < 20; i++)
+    snprintf(big + strlen(big), sizeof(big) - strlen(big), "  k%02d: %d\n", i, i);
+  ck_assert_int_eq(easyyaml_yaml_to_msgpack(big, &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_int_eq(out_len, 3 + 3 + 20 * 5);
+  ck_assert_int_eq(memcmp(out, "\x81\xa1" "m\xde\x00\x14\xa3" "k00\x00\xa3" "k01\x01", 14), 0);
+  ck_assert_int_eq(memcmp(out + out_len - 5, "\xa3" "k19\x13", 5), 0);
+  free(out);
+}
+END_TEST
+
+START_TEST (parse_msgpack_converted_success)
+{
+  const char * input =
+    "version: 1.2.7\n"
+    "ssl: \"true\"\n"
+    "users:\n"
+    "  michael: &michael\n"
+    "    password: qwerty\n"
+    "    uid: -70000\n"
+    "    access:\n"
+    "      - admin\n"
+    "      - read\n"
+    "  molly:\n"
+    "    <<: *michael\n"
+    "    password: ''\n"
+    "    uid: 007\n";
+  char yaml_values[512];
+  char * out;
+  size_t out_len;
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string(input, json_ys, NULL), EASYYAML_SUCCESS);
+  strcpy(yaml_values, json_values);
+
+  ck_assert_int_eq(easyyaml_yaml_to_msgpack(input, &out, &out_len), EASYYAML_SUCCESS);
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_msgpack(out, out_len, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, yaml_values);
+  free(out);
+}
+END_TEST
+
+START_TEST (parse_msgpack_types_success)
+{
+  // {"version": 1.5, "ssl": false, "users": {"bob": {"password": str8 "pw",
+  //  "uid": int32 -100000, "access": [uint16 513, bin "x"]}, bin "al": {"uid": 5}}}
+  const char input[] =
+    "\x83\xa7version\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00\xa3ssl\xc2"
+    "\xa5users\x82"
+    "\xa3" "bob\x83\xa8password\xd9\x02pw\xa3uid\xd2\xff\xfe\x79\x60"
+    "\xa6" "access\x92\xcd\x02\x01\xc4\x01x"
+    "\xc4\x02" "al\x81\xa3uid\x05";
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_msgpack(input, sizeof(input) - 1, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.5;/ssl=false;"
+                   "/users/bob/password=pw;/users/bob/uid=-100000;"
+                   "/users/bob/access=513;/users/bob/access=x;/users/al/uid=5;");
+}
+END_TEST
+
+START_TEST (parse_msgpack_invalid_fails_errlogs)
+{
+  const char * bad[] = {
+    "\x81\xa7version",
+    "\x81\xa7version\xa2x",
+    "\x81\xa7version\xd4\x01\x02",
+    "\x81\x81\xa1x\xa1y\xa1z",
+    "\x81\xc0\xa1z",
+    "\x81\xa7version\xa1z\xa1z",
+  };
+  size_t bad_len[] = {9, 11, 11, 7, 4, 12};
+
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    ck_assert_int_eq(easyyaml_parse_msgpack(bad[i], bad_len[i], json_ys, NULL), EASYYAML_ERROR_MSGPACK);
+    ck_assert_int_eq(g_log_count_errs, (int) i + 1);
+  }
+
+  // A nil value is an empty node, as in YAML.
+  ck_assert_int_eq(easyyaml_parse_string("version:\n", json_ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_STRING);
+  ck_assert_int_eq(easyyaml_parse_msgpack("\x81\xa7version\xc0", 10, json_ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_STRING);
+  ck_assert_int_eq(easyyaml_parse_msgpack("\x91\xa1z", 3, json_ys, NULL), EASYYAML_ERROR_PARSE_UNEXPECTED);
+}
+END_TEST
+
+typedef struct {
+  const char * name;
+  const char * password;
+  int          uid;
+  const char * access[3];
+} emit_user;
+
+typedef struct {
+  const char * version;
+  const char * ssl;
+  emit_user    users[2];
+} emit_config;
+
+int emit_getter (easyyaml_stack * stack, const easyyaml_schema * ys, size_t i, easyyaml_emit_value * val, void * cfg)
+{
+  emit_config * conf = (emit_config *) cfg;
+  emit_user * user = (emit_user *) cfg;
+
+  if (ys->key == NULL && strcmp(ys->descr, "user") == 0 && i < 2) {
+    val->key = conf->users[i].name;
+    val->cfg = &conf->users[i];
+    return 1;
+  } else if (ys->key == NULL && strcmp(ys->descr, "access") == 0) {
+    val->str = user->access[i];
+    return i < 3 && val->str != NULL;
+  } else if (ys->key == NULL) {
+    return 0;
+  }
+
+  if (strcmp(ys->key, "version") == 0)
+    val->str = conf->version;
+  else if (strcmp(ys->key, "ssl") == 0)
+    val->str = conf->ssl;
+  else if (strcmp(ys->key, "password") == 0)
+    val->str = user->password;
+  else if (strcmp(ys->key, "uid") == 0)
+    val->num = user->uid;
+
+  return strcmp(ys->key, "ssl") != 0 || conf->ssl != NULL;
+}
+
+START_TEST (emit_string_roundtrip_success)
+{
+  emit_config conf = {
+    "1.2: beta", NULL,
+    {{"michael", "qw\"er ty", -7, {"admin", "read", NULL}},
+     {"molly #2", "", 0, {NULL, NULL, NULL}}}
+  };
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_emit_string(json_ys, &conf, emit_getter, &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_str_eq(out,
+                   "version: \"1.2: beta\"\n"
+                   "users:\n"
+                   "  michael:\n"
+                   "    password: \"qw\\\"er ty\"\n"
+                   "    uid: -7\n"
+                   "    access:\n"
+                   "      - admin\n"
+                   "      - read\n"
+                   "  \"molly #2\":\n"
+                   "    password: \"\"\n"
+                   "    uid: 0\n");
+  ck_assert_int_eq(out_len, strlen(out));
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string(out, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.2: beta;"
+                   "/users/michael/password=qw\"er ty;/users/michael/uid=-7;"
+                   "/users/michael/access=admin;/users/michael/access=read;"
+                   "/users/molly #2/password=;/users/molly #2/uid=0;");
+  free(out);
+}
+END_TEST
+
+int emit_scalars_getter (easyyaml_stack * stack, const easyyaml_schema * ys, size_t i, easyyaml_emit_value * val, void * cfg)
+{
+  const char ** strs = (const char **) cfg;
+
+  if (ys->key != NULL || strs[i] == NULL)
+    return ys->key != NULL;
+  val->str = strs[i];
+
+  return 1;
+}
+
+START_TEST (emit_string_quoting_roundtrip_success)
+{
+  const char * strs[] = {
+    "plain words", "-7", "- x", "a:b", "#x", " lead", "trail ", "<<", "...", "~", "[1]", "{a}",
+    "'q'", "x\n\ty\r\\\"", "\x01\x7f", "caf\xc3\xa9", "@x", "&a", "*a", "!t", "|", ">", "%", "`",
+    "a\xc2\x85" "b", "x\xe2\x80\xa8y", "\xe2\x80\xa9", "\xef\xbb\xbf" "bom", "c1\xc2\x80", "\xef\xbf\xbe",
+    "\xf0\x9f\x98\x80", NULL
+  };
+  static EASYYAML_SCHEMA(item_ys)
+    EASYYAML_STR(NULL, json_value_handler, "item"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_LST("l", item_ys, "list"),
+    EASYYAML_END();
+  char expected[512] = "";
+  char * out;
+  size_t out_len;
+
+  for (size_t i = 0; strs[i] != NULL; i++)
+    snprintf(expected + strlen(expected), sizeof(expected) - strlen(expected), "/l=%s;", strs[i]);
+
+  ck_assert_int_eq(easyyaml_emit_string(ys, strs, emit_scalars_getter, &out, &out_len), EASYYAML_SUCCESS);
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string(out, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, expected);
+  free(out);
+
+  // Line breaks beyond ASCII are escaped, as is what is not valid UTF-8,
+  // which can only be read back as the code points of its bytes.
+  const char * breaks[] = { "a\xc2\x85" "b", "\xe2\x80\xa8", "\xff\xc3", "\xed\xa0\x80", NULL };
+  ck_assert_int_eq(easyyaml_emit_string(ys, breaks, emit_scalars_getter, &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_str_eq(out, "l:\n  - \"a\\Nb\"\n  - \"\\L\"\n  - \"\\xff\\xc3\"\n  - \"\\xed\\xa0\\x80\"\n");
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string(out, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, "/l=a\xc2\x85" "b;/l=\xe2\x80\xa8;/l=\xc3\xbf\xc3\x83;/l=\xc3\xad\xc2\xa0\xc2\x80;");
+  free(out);
+}
+END_TEST
+
+typedef struct {
+  char * name;
+  int    port;
+} emit_host;
+
+typedef struct {
+  emit_host * hosts;
+  size_t      count;
+  long        port_sum;
+} emit_hosts;
+
+int emit_hosts_getter (easyyaml_stack * stack, const easyyaml_schema * ys, size_t i, easyyaml_emit_value * val, void * cfg)
+{
+  emit_hosts * hosts = (emit_hosts *) cfg;
+
+  if (strcmp(ys->descr, "hosts") == 0) {
+    val->recs      = hosts->hosts;
+    val->rec_count = hosts->count;
+  } else if (strcmp(ys->descr, "ports") == 0) {
+    return 1;
+  } else if (strcmp(ys->descr, "port item") == 0) {
+    if (i >= hosts->count)
+      return 0;
+    val->cfg = &hosts->hosts[i];
+  } else {
+    val->num = ((emit_host *) cfg)->port;
+  }
+
+  return 1;
+}
+
+void emit_port_handler (easyyaml_stack * stack, int val, emit_hosts * hosts)
+{
+  hosts->port_sum += val;
+}
+
+START_TEST (emit_fd_large_success)
+{
+  static EASYYAML_SCHEMA(host_ys)
+    EASYYAML_INT("port", NULL, "port"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(port_ys)
+    EASYYAML_INT("port", emit_port_handler, "port"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(item_ys)
+    EASYYAML_MAP(NULL, port_ys, "port item"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_RECORDS("hosts", emit_host, name, host_ys, NULL, "hosts"),
+    EASYYAML_LST("ports", item_ys, "ports"),
+    EASYYAML_END();
+  emit_hosts hosts = {NULL, 20000, 0};
+  long port_sum = 0;
+
+  // Large enough to be written out in several blocks.
+  hosts.hosts = (emit_host *) calloc(hosts.count, sizeof(emit_host));
+  for (size_t i = 0; i < hosts.count; i++) {
+    hosts.hosts[i].name = (char *) malloc(32);
+    snprintf(hosts.hosts[i].name, 32, "host%lu", (unsigned long) i);
+    hosts.hosts[i].port = (int) i;
+    port_sum += (long) i;
+  }
+
+  FILE * fp = tmpfile();
+  ck_assert_ptr_ne(fp, NULL);
+  ck_assert_int_eq(easyyaml_emit_fd(fileno(fp), ys, &hosts, emit_hosts_getter), EASYYAML_SUCCESS);
+  ck_assert_int_gt(lseek(fileno(fp), 0, SEEK_END), 64 * 1024);
+  lseek(fileno(fp), 0, SEEK_SET);
+
+  // The records are emitted as a map, the list as a list of maps.
+  char head[64] = "";
+  ck_assert_int_eq(read(fileno(fp), head, 60), 60);
+  const char * expected = "hosts:\n  host0:\n    port: 0\n  host1:\n    port: 1\n";
+  ck_assert_int_eq(strncmp(head, expected, strlen(expected)), 0);
+  lseek(fileno(fp), 0, SEEK_SET);
+
+  hosts.port_sum = 0;
+  ck_assert_int_eq(easyyaml_parse_fd(fileno(fp), ys, &hosts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(hosts.port_sum, port_sum);
+  fclose(fp);
+
+  for (size_t i = 0; i < hosts.count; i++)
+    free(hosts.hosts[i].name);
+  free(hosts.hosts);
+}
+END_TEST
+
+START_TEST (emit_fd_write_fails_errlogs)
+{
+  emit_config conf = {"1", NULL, {{"a", "b", 1, {NULL}}, {"c", "d", 2, {NULL}}}};
+  int fd = open("/dev/null", O_RDONLY);
+
+  ck_assert_int_eq(easyyaml_emit_fd(fd, json_ys, &conf, emit_getter), EASYYAML_ERROR_WRITE);
+  ck_assert_int_eq(g_log_count_errs, 1);
+  close(fd);
+}
+END_TEST
+
+START_TEST (emit_no_key_fails_errlogs)
+{
+  emit_config conf = {"1", NULL, {{NULL, "b", 1, {NULL}}, {"c", "d", 2, {NULL}}}};
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_emit_string(json_ys, &conf, emit_getter, &out, &out_len), EASYYAML_ERROR_SCHEMA_INVALID);
+  ck_assert_ptr_eq(out, NULL);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (image_build_success)
+{
+  const char * input =
+    "version: 1.2.7\n"
+    "empty:\n"
+    "users:\n"
+    "  michael: &michael\n"
+    "    password: qwerty\n"
+    "    access:\n"
+    "      - admin\n"
+    "      - read\n"
+    "  molly: *michael\n"
+    "  bob:\n"
+    "    password: one\n"
+    "    password: two\n";
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_image_build(input, &out, &out_len), EASYYAML_SUCCESS);
+
+  // Offsets, not pointers, so the image works wherever it is copied to.
+  char * copy = (char *) malloc(out_len);
+  memcpy(copy, out, out_len);
+  free(out);
+  easyyaml_image * image = easyyaml_image_open_buf(copy, out_len);
+  ck_assert_ptr_ne(image, NULL);
+
+  size_t root = easyyaml_image_root(image);
+  ck_assert_int_eq(easyyaml_image_type(image, root), EASYYAML_SCHEMA_MAP);
+  ck_assert_int_eq(easyyaml_image_count(image, root), 3);
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "version"), NULL), "1.2.7");
+
+  size_t empty = easyyaml_image_lookup(image, root, "empty");
+  ck_assert_int_ne(empty, 0);
+  ck_assert_int_eq(easyyaml_image_type(image, empty), EASYYAML_SCHEMA_END);
+  ck_assert_ptr_eq(easyyaml_image_str(image, empty, NULL), NULL);
+
+  size_t len;
+  size_t access = easyyaml_image_lookup(image, root, "/users/molly/access");
+  ck_assert_int_eq(easyyaml_image_type(image, access), EASYYAML_SCHEMA_LST);
+  ck_assert_int_eq(easyyaml_image_count(image, access), 2);
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, access, "1"), &len), "read");
+  ck_assert_int_eq(len, 4);
+  ck_assert_int_eq(easyyaml_image_lookup(image, access, "2"), 0);
+  ck_assert_int_eq(easyyaml_image_lookup(image, access, "x"), 0);
+  ck_assert_int_eq(easyyaml_image_lookup(image, root, "users/nobody/access"), 0);
+  ck_assert_int_eq(easyyaml_image_lookup(image, root, "/version/x"), 0);
+  ck_assert_int_eq(easyyaml_image_lookup(image, root, ""), root);
+  ck_assert_int_eq(easyyaml_image_lookup(image, root, "/"), root);
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/users/bob/password"), NULL), "two");
+
+  // Map entries are in key order.
+  const char * key;
+  size_t users = easyyaml_image_lookup(image, root, "users");
+  ck_assert_int_eq(easyyaml_image_count(image, users), 3);
+  ck_assert_int_eq(easyyaml_image_child(image, users, 0, &key), easyyaml_image_lookup(image, users, "bob"));
+  ck_assert_str_eq(key, "bob");
+  easyyaml_image_child(image, users, 2, &key);
+  ck_assert_str_eq(key, "molly");
+  ck_assert_int_eq(easyyaml_image_child(image, users, 3, &key), 0);
+  ck_assert_ptr_eq(key, NULL);
+  ck_assert_int_eq(easyyaml_image_child(image, access, 0, &key), easyyaml_image_lookup(image, access, "0"));
+  ck_assert_ptr_eq(key, NULL);
+
+  easyyaml_image_close(image);
+  free(copy);
+  ck_assert_int_eq(g_log_count_errs, 0);
+}
+END_TEST
+
+START_TEST (image_merge_success)
+{
+  const char * input =
+    "base: &b\n"
+    "  x: 1\n"
+    "  y: 1\n"
+    "m:\n"
+    "  y: 2\n"
+    "  <<: *b\n"
+    "  a.b: dot\n"
+    "n:\n"
+    "  <<: *b\n"
+    "  x: 3\n"
+    "q:\n"
+    "  \"<<\": quoted\n";
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_image_build(input, &out, &out_len), EASYYAML_SUCCESS);
+  easyyaml_image * image = easyyaml_image_open_buf(out, out_len);
+  ck_assert_ptr_ne(image, NULL);
+  size_t root = easyyaml_image_root(image);
+
+  // The map's own keys win wherever the merge key is.
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/m/x"), NULL), "1");
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/m/y"), NULL), "2");
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/n/x"), NULL), "3");
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/n/y"), NULL), "1");
+  ck_assert_int_eq(easyyaml_image_lookup(image, root, "/m/<<"), 0);
+  ck_assert_int_eq(easyyaml_image_count(image, easyyaml_image_lookup(image, root, "m")), 3);
+  ck_assert_int_eq(easyyaml_image_count(image, easyyaml_image_lookup(image, root, "n")), 2);
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/m/a.b"), NULL), "dot");
+
+  // A quoted << is an ordinary key.
+  ck_assert_str_eq(easyyaml_image_str(image, easyyaml_image_lookup(image, root, "/q/<<"), NULL), "quoted");
+
+  easyyaml_image_close(image);
+  free(out);
+
+  ck_assert_int_eq(easyyaml_image_build("m:\n  <<: x\n", &out, &out_len), EASYYAML_ERROR_IMAGE);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (image_file_success)
+{
+  int fd = open("check_yaml_test_image_input.yaml", O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  ck_assert_int_ge(fd, 0);
+  ck_assert_int_eq(write(fd, "restapi:\n  port: 80\n", strlen("restapi:\n  port: 80\n")), strlen("restapi:\n  port: 80\n"));
+  close(fd);
+
+  ck_assert_int_eq(easyyaml_image_build_file("check_yaml_test_image_input.yaml", "check_yaml_test_image.img", NULL), EASYYAML_SUCCESS);
+  unlink("check_yaml_test_image_input.yaml");
+
+  // Any number of opens (in any number of processes) share the mapping.
+  easyyaml_image * image1 = easyyaml_image_open("check_yaml_test_image.img");
+  easyyaml_image * image2 = easyyaml_image_open("check_yaml_test_image.img");
+  ck_assert_ptr_ne(image1, NULL);
+  ck_assert_ptr_ne(image2, NULL);
+  ck_assert_str_eq(easyyaml_image_str(image1, easyyaml_image_lookup(image1, easyyaml_image_root(image1), "/restapi/port"), NULL), "80");
+  ck_assert_str_eq(easyyaml_image_str(image2, easyyaml_image_lookup(image2, easyyaml_image_root(image2), "/restapi/port"), NULL), "80");
+  easyyaml_image_close(image1);
+  easyyaml_image_close(image2);
+  unlink("check_yaml_test_image.img");
+
+  ck_assert_ptr_eq(easyyaml_image_open("check_yaml_test_image.img"), NULL);
+  ck_assert_int_eq(g_log_count_errs, 1);
+}
+END_TEST
+
+START_TEST (image_invalid_fails_errlogs)
+{
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_image_build("a: [1]\n", &out, &out_len), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_ptr_eq(out, NULL);
+  ck_assert_int_eq(g_log_count_errs, 1);
+  ck_assert_int_eq(easyyaml_image_build("? - x\n: y\n", &out, &out_len), EASYYAML_ERROR_IMAGE);
+  ck_assert_int_eq(g_log_count_errs, 2);
+
+  ck_assert_int_eq(easyyaml_image_build("a:\n  - b\n", &out, &out_len), EASYYAML_SUCCESS);
+  uint32_t * image = (uint32_t *) malloc(out_len);
+  size_t words = out_len / 4;
+  int errs = 2;
+
+  // Corrupt each word in turn (the spare header word, and the scalars'
+  // contents and padding, are not checked).
+  for (size_t i = 0; i < words; i++) {
+    memcpy(image, out, out_len);
+    image[i] ^= 0x41;
+    easyyaml_image * opened = easyyaml_image_open_buf(image, out_len);
+    if (opened != NULL) {
+      easyyaml_image_close(opened);
+    } else {
+      ck_assert_int_eq(g_log_count_errs, ++errs);
+    }
+  }
+  ck_assert_int_ge(errs, 2 + (int) words - 4);
+
+  memcpy(image, out, out_len);
+  ck_assert_ptr_eq(easyyaml_image_open_buf(image, out_len - 4), NULL);
+  ck_assert_ptr_eq(easyyaml_image_open_buf((char *) image + 1, out_len - 4), NULL);
+  ck_assert_int_eq(g_log_count_errs, errs + 2);
+
+  free(image);
+  free(out);
+}
+END_TEST
+
+#ifdef EASYYAML_WITH_HOLDER_TESTS
+typedef struct {
+  char * version;
+  int    a;
+  int    b;
+} holder_config;
+
+int holder_frees;
+
+void holder_version_handler (easyyaml_stack * stack, char * val, holder_config * cfg)
+{
+  cfg->version = strdup(val);
+}
+
+void holder_a_handler (easyyaml_stack * stack, int val, holder_config * cfg)
+{
+  cfg->a = val;
+}
+
+void holder_b_handler (easyyaml_stack * stack, int val, holder_config * cfg)
+{
+  cfg->b = val;
+}
+
+void holder_cfg_free (void * cfg)
+{
+  free(((holder_config *) cfg)->version);
+  holder_frees++;
+}
+
+static EASYYAML_SCHEMA(holder_ys)
+  EASYYAML_STR("version", holder_version_handler, "version"),
+  EASYYAML_INT("a",       holder_a_handler,       "a"      ),
+  EASYYAML_INT("b",       holder_b_handler,       "b"      ),
+  EASYYAML_END();
+
+START_TEST (holder_reload_success)
+{
+  easyyaml_holder * holder = easyyaml_holder_new(sizeof(holder_config), holder_cfg_free);
+  easyyaml_holder_reader * reader = easyyaml_holder_reader_new(holder);
+  const holder_config * cfg;
+
+  holder_frees = 0;
+  ck_assert_ptr_eq(easyyaml_holder_enter(reader), NULL);
+  easyyaml_holder_exit(reader);
+
+  ck_assert_int_eq(easyyaml_holder_load_string(holder, "version: one\n", holder_ys, NULL), EASYYAML_SUCCESS);
+  cfg = (const holder_config *) easyyaml_holder_enter(reader);
+  ck_assert_str_eq(cfg->version, "one");
+
+  // The version in use is kept until the reader is done with it.
+  ck_assert_int_eq(easyyaml_holder_load_string(holder, "version: two\n", holder_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(holder_frees, 0);
+  ck_assert_int_eq(easyyaml_holder_reclaim(holder), 1);
+  ck_assert_str_eq(cfg->version, "one");
+  easyyaml_holder_exit(reader);
+  ck_assert_int_eq(easyyaml_holder_reclaim(holder), 0);
+  ck_assert_int_eq(holder_frees, 1);
+
+  // A failed load keeps the current version.
+  ck_assert_int_eq(easyyaml_holder_load_string(holder, "version: three\nnaughty: 1\n", holder_ys, NULL), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(g_log_count_errs, 1);
+  ck_assert_int_eq(holder_frees, 2);
+  cfg = (const holder_config *) easyyaml_holder_enter(reader);
+  ck_assert_str_eq(cfg->version, "two");
+  easyyaml_holder_exit(reader);
+
+  // Freed readers are reused.
+  easyyaml_holder_reader_free(reader);
+  ck_assert_ptr_eq(easyyaml_holder_reader_new(holder), reader);
+
+  easyyaml_holder_free(holder);
+  ck_assert_int_eq(holder_frees, 3);
+}
+END_TEST
+
+#define HOLDER_THREADS 4
+#define HOLDER_RELOADS 200
+
+void * holder_reader_main (void * arg)
+{
+  easyyaml_holder_reader * reader = easyyaml_holder_reader_new((easyyaml_holder *) arg);
+  int last = 0;
+  long bad = 0;
+
+  while (last < HOLDER_RELOADS) {
+    const holder_config * cfg = (const holder_config *) easyyaml_holder_enter(reader);
+    if (cfg != NULL) {
+      bad += cfg->a != cfg->b || cfg->a < last;
+      last = cfg->a;
+    }
+    easyyaml_holder_exit(reader);
+  }
+  easyyaml_holder_reader_free(reader);
+
+  return (void *) bad;
+}
+
+START_TEST (holder_threads_success)
+{
+  easyyaml_holder * holder = easyyaml_holder_new(sizeof(holder_config), holder_cfg_free);
+  pthread_t threads[HOLDER_THREADS];
+  char input[64];
+
+  holder_frees = 0;
+  for (int i = 0; i < HOLDER_THREADS; i++)
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, holder_reader_main, holder), 0);
+
+  for (int i = 1; i <= HOLDER_RELOADS; i++) {
+    snprintf(input, sizeof(input), "version: v%d\na: %d\nb: %d\n", i, i, i);
+    ck_assert_int_eq(easyyaml_holder_load_string(holder, input, holder_ys, NULL), EASYYAML_SUCCESS);
+  }
+
+  for (int i = 0; i < HOLDER_THREADS; i++) {
+    void * bad;
+    ck_assert_int_eq(pthread_join(threads[i], &bad), 0);
+    ck_assert_ptr_eq(bad, NULL);
+  }
+
+  ck_assert_int_eq(easyyaml_holder_reclaim(holder), 0);
+  ck_assert_int_eq(holder_frees, HOLDER_RELOADS - 1);
+  easyyaml_holder_free(holder);
+}
+END_TEST
+#endif
+
+START_TEST (parser_reuse_success)
+{
+  easyyaml_parser * parser = easyyaml_parser_new(json_ys, NULL);
+  const char * input =
+    "version: 1.2\n"
+    "users:\n"
+    "  michael: &m\n"
+    "    password: pw\n"
+    "    access:\n"
+    "      - admin\n"
+    "  molly: *m\n";
+
+  // The same document parses the same every time, and the result of one
+  // document has no bearing on the next.
+  for (int i = 0; i < 100; i++) {
+    json_values[0] = '\0';
+    ck_assert_int_eq(easyyaml_parser_parse(parser, input, strlen(input), NULL), EASYYAML_SUCCESS);
+    ck_assert_str_eq(json_values,
+                     "/version=1.2;"
+                     "/users/michael/password=pw;/users/michael/access=admin;"
+                     "/users/molly/password=pw;/users/molly/access=admin;");
+
+    ck_assert_int_eq(easyyaml_parser_parse(parser, "bogus: 1\n", 9, NULL), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+    ck_assert_int_eq(easyyaml_parser_parse(parser, "version: 'open\n", 15, NULL), EASYYAML_ERROR_LIBYAML_SCAN);
+  }
+  ck_assert_int_eq(g_log_count_errs, 200);
+
+  // Input need not be terminated.
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parser_parse(parser, "ssl: on\nversion: 2", 7, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, "/ssl=on;");
+
+  easyyaml_parser_free(parser);
+
+  // The schema is compiled up front, so one that does not compile fails
+  // creation.
+  static const easyyaml_enum_value dup_values[] = { {"a", 1}, {"a", 2}, {NULL, 0} };
+  static easyyaml_enum dup = { dup_values };
+  static EASYYAML_SCHEMA(dup_ys)
+    EASYYAML_ENUM("dup", NULL, &dup, "dup"),
+    EASYYAML_END();
+  ck_assert_ptr_eq(easyyaml_parser_new(dup_ys, NULL), NULL);
+  ck_assert_ptr_eq(easyyaml_parser_pool_new(dup_ys, NULL), NULL);
+  ck_assert_int_eq(g_log_count_errs, 202);
+}
+END_TEST
+
+#ifdef EASYYAML_WITH_THREAD_TESTS
+#define PARSER_THREADS 4
+#define PARSER_DOCS 200
+
+typedef struct {
+  int a;
+  int b;
+} parser_config;
+
+void parser_a_handler (easyyaml_stack * stack, int val, void * cfg)
+{
+  ((parser_config *) cfg)->a = val;
+}
+
+void parser_b_handler (easyyaml_stack * stack, int val, void * cfg)
+{
+  ((parser_config *) cfg)->b = val;
+}
+
+static EASYYAML_SCHEMA(parser_ys)
+  EASYYAML_INT("a", parser_a_handler, "a"),
+  EASYYAML_INT("b", parser_b_handler, "b"),
+  EASYYAML_END();
+
+void * parser_pool_main (void * arg)
+{
+  easyyaml_parser_pool * pool = (easyyaml_parser_pool *) arg;
+  easyyaml_parser * parser = easyyaml_parser_pool_get(pool);
+  char input[64];
+  long bad = parser == NULL;
+
+  for (int i = 0; i < PARSER_DOCS && !bad; i++) {
+    parser_config cfg = {0, 0};
+    int len = snprintf(input, sizeof(input), "a: %d\nb: %d\n", i, -i);
+
+    bad += easyyaml_parser_pool_get(pool) != parser;
+    bad += easyyaml_parser_parse(parser, input, (size_t) len, &cfg) != EASYYAML_SUCCESS;
+    bad += cfg.a != i || cfg.b != -i;
+  }
+
+  return (void *) bad;
+}
+
+START_TEST (parser_pool_success)
+{
+  easyyaml_parser_pool * pool = easyyaml_parser_pool_new(parser_ys, NULL);
+  pthread_t threads[PARSER_THREADS];
+
+  for (int i = 0; i < PARSER_THREADS; i++)
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, parser_pool_main, pool), 0);
+
+  for (int i = 0; i < PARSER_THREADS; i++) {
+    void * bad;
+    ck_assert_int_eq(pthread_join(threads[i], &bad), 0);
+    ck_assert_ptr_eq(bad, NULL);
+  }
+
+  // The calling thread's parser is freed with the pool.
+  parser_config cfg = {0, 0};
+  easyyaml_parser * parser = easyyaml_parser_pool_get(pool);
+  ck_assert_ptr_ne(parser, NULL);
+  ck_assert_ptr_eq(easyyaml_parser_pool_get(pool), parser);
+  ck_assert_int_eq(easyyaml_parser_parse(parser, "a: 1\nb: 2\n", 10, &cfg), EASYYAML_SUCCESS);
+  ck_assert_int_eq(cfg.a, 1);
+  ck_assert_int_eq(cfg.b, 2);
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_parser_pool_free(pool);
+}
+END_TEST
+#endif
+
+static char route_log[65536];
+
+void route_handler (easyyaml_stack * stack, char * val, void * cfg)
+{
+  snprintf(route_log + strlen(route_log), sizeof(route_log) - strlen(route_log),
+           "%s:%s=%s;", (char *) cfg, easyyaml_stack_path(stack), val);
+}
+
+void route_handler_limit (easyyaml_stack * stack, char * val, void * cfg)
+{
+  // The path is the document's, and its hash kept up to date.
+  ck_assert(stack->hash == easyyaml_path_hash(easyyaml_stack_path(stack)));
+  snprintf(route_log + strlen(route_log), sizeof(route_log) - strlen(route_log),
+           "limit:%s=%s;", easyyaml_stack_path(stack), val);
+}
+
+START_TEST (router_patterns_success)
+{
+  easyyaml_router * router = easyyaml_router_new();
+  ck_assert_ptr_ne(router, NULL);
+
+  ck_assert_int_eq(easyyaml_router_add(router, "/users/*/access", route_handler), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_add(router, "/services/*/limits/**", route_handler_limit), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_add(router, "/version", route_handler), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_add(router, "/**/port", route_handler), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_states(router), 0);
+
+  const char * input =
+    "version: 1\n"
+    "users:\n"
+    "  michael:\n    access:\n      - admin\n    port: 1\n"
+    "  john: &j\n    access:\n      - read\n      - write\n    port: 2\n"
+    "services:\n"
+    "  web:\n    port: 80\n    limits:\n      cpu: 2\n      mem:\n        max: 1G\n"
+    "  db:\n    <<: *j\n    limits:\n      cpu: 1\n";
+
+  route_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_router_parse_string(router, input, "r"), EASYYAML_SUCCESS);
+  ck_assert_int_gt(easyyaml_router_states(router), 0);
+  ck_assert_str_eq(route_log,
+                   "r:/version=1;r:/users/michael/access=admin;r:/users/michael/port=1;"
+                   "r:/users/john/access=read;r:/users/john/access=write;r:/users/john/port=2;"
+                   "r:/services/web/port=80;limit:/services/web/limits/cpu=2;limit:/services/web/limits/mem/max=1G;"
+                   "r:/services/db/port=2;limit:/services/db/limits/cpu=1;");
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_router_free(router);
+}
+END_TEST
+
+START_TEST (router_many_patterns_success)
+{
+  easyyaml_router * router = easyyaml_router_new();
+  char pattern[32];
+  char * input = (char *) malloc(64 * 1000);
+  char * p = input;
+
+  for (int i = 0; i < 1000; i++) {
+    snprintf(pattern, sizeof(pattern), "/k%d/v", i);
+    ck_assert_int_eq(easyyaml_router_add(router, pattern, route_handler), EASYYAML_SUCCESS);
+    p += sprintf(p, "k%d:\n  v: %d\n  w: %d\n", i, i, i);
+  }
+  ck_assert_int_eq(easyyaml_router_add(router, "/k999/*", route_handler), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_compile(router), EASYYAML_SUCCESS);
+
+  // A state per pattern prefix, not per combination of patterns.
+  ck_assert_int_le(easyyaml_router_states(router), 2 * 1000 + 8);
+
+  route_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_router_parse_string(router, input, "m"), EASYYAML_SUCCESS);
+  ck_assert_int_eq(strncmp(route_log, "m:/k0/v=0;m:/k1/v=1;", 20), 0);
+  ck_assert_ptr_ne(strstr(route_log, "m:/k998/v=998;m:/k999/v=999;m:/k999/v=999;m:/k999/w=999;"), NULL);
+
+  easyyaml_router_free(router);
+  free(input);
+}
+END_TEST
+
+START_TEST (router_invalid_fails_errlogs)
+{
+  easyyaml_router * router = easyyaml_router_new();
+
+  ck_assert_int_eq(easyyaml_router_add(router, "users", route_handler), EASYYAML_ERROR_ROUTE);
+  ck_assert_int_eq(easyyaml_router_add(router, "/users//access", route_handler), EASYYAML_ERROR_ROUTE);
+  ck_assert_int_eq(easyyaml_router_add(router, "/users/", route_handler), EASYYAML_ERROR_ROUTE);
+  ck_assert_int_eq(g_log_count_errs, 3);
+
+  ck_assert_int_eq(easyyaml_router_add(router, "/", route_handler), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_router_parse_string(router, "a: [1]\n", "x"), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_int_eq(easyyaml_router_parse_string(router, "? - x\n: y\n", "x"), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_int_eq(easyyaml_router_parse_file(router, "/nonexistent/router.yaml", "x"), EASYYAML_ERROR_FILEOPEN);
+  ck_assert_int_eq(g_log_count_errs, 6);
+
+  route_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_router_parse_string(router, "top\n", "x"), EASYYAML_SUCCESS);
+  ck_assert_str_eq(route_log, "x:/=top;");
+
+  easyyaml_router_free(router);
+}
+END_TEST
+
+static const easyyaml_enum_value level_values[] = {
+  {"debug", 10}, {"info", 20}, {"warn", 30}, {"warning", 30}, {"error", 40}, {NULL, 0}
+};
+
+static char enum_log[1024];
+
+void enum_level_handler (easyyaml_stack * stack, int val, void * cfg)
+{
+  snprintf(enum_log + strlen(enum_log), sizeof(enum_log) - strlen(enum_log),
+           "%s=%d;", easyyaml_stack_path(stack), val);
+}
+
+START_TEST (enum_parse_success)
+{
+  static easyyaml_enum levels = { level_values };
+  static EASYYAML_SCHEMA(item_ys)
+    EASYYAML_ENUM(NULL, enum_level_handler, &levels, "log level"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_ENUM("level", enum_level_handler, &levels, "log level"),
+    EASYYAML_LST("levels", item_ys, "log levels"),
+    EASYYAML_END();
+
+  // Compiled on first use.
+  enum_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("level: warning\nlevels:\n  - debug\n  - error\n  - warn\n", ys, NULL),
+                   EASYYAML_SUCCESS);
+  ck_assert_str_eq(enum_log, "/level=30;/levels=10;/levels=40;/levels=30;");
+  ck_assert_int_eq(levels.count, 5);
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  int value = 0;
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "info", 4, &value), 1);
+  ck_assert_int_eq(value, 20);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "infos", 4, &value), 1);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "inf", 3, &value), 0);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "", 0, &value), 0);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "info\0abcdefgh", 13, &value), 0);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "warn\0", 5, &value), 0);
+
+  // Scalars may have NULs in them (from escapes, JSON or MessagePack), and
+  // whichever value they hash to, are never read beyond.
+  char nuls[64];
+  memset(nuls, 'x', sizeof(nuls));
+  for (size_t len = 2; len <= sizeof(nuls); len++) {
+    memcpy(nuls, "warn", 4);
+    nuls[len < 5 ? 1 : 4] = '\0';
+    ck_assert_int_eq(easyyaml_enum_lookup(&levels, nuls, len, &value), 0);
+  }
+
+  easyyaml_enum_free(&levels);
+  ck_assert_int_eq(easyyaml_enum_lookup(&levels, "info", 4, &value), 0);
+}
+END_TEST
+
+START_TEST (enum_many_values_success)
+{
+  static char names[5000][8];
+  static easyyaml_enum_value values[5001];
+  easyyaml_enum table = { values };
+
+  for (int i = 0; i < 5000; i++) {
+    snprintf(names[i], sizeof(names[i]), "v%d", i);
+    values[i].name  = names[i];
+    values[i].value = i * 3;
+  }
+  values[5000].name = NULL;
+
+  // The hash is no larger than the working arrays (five of a word a value,
+  // and a displacement a bucket) and four slots a value.
+  int counted = easyyaml_alloc_start();
+  ck_assert_int_eq(easyyaml_enum_compile(&table), EASYYAML_SUCCESS);
+  easyyaml_alloc_stats stats;
+  easyyaml_alloc_stop(&stats);
+  ck_assert_int_eq(table.count, 5000);
+  if (counted)
+    ck_assert_uint_le(stats.peak, 5 * 8 * 5001 + 4 * 2501 + 4 * 4 * 5000 + 256);
+
+  for (int i = 0; i < 5000; i++) {
+    int value = -1;
+    ck_assert_int_eq(easyyaml_enum_lookup(&table, names[i], strlen(names[i]), &value), 1);
+    ck_assert_int_eq(value, i * 3);
+  }
+  ck_assert_int_eq(easyyaml_enum_lookup(&table, "v5000", 5, &(int) {0}), 0);
+  ck_assert_int_eq(easyyaml_enum_lookup(&table, "x1", 2, &(int) {0}), 0);
+
+  easyyaml_enum_free(&table);
+}
+END_TEST
+
+START_TEST (enum_unknown_fails_errlogs)
+{
+  static easyyaml_enum levels = { level_values };
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_ENUM("level", enum_level_handler, &levels, "log level"),
+    EASYYAML_STR("name", NULL, "name"),
+    EASYYAML_END();
+
+  ck_assert_int_eq(easyyaml_enum_compile(&levels), EASYYAML_SUCCESS);
+
+  enum_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("level: loud\n", ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_ENUM);
+  ck_assert_int_eq(easyyaml_parse_string("level:\n  - info\n", ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_ENUM);
+  ck_assert_int_eq(g_log_count_errs, 2);
+  ck_assert_str_eq(enum_log, "");
+
+  // Collected, with the value found, and the parse carries on.
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("level: Info\nname: x\n", ys, NULL, &opts),
+                   EASYYAML_ERROR_SCHEMA_MANDATES_ENUM);
+  ck_assert_int_eq(errors.count, 1);
+  char buf[256];
+  ck_assert_str_eq(easyyaml_error_message(&errors, 0, buf, sizeof(buf)),
+                   "line 1 column 8: level (log level) must be one of its values at /level (found Info)");
+  easyyaml_errors_free(&errors);
+  ck_assert_int_eq(g_log_count_errs, 2);
+
+  static const easyyaml_enum_value dup_values[] = { {"a", 1}, {"b", 2}, {"a", 3}, {NULL, 0} };
+  easyyaml_enum dup = { dup_values };
+  ck_assert_int_eq(easyyaml_enum_compile(&dup), EASYYAML_ERROR_SCHEMA_INVALID);
+  ck_assert_ptr_eq(dup.hash, NULL);
+  ck_assert_int_eq(g_log_count_errs, 3);
+
+  easyyaml_enum_free(&levels);
+}
+END_TEST
+
+int enum_emit_getter (easyyaml_stack * stack, const easyyaml_schema * ys, size_t i, easyyaml_emit_value * val, void * cfg)
+{
+  if (i > 0)
+    return 0;
+  val->num = *(int *) cfg;
+
+  return 1;
+}
+
+START_TEST (enum_emit_roundtrip_success)
+{
+  static easyyaml_enum levels = { level_values };
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_ENUM("level", enum_level_handler, &levels, "log level"),
+    EASYYAML_END();
+  int level = 30;
+  char * out;
+  size_t out_len;
+
+  ck_assert_int_eq(easyyaml_emit_string(ys, &level, enum_emit_getter, &out, &out_len), EASYYAML_SUCCESS);
+  ck_assert_str_eq(out, "level: warn\n");
+
+  enum_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string(out, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(enum_log, "/level=30;");
+  free(out);
+
+  level = 31;
+  ck_assert_int_eq(easyyaml_emit_string(ys, &level, enum_emit_getter, &out, &out_len), EASYYAML_ERROR_SCHEMA_INVALID);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  easyyaml_enum_free(&levels);
+}
+END_TEST
+
+START_TEST (enum_compiled_before_parse_success)
+{
+  static easyyaml_enum levels = { level_values };
+  static const easyyaml_enum_value dup_values[] = { {"a", 1}, {"a", 2}, {NULL, 0} };
+  static easyyaml_enum dup = { dup_values };
+  static EASYYAML_SCHEMA(node_ys)
+    EASYYAML_ENUM("level", enum_level_handler, &levels, "log level"),
+    EASYYAML_MAP("node", NULL, "node"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(nodes_ys)
+    EASYYAML_MAP(NULL, node_ys, "node"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("name", NULL, "name"),
+    EASYYAML_LST("nodes", nodes_ys, "nodes"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(dup_ys)
+    EASYYAML_STR("name", NULL, "name"),
+    EASYYAML_ENUM("dup", NULL, &dup, "dup"),
+    EASYYAML_END();
+
+  // A schema may include itself.
+  node_ys[1].data = node_ys;
+
+  // The tables of the whole schema are compiled, whether or not the
+  // document has values for them.
+  ck_assert_ptr_eq(levels.hash, NULL);
+  ck_assert_int_eq(easyyaml_parse_string("name: x\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_ptr_ne(levels.hash, NULL);
+
+  enum_log[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string("nodes:\n  - node:\n      level: info\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(enum_log, "/nodes/node/level=20;");
+
+  // The schema is walked once, and again only after a table is freed.
+  unsigned int compiled = ys[0].compiled;
+  ck_assert_uint_ne(compiled, 0);
+  ck_assert_int_eq(easyyaml_parse_string("name: x\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_uint_eq(ys[0].compiled, compiled);
+  easyyaml_enum_free(&levels);
+  ck_assert_int_eq(easyyaml_parse_string("name: x\n", ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_ptr_ne(levels.hash, NULL);
+  ck_assert_uint_ne(ys[0].compiled, compiled);
+
+  ck_assert_int_eq(easyyaml_parse_string("name: x\n", dup_ys, NULL), EASYYAML_ERROR_SCHEMA_INVALID);
+  ck_assert_int_eq(easyyaml_parse_string("name: x\n", dup_ys, NULL), EASYYAML_ERROR_SCHEMA_INVALID);
+  ck_assert_uint_eq(dup_ys[0].compiled, 0);
+  ck_assert_int_eq(g_log_count_errs, 2);
+
+  easyyaml_enum_free(&levels);
+}
+END_TEST
+
+#ifdef EASYYAML_WITH_THREAD_TESTS
+#define ENUM_THREADS 4
+
+static easyyaml_enum enum_threads_levels = { level_values };
+
+void enum_threads_handler (easyyaml_stack * stack, int val, void * cfg)
+{
+  *(int *) cfg = val;
+}
+
+static EASYYAML_SCHEMA(enum_threads_ys)
+  EASYYAML_ENUM("level", enum_threads_handler, &enum_threads_levels, "log level"),
+  EASYYAML_END();
+
+void * enum_threads_main (void * arg)
+{
+  long bad = 0;
+
+  for (int i = 0; i < 200; i++) {
+    int value = 0;
+    bad += easyyaml_parse_string_opts("level: error\n", enum_threads_ys, &value, NULL) != EASYYAML_SUCCESS;
+    bad += value != 40;
+  }
+
+  return (void *) bad;
+}
+
+START_TEST (enum_threads_success)
+{
+  pthread_t threads[ENUM_THREADS];
+
+  // The table is compiled once, by whichever parse starts first.
+  for (int i = 0; i < ENUM_THREADS; i++)
+    ck_assert_int_eq(pthread_create(&threads[i], NULL, enum_threads_main, NULL), 0);
+  for (int i = 0; i < ENUM_THREADS; i++) {
+    void * bad;
+    ck_assert_int_eq(pthread_join(threads[i], &bad), 0);
+    ck_assert_ptr_eq(bad, NULL);
+  }
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_enum_free(&enum_threads_levels);
+}
+END_TEST
+#endif
+
+#define INCLUDE_DIR "check_yaml_test_includes"
+
+void include_write (const char * name, const char * content)
+{
+  char path[256];
+  snprintf(path, sizeof(path), INCLUDE_DIR "/%s", name);
+
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  ck_assert_int_ge(fd, 0);
+  ck_assert_int_eq(write(fd, content, strlen(content)), strlen(content));
+  close(fd);
+}
+
+void include_cleanup (const char ** names)
+{
+  char path[256];
+
+  for (; *names != NULL; names++) {
+    snprintf(path, sizeof(path), INCLUDE_DIR "/%s", *names);
+    unlink(path);
+  }
+  rmdir(INCLUDE_DIR);
+}
+
+START_TEST (include_parse_success)
+{
+  static const char * names[] = {"version.yaml", "user.yaml", "access.yaml", NULL};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("version.yaml", "1.2\n");
+  include_write("user.yaml", "password: pw\naccess: !include access.yaml\n");
+  include_write("access.yaml", "- admin\n- read\n");
+
+  easyyaml_includes * includes = easyyaml_includes_new(INCLUDE_DIR);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.includes = includes;
+  size_t scans;
+  size_t hits;
+
+  const char * input =
+    "version: !include version.yaml\n"
+    "users:\n"
+    "  michael: &m !include user.yaml\n"
+    "  molly: *m\n";
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, json_ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.2;"
+                   "/users/michael/password=pw;/users/michael/access=admin;/users/michael/access=read;"
+                   "/users/molly/password=pw;/users/molly/access=admin;/users/molly/access=read;");
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 3);
+  ck_assert_int_eq(hits, 1);
+
+  // Unchanged files are not scanned again.
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, json_ys, NULL, &opts), EASYYAML_SUCCESS);
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 3);
+  ck_assert_int_eq(hits, 5);
+
+  include_write("access.yaml", "- none\n");
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string_opts("users:\n  michael: !include user.yaml\n", json_ys, NULL, &opts),
+                   EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, "/users/michael/password=pw;/users/michael/access=none;");
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 4);
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_includes_free(includes);
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (include_preload_success)
+{
+  static const char * names[] = {
+    "shared.yaml", "u0.yaml", "u1.yaml", "u2.yaml", "u3.yaml", "u4.yaml", "u5.yaml", "u6.yaml", "u7.yaml",
+    "u8.yaml", "u9.yaml", "u10.yaml", "u11.yaml", "u12.yaml", "u13.yaml", "u14.yaml", "u15.yaml", NULL
+  };
+  char input[1024];
+  char * p = input;
+
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("shared.yaml", "- read\n");
+  p += sprintf(p, "users:\n");
+  for (int i = 1; names[i] != NULL; i++) {
+    char content[64];
+    snprintf(content, sizeof(content), "password: p%d\naccess: !include shared.yaml\n", i - 1);
+    include_write(names[i], content);
+    if (i <= 2)
+      p += sprintf(p, "  user%d: !include %s\n", i - 1, names[i]);
+  }
+
+  easyyaml_includes * includes = easyyaml_includes_new(INCLUDE_DIR);
+  size_t scans;
+  size_t hits;
+
+  ck_assert_int_eq(easyyaml_includes_preload(includes, names + 1, 16), EASYYAML_SUCCESS);
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 17);
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.includes = includes;
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, json_ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/users/user0/password=p0;/users/user0/access=read;"
+                   "/users/user1/password=p1;/users/user1/access=read;");
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 17);
+
+  // Preloading again finds everything current.
+  ck_assert_int_eq(easyyaml_includes_preload(includes, names + 1, 16), EASYYAML_SUCCESS);
+  easyyaml_includes_stats(includes, &scans, &hits);
+  ck_assert_int_eq(scans, 17);
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_includes_free(includes);
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (include_aliases_success)
+{
+  static const char * names[] = {"users.yaml", NULL};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("users.yaml",
+                "michael: &m\n"
+                "  password: pw\n"
+                "  access: &a\n"
+                "    - admin\n"
+                "    - read\n"
+                "molly:\n"
+                "  <<: *m\n"
+                "  access: *a\n");
+
+  easyyaml_includes * includes = easyyaml_includes_new(INCLUDE_DIR);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.includes = includes;
+
+  // The aliases in an included file refer to its own anchors, wherever
+  // the include falls among the anchors of the document.
+  const char * input =
+    "version: &v 1.2\n"
+    "users: !include users.yaml\n"
+    "ssl: *v\n";
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, json_ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.2;"
+                   "/users/michael/password=pw;/users/michael/access=admin;/users/michael/access=read;"
+                   "/users/molly/password=pw;/users/molly/access=admin;/users/molly/access=read;"
+                   "/users/molly/access=admin;/users/molly/access=read;"
+                   "/ssl=1.2;");
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  easyyaml_includes_free(includes);
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (include_alias_expansion_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(node_ys)
+    EASYYAML_STR("v", NULL, "leaf"),
+    EASYYAML_MAP("a", node_ys, "node"),
+    EASYYAML_MAP("b", node_ys, "node"),
+    EASYYAML_MAP("c", node_ys, "node"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(levels_ys)
+    EASYYAML_MAP(NULL, node_ys, "level"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_MAP("all", levels_ys, "levels"),
+    EASYYAML_END();
+  static const char * names[] = {"bomb.yaml", NULL};
+
+  // As in limit_keys_alias_expansion_fails_errlogs, but included, so the
+  // file loads as it is (not expanded) and the limit applies to the parse.
+  char content[4096] = "l0: &l0\n  v: x\n";
+  for (int i = 1; i < 20; i++)
+    snprintf(content + strlen(content), sizeof(content) - strlen(content),
+             "l%d: &l%d\n  <<: *l%d\n  a: *l%d\n  b: *l%d\n  c: *l%d\n",
+             i, i, i - 1, i - 1, i - 1, i - 1);
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("bomb.yaml", content);
+
+  easyyaml_includes * includes = easyyaml_includes_new(INCLUDE_DIR);
+  ck_assert_int_eq(easyyaml_includes_preload(includes, names, 1), EASYYAML_SUCCESS);
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.includes = includes;
+  opts.max_keys = 100000;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("all: !include bomb.yaml\n", ys, NULL, &opts), EASYYAML_ERROR_LIMIT_KEYS);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  easyyaml_includes_free(includes);
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (include_invalid_fails_errlogs)
+{
+  static const char * names[] = {"version.yaml", "cycle.yaml", "empty.yaml", NULL};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("version.yaml", "1.2\n");
+  include_write("cycle.yaml", "!include cycle.yaml\n");
+  include_write("empty.yaml", "");
+
+  easyyaml_includes * includes = easyyaml_includes_new(INCLUDE_DIR);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.includes = includes;
+
+  ck_assert_int_eq(easyyaml_parse_string_opts("version: !include missing.yaml\n", json_ys, NULL, &opts),
+                   EASYYAML_ERROR_FILEOPEN);
+  ck_assert_int_eq(easyyaml_parse_string_opts("version: !include cycle.yaml\n", json_ys, NULL, &opts),
+                   EASYYAML_ERROR_INCLUDE);
+  ck_assert_int_eq(easyyaml_parse_string_opts("version: !include empty.yaml\n", json_ys, NULL, &opts),
+                   EASYYAML_ERROR_INCLUDE);
+  ck_assert_int_eq(easyyaml_parse_string_opts("version: !include\n  a: b\n", json_ys, NULL, &opts),
+                   EASYYAML_ERROR_INCLUDE);
+  ck_assert_int_eq(g_log_count_errs, 4);
+
+  // Includes are only followed when enabled.
+  ck_assert_int_ne(easyyaml_parse_string("version: !include version.yaml\n", json_ys, NULL), EASYYAML_SUCCESS);
+
+  const char * missing[] = {"version.yaml", "missing.yaml"};
+  ck_assert_int_eq(easyyaml_includes_preload(includes, missing, 2), EASYYAML_ERROR_FILEOPEN);
+
+  easyyaml_includes_free(includes);
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (layers_merge_success)
+{
+  static const char * names[] = {"defaults.yaml", "site.yaml", "host.yaml", NULL};
+  static const char * files[] = {
+    INCLUDE_DIR "/defaults.yaml", INCLUDE_DIR "/site.yaml", INCLUDE_DIR "/host.yaml"
+  };
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("defaults.yaml",
+                "version: 1.0\n"
+                "ssl: off\n"
+                "users:\n"
+                "  michael:\n"
+                "    password: pw\n"
+                "    uid: 1000\n"
+                "    access:\n"
+                "      - admin\n"
+                "      - read\n");
+  include_write("site.yaml",
+                "version: 1.1\n"
+                "users:\n"
+                "  michael:\n"
+                "    access:\n"
+                "      - read\n"
+                "  molly:\n"
+                "    password: mp\n");
+  include_write("host.yaml",
+                "ssl: on\n"
+                "users:\n"
+                "  molly:\n"
+                "    uid: 1001\n");
+
+  // Each handler is called once, with the winning value, in the order
+  // the keys were first read.
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files, 3, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=1.1;/ssl=on;"
+                   "/users/michael/password=pw;/users/michael/uid=1000;/users/michael/access=read;"
+                   "/users/molly/password=mp;/users/molly/uid=1001;");
+
+  // A scalar replaces a map, and a map a scalar.
+  include_write("site.yaml", "users: none\n");
+  include_write("host.yaml", "users:\n  molly:\n    password: x\n");
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files, 3, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, "/version=1.0;/ssl=off;/users/molly/password=x;");
+
+  // Merge keys merge into their map, aliases replay, and a single layer
+  // parses as it is.
+  include_write("host.yaml", "users:\n  molly: &m\n    password: x\n  michael:\n    <<: *m\n    uid: 7\n");
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files + 2, 1, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values, "/users/molly/password=x;/users/michael/password=x;/users/michael/uid=7;");
+  include_write("site.yaml", "ssl: off\n");
+  include_write("host.yaml", "---\nversion: 2.0\n<<:\n  ssl: on\n");
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files, 3, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/version=2.0;/ssl=on;"
+                   "/users/michael/password=pw;/users/michael/uid=1000;/users/michael/access=admin;/users/michael/access=read;");
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (layers_merge_key_override_success)
+{
+  static const char * names[] = {"defaults.yaml", "site.yaml", NULL};
+  static const char * files[] = {INCLUDE_DIR "/defaults.yaml", INCLUDE_DIR "/site.yaml"};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("defaults.yaml",
+                "users:\n"
+                "  michael:\n"
+                "    uid: 1000\n"
+                "    password: pw\n");
+  include_write("site.yaml",
+                "users:\n"
+                "  molly: &m\n"
+                "    password: mp\n"
+                "    uid: 1001\n"
+                "  michael:\n"
+                "    uid: 7\n"
+                "    <<: *m\n");
+
+  // Merged entries override earlier layers, but not the keys their map
+  // sets itself in the same layer, even before the merge key.
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files, 2, json_ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_str_eq(json_values,
+                   "/users/michael/uid=7;/users/michael/password=mp;"
+                   "/users/molly/password=mp;/users/molly/uid=1001;");
+  ck_assert_int_eq(g_log_count_errs, 0);
+
+  include_cleanup(names);
+}
+END_TEST
+
+START_TEST (layers_invalid_fails_errlogs)
+{
+  static const char * names[] = {"defaults.yaml", "list.yaml", NULL};
+  static const char * files[] = {INCLUDE_DIR "/defaults.yaml", INCLUDE_DIR "/missing.yaml"};
+  static const char * list_files[] = {INCLUDE_DIR "/defaults.yaml", INCLUDE_DIR "/list.yaml"};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("defaults.yaml", "version: 1.0\n");
+  include_write("list.yaml", "- version\n");
+
+  json_values[0] = '\0';
+  ck_assert_int_eq(easyyaml_parse_layers(files, 2, json_ys, NULL), EASYYAML_ERROR_FILEOPEN);
+  ck_assert_int_eq(easyyaml_parse_layers(list_files, 2, json_ys, NULL), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  ck_assert_str_eq(json_values, "");
+  ck_assert_int_eq(g_log_count_errs, 2);
+
+  // No layers is an empty document.
+  ck_assert_int_eq(easyyaml_parse_layers(files, 0, json_ys, NULL), EASYYAML_SUCCESS);
+
+  include_cleanup(names);
+}
+END_TEST
+
+static char cursor_log[4096];
+
+/// Read all the events of a cursor into \c cursor_log, returning the
+/// result of the parse.
+
+int cursor_read (easyyaml_cursor * cursor)
+{
+  static const char * names[] = {"end", "map", "/map", "list", "/list", "scalar"};
+  easyyaml_event ev;
+  int retval;
+
+  cursor_log[0] = '\0';
+  while ((retval = easyyaml_next(cursor, &ev)) == EASYYAML_SUCCESS && ev.type != EASYYAML_EVENT_END) {
+    ck_assert(ev.stack->hash == easyyaml_path_hash(easyyaml_stack_path(ev.stack)));
+    snprintf(cursor_log + strlen(cursor_log), sizeof(cursor_log) - strlen(cursor_log),
+             "%s %s %lu", names[ev.type], easyyaml_stack_path(ev.stack), (unsigned long) ev.depth);
+    if (ev.key != NULL)
+      snprintf(cursor_log + strlen(cursor_log), sizeof(cursor_log) - strlen(cursor_log), " %s", ev.key);
+    if (ev.type == EASYYAML_EVENT_SCALAR)
+      snprintf(cursor_log + strlen(cursor_log), sizeof(cursor_log) - strlen(cursor_log),
+               "=%s/%d", ev.str, ev.num);
+    snprintf(cursor_log + strlen(cursor_log), sizeof(cursor_log) - strlen(cursor_log), ";");
+  }
+
+  return retval;
+}
+
+START_TEST (cursor_events_success)
+{
+  easyyaml_cursor * cursor = easyyaml_cursor_new_string(
+    "version: 1.2\n"
+    "empty:\n"
+    "base: &b\n"
+    "  uid: 7\n"
+    "users:\n"
+    "  molly:\n"
+    "    <<: *b\n"
+    "    access:\n"
+    "      - admin\n"
+    "      - nested:\n"
+    "          - a\n"
+    "      - \n",
+    NULL, NULL);
+
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_SUCCESS);
+  ck_assert_str_eq(cursor_log,
+                   "map / 0;"
+                   "scalar /version 1 version=1.2/0;"
+                   "scalar /empty 1 empty=/0;"
+                   "map /base 1 base;scalar /base/uid 2 uid=7/0;/map /base 1 base;"
+                   "map /users 1 users;"
+                   "map /users/molly 2 molly;"
+                   "scalar /users/molly/uid 3 uid=7/0;"
+                   "list /users/molly/access 3 access;"
+                   "scalar /users/molly/access 4=admin/0;"
+                   "map /users/molly/access 4;"
+                   "list /users/molly/access/nested 5 nested;"
+                   "scalar /users/molly/access/nested 6=a/0;"
+                   "/list /users/molly/access/nested 5 nested;"
+                   "/map /users/molly/access 4;"
+                   "scalar /users/molly/access 4=/0;"
+                   "/list /users/molly/access 3 access;"
+                   "/map /users/molly 2 molly;"
+                   "/map /users 1 users;"
+                   "/map / 0;");
+
+  // The end, and the result, are sticky.
+  easyyaml_event ev;
+  ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_int_eq(ev.type, EASYYAML_EVENT_END);
+  easyyaml_cursor_free(cursor);
+
+  // Freed part way through.
+  cursor = easyyaml_cursor_new_string("a:\n  b:\n    - c\n", NULL, NULL);
+  for (int i = 0; i < 4; i++)
+    ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_int_eq(ev.type, EASYYAML_EVENT_SCALAR);
+  ck_assert_str_eq(ev.str, "c");
+  easyyaml_cursor_free(cursor);
+
+  // Deep enough to outgrow the levels first allocated, lists and all.
+  char deep[4096] = "k0:\n";
+  char path[256] = "/k0";
+  for (int i = 1; i <= 30; i++) {
+    snprintf(deep + strlen(deep), sizeof(deep) - strlen(deep), "%*s- k%d:%s\n", 4 * i - 2, "", i, i == 30 ? " v" : "");
+    snprintf(path + strlen(path), sizeof(path) - strlen(path), "/k%d", i);
+  }
+  cursor = easyyaml_cursor_new_string(deep, NULL, NULL);
+  do
+    ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  while (ev.type != EASYYAML_EVENT_SCALAR);
+  ck_assert_str_eq(easyyaml_stack_path(ev.stack), path);
+  ck_assert_int_eq(ev.depth, 61);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_SUCCESS);
+  easyyaml_cursor_free(cursor);
+
+  cursor = easyyaml_cursor_new_string("", NULL, NULL);
+  ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_int_eq(ev.type, EASYYAML_EVENT_END);
+  easyyaml_cursor_free(cursor);
+
+  ck_assert_int_eq(g_log_count_errs, 0);
+}
+END_TEST
+
+START_TEST (cursor_schema_success)
+{
+  static easyyaml_enum levels = { level_values };
+  static EASYYAML_SCHEMA(item_ys)
+    EASYYAML_INT(NULL, NULL, "port"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(user_ys)
+    EASYYAML_INT("uid", NULL, "uid"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_ENUM("level", NULL, &levels, "log level"),
+    EASYYAML_STR("name", NULL, "name"),
+    EASYYAML_LST("ports", item_ys, "ports"),
+    EASYYAML_RECORDS("users", test_record, name, user_ys, NULL, "users"),
+    EASYYAML_END();
+
+  easyyaml_cursor * cursor = easyyaml_cursor_new_string(
+    "level: warning\n"
+    "name: x\n"
+    "ports:\n"
+    "  - 80\n"
+    "  - 443\n"
+    "users:\n"
+    "  molly:\n"
+    "    uid: 7\n",
+    ys, NULL);
+
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_SUCCESS);
+  ck_assert_str_eq(cursor_log,
+                   "map / 0;"
+                   "scalar /level 1 level=warning/30;"
+                   "scalar /name 1 name=x/0;"
+                   "list /ports 1 ports;"
+                   "scalar /ports 2=80/80;"
+                   "scalar /ports 2=443/443;"
+                   "/list /ports 1 ports;"
+                   "map /users 1 users;"
+                   "map /users/molly 2 molly;"
+                   "scalar /users/molly/uid 3 uid=7/7;"
+                   "/map /users/molly 2 molly;"
+                   "/map /users 1 users;"
+                   "/map / 0;");
+  easyyaml_cursor_free(cursor);
+
+  // Each event has its schema entry.
+  easyyaml_event ev;
+  cursor = easyyaml_cursor_new_string("ports:\n  - 1\n", ys, NULL);
+  ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_ptr_eq(ev.ys, NULL);
+  ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_ptr_eq(ev.ys, &ys[2]);
+  ck_assert_int_eq(easyyaml_next(cursor, &ev), EASYYAML_SUCCESS);
+  ck_assert_ptr_eq(ev.ys, &item_ys[0]);
+  easyyaml_cursor_free(cursor);
+
+  ck_assert_int_eq(g_log_count_errs, 0);
+  easyyaml_enum_free(&levels);
+}
+END_TEST
+
+START_TEST (cursor_schema_fails_errlogs)
+{
+  static easyyaml_enum levels = { level_values };
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_ENUM("level", NULL, &levels, "log level"),
+    EASYYAML_INT("port", NULL, "port"),
+    EASYYAML_STR("name", NULL, "name"),
+    EASYYAML_END();
+
+  easyyaml_cursor * cursor = easyyaml_cursor_new_string("name: x\nbogus: 1\nport: 2\n", ys, NULL);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_str_eq(cursor_log, "map / 0;scalar /name 1 name=x/0;");
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  easyyaml_cursor_free(cursor);
+  ck_assert_int_eq(g_log_count_errs, 1);
+
+  cursor = easyyaml_cursor_new_string("port:\n  - 1\n", ys, NULL);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  easyyaml_cursor_free(cursor);
+  cursor = easyyaml_cursor_new_string("- 1\n", ys, NULL);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_PARSE_UNEXPECTED);
+  easyyaml_cursor_free(cursor);
+  ck_assert_ptr_eq(easyyaml_cursor_new_file("/nonexistent/cursor.yaml", ys, NULL), NULL);
+  ck_assert_int_eq(g_log_count_errs, 4);
+
+  // Collected, the parse carries on past the errors.
+  easyyaml_errors errors;
+  easyyaml_errors_init(&errors);
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.errors = &errors;
+
+  cursor = easyyaml_cursor_new_string("level: loud\nbogus:\n  a: 1\nport:\n  - 1\nport:\nname: x\n", ys, &opts);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_SCHEMA_MANDATES_ENUM);
+  ck_assert_str_eq(cursor_log, "map / 0;scalar /name 1 name=x/0;/map / 0;");
+  ck_assert_int_eq(errors.count, 4);
+  ck_assert_int_eq(errors.list[1].code, EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(errors.list[2].code, EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  ck_assert_int_eq(errors.list[3].code, EASYYAML_ERROR_SCHEMA_MANDATES_INT);
+  easyyaml_cursor_free(cursor);
+  easyyaml_errors_free(&errors);
+
+  // As are the limits.
+  easyyaml_options_init(&opts);
+  opts.max_depth = 2;
+  cursor = easyyaml_cursor_new_string("a:\n  b:\n    c: 1\n", NULL, &opts);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_LIMIT_DEPTH);
+  ck_assert_str_eq(cursor_log, "map / 0;map /a 1 a;");
+  easyyaml_cursor_free(cursor);
+  ck_assert_int_eq(g_log_count_errs, 5);
+
+  easyyaml_enum_free(&levels);
+}
+END_TEST
+
+START_TEST (cursor_file_success)
+{
+  static const char * names[] = {"cursor.yaml", NULL};
+  mkdir(INCLUDE_DIR, 0777);
+  include_write("cursor.yaml", "a: 1\nb:\n  - 2\n");
+
+  easyyaml_options opts;
+  easyyaml_options_init(&opts);
+  opts.read_buffer_size = 4;
+  easyyaml_cursor * cursor = easyyaml_cursor_new_file(INCLUDE_DIR "/cursor.yaml", NULL, &opts);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_SUCCESS);
+  ck_assert_str_eq(cursor_log, "map / 0;scalar /a 1 a=1/0;list /b 1 b;scalar /b 2=2/0;/list /b 1 b;/map / 0;");
+  easyyaml_cursor_free(cursor);
+
+  include_cleanup(names);
+  ck_assert_int_eq(g_log_count_errs, 0);
+}
+END_TEST
+
+static size_t cursor_ids[8];
+static size_t cursor_id_count;
+
+void cursor_id_handler (easyyaml_stack * stack, char * val, void * cfg)
+{
+  cursor_ids[cursor_id_count++] = stack->id;
+}
+
+START_TEST (cursor_as_parse_fails_errlogs)
+{
+  static EASYYAML_SCHEMA(user_ys)
+    EASYYAML_STR(NULL, cursor_id_handler, "user"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("a", NULL, "a"),
+    EASYYAML_STR("b", NULL, "b"),
+    EASYYAML_MAP("u", user_ys, "users"),
+    EASYYAML_END();
+  const char * input = "a: y\nb: x\nu:\n  bob: 1\n  al: 2\n";
+
+  // The cursor reads the document just as a parse does, its variable keys
+  // interned to the same ids.
+  ck_assert_int_eq(easyyaml_parse_string(input, ys, NULL), EASYYAML_SUCCESS);
+  ck_assert_int_eq(cursor_id_count, 2);
+  ck_assert_int_ne(cursor_ids[0], EASYYAML_NOID);
+  ck_assert_int_ne(cursor_ids[0], cursor_ids[1]);
+
+  easyyaml_cursor * cursor = easyyaml_cursor_new_string(input, ys, NULL);
+  easyyaml_event ev;
+  size_t ids = 0;
+  while (easyyaml_next(cursor, &ev) == EASYYAML_SUCCESS && ev.type != EASYYAML_EVENT_END) {
+    if (ev.type == EASYYAML_EVENT_SCALAR && ev.ys == &user_ys[0])
+      ck_assert_int_eq(ev.stack->id, cursor_ids[ids++]);
+  }
+  ck_assert_int_eq(ids, 2);
+  easyyaml_cursor_free(cursor);
+
+  // And fails where it does, an empty value not being a string.
+  input = "a:\nb: x\nu:\n  bob: 1\n  al: 2\n";
+  ck_assert_int_eq(easyyaml_parse_string(input, ys, NULL), EASYYAML_ERROR_SCHEMA_MANDATES_STRING);
+  cursor = easyyaml_cursor_new_string(input, ys, NULL);
+  ck_assert_int_eq(cursor_read(cursor), EASYYAML_ERROR_SCHEMA_MANDATES_STRING);
+  ck_assert_str_eq(cursor_log, "map / 0;");
+  easyyaml_cursor_free(cursor);
+  ck_assert_int_eq(g_log_count_errs, 2);
+}
+END_TEST
+
+static int profile_items;
+
+void profile_slow_handler (easyyaml_stack * stack, char * val, void * cfg)
+{
+  struct timespec ts = {0, 2000000};
+  nanosleep(&ts, NULL);
+}
+
+void profile_item_handler (easyyaml_stack * stack, int val, void * cfg)
+{
+  profile_items++;
+}
+
+START_TEST (profile_collects_success)
+{
+  static EASYYAML_SCHEMA(item_ys)
+    EASYYAML_INT(NULL, profile_item_handler, "item"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(server_ys)
+    EASYYAML_STR("host", profile_slow_handler, "host to resolve"),
+    EASYYAML_LST("ports", item_ys, "ports"),
+    EASYYAML_END();
+  static EASYYAML_SCHEMA(ys)
+    EASYYAML_STR("version", NULL, "version"),
+    EASYYAML_MAP("server", server_ys, "server"),
+    EASYYAML_END();
+  const char * input =
+    "version: 1\n"
+    "server:\n"
+    "  host: example.com\n"
+    "  ports:\n"
+    "    - 1\n    - 2\n    - 3\n    - 4\n    - 5\n";
+  easyyaml_options opts;
+  easyyaml_profile_entry stats[8];
+
+  easyyaml_options_init(&opts);
+  opts.profile = easyyaml_profile_new();
+  ck_assert_ptr_ne(opts.profile, NULL);
+
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(profile_items, 10);
+
+  // The document, and each schema entry, whether or not it has a handler.
+  ck_assert_int_eq(easyyaml_profile_stats(opts.profile, stats, 8, EASYYAML_PROFILE_BY_TIME), 6);
+  ck_assert_ptr_eq(stats[0].ys, &server_ys[0]);
+  ck_assert_str_eq(stats[0].path, "/server/host");
+  ck_assert_int_eq(stats[0].calls, 2);
+  ck_assert_int_ge(stats[0].call_ns, 4000000);
+  ck_assert_int_ge(stats[0].call_max_ns, 2000000);
+  // Both calls take at least 2ms, which is over 2^20ns.
+  uint64_t hist_calls = 0;
+  for (int i = 20; i < EASYYAML_PROFILE_BUCKETS; i++)
+    hist_calls += stats[0].call_hist[i];
+  ck_assert_int_eq(hist_calls, 2);
+
+  ck_assert_int_eq(easyyaml_profile_stats(opts.profile, stats, 2, EASYYAML_PROFILE_BY_CALLS), 2);
+  ck_assert_ptr_eq(stats[0].ys, &item_ys[0]);
+  ck_assert_str_eq(stats[0].path, "/server/ports");
+  ck_assert_int_eq(stats[0].calls, 10);
+  ck_assert_int_eq(stats[0].tokens, 10);
+
+  // Every token is scanned in the context of some entry.
+  size_t n = easyyaml_profile_stats(opts.profile, stats, 8, EASYYAML_PROFILE_BY_CALLS);
+  uint64_t tokens = 0;
+  for (size_t i = 0; i < n; i++) {
+    tokens += stats[i].tokens;
+    if (stats[i].ys == NULL)
+      ck_assert_str_eq(stats[i].path, "/");
+    if (stats[i].ys == &ys[0])
+      ck_assert_int_eq(stats[i].calls, 0);
+  }
+  ck_assert_int_eq(tokens, 2 * 31);
+
+  FILE * fp = tmpfile();
+  ck_assert_ptr_ne(fp, NULL);
+  ck_assert_int_eq(easyyaml_profile_dump(opts.profile, fileno(fp), 1, EASYYAML_PROFILE_BY_TIME), EASYYAML_SUCCESS);
+  char dump[1024] = "";
+  lseek(fileno(fp), 0, SEEK_SET);
+  ck_assert_int_gt(read(fileno(fp), dump, sizeof(dump) - 1), 0);
+  fclose(fp);
+  ck_assert_ptr_ne(strstr(dump, "total ms"), NULL);
+  ck_assert_ptr_ne(strstr(dump, "/server/host (host to resolve)\n"), NULL);
+  ck_assert_ptr_eq(strstr(dump, "/server/ports"), NULL);
+
+  easyyaml_profile_reset(opts.profile);
+  ck_assert_int_eq(easyyaml_profile_stats(opts.profile, stats, 8, EASYYAML_PROFILE_BY_TIME), 0);
+  ck_assert_int_eq(easyyaml_parse_string_opts(input, ys, NULL, &opts), EASYYAML_SUCCESS);
+  ck_assert_int_eq(easyyaml_profile_stats(opts.profile, stats, 8, EASYYAML_PROFILE_BY_TIME), 6);
+  easyyaml_profile_free(opts.profile);
+}
+END_TEST
+
+/// A list of \p items maps of two strings, as YAML, or as JSON if \p json,
+/// the caller must free the result.
+
+static char * alloc_corpus (int items, int json)
+{
+  char * buf = (char *) malloc(64 + (size_t) items * 64);
+  char * p   = buf;
+
+  p += sprintf(p, json ? "{\"items\": [" : "items:\n");
+  for (int i = 0; i < items; i++) {
+    if (json)
+      p += sprintf(p, "%s{\"name\": \"item%d\", \"value\": \"v%d\"}", i > 0 ? ", " : "", i, i);
+    else
+      p += sprintf(p, "  - name: item%d\n    value: v%d\n", i, i);
+  }
+  if (json)
+    sprintf(p, "]}");
+
+  return buf;
+}
+
+static EASYYAML_SCHEMA(alloc_item_ys)
+  EASYYAML_STR("name",  NULL, "name" ),
+  EASYYAML_STR("value", NULL, "value"),
+  EASYYAML_END();
+static EASYYAML_SCHEMA(alloc_items_ys)
+  EASYYAML_MAP(NULL, alloc_item_ys, "item"),
+  EASYYAML_END();
+static EASYYAML_SCHEMA(alloc_ys)
+  EASYYAML_LST("items", alloc_items_ys, "items"),
+  EASYYAML_END();
+
+/// Parse a corpus of \p items items, from a string, JSON or (if \p fp is not
+/// NULL) a file, returning what was allocated.
+
+static easyyaml_alloc_stats alloc_parse (int items, int json, FILE * fp)
+{
+  char * input = alloc_corpus(items, json);
+  easyyaml_alloc_stats stats;
+  int rc;
+
+  if (fp != NULL) {
+    ck_assert_int_eq(ftruncate(fileno(fp), 0), 0);
+    ck_assert_int_eq(pwrite(fileno(fp), input, strlen(input), 0), (ssize_t) strlen(input));
+    lseek(fileno(fp), 0, SEEK_SET);
+  }
+
+  easyyaml_alloc_start();
+  if (fp != NULL)
+    rc = easyyaml_parse_fd(fileno(fp), alloc_ys, NULL);
+  else if (json)
+    rc = easyyaml_parse_json(input, strlen(input), alloc_ys, NULL);
+  else
+    rc = easyyaml_parse_string(input, alloc_ys, NULL);
+  easyyaml_alloc_stop(&stats);
+
+  ck_assert_int_eq(rc, EASYYAML_SUCCESS);
+  free(input);
+
+  return stats;
+}
+
+START_TEST (alloc_budget_success)
+{
+  if (!easyyaml_alloc_start())
+    return;
+  easyyaml_alloc_stats stats;
+  easyyaml_alloc_stop(&stats);
+
+  // Each item is four scalars: libyaml allocates four times for each of
+  // them, the JSON parser once, and nothing is kept once the item is done.
+  static const struct { int json; size_t per_item; } budgets[] = { {0, 16}, {1, 4} };
+  for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+    easyyaml_alloc_stats small = alloc_parse(100, budgets[i].json, NULL);
+    easyyaml_alloc_stats large = alloc_parse(1000, budgets[i].json, NULL);
+
+    ck_assert_int_eq(small.frees, small.allocs);
+    ck_assert_int_eq(large.frees, large.allocs);
+    ck_assert_int_le(large.allocs - small.allocs, 900 * budgets[i].per_item);
+    ck_assert_int_le(large.peak, small.peak + 1024);
+  }
+}
+END_TEST
+
+START_TEST (alloc_file_peak_success)
+{
+  if (!easyyaml_alloc_start())
+    return;
+  easyyaml_alloc_stats stats;
+  easyyaml_alloc_stop(&stats);
+
+  // Streamed input costs its read buffer on top of libyaml's own buffers,
+  // however long it is.
+  easyyaml_alloc_stats string = alloc_parse(100, 0, NULL);
+  FILE * fp = tmpfile();
+  ck_assert_ptr_ne(fp, NULL);
+  easyyaml_alloc_stats small = alloc_parse(100, 0, fp);
+  easyyaml_alloc_stats large = alloc_parse(10000, 0, fp);
+  fclose(fp);
+
+  ck_assert_int_eq(large.frees, large.allocs);
+  ck_assert_int_le(large.allocs - small.allocs, 9900 * 16);
+  ck_assert_int_le(large.peak, small.peak + 1024);
+  ck_assert_int_le(large.peak, string.peak + DEFAULT_READ_BUFFER_LEN + 1024);
+}
+END_TEST
+
+typedef struct alloc_record_st {
+  char * name;
+  char   pad[4096];
+} alloc_record;
+
+static EASYYAML_SCHEMA(alloc_record_ys)
+  EASYYAML_STR("value", NULL, "value"),
+  EASYYAML_END();
+static EASYYAML_SCHEMA(alloc_records_ys)
+  EASYYAML_RECORDS("items", alloc_record, name, alloc_record_ys, NULL, "items"),
+  EASYYAML_END();
+
+START_TEST (alloc_cursor_records_success)
+{
+  if (!easyyaml_alloc_start())
+    return;
+  easyyaml_alloc_stats stats;
+  easyyaml_alloc_stop(&stats);
+
+  char * input = (char *) malloc(16 + 1000 * 48);
+  char * p = input + sprintf(input, "items:\n");
+  for (int i = 0; i < 1000; i++)
+    p += sprintf(p, "  item%d:\n    value: v%d\n", i, i);
+
+  // A cursor reads the records without binding them, so never holds the
+  // array of them a parse would.
+  easyyaml_cursor * cursor = easyyaml_cursor_new_string(input, alloc_records_ys, NULL);
+  easyyaml_event ev;
+  size_t begins = 0;
+  int rc;
+  easyyaml_alloc_start();
+  while ((rc = easyyaml_next(cursor, &ev)) == EASYYAML_SUCCESS && ev.type != EASYYAML_EVENT_END)
+    begins += ev.type == EASYYAML_EVENT_MAP_BEGIN;
+  easyyaml_alloc_stop(&stats);
+  easyyaml_cursor_free(cursor);
+  free(input);
+
+  ck_assert_int_eq(rc, EASYYAML_SUCCESS);
+  ck_assert_int_eq(begins, 1002);
+  ck_assert_int_lt(stats.peak, 1000 * sizeof(alloc_record) / 8);
+}
+END_TEST
+
+START_TEST (stack_path_renders_empty_stack)
+{
+  easyyaml_stack stack1;
+  stack1.key  = NULL;
+  stack1.prev = NULL;
+
+  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack1), "/"), 0);
+}
+END_TEST
+
+START_TEST (stack_path_renders_nonempty_stack)
+{
+  easyyaml_stack stack1;
+  stack1.key  = NULL;
+  stack1.prev = NULL;
+  easyyaml_stack stack2;
+  stack2.key  = "foo";
+  stack2.prev = &stack1;
+
+  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack2), "/foo"), 0);
+
+  easyyaml_stack stack3;
+  stack3.key  = "bar";
+  stack3.prev = &stack2;
+
+  ck_assert_int_eq(strcmp(easyyaml_stack_path(&stack3), "/foo/bar"), 0);
 }
 END_TEST
 
@@ -522,6 +3950,7 @@ void teardown_passthrough_errhandler (void)
 
 void setup_quashing_errhandler (void)
 {
+  g_errhandler_count = 0;
   easyyaml_set_errhandler(test_quashing_errhandler);
 }
 
@@ -548,18 +3977,190 @@ void parse_success_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)
   tcase_add_test(tc, calls_string_handler_callback);
   tcase_add_test(tc, calls_int_handler_callback);
   tcase_add_test(tc, handler_callback_stack_traces_path);
+  tcase_add_test(tc, varkey_ids_dense_and_stable);
+  tcase_add_test(tc, varkey_ids_many_keys);
+  tcase_add_test(tc, parse_records_success);
+  tcase_add_test(tc, parse_records_many_success);
+  tcase_add_test(tc, parse_records_each_success);
+  tcase_add_test(tc, parse_alias_scalar_success);
+  tcase_add_test(tc, parse_alias_map_success);
+  tcase_add_test(tc, parse_alias_nested_success);
+  tcase_add_test(tc, parse_merge_key_success);
+  tcase_add_test(tc, parse_merge_key_varkey_success);
+  tcase_add_test(tc, parse_merge_key_override_success);
+  tcase_add_test(tc, parse_deep_nesting_success);
+  tcase_add_test(tc, parse_path_hash_success);
+  tcase_add_test(tc, parse_frame_buf_success);
   tcase_add_test(tc, parse_file_success);
+  tcase_add_test(tc, parse_reader_success);
+  tcase_add_test(tc, parse_reader_uncompressed_auto_success);
+  tcase_add_test(tc, parse_fd_success);
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  tcase_add_test(tc, parse_reader_gzip_success);
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+  tcase_add_test(tc, parse_reader_zstd_success);
+#endif
   tcase_add_test(tc, stack_path_renders_empty_stack);
   tcase_add_test(tc, stack_path_renders_nonempty_stack);
 }
 
+void push_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+#ifdef EASYYAML_WITH_PUSH_TESTS
+  tcase_add_test(tc, push_bytewise_success);
+  tcase_add_test(tc, push_chunked_opts_success);
+  tcase_add_test(tc, push_unknown_key_fails_errlogs);
+  tcase_add_test(tc, push_incomplete_fails_errlogs);
+  tcase_add_test(tc, push_deep_nesting_small_stack_success);
+#endif
+}
+
+void msgpack_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, msgpack_convert_success);
+  tcase_add_test(tc, parse_msgpack_converted_success);
+  tcase_add_test(tc, parse_msgpack_types_success);
+  tcase_add_test(tc, parse_msgpack_invalid_fails_errlogs);
+}
+
+void emit_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, emit_string_roundtrip_success);
+  tcase_add_test(tc, emit_string_quoting_roundtrip_success);
+  tcase_add_test(tc, emit_fd_large_success);
+  tcase_add_test(tc, emit_fd_write_fails_errlogs);
+  tcase_add_test(tc, emit_no_key_fails_errlogs);
+}
+
+void image_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, image_build_success);
+  tcase_add_test(tc, image_merge_success);
+  tcase_add_test(tc, image_file_success);
+  tcase_add_test(tc, image_invalid_fails_errlogs);
+}
+
+void router_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, router_patterns_success);
+  tcase_add_test(tc, router_many_patterns_success);
+  tcase_add_test(tc, router_invalid_fails_errlogs);
+}
+
+void enum_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, enum_parse_success);
+  tcase_add_test(tc, enum_many_values_success);
+  tcase_add_test(tc, enum_unknown_fails_errlogs);
+  tcase_add_test(tc, enum_emit_roundtrip_success);
+  tcase_add_test(tc, enum_compiled_before_parse_success);
+#ifdef EASYYAML_WITH_THREAD_TESTS
+  tcase_add_test(tc, enum_threads_success);
+#endif
+}
+
+void include_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, include_parse_success);
+  tcase_add_test(tc, include_aliases_success);
+  tcase_add_test(tc, include_alias_expansion_fails_errlogs);
+  tcase_add_test(tc, include_preload_success);
+  tcase_add_test(tc, include_invalid_fails_errlogs);
+}
+
+void layers_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, layers_merge_success);
+  tcase_add_test(tc, layers_merge_key_override_success);
+  tcase_add_test(tc, layers_invalid_fails_errlogs);
+}
+
+void profile_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, profile_collects_success);
+}
+
+void alloc_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, alloc_budget_success);
+  tcase_add_test(tc, alloc_file_peak_success);
+  tcase_add_test(tc, alloc_cursor_records_success);
+}
+
+void holder_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+#ifdef EASYYAML_WITH_HOLDER_TESTS
+  tcase_add_test(tc, holder_reload_success);
+  tcase_add_test(tc, holder_threads_success);
+#endif
+}
+
+void parser_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, parser_reuse_success);
+#ifdef EASYYAML_WITH_THREAD_TESTS
+  tcase_add_test(tc, parser_pool_success);
+#endif
+}
+
+void cursor_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, cursor_events_success);
+  tcase_add_test(tc, cursor_schema_success);
+  tcase_add_test(tc, cursor_schema_fails_errlogs);
+  tcase_add_test(tc, cursor_file_success);
+  tcase_add_test(tc, cursor_as_parse_fails_errlogs);
+}
+
+void limits_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, limits_within_success);
+  tcase_add_test(tc, limit_input_string_fails_errlogs);
+  tcase_add_test(tc, limit_input_reader_fails_errlogs);
+  tcase_add_test(tc, limit_depth_fails_errlogs);
+  tcase_add_test(tc, limit_scalar_fails_errlogs);
+  tcase_add_test(tc, limit_keys_fails_errlogs);
+  tcase_add_test(tc, limit_keys_alias_expansion_fails_errlogs);
+  tcase_add_test(tc, limit_time_fails_errlogs);
+}
+
+void json_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, parse_json_success);
+  tcase_add_test(tc, parse_json_long_strings_success);
+  tcase_add_test(tc, parse_json_schema_fails_errlogs);
+  tcase_add_test(tc, parse_json_collect_errors_lines);
+  tcase_add_test(tc, parse_json_syntax_fails_errlogs);
+}
+
+void step_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+#ifdef EASYYAML_WITH_PUSH_TESTS
+  tcase_add_test(tc, step_token_budget_resumes);
+  tcase_add_test(tc, step_time_budget_resumes);
+  tcase_add_test(tc, step_file_success);
+  tcase_add_test(tc, step_unknown_key_fails_errlogs);
+  tcase_add_test(tc, step_abandoned_frees);
+#endif
+}
+
 void parse_failure_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
 {
   tcase_add_test(tc, parse_unknown_key_nokeys_fails_errlogs);
   tcase_add_test(tc, parse_unknown_key_somekeys_fails_errlogs);
   tcase_add_test(tc, parse_badyaml_fails_errlogs);
   tcase_add_test(tc, parse_badschema_fails_errlogs);
+  tcase_add_test(tc, parse_records_notmap_fails_errlogs);
+  tcase_add_test(tc, parse_alias_unknown_fails_errlogs);
+  tcase_add_test(tc, parse_alias_recursive_fails_errlogs);
+  tcase_add_test(tc, parse_merge_notmap_fails_errlogs);
   tcase_add_test(tc, parse_file_nonexisting_fails_errlogs);
+  tcase_add_test(tc, parse_frame_buf_exhausted_fails_errlogs);
+  tcase_add_test(tc, parse_reader_read_error_fails_errlogs);
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  tcase_add_test(tc, parse_reader_gzip_truncated_fails_errlogs);
+#endif
   tcase_add_test(tc, parse_binarydata_fails_errlogs);
   tcase_add_test(tc, parse_expected_list_fails_errlogs);
   tcase_add_test(tc, parse_expected_map_fails_errlogs);
@@ -590,6 +4191,14 @@ void errhandler_override_tests (TCase * tc, Suite * s, char ** tags, void (**fix
 {
   tcase_add_test(tc, parse_unknown_key_nokeys_success);
   tcase_add_test(tc, parse_unknown_key_somekeys_success);
+  tcase_add_test(tc, parse_quashed_error_skips_node);
+}
+
+void collect_errors_tests (TCase * tc, Suite * s, char ** tags, void (**fixtures)(), void * extra)
+{
+  tcase_add_test(tc, collect_errors_reports_all);
+  tcase_add_test(tc, collect_errors_none_success);
+  tcase_add_test(tc, collect_errors_fatal_stops);
 }
 
 Suite * mk_suite()
@@ -614,6 +4223,91 @@ Suite * mk_suite()
               errhandler_override_tests,
               s, NULL);
 
+  build_suite(add_tag(tags, "collect_errors"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              collect_errors_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "push"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              push_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "step"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              step_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "parser"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              parser_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "cursor"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              cursor_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "json"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              json_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "msgpack"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              msgpack_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "emit"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              emit_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "image"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              image_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "router"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              router_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "enum"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              enum_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "include"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              include_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "layers"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              layers_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "holder"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              holder_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "profile"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              profile_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "alloc"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              alloc_tests,
+              s, NULL);
+
+  build_suite(add_tag(tags, "limits"),
+              add_fixture(fixtures, setup_logger, teardown_logger),
+              limits_tests,
+              s, NULL);
+
   return s;
 }
 
@@ -0,0 +1,184 @@
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include <check.h>
+
+#include "easyyaml.hpp"
+
+
+// Structures parsed into.
+
+struct hpp_server {
+  int         port;
+  bool        ssl;
+  std::string base_path;
+};
+
+struct hpp_config {
+  std::string version;
+  hpp_server  server;
+  int         users;
+  int         admins;
+  long        uid_sum;
+};
+
+
+static constexpr auto hpp_schema = easyyaml::schema<hpp_config>(
+  easyyaml::field("version", &hpp_config::version, "Configuration version"),
+  easyyaml::map("restapi", &hpp_config::server,
+    easyyaml::field("port", &hpp_server::port, "TCP port"),
+    easyyaml::field("ssl", &hpp_server::ssl, "SSL enabled"),
+    easyyaml::field("base-path", &hpp_server::base_path, "URL base path")),
+  easyyaml::map("users",
+    easyyaml::map(nullptr,
+      easyyaml::integer("uid", [](hpp_config & c, int v, easyyaml_stack * stack) {
+        c.users++;
+        c.uid_sum += v;
+        ck_assert_int_eq(easyyaml::key_hash(stack), easyyaml::hash("uid"));
+      }),
+      easyyaml::list("access",
+        easyyaml::str(nullptr, [](hpp_config & c, std::string_view v) {
+          if (v == "admin")
+            c.admins++;
+        }))))
+);
+
+
+// A single callback, switching on the path hash.
+
+struct hpp_paths {
+  int ports;
+  int versions;
+  int others;
+};
+
+static constexpr auto hpp_on_path = [](hpp_paths & c, std::string_view v, easyyaml_stack * stack) {
+  switch (stack->hash) {
+  case easyyaml::path_hash("/restapi/port"):
+    c.ports++;
+    break;
+  case easyyaml::path_hash("/version"):
+    c.versions++;
+    break;
+  default:
+    c.others++;
+  }
+};
+
+static constexpr auto hpp_paths_schema = easyyaml::schema<hpp_paths>(
+  easyyaml::str("version", hpp_on_path),
+  easyyaml::map("restapi",
+    easyyaml::str("port", hpp_on_path),
+    easyyaml::str("ssl", hpp_on_path))
+);
+
+
+// Tests.
+
+START_TEST (hpp_parse_string_success)
+{
+  hpp_config cfg = {};
+
+  ck_assert_int_eq(easyyaml::parse_string<hpp_schema>(
+                     "version: 1.2.7\n"
+                     "restapi:\n  port: 80\n  ssl: true\n  base-path: /api\n"
+                     "users:\n"
+                     "  michael:\n    uid: 100\n    access:\n      - admin\n"
+                     "  john:\n    uid: 101\n    access:\n      - read\n",
+                     cfg), EASYYAML_SUCCESS);
+
+  ck_assert_str_eq(cfg.version.c_str(), "1.2.7");
+  ck_assert_int_eq(cfg.server.port, 80);
+  ck_assert_int_eq(cfg.server.ssl, 1);
+  ck_assert_str_eq(cfg.server.base_path.c_str(), "/api");
+  ck_assert_int_eq(cfg.users, 2);
+  ck_assert_int_eq(cfg.admins, 1);
+  ck_assert_int_eq(cfg.uid_sum, 201);
+}
+END_TEST
+
+START_TEST (hpp_parse_string_schema_error_fails)
+{
+  hpp_config cfg = {};
+
+  easyyaml_set_loglevel(EASYYAML_LOG_LEVEL_NONE);
+  ck_assert_int_eq(easyyaml::parse_string<hpp_schema>("restapi:\n  naughty: 1\n", cfg),
+                   EASYYAML_ERROR_SCHEMA_UNEXPECTED_KEY);
+  ck_assert_int_eq(easyyaml::parse_string<hpp_schema>("restapi: 80\n", cfg),
+                   EASYYAML_ERROR_SCHEMA_MANDATES_MAP);
+}
+END_TEST
+
+START_TEST (hpp_c_schema_matches_declaration)
+{
+  easyyaml_schema * ys = easyyaml::c_schema<hpp_schema>();
+
+  ck_assert_str_eq(ys[0].key, "version");
+  ck_assert_int_eq(ys[0].type, EASYYAML_SCHEMA_STR);
+  ck_assert_str_eq(ys[1].key, "restapi");
+  ck_assert_int_eq(ys[1].type, EASYYAML_SCHEMA_MAP);
+  ck_assert_int_eq(((easyyaml_schema *) ys[1].data)[0].type, EASYYAML_SCHEMA_INT);
+  ck_assert_int_eq(ys[3].type, EASYYAML_SCHEMA_END);
+  ck_assert_ptr_eq(ys, easyyaml::c_schema<hpp_schema>());
+}
+END_TEST
+
+START_TEST (hpp_hash_is_constexpr)
+{
+  static_assert(easyyaml::hash("port") != easyyaml::hash("ssl"), "hashes should differ");
+
+  switch (easyyaml::hash("ssl")) {
+  case easyyaml::hash("port"):
+    ck_abort_msg("wrong case");
+    break;
+  case easyyaml::hash("ssl"):
+    break;
+  default:
+    ck_abort_msg("no case");
+  }
+}
+END_TEST
+
+START_TEST (hpp_path_hash_switch_success)
+{
+  hpp_paths paths = {};
+
+  ck_assert_int_eq(easyyaml::parse_string<hpp_paths_schema>(
+                     "version: 1.2.7\nrestapi:\n  port: 80\n  ssl: true\n", paths), EASYYAML_SUCCESS);
+  ck_assert_int_eq(paths.ports, 1);
+  ck_assert_int_eq(paths.versions, 1);
+  ck_assert_int_eq(paths.others, 1);
+}
+END_TEST
+
+
+// Suite.
+
+Suite * mk_suite ()
+{
+  Suite * s  = suite_create("easyyaml_hpp");
+  TCase * tc = tcase_create("hpp");
+
+  tcase_add_test(tc, hpp_parse_string_success);
+  tcase_add_test(tc, hpp_parse_string_schema_error_fails);
+  tcase_add_test(tc, hpp_c_schema_matches_declaration);
+  tcase_add_test(tc, hpp_hash_is_constexpr);
+  tcase_add_test(tc, hpp_path_hash_switch_success);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
+
+
+int main ()
+{
+  Suite * s = mk_suite();
+
+  SRunner * sr = srunner_create(s);
+  srunner_run_all(sr, CK_VERBOSE);
+  int num_failed = srunner_ntests_failed(sr);
+  srunner_free(sr);
+
+  return num_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+/// \file
+/// \brief Heap allocation accounting, replacing the allocator functions
+/// with ones which forward to the C library's and count while accounting
+/// is started.
+///
+/// Interposing needs the glibc entry points (\c __libc_malloc and friends)
+/// and \c malloc_usable_size, and is not done under AddressSanitizer, which
+/// interposes them itself: without them \ref easyyaml_alloc_start returns 0
+/// and callers skip their measurements. The counters are not atomic, so
+/// measure a single thread.
+
+
+#include <stddef.h>
+
+#include "config.h"
+#include "easyyaml_alloc.h"
+
+#if defined(__SANITIZE_ADDRESS__)
+#define EASYYAML_NO_ALLOC_ACCOUNTING 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define EASYYAML_NO_ALLOC_ACCOUNTING 1
+#endif
+#endif
+
+#if defined(HAVE___LIBC_MALLOC) && defined(HAVE_MALLOC_USABLE_SIZE) && !defined(EASYYAML_NO_ALLOC_ACCOUNTING)
+#define EASYYAML_WITH_ALLOC_ACCOUNTING 1
+#include <malloc.h>
+#endif
+
+
+static int                  alloc_active;
+static long                 alloc_live;
+static easyyaml_alloc_stats alloc_stats;
+
+
+#ifdef EASYYAML_WITH_ALLOC_ACCOUNTING
+
+extern void * __libc_malloc (size_t size);
+extern void * __libc_calloc (size_t nmemb, size_t size);
+extern void * __libc_realloc (void * ptr, size_t size);
+extern void   __libc_free (void * ptr);
+
+
+/// Account for \p ptr being allocated.
+
+static void alloc_add (void * ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  size_t size = malloc_usable_size(ptr);
+  alloc_stats.allocs++;
+  alloc_stats.bytes += size;
+  alloc_live        += (long) size;
+  if (alloc_live > (long) alloc_stats.peak)
+    alloc_stats.peak = (size_t) alloc_live;
+}
+
+
+/// Account for \p ptr being freed (which may have been allocated before
+/// accounting started, making the live bytes negative).
+
+static void alloc_sub (void * ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  alloc_live -= (long) malloc_usable_size(ptr);
+}
+
+
+void * malloc (size_t size)
+{
+  void * ptr = __libc_malloc(size);
+
+  if (alloc_active)
+    alloc_add(ptr);
+
+  return ptr;
+}
+
+
+void * calloc (size_t nmemb, size_t size)
+{
+  void * ptr = __libc_calloc(nmemb, size);
+
+  if (alloc_active)
+    alloc_add(ptr);
+
+  return ptr;
+}
+
+
+void * realloc (void * ptr, size_t size)
+{
+  if (alloc_active)
+    alloc_sub(ptr);
+
+  void * new_ptr = __libc_realloc(ptr, size);
+
+  if (alloc_active) {
+    // A failed realloc leaves the original allocated.
+    if (new_ptr == NULL && size > 0)
+      alloc_live += (long) malloc_usable_size(ptr);
+    else
+      alloc_add(new_ptr);
+  }
+
+  return new_ptr;
+}
+
+
+void free (void * ptr)
+{
+  if (alloc_active && ptr != NULL) {
+    alloc_stats.frees++;
+    alloc_sub(ptr);
+  }
+
+  __libc_free(ptr);
+}
+
+#endif
+
+
+/// Start accounting for allocations, returns 0 if it is not available.
+
+int easyyaml_alloc_start ()
+{
+#ifdef EASYYAML_WITH_ALLOC_ACCOUNTING
+  alloc_stats.allocs = 0;
+  alloc_stats.frees  = 0;
+  alloc_stats.bytes  = 0;
+  alloc_stats.peak   = 0;
+  alloc_live         = 0;
+  alloc_active       = 1;
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+/// Stop accounting for allocations, setting \p stats to those since
+/// \ref easyyaml_alloc_start.
+
+void easyyaml_alloc_stop (easyyaml_alloc_stats * stats)
+{
+  alloc_active = 0;
+  *stats       = alloc_stats;
+}
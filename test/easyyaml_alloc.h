@@ -0,0 +1,40 @@
+/// \file
+/// \brief Heap allocation accounting for the tests and benchmarks, by
+/// interposing malloc, calloc, realloc and free.
+
+
+#ifndef EASYYAML_ALLOC_INCLUDED
+#define EASYYAML_ALLOC_INCLUDED
+
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// What was allocated between \ref easyyaml_alloc_start and
+/// \ref easyyaml_alloc_stop: the number of allocations (a realloc counts as
+/// one), the number of frees, the bytes allocated, and the high-water mark
+/// of the bytes live, relative to those live at the start.
+
+typedef struct easyyaml_alloc_stats_st {
+  size_t allocs;
+  size_t frees;
+  size_t bytes;
+  size_t peak;
+} easyyaml_alloc_stats;
+
+
+extern int  easyyaml_alloc_start ();
+extern void easyyaml_alloc_stop (easyyaml_alloc_stats * stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // EASYYAML_ALLOC_INCLUDED